@@ -77,6 +77,12 @@ namespace SubscriptionScope {
 typedef void (*EventHandler)(const char *event_name, const char *data);
 typedef void (*EventHandlerWithData)(void *handler_data, const char *event_name, const char *data);
 
+/**
+ * Writes the data of an event directly into the message buffer, which has room for `size` bytes.
+ * Returns the size of the data, or a negative result code if the data doesn't fit.
+ */
+typedef int (*EventDataWriter)(char *buf, size_t size, void *writer_data);
+
 /**
  *  This is used in a callback so only change by adding fields to the end
  */
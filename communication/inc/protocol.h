@@ -15,6 +15,7 @@
 #include "hal_platform.h"
 #include "mesh.h"
 #include "timesyncmanager.h"
+#include "describe_cache.h"
 #include "hal_platform.h"
 
 namespace particle
@@ -111,6 +112,11 @@ class Protocol
 	 */
 	TimeSyncManager timesync_;
 
+	/**
+	 * Cached parts of the describe message.
+	 */
+	DescribeCache describe_cache;
+
 #if HAL_PLATFORM_MESH
 	Mesh mesh;
 #endif
@@ -222,7 +228,10 @@ protected:
 		}
 		else
 		{
-			ProtocolError error = pinger.process(
+			ProtocolError error = publisher.process(channel, callbacks.millis());
+			if (error)
+				return error;
+			error = pinger.process(
 					callbacks.millis() - last_message_millis, [this]
 					{	return ping();});
 			if (error)
@@ -245,6 +254,7 @@ protected:
 	 * @param desc_flags The information description flags
 	 * @arg \p DESCRIBE_APPLICATION
 	 * @arg \p DESCRIBE_METRICS
+	 * @arg \p DESCRIBE_METRICS_DELTA
 	 * @arg \p DESCRIBE_SYSTEM
 	 *
 	 * @returns \s ProtocolError result value
@@ -258,8 +268,26 @@ protected:
 	/**
 	 * Produces and transmits (PIGGYBACK) a describe message.
 	 * @param desc_flags Flags describing the information to provide. A combination of {@code DESCRIBE_APPLICATION) and {@code DESCRIBE_SYSTEM) flags.
+	 * @param known_checksum The checksum of the describe message known to the server, or nullptr.
+	 * When set, the response carries the current checksum, and has no payload if the checksums match.
+	 */
+	ProtocolError send_description(token_t token, message_id_t msg_id, int desc_flags,
+			const uint32_t* known_checksum = nullptr);
+
+	/**
+	 * Appends a part of the describe message, from the cache if possible.
 	 */
-	ProtocolError send_description(token_t token, message_id_t msg_id, int desc_flags);
+	void append_describe_part(Appender& appender, DescribeCache::Part part, bool cached);
+
+	/**
+	 * Produces a part of the describe message.
+	 */
+	void build_describe_part(Appender& appender, DescribeCache::Part part);
+
+	/**
+	 * Returns the cached checksum of a part of the describe message.
+	 */
+	uint32_t describe_part_checksum(DescribeCache::Part part);
 
 	/**
 	 * Decodes and dispatches a received message to its handler.
@@ -328,6 +356,42 @@ public:
 		chunkedTransfer.set_fast_ota(data);
 	}
 
+	void set_publish_rate_limit(uint16_t burst, system_tick_t period)
+	{
+		publisher.set_rate_limit(Publisher::APPLICATION_EVENT, burst, period);
+	}
+
+	void set_publish_backlog_size(size_t size)
+	{
+		publisher.set_backlog_size(size);
+	}
+
+	void set_publish_batching_window(system_tick_t window)
+	{
+		publisher.set_batching_window(window);
+	}
+
+	bool has_pending_events() const
+	{
+		return publisher.has_pending_events();
+	}
+
+	/**
+	 * Sends the events accumulated in the current batch, if any.
+	 */
+	ProtocolError flush_events()
+	{
+		return publisher.flush_batch(channel);
+	}
+
+	/**
+	 * Fails the events that are queued or batched but haven't been sent in the current session.
+	 */
+	void cancel_pending_events()
+	{
+		publisher.reset(SYSTEM_ERROR_ABORTED);
+	}
+
 	void set_handlers(CommunicationsHandlers& handlers)
 	{
 		copy_and_init(&this->handlers, sizeof(this->handlers), &handlers, handlers.size);
@@ -384,14 +448,17 @@ public:
 	 * @param desc_flags The information description flags
 	 * @arg \p DESCRIBE_APPLICATION
 	 * @arg \p DESCRIBE_METRICS
+	 * @arg \p DESCRIBE_METRICS_DELTA
 	 * @arg \p DESCRIBE_SYSTEM
+	 * @param handler Completion handler, invoked when the message is acknowledged by the cloud
+	 *                or fails to be delivered
 	 *
 	 * @returns \s ProtocolError result value
 	 * @retval \p particle::protocol::NO_ERROR
 	 *
 	 * @sa particle::protocol::ProtocolError
 	 */
-	ProtocolError post_description(int desc_flags);
+	ProtocolError post_description(int desc_flags, CompletionHandler handler = CompletionHandler());
 
 	// Returns true on success, false on sending timeout or rate-limiting failure
 	bool send_event(const char *event_name, const char *data, int ttl,
@@ -412,6 +479,25 @@ public:
 		return true;
 	}
 
+	// Same as above, but the event data is written by `data_writer` directly into the message buffer
+	bool send_event(const char *event_name, EventDataWriter data_writer, void* data_writer_data,
+			int ttl, EventType::Enum event_type, int flags, CompletionHandler handler)
+	{
+		if (chunkedTransfer.is_updating())
+		{
+			handler.setError(SYSTEM_ERROR_BUSY);
+			return false;
+		}
+		const ProtocolError error = publisher.send_event(channel, event_name, data_writer, data_writer_data,
+				ttl, event_type, flags, callbacks.millis(), std::move(handler));
+		if (error != NO_ERROR)
+		{
+			handler.setError(toSystemError(error));
+			return false;
+		}
+		return true;
+	}
+
 	inline bool send_subscription(const char *event_name, const char *device_id)
 	{
 		bool success = !subscriptions.send_subscription(channel, event_name, device_id);
@@ -429,7 +515,26 @@ public:
 		return success;
 	}
 
-	void build_describe_message(Appender& appender, int desc_flags);
+	/**
+	 * Produces a describe message. The cached parts are used only if `cached` is set, which
+	 * requires the caller to run on the system thread.
+	 */
+	void build_describe_message(Appender& appender, int desc_flags, bool cached = false);
+
+	/**
+	 * Returns the checksum of the describe message with the given DESCRIBE_APPLICATION and
+	 * DESCRIBE_SYSTEM flags.
+	 */
+	uint32_t describe_checksum(int desc_flags);
+
+	/**
+	 * Notifies the protocol that the information selected by the given flags has changed.
+	 * Can be called from any thread.
+	 */
+	void describe_changed(int desc_flags)
+	{
+		describe_cache.invalidate(desc_flags);
+	}
 
 	inline bool add_event_handler(const char *event_name, EventHandler handler)
 	{
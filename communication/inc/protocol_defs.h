@@ -18,7 +18,7 @@ namespace particle { namespace protocol {
 #define PRODUCT_FIRMWARE_VERSION (0xffff)
 #endif
 
-#define MAX_SUBSCRIPTIONS (6)       // 2 system and 4 application
+#define MAX_SUBSCRIPTIONS (6)       // preallocated handlers (2 system and 4 application), more are allocated on demand
 
 enum ProtocolError
 {
@@ -80,6 +80,9 @@ const size_t MAX_EVENT_DATA_LENGTH   = 622;
 // Timeout in milliseconds given to receive an acknowledgement for a published event
 const unsigned SEND_EVENT_ACK_TIMEOUT = 20000;
 
+// Timeout in milliseconds given to receive an acknowledgement for a posted describe message
+const unsigned POST_DESCRIPTION_ACK_TIMEOUT = 20000;
+
 #ifndef PROTOCOL_BUFFER_SIZE
     #define PROTOCOL_BUFFER_SIZE 800
 #endif
@@ -97,7 +100,9 @@ enum DescriptionType {
     DESCRIBE_APPLICATION = 1<<1,       	// functions and variables
 	DESCRIBE_METRICS = 1<<2,				// metrics/diagnostics
     DESCRIBE_DEFAULT = DESCRIBE_SYSTEM | DESCRIBE_APPLICATION,
-	DESCRIBE_MAX = (1<<3)-1
+	DESCRIBE_MAX = (1<<3)-1,
+	// metrics/diagnostics that changed since the last delivered snapshot, only posted by the device
+	DESCRIBE_METRICS_DELTA = 1<<3
 };
 
 namespace Connection
@@ -105,7 +110,10 @@ namespace Connection
 enum Enum
 {
     PING = 0,
-    FAST_OTA = 1
+    FAST_OTA = 1,
+    PUBLISH_RATE_LIMIT = 2, // data: milliseconds to regain the budget for one event, 0 disables rate limiting
+    PUBLISH_BACKLOG = 3,    // data: maximum number of rate limited events queued in RAM
+    PUBLISH_BATCHING = 4    // data: milliseconds to accumulate events into a single message, 0 disables batching
 };
 }
 
@@ -130,6 +138,7 @@ typedef struct
 {
     uint16_t size;
     keepalive_source_t keepalive_source;
+    uint16_t publish_burst; // used with Connection::PUBLISH_RATE_LIMIT
 } connection_properties_t;
 
 namespace KeepAliveSource {
@@ -167,14 +167,21 @@ bool spark_protocol_event_loop(ProtocolFacade* protocol, void* reserved=NULL);
 bool spark_protocol_is_initialized(ProtocolFacade* protocol);
 int spark_protocol_presence_announcement(ProtocolFacade* protocol, unsigned char *buf, const unsigned char *id, void* reserved=NULL);
 
-// Additional parameters for spark_protocol_send_event()
+// Additional parameters for spark_protocol_send_event() and spark_protocol_post_description()
 typedef struct {
     size_t size;
     completion_callback handler_callback;
     void* handler_data;
 } completion_handler_data;
 
-typedef completion_handler_data spark_protocol_send_event_data;
+// The first fields match completion_handler_data
+typedef struct {
+    size_t size;
+    completion_callback handler_callback;
+    void* handler_data;
+    EventDataWriter data_writer; // If set, writes the event data in place and the `data` argument is ignored
+    void* data_writer_data;
+} spark_protocol_send_event_data;
 
 bool spark_protocol_send_event(ProtocolFacade* protocol, const char *event_name, const char *data,
                 int ttl, uint32_t flags, void* reserved);
@@ -214,8 +221,10 @@ int spark_protocol_get_describe_data(ProtocolFacade* protocol, spark_protocol_de
  * @param desc_flags The information description flags (default value: \p DESCRIBE_METRICS)
  * @arg \p DESCRIBE_APPLICATION
  * @arg \p DESCRIBE_METRICS
+ * @arg \p DESCRIBE_METRICS_DELTA
  * @arg \p DESCRIBE_SYSTEM
- * @param[in,out] reserved Reserved for future use (default value: \p NULL).
+ * @param[in] reserved Optional \p completion_handler_data, invoked once the message is
+ *                     acknowledged by the cloud or fails to be delivered (default value: \p NULL).
  *
  * @returns \p ProtocolError result code
  * @retval \p ProtocolError::NO_ERROR
@@ -353,6 +362,21 @@ typedef struct protocol_status {
  */
 int spark_protocol_get_status(ProtocolFacade* protocol, protocol_status* status, void* reserved);
 
+/**
+ * Notify the protocol that the information included in the describe message has changed.
+ *
+ * The protocol caches the describe message and its checksums, the cached parts selected by
+ * \p desc_flags are produced again the next time they are needed. Can be called from any thread.
+ *
+ * @param protocol Protocol instance.
+ * @param desc_flags The information description flags.
+ * @arg \p DESCRIBE_APPLICATION
+ * @arg \p DESCRIBE_SYSTEM
+ * @param reserved This argument should be set to NULL.
+ * @return 0 on success.
+ */
+int spark_protocol_describe_changed(ProtocolFacade* protocol, int desc_flags, void* reserved);
+
 /**
  * Decrypt a buffer using the given public key.
  * @param ciphertext        The ciphertext to decrypt
@@ -98,8 +98,13 @@ ProtocolError ChunkedTransfer::handle_update_begin(
             // know the correct size of the bitmap.
             set_chunks_received(flags & 1 ? 0 : 0xFF);
 
-            // send update_reaady - use fast OTA if available
-            size_t size = Messages::update_ready(updateReady.buf(), 0, token, (flags & 0x1), channel.is_unreliable());
+            // send update_reaady - use fast OTA if available, and let the server stream chunks
+            // within the receive window if it supports that
+            windowed = (flags & 1) && window_supported;
+            unacked_count = 0;
+            size_t size = windowed ?
+                    Messages::update_ready(updateReady.buf(), 0, token, 0x3, RECEIVE_WINDOW, channel.is_unreliable()) :
+                    Messages::update_ready(updateReady.buf(), 0, token, (flags & 0x1), channel.is_unreliable());
             updateReady.set_length(size);
             updateReady.set_confirm_received(true);
             error = channel.send(updateReady);
@@ -209,6 +214,11 @@ ProtocolError ChunkedTransfer::handle_chunk(token_t token, Message& message,
             if (error)
                 return error;
         }
+        if (fast_ota && windowed && ++unacked_count >= ACK_INTERVAL)
+        {
+            unacked_count = 0;
+            return send_chunks_acked(channel);
+        }
     }
     return NO_ERROR;
 }
@@ -333,6 +343,37 @@ ProtocolError ChunkedTransfer::send_missing_chunks(MessageChannel& channel,
     return NO_ERROR;
 }
 
+ProtocolError ChunkedTransfer::send_chunks_acked(MessageChannel& channel)
+{
+    const chunk_index_t chunks = file.chunk_count(chunk_size);
+    Message message;
+    channel.create(message, 9 + MAX_ACK_RANGES * 4);
+
+    // the server may send chunks up to RECEIVE_WINDOW past the first missing chunk, and
+    // resends the gaps between the reported ranges
+    chunk_index_t idx = next_chunk(0, false);
+    if (idx == NO_CHUNKS_MISSING)
+        idx = chunks;
+    uint8_t* buf = message.buf();
+    size_t size = Messages::chunks_acked(buf, 0, idx);
+    for (unsigned ranges = 0; ranges < MAX_ACK_RANGES && idx < chunks; ranges++)
+    {
+        const chunk_index_t first = next_chunk(idx, true);
+        if (first == NO_CHUNKS_MISSING)
+            break;
+        idx = next_chunk(first, false);
+        if (idx == NO_CHUNKS_MISSING)
+            idx = chunks;
+        const chunk_index_t count = idx - first;
+        buf[size++] = first >> 8;
+        buf[size++] = first & 0xFF;
+        buf[size++] = count >> 8;
+        buf[size++] = count & 0xFF;
+    }
+    message.set_length(size);
+    return channel.send(message);
+}
+
 ProtocolError ChunkedTransfer::idle(MessageChannel& channel)
 {
     /* Timeout to resend missing chunks removed.
@@ -351,21 +392,33 @@ void ChunkedTransfer::cancel()
 }
 
 
-chunk_index_t ChunkedTransfer::next_chunk_missing(chunk_index_t start)
+chunk_index_t ChunkedTransfer::next_chunk(chunk_index_t start, bool received)
 {
-    chunk_index_t chunk = NO_CHUNKS_MISSING;
-    chunk_index_t chunks = file.chunk_count(chunk_size);
-    chunk_index_t idx = start;
-    for (; idx < chunks; idx++)
+    const unsigned chunks = file.chunk_count(chunk_size);
+    const unsigned bitmap_size = (chunks + 7) / 8;
+    const uint8_t* const map = chunk_bitmap();
+    unsigned idx = start;
+    while (idx < chunks)
     {
-        if (!is_chunk_received(idx))
+        // examine up to 32 flags at a time, beginning with the byte holding idx.
+        // The bitmap lives at an arbitrary offset in the message buffer, so it is read bytewise.
+        const unsigned byte = idx >> 3;
+        const unsigned bytes = std::min(4u, bitmap_size - byte);
+        uint32_t matching = 0;
+        for (unsigned i = 0; i < bytes; i++)
         {
-            //serial_dump("next missing chunk %d from %d", idx, start);
-            chunk = idx;
-            break;
+            matching |= uint32_t(uint8_t(received ? map[byte + i] : ~map[byte + i])) << (i * 8);
+        }
+        matching >>= (idx & 7);
+        if (matching)
+        {
+            idx += __builtin_ctz(matching);
+            //serial_dump("next chunk %d from %d", idx, start);
+            return idx < chunks ? chunk_index_t(idx) : NO_CHUNKS_MISSING;
         }
+        idx = (byte + bytes) * 8;
     }
-    return chunk;
+    return NO_CHUNKS_MISSING;
 }
 
 void ChunkedTransfer::set_chunks_received(uint8_t value)
@@ -35,6 +35,22 @@ class ChunkedTransfer
 
 public:
 
+	/**
+	 * Number of chunks the server may send past the first chunk the device has not acknowledged,
+	 * when the receive window is supported by the server.
+	 */
+	static const chunk_index_t RECEIVE_WINDOW = 32;
+
+	/**
+	 * Number of chunks received between acknowledgements in windowed mode.
+	 */
+	static const chunk_index_t ACK_INTERVAL = RECEIVE_WINDOW / 4;
+
+	/**
+	 * Maximum number of ranges of received chunks reported in one acknowledgement.
+	 */
+	static const unsigned MAX_ACK_RANGES = 8;
+
 	/**
 	 * Callbacks interface for chunk transfer.
 	 * This is coded as a abstract virtual interface so that the vtable
@@ -90,6 +106,19 @@ private:
 	bool fast_ota_override;
 	bool fast_ota_value;
 
+	/**
+	 * Set when the server advertised the receive window in its hello message.
+	 */
+	bool window_supported;
+	/**
+	 * Set when the current transfer uses the receive window.
+	 */
+	bool windowed;
+	/**
+	 * Number of chunks received since the last acknowledgement.
+	 */
+	chunk_index_t unacked_count;
+
 protected:
 
 	unsigned chunk_bitmap_size()
@@ -113,12 +142,25 @@ protected:
 		return (chunk_bitmap()[idx >> 3] & uint8_t(1 << (idx & 7)));
 	}
 
-	chunk_index_t next_chunk_missing(chunk_index_t start);
+	/**
+	 * Finds the first chunk at or after `start` whose received flag equals `received`.
+	 * Returns NO_CHUNKS_MISSING if there is no such chunk.
+	 */
+	chunk_index_t next_chunk(chunk_index_t start, bool received);
+
+	chunk_index_t next_chunk_missing(chunk_index_t start)
+	{
+		return next_chunk(start, false);
+	}
+
 	void set_chunks_received(uint8_t value);
+
+	ProtocolError send_chunks_acked(MessageChannel& channel);
 public:
 
 	ChunkedTransfer() :
-			updating(false), callbacks(nullptr), fast_ota_override(false), fast_ota_value(true)
+			updating(false), callbacks(nullptr), fast_ota_override(false), fast_ota_value(true),
+			window_supported(false), windowed(false), unacked_count(0)
 	{
 	}
 
@@ -150,6 +192,11 @@ public:
 		fast_ota_override = true;
 	}
 
+	void set_window_supported(bool supported)
+	{
+		window_supported = supported;
+	}
+
 	bool is_updating()
 	{
 		return updating;
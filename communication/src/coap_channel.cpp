@@ -18,6 +18,7 @@
  */
 
 #include "coap_channel.h"
+#include <new>
 #include "service_debug.h"
 #include "messages.h"
 #include "communication_diagnostic.h"
@@ -26,6 +27,51 @@ namespace particle { namespace protocol {
 
 uint16_t CoAPMessage::message_count = 0;
 
+namespace {
+
+static_assert(COAP_MESSAGE_POOL_SIZE <= 32, "COAP_MESSAGE_POOL_SIZE should not exceed 32");
+
+/**
+ * Fixed-size blocks for small messages, so that acknowledgements and received requests
+ * do not fragment the heap.
+ */
+struct alignas(void*) CoAPMessageBlock
+{
+	uint8_t data[sizeof(CoAPMessage)+CoAPMessage::POOLED_DATA_SIZE];
+};
+
+CoAPMessageBlock message_pool[COAP_MESSAGE_POOL_SIZE];
+
+/**
+ * A bit is set for each free block in the pool.
+ */
+uint32_t message_pool_free = (uint32_t)((1ull << COAP_MESSAGE_POOL_SIZE) - 1);
+
+} // namespace
+
+void* CoAPMessage::allocate(size_t size)
+{
+	if (size<=sizeof(CoAPMessageBlock) && message_pool_free)
+	{
+		const unsigned index = __builtin_ctz(message_pool_free);
+		message_pool_free &= ~(1u << index);
+		return &message_pool[index];
+	}
+	void* ptr = new(std::nothrow) uint8_t[size];
+	if (!ptr)
+		g_messageAllocFailureCounter++;
+	return ptr;
+}
+
+void CoAPMessage::release(void* ptr)
+{
+	CoAPMessageBlock* const block = static_cast<CoAPMessageBlock*>(ptr);
+	if (block>=message_pool && block<message_pool+COAP_MESSAGE_POOL_SIZE)
+		message_pool_free |= (1u << (block-message_pool));
+	else
+		delete[] static_cast<uint8_t*>(ptr);
+}
+
 bool is_ack_or_reset(const uint8_t* buf, size_t len)
 {
 	if (len<1)
@@ -67,25 +113,57 @@ void CoAPMessageStore::message_timeout(CoAPMessage& msg, Channel& channel)
  */
 void CoAPMessageStore::process(system_tick_t time, Channel& channel)
 {
-	CoAPMessage* msg = head;
-	CoAPMessage* prev = nullptr;
-	while (msg!=nullptr)
+	// most calls happen before any message is due, so avoid visiting each message
+	if (!count || !time_has_passed(time, next_timeout))
+		return;
+	// recomputed below from the messages that remain
+	next_timeout = time + 0x7FFFFFFF;
+	for (CoAPMessage*& head : buckets)
 	{
-		if (time_has_passed(time, msg->get_timeout()) && !retransmit(msg, channel, time))
-		{
-			remove(msg, prev);
-			message_timeout(*msg, channel);
-			delete msg;
-			msg = (prev==nullptr) ? head : prev->get_next();
-		}
-		else
+		CoAPMessage* msg = head;
+		CoAPMessage* prev = nullptr;
+		while (msg!=nullptr)
 		{
-			prev = msg;
-			msg = msg->get_next();
+			if (time_has_passed(time, msg->get_timeout()) && !retransmit(msg, channel, time))
+			{
+				remove(msg, prev);
+				message_timeout(*msg, channel);
+				delete msg;
+				msg = (prev==nullptr) ? head : prev->get_next();
+			}
+			else
+			{
+				schedule(msg->get_timeout());
+				prev = msg;
+				msg = msg->get_next();
+			}
 		}
 	}
 }
 
+ProtocolError CoAPMessageStore::add(CoAPMessage& message)
+{
+	// trying to add exactly the same message
+	if (from_id(message.get_id())==&message)
+		return NO_ERROR;
+
+	clear_message(message.get_id());
+	if (message.get_next())
+		return INVALID_STATE;
+	CoAPMessage*& head = bucket(message.get_id());
+	message.set_next(head);
+	head = &message;
+	if (message.get_type()==CoAPType::CON)
+		confirmable_count++;
+	if (++count>g_pendingMessagesPeak)
+		g_pendingMessagesPeak = count;
+	if (count==1)
+		next_timeout = message.get_timeout();
+	else
+		schedule(message.get_timeout());
+	return NO_ERROR;
+}
+
 
 /**
  * Registers that this message has been sent from the application.
@@ -123,6 +201,14 @@ ProtocolError CoAPMessageStore::receive(Message& msg, Channel& channel, system_t
 	if (msgtype==CoAPType::ACK || msgtype==CoAPType::RESET)
 	{
 		message_id_t id = msg.get_id();
+#if DIAG_ENABLE_HISTOGRAMS
+		if (msgtype==CoAPType::ACK) {
+			// the acknowledgement of a retransmitted message may be for any of its transmissions
+			CoAPMessage* request = from_id(id);
+			if (request && request->get_type()==CoAPType::CON && request->get_transmit_count()==1)
+				g_ackLatency.record(time-request->get_sent());
+		}
+#endif
 		if (msgtype==CoAPType::RESET) {
 			CoAPMessage* msg = from_id(id);
 			if (msg) {
@@ -166,15 +252,4 @@ ProtocolError CoAPMessageStore::receive(Message& msg, Channel& channel, system_t
 	return NO_ERROR;
 }
 
-bool CoAPMessageStore::has_unacknowledged_requests() const
-{
-	// TODO: Use a message counter
-	for (const CoAPMessage* msg = head; msg != nullptr; msg = msg->get_next()) {
-		if (is_confirmable((uint8_t*)msg->get_data()))
-			return true;
-	}
-
-	return false;
-}
-
 }}
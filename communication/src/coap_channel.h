@@ -24,6 +24,13 @@
 #include "stdlib.h"
 #include "service_debug.h"
 
+/**
+ * The number of small message blocks preallocated for the CoAP message stores.
+ */
+#ifndef COAP_MESSAGE_POOL_SIZE
+#define COAP_MESSAGE_POOL_SIZE 8
+#endif
+
 namespace particle
 {
 namespace protocol
@@ -101,8 +108,8 @@ public:
 
 private:
 	/**
-	 * Messages are stored as a singly-linked list.
-	 * This pointer is the next message in the list, or nullptr if this is the last message in the list.
+	 * Messages that share a hash bucket in the message store are chained in a singly-linked list.
+	 * This pointer is the next message in the bucket, or nullptr if this is the last message in the bucket.
 	 */
 	CoAPMessage* next;
 
@@ -112,6 +119,11 @@ private:
 	 */
 	system_tick_t timeout;
 
+	/**
+	 * The time when this message was last transmitted.
+	 */
+	system_tick_t sent;
+
 	/**
 	 * The unique 16-bit ID for this message.
 	 */
@@ -140,6 +152,17 @@ private:
 
 	static uint16_t message_count;
 
+	/**
+	 * Allocates memory for a message, taking a block from the message pool when the message is small enough.
+	 * Returns nullptr if the memory could not be allocated.
+	 */
+	static void* allocate(size_t size);
+
+	/**
+	 * Releases memory previously returned by allocate().
+	 */
+	static void release(void* ptr);
+
 	/**
 	 * Notification that the message has been delivered to the server.
 	 */
@@ -157,6 +180,12 @@ public:
 	static const uint8_t MAX_RETRANSMIT = 3;
 	static const uint16_t MAX_TRANSMIT_SPAN = 45*1000;
 
+	/**
+	 * The largest message data that fits in a pooled block. This covers acknowledgements and the
+	 * headers of received confirmable messages, which make up most of the message store traffic.
+	 */
+	static const uint8_t POOLED_DATA_SIZE = 16;
+
 
 	/**
 	 * The number of outstanding messages allowed.
@@ -164,7 +193,7 @@ public:
 	static const uint8_t NSTART = 1;
 
 
-	CoAPMessage(message_id_t id_) : next(nullptr), timeout(0), id(id_), transmit_count(0), delivered(nullptr), data_len(0) {
+	CoAPMessage(message_id_t id_) : next(nullptr), timeout(0), sent(0), id(id_), transmit_count(0), delivered(nullptr), data_len(0) {
 		message_count++;
 	}
 
@@ -176,7 +205,7 @@ public:
 	static CoAPMessage* create(Message& msg, size_t data_len = 0)
 	{
 		size_t len = data_len && data_len<msg.length() ? data_len : msg.length();
-		uint8_t* memory = new uint8_t[sizeof(CoAPMessage)+len];
+		void* memory = allocate(sizeof(CoAPMessage)+len);
 		if (memory) {
 			CoAPMessage* coapmsg = new (memory)CoAPMessage(msg.get_id());		// in-place new
 			coapmsg->set_data(msg.buf(), len);
@@ -190,6 +219,10 @@ public:
 		message_count--;
 	}
 
+	static void* operator new(size_t size) noexcept { return allocate(size); }
+	static void* operator new(size_t size, void* ptr) noexcept { return ptr; }
+	static void operator delete(void* ptr) { release(ptr); }
+
 	static uint16_t messages() { return message_count; }
 
 	inline CoAPMessage* get_next() const { return next; }
@@ -198,6 +231,8 @@ public:
 	inline message_id_t get_id() const { return id; }
 	inline void removed() { next = nullptr; }
 	inline system_tick_t get_timeout() const { return timeout; }
+	inline system_tick_t get_sent() const { return sent; }
+	inline uint8_t get_transmit_count() const { return transmit_count; }
 
 	inline void set_delivered_handler(std::function<void(Delivery)>* handler) { this->delivered = handler; }
 
@@ -221,6 +256,7 @@ public:
 	{
 		CoAPType::Enum coapType = CoAP::type(get_data());
 		if (coapType==CoAPType::CON) {
+			sent = now;
 			timeout = now + transmit_timeout(transmit_count);
 			transmit_count++;
 			return transmit_count <= MAX_RETRANSMIT+1;
@@ -301,18 +337,52 @@ class CoAPMessageStore
 	LOG_CATEGORY("comm.coap");
 
 	/**
-	 * The head of the list of messages.
+	 * The number of hash buckets messages are distributed over by message ID.
+	 * Message IDs are allocated sequentially so consecutive messages land in distinct buckets.
+	 */
+	static const unsigned BUCKET_COUNT = 16;
+
+	static_assert((BUCKET_COUNT & (BUCKET_COUNT - 1)) == 0, "BUCKET_COUNT should be a power of 2");
+
+	/**
+	 * The heads of the per-bucket lists of messages.
+	 */
+	CoAPMessage* buckets[BUCKET_COUNT];
+
+	/**
+	 * The number of messages in the store.
 	 */
-	CoAPMessage* head;
+	uint16_t count;
 
 	/**
-	 * Retrieves the message with the given ID and the previous message.
+	 * The number of confirmable messages in the store.
+	 */
+	uint16_t confirmable_count;
+
+	/**
+	 * The time at or before which no message in the store needs processing.
+	 * This may be earlier than the earliest message timeout, never later.
+	 */
+	system_tick_t next_timeout;
+
+	CoAPMessage*& bucket(message_id_t id)
+	{
+		return buckets[id & (BUCKET_COUNT - 1)];
+	}
+
+	CoAPMessage* const& bucket(message_id_t id) const
+	{
+		return buckets[id & (BUCKET_COUNT - 1)];
+	}
+
+	/**
+	 * Retrieves the message with the given ID and the previous message in its bucket.
 	 * If no message exists with the given id, nullptr is returned.
 	 */
 	CoAPMessage* for_id(message_id_t id, CoAPMessage*& prev) const
 	{
 		prev = nullptr;
-		CoAPMessage* next = head;
+		CoAPMessage* next = bucket(id);
 		while (next)
 		{
 			if (next->matches(id))
@@ -324,22 +394,34 @@ class CoAPMessageStore
 	}
 
 	/**
-	 * Removes a message given the message to remove and the previous entry in the list.
+	 * Removes a message given the message to remove and the previous entry in its bucket.
 	 */
 	void remove(CoAPMessage* message, CoAPMessage* previous)
 	{
 		if (previous)
 			previous->set_next(message->get_next());
 		else
-			head = message->get_next();
+			bucket(message->get_id()) = message->get_next();
 		message->removed();
+		count--;
+		if (message->get_type()==CoAPType::CON)
+			confirmable_count--;
+	}
+
+	/**
+	 * Ensures the store is processed no later than the given time.
+	 */
+	void schedule(system_tick_t timeout)
+	{
+		if (time_has_passed(next_timeout, timeout))
+			next_timeout = timeout;
 	}
 
 	void message_timeout(CoAPMessage& msg, Channel& channel);
 
 public:
 
-	CoAPMessageStore() : head(nullptr) {}
+	CoAPMessageStore() : buckets(), count(0), confirmable_count(0), next_timeout(0) {}
 
 	~CoAPMessageStore() {
 		clear();
@@ -347,10 +429,13 @@ public:
 
 	bool has_messages() const
 	{
-		return head!=nullptr;
+		return count!=0;
 	}
 
-	bool has_unacknowledged_requests() const;
+	bool has_unacknowledged_requests() const
+	{
+		return confirmable_count!=0;
+	}
 
 	/**
 	 * Retrieves the current confirmable message that is still
@@ -372,19 +457,7 @@ public:
 	/**
 	 * Adds a message to this message store.
 	 */
-	ProtocolError add(CoAPMessage& message)
-	{
-		// trying to add exactly the same message
-		if (from_id(message.get_id())==&message)
-			return NO_ERROR;
-
-		clear_message(message.get_id());
-		if (message.get_next())
-			return INVALID_STATE;
-		message.set_next(head);
-		head = &message;
-		return NO_ERROR;
-	}
+	ProtocolError add(CoAPMessage& message);
 
 	/**
 	 * Removes a message from the store with the given id.
@@ -444,9 +517,12 @@ public:
 	 */
 	void clear()
 	{
-		while (head!=nullptr)
+		for (CoAPMessage*& head : buckets)
 		{
-			delete remove(head->get_id());
+			while (head!=nullptr)
+			{
+				delete remove(head->get_id());
+			}
 		}
 	}
 
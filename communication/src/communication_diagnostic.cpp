@@ -2,3 +2,11 @@
 
 particle::SimpleIntegerDiagnosticData g_rateLimitedEventsCounter(DIAG_ID_CLOUD_RATE_LIMITED_EVENTS, DIAG_NAME_CLOUD_RATE_LIMITED_EVENTS);
 particle::SimpleIntegerDiagnosticData g_unacknowledgedMessageCounter(DIAG_ID_CLOUD_UNACKNOWLEDGED_MESSAGES, DIAG_NAME_CLOUD_UNACKNOWLEDGED_MESSAGES);
+particle::SimpleIntegerDiagnosticData g_pendingMessagesPeak(DIAG_ID_CLOUD_PENDING_MESSAGES_PEAK, DIAG_NAME_CLOUD_PENDING_MESSAGES_PEAK);
+particle::SimpleIntegerDiagnosticData g_messageAllocFailureCounter(DIAG_ID_CLOUD_MESSAGE_ALLOC_FAILURES, DIAG_NAME_CLOUD_MESSAGE_ALLOC_FAILURES);
+particle::SimpleIntegerDiagnosticData g_queuedEventsCounter(DIAG_ID_CLOUD_QUEUED_EVENTS, DIAG_NAME_CLOUD_QUEUED_EVENTS);
+particle::SimpleIntegerDiagnosticData g_droppedEventsCounter(DIAG_ID_CLOUD_DROPPED_EVENTS, DIAG_NAME_CLOUD_DROPPED_EVENTS);
+particle::SimpleIntegerDiagnosticData g_drainedEventsCounter(DIAG_ID_CLOUD_DRAINED_EVENTS, DIAG_NAME_CLOUD_DRAINED_EVENTS);
+#if DIAG_ENABLE_HISTOGRAMS
+particle::HistogramDiagnosticData<> g_ackLatency(DIAG_ID_CLOUD_ACK_LATENCY, DIAG_NAME_CLOUD_ACK_LATENCY);
+#endif
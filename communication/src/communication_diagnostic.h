@@ -2,3 +2,12 @@
 
 extern particle::SimpleIntegerDiagnosticData g_rateLimitedEventsCounter;
 extern particle::SimpleIntegerDiagnosticData g_unacknowledgedMessageCounter;
+extern particle::SimpleIntegerDiagnosticData g_pendingMessagesPeak;
+extern particle::SimpleIntegerDiagnosticData g_messageAllocFailureCounter;
+extern particle::SimpleIntegerDiagnosticData g_queuedEventsCounter;
+extern particle::SimpleIntegerDiagnosticData g_droppedEventsCounter;
+extern particle::SimpleIntegerDiagnosticData g_drainedEventsCounter;
+#if DIAG_ENABLE_HISTOGRAMS
+// Milliseconds between the first transmission of a confirmable message and its acknowledgement
+extern particle::HistogramDiagnosticData<> g_ackLatency;
+#endif
@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "protocol_defs.h"
+#include "appender.h"
+#include "test_malloc.h"
+
+#include <atomic>
+#include <cstring>
+
+namespace particle { namespace protocol {
+
+/**
+ * Caches the parts of the describe message and their checksums.
+ *
+ * Producing a part is expensive: the application part enumerates all functions and variables,
+ * and the system part walks the headers of all modules in flash. Each part has a generation
+ * counter that is bumped when its content changes, and a cached part or checksum is only used
+ * while its generation is current.
+ *
+ * `invalidate()` can be called from any thread, everything else needs to be called from the
+ * system thread.
+ */
+class DescribeCache
+{
+public:
+	enum Part
+	{
+		APPLICATION,
+		SYSTEM,
+		PART_COUNT
+	};
+
+	DescribeCache() :
+			entries_(),
+			generations_()
+	{
+	}
+
+	~DescribeCache()
+	{
+		for (auto& e : entries_)
+		{
+			t_free(e.data);
+		}
+	}
+
+	DescribeCache(const DescribeCache&) = delete;
+	DescribeCache& operator=(const DescribeCache&) = delete;
+
+	/**
+	 * Marks the parts selected by the given DESCRIBE_APPLICATION and DESCRIBE_SYSTEM flags
+	 * as changed.
+	 */
+	void invalidate(int desc_flags)
+	{
+		if (desc_flags & DESCRIBE_APPLICATION)
+			generations_[APPLICATION].fetch_add(1, std::memory_order_relaxed);
+		if (desc_flags & DESCRIBE_SYSTEM)
+			generations_[SYSTEM].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	uint32_t generation(Part part) const
+	{
+		return generations_[part].load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * Rebuilds a part with `build(Appender&)` unless it's cached already. The part is built
+	 * once, into a buffer that grows as needed.
+	 * Returns false if the part couldn't be cached.
+	 */
+	template<typename BuildFn>
+	bool update(Part part, BuildFn build)
+	{
+		Entry& e = entries_[part];
+		const uint32_t gen = generation(part);
+		if (e.data_valid && e.data_generation == gen)
+			return true;
+		e.data_valid = false;
+		GrowingAppender appender(e.data, e.capacity);
+		build(appender);
+		// the buffer is kept even if it couldn't be grown, the next attempt reuses it
+		e.data = appender.data();
+		e.capacity = appender.capacity();
+		if (appender.failed())
+			return false;
+		e.size = appender.size();
+		if (e.capacity > e.size)
+		{
+			void* data = t_realloc(e.data, e.size ? e.size : 1);
+			if (data)
+			{
+				e.data = (uint8_t*)data;
+				e.capacity = e.size ? e.size : 1;
+			}
+		}
+		e.data_generation = gen;
+		e.data_valid = true;
+		return true;
+	}
+
+	const uint8_t* data(Part part) const
+	{
+		return entries_[part].data;
+	}
+
+	size_t size(Part part) const
+	{
+		return entries_[part].size;
+	}
+
+	/**
+	 * Returns the checksum of a part, computing it with `compute()` unless it's cached already.
+	 */
+	template<typename ComputeFn>
+	uint32_t checksum(Part part, ComputeFn compute)
+	{
+		Entry& e = entries_[part];
+		const uint32_t gen = generation(part);
+		if (!e.checksum_valid || e.checksum_generation != gen)
+		{
+			e.checksum = compute();
+			e.checksum_generation = gen;
+			e.checksum_valid = true;
+		}
+		return e.checksum;
+	}
+
+private:
+	/**
+	 * Appends to a heap buffer, which is reallocated when it's full.
+	 */
+	class GrowingAppender : public Appender
+	{
+	public:
+		static const size_t MIN_CAPACITY = 64;
+
+		GrowingAppender(uint8_t* data, size_t capacity) :
+				data_(data),
+				capacity_(capacity),
+				size_(0),
+				failed_(false)
+		{
+		}
+
+		bool append(const uint8_t* data, size_t size) override
+		{
+			if (failed_)
+				return false;
+			if (capacity_ - size_ < size)
+			{
+				size_t capacity = capacity_;
+				if (capacity < MIN_CAPACITY)
+					capacity = MIN_CAPACITY;
+				while (capacity - size_ < size)
+					capacity *= 2;
+				void* p = t_realloc(data_, capacity);
+				if (!p)
+				{
+					failed_ = true;
+					return false;
+				}
+				data_ = (uint8_t*)p;
+				capacity_ = capacity;
+			}
+			memcpy(data_ + size_, data, size);
+			size_ += size;
+			return true;
+		}
+
+		uint8_t* data() const
+		{
+			return data_;
+		}
+
+		size_t capacity() const
+		{
+			return capacity_;
+		}
+
+		size_t size() const
+		{
+			return size_;
+		}
+
+		bool failed() const
+		{
+			return failed_;
+		}
+
+	private:
+		uint8_t* data_;
+		size_t capacity_;
+		size_t size_;
+		bool failed_;
+	};
+
+	struct Entry
+	{
+		uint8_t* data;
+		size_t capacity;
+		size_t size;
+		uint32_t data_generation;
+		uint32_t checksum;
+		uint32_t checksum_generation;
+		bool data_valid;
+		bool checksum_valid;
+	};
+
+	Entry entries_[PART_COUNT];
+	std::atomic<uint32_t> generations_[PART_COUNT];
+};
+
+}}
@@ -78,10 +78,13 @@ public:
 		switch (command)
 		{
 		case ProtocolCommands::SLEEP:
+			flush_events();
 			result = wait_confirmable();
 			break;
 		case ProtocolCommands::DISCONNECT:
+			flush_events();
 			result = wait_confirmable();
+			cancel_pending_events();
 			ack_handlers.clear();
 			break;
 		case ProtocolCommands::WAKE:
@@ -89,6 +92,7 @@ public:
 			result = NO_ERROR;
 			break;
 		case ProtocolCommands::TERMINATE:
+			cancel_pending_events();
 			ack_handlers.clear();
 			result = NO_ERROR;
 			break;
@@ -108,7 +112,7 @@ public:
 	int get_status(protocol_status* status) const override {
 		SPARK_ASSERT(status);
 		status->flags = 0;
-		if (channel.has_unacknowledged_client_requests()) {
+		if (channel.has_unacknowledged_client_requests() || has_pending_events()) {
 			status->flags |= PROTOCOL_STATUS_HAS_PENDING_CLIENT_MESSAGES;
 		}
 		return NO_ERROR;
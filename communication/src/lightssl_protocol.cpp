@@ -28,9 +28,14 @@ int LightSSLProtocol::command(ProtocolCommands::Enum command, uint32_t data)
   switch (command) {
   case ProtocolCommands::SLEEP:
   case ProtocolCommands::DISCONNECT:
+    flush_events();
     result = this->wait_confirmable();
+    if (command == ProtocolCommands::DISCONNECT) {
+      cancel_pending_events();
+    }
     break;
   case ProtocolCommands::TERMINATE:
+    cancel_pending_events();
     ack_handlers.clear();
     result = NO_ERROR;
     break;
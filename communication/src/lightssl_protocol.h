@@ -83,6 +83,9 @@ public:
 	{
 		SPARK_ASSERT(status);
 		status->flags = 0;
+		if (has_pending_events()) {
+			status->flags |= PROTOCOL_STATUS_HAS_PENDING_CLIENT_MESSAGES;
+		}
 		return 0;
 	}
 
@@ -203,6 +203,20 @@ size_t Messages::chunk_missed(uint8_t* buf, uint16_t message_id, chunk_index_t c
 	return 9;
 }
 
+size_t Messages::chunks_acked(uint8_t* buf, uint16_t message_id, chunk_index_t next_index)
+{
+	buf[0] = 0x50; // non-confirmable, no token
+	buf[1] = 0x02; // code 0.02 POST
+	buf[2] = message_id >> 8;
+	buf[3] = message_id & 0xff;
+	buf[4] = 0xb1; // one-byte Uri-Path option
+	buf[5] = 'a';
+	buf[6] = 0xff; // payload marker
+	buf[7] = next_index >> 8;
+	buf[8] = next_index & 0xff;
+	return 9;
+}
+
 size_t Messages::content(uint8_t* buf, uint16_t message_id, uint8_t token)
 {
 	buf[0] = 0x61; // acknowledgment, one-byte token
@@ -215,6 +229,24 @@ size_t Messages::content(uint8_t* buf, uint16_t message_id, uint8_t token)
 }
 
 
+size_t Messages::description(uint8_t* buf, uint16_t message_id, uint8_t token, uint32_t checksum, bool payload)
+{
+	buf[0] = 0x61; // acknowledgment, one-byte token
+	buf[1] = payload ? 0x45 : 0x43; // response code 2.05 CONTENT or 2.03 VALID
+	buf[2] = message_id >> 8;
+	buf[3] = message_id & 0xff;
+	buf[4] = token;
+	buf[5] = 0x44; // ETag option of length 4
+	buf[6] = checksum >> 24;
+	buf[7] = (checksum >> 16) & 0xff;
+	buf[8] = (checksum >> 8) & 0xff;
+	buf[9] = checksum & 0xff;
+	if (!payload)
+		return 10;
+	buf[10] = 0xff; // payload marker
+	return 11;
+}
+
 size_t Messages::keep_alive(uint8_t* buf)
 {
 	buf[0] = 0;
@@ -289,6 +321,23 @@ size_t Messages::separate_response_with_payload(unsigned char *buf, uint16_t mes
 
 size_t Messages::event(uint8_t buf[], uint16_t message_id, const char *event_name,
              const char *data, int ttl, EventType::Enum event_type, bool confirmable)
+{
+  uint8_t *p = buf + event_header(buf, message_id, event_name, ttl, event_type, confirmable);
+
+  if (NULL != data)
+  {
+    const size_t data_len = strnlen(data, MAX_EVENT_DATA_LENGTH);
+
+    *p++ = 0xff;
+    memcpy(p, data, data_len);
+    p += data_len;
+  }
+
+  return p - buf;
+}
+
+size_t Messages::event_header(uint8_t buf[], uint16_t message_id, const char *event_name,
+             int ttl, EventType::Enum event_type, bool confirmable)
 {
   uint8_t *p = buf;
   *p++ = confirmable ? 0x40 : 0x50; // non-confirmable /confirmable, no token
@@ -298,8 +347,8 @@ size_t Messages::event(uint8_t buf[], uint16_t message_id, const char *event_nam
   *p++ = 0xb1; // one-byte Uri-Path option
   *p++ = event_type;
 
-  size_t name_data_len = strnlen(event_name, MAX_EVENT_NAME_LENGTH);
-  p += event_name_uri_path(p, event_name, name_data_len);
+  const size_t name_len = strnlen(event_name, MAX_EVENT_NAME_LENGTH);
+  p += event_name_uri_path(p, event_name, name_len);
 
   if (60 != ttl)
   {
@@ -309,18 +358,87 @@ size_t Messages::event(uint8_t buf[], uint16_t message_id, const char *event_nam
     *p++ = ttl & 0xff;
   }
 
-  if (NULL != data)
-  {
-    name_data_len = strnlen(data, MAX_EVENT_DATA_LENGTH);
+  return p - buf;
+}
+
+size_t Messages::event_batch(uint8_t buf[], uint16_t message_id, bool confirmable)
+{
+  buf[0] = confirmable ? 0x40 : 0x50; // non-confirmable /confirmable, no token
+  buf[1] = 0x02; // code 0.02 POST request
+  buf[2] = message_id >> 8;
+  buf[3] = message_id & 0xff;
+  buf[4] = 0xb1; // one-byte Uri-Path option
+  buf[5] = 'b';
+  buf[6] = 0xff; // payload marker
+  return event_batch_header_size;
+}
+
+size_t Messages::event_batch_record_size(const char *event_name, const char *data)
+{
+  const size_t name_len = strnlen(event_name, MAX_EVENT_NAME_LENGTH);
+  const size_t data_len = data ? strnlen(data, MAX_EVENT_DATA_LENGTH) : 0;
+  return 7 + name_len + data_len;
+}
 
+size_t Messages::event_batch_record(uint8_t buf[], const char *event_name,
+             const char *data, int ttl, EventType::Enum event_type)
+{
+  uint8_t *p = buf;
+  *p++ = event_type;
+  *p++ = (ttl >> 16) & 0xff;
+  *p++ = (ttl >> 8) & 0xff;
+  *p++ = ttl & 0xff;
+
+  const size_t name_len = strnlen(event_name, MAX_EVENT_NAME_LENGTH);
+  *p++ = name_len;
+  memcpy(p, event_name, name_len);
+  p += name_len;
+
+  if (data)
+  {
+    const size_t data_len = strnlen(data, MAX_EVENT_DATA_LENGTH);
+    *p++ = data_len >> 8;
+    *p++ = data_len & 0xff;
+    memcpy(p, data, data_len);
+    p += data_len;
+  }
+  else
+  {
+    *p++ = 0xff;
     *p++ = 0xff;
-    memcpy(p, data, name_data_len);
-    p += name_data_len;
   }
 
   return p - buf;
 }
 
+uint8_t Messages::hello_flags(const uint8_t* buf, size_t length)
+{
+  if (length < 4)
+  {
+    return 0;
+  }
+  // Skip the token and options
+  uint8_t* p = const_cast<uint8_t*>(buf) + 4 + (buf[0] & 0x0F);
+  const uint8_t* const end = buf + length;
+  while (p < end && *p != 0xff)
+  {
+    const uint8_t nibble = *p & 0x0f;
+    // Reserved values, or an extended length that runs past the end of the message
+    if (nibble == 15 || (*p & 0xf0) == 0xf0 || (nibble >= 13 && end - p <= nibble - 12))
+    {
+      return 0;
+    }
+    p += CoAP::option_decode(&p);
+  }
+  // The payload of a hello message starts with the product ID (2 bytes), product version
+  // (2 bytes) and reserved flags (1 byte), followed by the flags
+  if (p >= end || end - p < 7)
+  {
+    return 0;
+  }
+  return p[6];
+}
+
 size_t Messages::coded_ack(uint8_t* buf, uint8_t token, uint8_t code,
                            uint8_t message_id_msb, uint8_t message_id_lsb,
                            uint8_t* data, size_t data_len)
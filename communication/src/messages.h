@@ -63,6 +63,13 @@ public:
 
 	static size_t chunk_missed(uint8_t* buf, uint16_t message_id, chunk_index_t chunk_index);
 
+	/**
+	 * Writes the header of a non-confirmable acknowledgement of firmware chunks. The payload
+	 * starts with the index of the first chunk not yet received; ranges of chunks received past
+	 * that index may follow it.
+	 */
+	static size_t chunks_acked(uint8_t* buf, uint16_t message_id, chunk_index_t next_index);
+
 	static size_t content(uint8_t* buf, uint16_t message_id, uint8_t token);
 
 	static size_t ping(uint8_t* buf, uint16_t message_id);
@@ -77,6 +84,36 @@ public:
 	static size_t event(uint8_t buf[], uint16_t message_id, const char *event_name,
 	             const char *data, int ttl, EventType::Enum event_type, bool confirmable);
 
+	/**
+	 * Writes the options of an event message without the payload marker and data, so that
+	 * the data can be written in place after it.
+	 */
+	static size_t event_header(uint8_t buf[], uint16_t message_id, const char *event_name,
+	             int ttl, EventType::Enum event_type, bool confirmable);
+
+	/**
+	 * Size of the header of a message carrying a batch of events (`POST /b`). The header is
+	 * followed by the event records written by {@link #event_batch_record()}.
+	 */
+	static const size_t event_batch_header_size = 7;
+
+	static size_t event_batch(uint8_t buf[], uint16_t message_id, bool confirmable);
+
+	/**
+	 * Encodes an event as a record in a batch of events:
+	 * event type (1 byte), TTL (3 bytes), name length (1 byte), name, data length (2 bytes),
+	 * data. The data length is 0xffff if the event has no data.
+	 */
+	static size_t event_batch_record(uint8_t buf[], const char *event_name,
+	             const char *data, int ttl, EventType::Enum event_type);
+
+	static size_t event_batch_record_size(const char *event_name, const char *data);
+
+	/**
+	 * Returns the flags of a hello message, or 0 if the message is not a valid hello message.
+	 */
+	static uint8_t hello_flags(const uint8_t* buf, size_t length);
+
 
     static inline size_t empty_ack(unsigned char *buf,
                           unsigned char message_id_msb,
@@ -136,6 +173,16 @@ public:
         return separate_response_with_payload(buf, message_id, token, 0x44, &flags, 1, confirmable);
     }
 
+    /**
+     * Writes an UpdateReady response that also advertises how many chunks the device accepts
+     * past the first chunk it has not acknowledged.
+     */
+    static inline size_t update_ready(unsigned char *buf, message_id_t message_id, token_t token, uint8_t flags, chunk_index_t window, bool confirmable)
+    {
+        const uint8_t payload[3] = { flags, uint8_t(window >> 8), uint8_t(window & 0xff) };
+        return separate_response_with_payload(buf, message_id, token, 0x44, payload, sizeof(payload), confirmable);
+    }
+
     static inline size_t chunk_received(unsigned char *buf, message_id_t message_id, token_t token, ChunkReceivedCode::Enum code, bool confirmable)
     {
        return separate_response(buf, message_id, token, code, confirmable);
@@ -152,6 +199,14 @@ public:
         return content(buf, message_id, token);
     }
 
+    /**
+     * Writes the header of a describe response that carries the checksum of the describe message
+     * in an ETag option. Without a payload, the response code is 2.03 (Valid), meaning that the
+     * describe message known to the server is current.
+     */
+    static size_t description(unsigned char *buf, message_id_t message_id, token_t token,
+                              uint32_t checksum, bool payload);
+
     /**
      * Returns the size of a response message (an ACK or a separate response) without options.
      *
@@ -27,6 +27,12 @@ LOG_SOURCE_CATEGORY("comm.protocol")
 
 namespace particle { namespace protocol {
 
+const auto HELLO_FLAG_OTA_UPGRADE_SUCCESSFUL = 1;
+const auto HELLO_FLAG_DIAGNOSTICS_SUPPORT = 2;
+const auto HELLO_FLAG_IMMEDIATE_UPDATES_SUPPORT = 4;
+const auto HELLO_FLAG_EVENT_BATCHING_SUPPORT = 8;
+const auto HELLO_FLAG_OTA_WINDOW_SUPPORT = 16;
+
 /**
  * Sends an empty acknowledgement for the given message
  */
@@ -37,6 +43,63 @@ ProtocolError Protocol::send_empty_ack(Message& message, message_id_t msg_id)
 	return channel.send(message);
 }
 
+/**
+ * Decodes the Uri-Query options of a describe request. A single byte option holds the describe
+ * flags, and a 4-byte option holds the checksum of the description known to the server.
+ * Other options are skipped.
+ */
+static void decode_describe_query(uint8_t* buf, size_t length, int& desc_flags, uint32_t& known_checksum,
+		bool& has_checksum)
+{
+	// the options follow the 4 bytes header and the token
+	uint8_t* option = buf + 4 + (buf[0] & 0x0f);
+	const uint8_t* const end = buf + length;
+	unsigned option_number = 0;
+	while (option < end && *option != 0xff)
+	{
+		// extended option deltas are not used by the server
+		const unsigned delta = *option >> 4;
+		const unsigned length_nibble = *option & 0x0f;
+		const size_t header_size = (length_nibble < 13) ? 1 : length_nibble - 11;
+		if (delta >= 13 || length_nibble == 15 || size_t(end - option) < header_size)
+		{
+			LOG(WARN, "Malformed DESCRIBE options");
+			return;
+		}
+		option_number += delta;
+		const size_t option_length = CoAP::option_decode(&option);
+		if (size_t(end - option) < option_length)
+		{
+			LOG(WARN, "Malformed DESCRIBE options");
+			return;
+		}
+		if (option_number == CoAPOption::URI_QUERY)
+		{
+			if (option_length == 1)
+			{
+				if (*option <= DESCRIBE_MAX)
+				{
+					desc_flags = *option;
+				}
+				else
+				{
+					LOG(WARN, "Invalid DESCRIBE flags %02x", *option);
+				}
+			}
+			else if (option_length == 4)
+			{
+				known_checksum = (uint32_t)option[0]<<24 | (uint32_t)option[1]<<16 | (uint32_t)option[2]<<8 | option[3];
+				has_checksum = true;
+			}
+			else
+			{
+				LOG(WARN, "Unexpected DESCRIBE query of %u bytes", (unsigned)option_length);
+			}
+		}
+		option += option_length;
+	}
+}
+
 /**
  * Decodes and dispatches a received message to its handler.
  */
@@ -76,15 +139,13 @@ ProtocolError Protocol::handle_received_message(Message& message,
 	{
 	case CoAPMessageType::DESCRIBE:
 	{
-		// 4 bytes header, 1 byte token, 2 bytes Uri-Path
-		// 2 bytes optional single character Uri-Query for describe flags
+		// Uri-Path, then optional Uri-Query options for the describe flags and for the
+		// checksum known to the server
 		int descriptor_type = DESCRIBE_DEFAULT;
-		if (message.length()>8 && queue[8] <= DESCRIBE_MAX) {
-			descriptor_type = queue[8];
-		} else if (message.length() > 8) {
-			LOG(WARN, "Invalid DESCRIBE flags %02x", queue[8]);
-		}
-		error = send_description(token, msg_id, descriptor_type);
+		uint32_t known_checksum = 0;
+		bool has_checksum = false;
+		decode_describe_query(queue, message.length(), descriptor_type, known_checksum, has_checksum);
+		error = send_description(token, msg_id, descriptor_type, has_checksum ? &known_checksum : nullptr);
 		break;
 	}
 
@@ -137,6 +198,10 @@ ProtocolError Protocol::handle_received_message(Message& message,
 		return channel.send(message);
 
 	case CoAPMessageType::HELLO:
+		publisher.set_batching_supported(publisher.batching_window() &&
+				(Messages::hello_flags(queue, message.length()) & HELLO_FLAG_EVENT_BATCHING_SUPPORT));
+		chunkedTransfer.set_window_supported(
+				Messages::hello_flags(queue, message.length()) & HELLO_FLAG_OTA_WINDOW_SUPPORT);
 		if (message.get_type()==CoAPType::CON)
 			send_empty_ack(message, msg_id);
 		descriptor.ota_upgrade_status_sent();
@@ -283,11 +348,35 @@ uint32_t Protocol::application_state_checksum()
 {
 	return descriptor.app_state_selector_info ? application_state_checksum(callbacks.calculate_crc,
 			subscriptions.compute_subscriptions_checksum(callbacks.calculate_crc),
-			descriptor.app_state_selector_info(SparkAppStateSelector::DESCRIBE_APP, SparkAppStateUpdate::COMPUTE, 0, nullptr),
-			descriptor.app_state_selector_info(SparkAppStateSelector::DESCRIBE_SYSTEM, SparkAppStateUpdate::COMPUTE, 0, nullptr))
+			describe_part_checksum(DescribeCache::APPLICATION),
+			describe_part_checksum(DescribeCache::SYSTEM))
 			: 0;
 }
 
+/**
+ * Retrieves the checksum of a part of the describe message, which is only computed again when
+ * the part has changed since.
+ */
+uint32_t Protocol::describe_part_checksum(DescribeCache::Part part)
+{
+	if (!descriptor.app_state_selector_info)
+		return 0;
+	return describe_cache.checksum(part, [this, part]() {
+		return descriptor.app_state_selector_info((part==DescribeCache::APPLICATION) ?
+				SparkAppStateSelector::DESCRIBE_APP : SparkAppStateSelector::DESCRIBE_SYSTEM,
+				SparkAppStateUpdate::COMPUTE, 0, nullptr);
+	});
+}
+
+uint32_t Protocol::describe_checksum(int desc_flags)
+{
+	uint32_t chk[3];
+	chk[0] = desc_flags & (DESCRIBE_APPLICATION | DESCRIBE_SYSTEM);
+	chk[1] = (desc_flags & DESCRIBE_APPLICATION) ? describe_part_checksum(DescribeCache::APPLICATION) : 0;
+	chk[2] = (desc_flags & DESCRIBE_SYSTEM) ? describe_part_checksum(DescribeCache::SYSTEM) : 0;
+	return callbacks.calculate_crc((uint8_t*)chk, sizeof(chk));
+}
+
 /**
  * Establish a secure connection and send and process the hello message.
  */
@@ -300,6 +389,7 @@ int Protocol::begin()
 	timesync_.reset();
 
 	// FIXME: Pending completion handlers should be cancelled at the end of a previous session
+	cancel_pending_events();
 	ack_handlers.clear();
 	last_ack_handlers_update = callbacks.millis();
 
@@ -335,6 +425,10 @@ int Protocol::begin()
 	// todo - this will return code 0 even when the session was resumed,
 	// causing all the application events to be sent.
 
+	// batching and the OTA receive window are renegotiated in the hello exchange
+	publisher.set_batching_supported(false);
+	chunkedTransfer.set_window_supported(false);
+
 	LOG(INFO,"Sending HELLO message");
 	error = hello(descriptor.was_ota_upgrade_successful());
 	if (error)
@@ -354,9 +448,6 @@ int Protocol::begin()
 	return error;
 }
 
-const auto HELLO_FLAG_OTA_UPGRADE_SUCCESSFUL = 1;
-const auto HELLO_FLAG_DIAGNOSTICS_SUPPORT = 2;
-const auto HELLO_FLAG_IMMEDIATE_UPDATES_SUPPORT = 4;
 
 /**
  * Send the hello message over the channel.
@@ -369,6 +460,13 @@ ProtocolError Protocol::hello(bool was_ota_upgrade_successful)
 
 	uint8_t flags = was_ota_upgrade_successful ? HELLO_FLAG_OTA_UPGRADE_SUCCESSFUL : 0;
 	flags |= HELLO_FLAG_DIAGNOSTICS_SUPPORT | HELLO_FLAG_IMMEDIATE_UPDATES_SUPPORT;
+	// The server sends firmware chunks within the receive window advertised in UpdateReady
+	// if it sets the same flag in its hello message
+	flags |= HELLO_FLAG_OTA_WINDOW_SUPPORT;
+	if (publisher.batching_window()) {
+		// The server enables batching by setting the same flag in its hello message
+		flags |= HELLO_FLAG_EVENT_BATCHING_SUPPORT;
+	}
 	size_t len = build_hello(message, flags);
 	message.set_length(len);
 	message.set_confirm_received(true);
@@ -453,15 +551,81 @@ ProtocolError Protocol::event_loop(CoAPMessageType::Enum& message_type)
 	return error;
 }
 
-void Protocol::build_describe_message(Appender& appender, int desc_flags)
+void Protocol::build_describe_part(Appender& appender, DescribeCache::Part part)
+{
+	if (part == DescribeCache::SYSTEM)
+	{
+		descriptor.append_system_info(append_instance, &appender, nullptr);
+		return;
+	}
+
+	appender.append("\"f\":[");
+
+	int num_keys = descriptor.num_functions();
+	int i;
+	for (i = 0; i < num_keys; ++i)
+	{
+		if (i)
+		{
+			appender.append(',');
+		}
+		appender.append('"');
+
+		const char* key = descriptor.get_function_key(i);
+		size_t function_name_length = strlen(key);
+		if (MAX_FUNCTION_KEY_LENGTH < function_name_length)
+		{
+			function_name_length = MAX_FUNCTION_KEY_LENGTH;
+		}
+		appender.append((const uint8_t*) key, function_name_length);
+		appender.append('"');
+	}
+
+	appender.append("],\"v\":{");
+
+	num_keys = descriptor.num_variables();
+	for (i = 0; i < num_keys; ++i)
+	{
+		if (i)
+		{
+			appender.append(',');
+		}
+		appender.append('"');
+		const char* key = descriptor.get_variable_key(i);
+		size_t variable_name_length = strlen(key);
+		SparkReturnType::Enum t = descriptor.variable_type(key);
+		if (MAX_VARIABLE_KEY_LENGTH < variable_name_length)
+		{
+			variable_name_length = MAX_VARIABLE_KEY_LENGTH;
+		}
+		appender.append((const uint8_t*) key, variable_name_length);
+		appender.append("\":");
+		appender.append('0' + (char) t);
+	}
+	appender.append('}');
+}
+
+void Protocol::append_describe_part(Appender& appender, DescribeCache::Part part, bool cached)
+{
+	if (cached && describe_cache.update(part, [this, part](Appender& a) { build_describe_part(a, part); }))
+	{
+		appender.append(describe_cache.data(part), describe_cache.size(part));
+	}
+	else
+	{
+		build_describe_part(appender, part);
+	}
+}
+
+void Protocol::build_describe_message(Appender& appender, int desc_flags, bool cached)
 {
 	// diagnostics must be requested in isolation to be a binary packet
-	if (descriptor.append_metrics && (desc_flags == DESCRIBE_METRICS))
+	if (descriptor.append_metrics && (desc_flags == DESCRIBE_METRICS || desc_flags == DESCRIBE_METRICS_DELTA))
 	{
 		appender.append(char(0));	// null byte means binary data
-		appender.append(char(DESCRIBE_METRICS)); 									// uint16 describes the type of binary packet
+		appender.append(char(desc_flags)); 									// uint16 describes the type of binary packet
 		appender.append(char(0));	//
-		const int flags = 1;		// binary
+		const int flags = (desc_flags == DESCRIBE_METRICS_DELTA) ? 3 : 1;		// binary, delta-encoded
 		const int page = 0;
 		descriptor.append_metrics(append_instance, &appender, flags, page, nullptr);
 	}
@@ -472,50 +636,7 @@ void Protocol::build_describe_message(Appender& appender, int desc_flags)
 		if (desc_flags & DESCRIBE_APPLICATION)
 		{
 			has_content = true;
-			appender.append("\"f\":[");
-
-			int num_keys = descriptor.num_functions();
-			int i;
-			for (i = 0; i < num_keys; ++i)
-			{
-				if (i)
-				{
-					appender.append(',');
-				}
-				appender.append('"');
-
-				const char* key = descriptor.get_function_key(i);
-				size_t function_name_length = strlen(key);
-				if (MAX_FUNCTION_KEY_LENGTH < function_name_length)
-				{
-					function_name_length = MAX_FUNCTION_KEY_LENGTH;
-				}
-				appender.append((const uint8_t*) key, function_name_length);
-				appender.append('"');
-			}
-
-			appender.append("],\"v\":{");
-
-			num_keys = descriptor.num_variables();
-			for (i = 0; i < num_keys; ++i)
-			{
-				if (i)
-				{
-					appender.append(',');
-				}
-				appender.append('"');
-				const char* key = descriptor.get_variable_key(i);
-				size_t variable_name_length = strlen(key);
-				SparkReturnType::Enum t = descriptor.variable_type(key);
-				if (MAX_VARIABLE_KEY_LENGTH < variable_name_length)
-				{
-					variable_name_length = MAX_VARIABLE_KEY_LENGTH;
-				}
-				appender.append((const uint8_t*) key, variable_name_length);
-				appender.append("\":");
-				appender.append('0' + (char) t);
-			}
-			appender.append('}');
+			append_describe_part(appender, DescribeCache::APPLICATION, cached);
 		}
 
 		if (descriptor.append_system_info && (desc_flags & DESCRIBE_SYSTEM))
@@ -525,7 +646,7 @@ void Protocol::build_describe_message(Appender& appender, int desc_flags)
 				appender.append(',');
 			}
 			has_content = true;
-			descriptor.append_system_info(append_instance, &appender, nullptr);
+			append_describe_part(appender, DescribeCache::SYSTEM, cached);
 		}
 		appender.append('}');
 	}
@@ -537,7 +658,7 @@ ProtocolError Protocol::generate_and_send_description(MessageChannel& channel, M
     ProtocolError error;
 
     BufferAppender appender((message.buf() + header_size), (message.capacity() - header_size));
-    build_describe_message(appender, desc_flags);
+    build_describe_message(appender, desc_flags, true /* cached */);
 
     const size_t msglen = (appender.next() - (uint8_t*)message.buf());
     message.set_length(msglen);
@@ -552,8 +673,9 @@ ProtocolError Protocol::generate_and_send_description(MessageChannel& channel, M
         SPARK_ASSERT(!appender.overflowed());
     }
 
-    LOG(INFO, "Posting '%s%s%s' describe message", desc_flags & DESCRIBE_SYSTEM ? "S" : "",
-        desc_flags & DESCRIBE_APPLICATION ? "A" : "", desc_flags & DESCRIBE_METRICS ? "M" : "");
+    LOG(INFO, "Posting '%s%s%s%s' describe message", desc_flags & DESCRIBE_SYSTEM ? "S" : "",
+        desc_flags & DESCRIBE_APPLICATION ? "A" : "", desc_flags & DESCRIBE_METRICS ? "M" : "",
+        desc_flags & DESCRIBE_METRICS_DELTA ? "D" : "");
 
     error = channel.send(message);
 
@@ -565,14 +687,16 @@ ProtocolError Protocol::generate_and_send_description(MessageChannel& channel, M
         {
             // have sent the describe message to the cloud so update the crc
             descriptor.app_state_selector_info(SparkAppStateSelector::DESCRIBE_APP,
-                                               SparkAppStateUpdate::COMPUTE_AND_PERSIST, 0,
+                                               SparkAppStateUpdate::PERSIST,
+                                               describe_part_checksum(DescribeCache::APPLICATION),
                                                nullptr);
         }
         if (desc_flags & DESCRIBE_SYSTEM)
         {
             // have sent the describe message to the cloud so update the crc
             descriptor.app_state_selector_info(SparkAppStateSelector::DESCRIBE_SYSTEM,
-                                               SparkAppStateUpdate::COMPUTE_AND_PERSIST, 0,
+                                               SparkAppStateUpdate::PERSIST,
+                                               describe_part_checksum(DescribeCache::SYSTEM),
                                                nullptr);
         }
         this->channel.command(Channel::LOAD_SESSION);
@@ -586,14 +710,27 @@ ProtocolError Protocol::generate_and_send_description(MessageChannel& channel, M
     return error;
 }
 
-ProtocolError Protocol::post_description(int desc_flags)
+ProtocolError Protocol::post_description(int desc_flags, CompletionHandler handler)
 {
     Message message;
     channel.create(message);
     const size_t header_size =
         Messages::describe_post_header(message.buf(), message.capacity(), 0, (desc_flags & 0xFF));
 
-    return generate_and_send_description(channel, message, header_size, desc_flags);
+    const ProtocolError error = generate_and_send_description(channel, message, header_size, desc_flags);
+    if (error != NO_ERROR)
+    {
+        handler.setError(toSystemError(error));
+    }
+    else if (handler && message.has_id())
+    {
+        add_ack_handler(message.get_id(), std::move(handler), POST_DESCRIPTION_ACK_TIMEOUT);
+    }
+    else
+    {
+        handler.setResult();
+    }
+    return error;
 }
 
 /**
@@ -601,14 +738,28 @@ ProtocolError Protocol::post_description(int desc_flags)
  * @param desc_flags Flags describing the information to provide. A combination of {@code
  * DESCRIBE_APPLICATION) and {@code DESCRIBE_SYSTEM) flags.
  */
-ProtocolError Protocol::send_description(token_t token, message_id_t msg_id, int desc_flags)
+ProtocolError Protocol::send_description(token_t token, message_id_t msg_id, int desc_flags,
+                                         const uint32_t* known_checksum)
 {
     Message message;
     channel.create(message);
     uint8_t* buf = message.buf();
     message.set_id(msg_id);
-    size_t desc = Messages::description(buf, msg_id, token);
+    // the metrics are not cached and always sent in full
+    if (!known_checksum || (desc_flags & (DESCRIBE_METRICS | DESCRIBE_METRICS_DELTA)))
+    {
+        size_t desc = Messages::description(buf, msg_id, token);
+        return generate_and_send_description(channel, message, desc, desc_flags);
+    }
 
+    const uint32_t checksum = describe_checksum(desc_flags);
+    if (checksum == *known_checksum)
+    {
+        LOG(INFO, "Describe message unchanged");
+        message.set_length(Messages::description(buf, msg_id, token, checksum, false /* payload */));
+        return channel.send(message);
+    }
+    size_t desc = Messages::description(buf, msg_id, token, checksum, true /* payload */);
     return generate_and_send_description(channel, message, desc, desc_flags);
 }
 
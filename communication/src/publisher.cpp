@@ -15,10 +15,342 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "logging.h"
+LOG_SOURCE_CATEGORY("comm.publisher")
+
 #include "publisher.h"
 
 #include "protocol.h"
 
-void particle::protocol::Publisher::add_ack_handler(message_id_t msg_id, CompletionHandler handler) {
+#include <new>
+#include <algorithm>
+
+namespace particle { namespace protocol {
+
+namespace {
+
+// Completes the handlers of all events in a batch when the batch is acknowledged
+struct BatchAckHandler {
+    spark::Vector<CompletionHandler> handlers;
+
+    static void callback(int error, const void* data, void* callback_data, void* reserved) {
+        const auto h = static_cast<BatchAckHandler*>(callback_data);
+        for (CompletionHandler& handler: h->handlers) {
+            if (error) {
+                handler.setError(error);
+            } else {
+                handler.setResult();
+            }
+        }
+        delete h;
+    }
+};
+
+} // unnamed
+
+ProtocolError Publisher::send_event(MessageChannel& channel, const char* event_name,
+        const char* data, int ttl, EventType::Enum event_type, int flags,
+        system_tick_t time, CompletionHandler handler) {
+    const bool is_system_event = is_system(event_name);
+    if (can_send_now(is_system_event, time)) {
+        return send_event_now(channel, event_name, data, ttl, event_type, flags, time, handler);
+    }
+    return defer_event(event_name, data, ttl, event_type, flags, is_system_event, handler);
+}
+
+ProtocolError Publisher::send_event(MessageChannel& channel, const char* event_name,
+        EventDataWriter data_writer, void* data_writer_data, int ttl, EventType::Enum event_type,
+        int flags, system_tick_t time, CompletionHandler handler) {
+    const bool is_system_event = is_system(event_name);
+    // The budget is only charged once the data has been written successfully
+    const bool send_now = is_send_allowed(is_system_event, time);
+    if (send_now && !is_batching()) {
+        Message message;
+        channel.create(message);
+        size_t msglen = Messages::event_header(message.buf(), 0, event_name, ttl, event_type,
+                is_confirmable(channel, flags));
+        message.buf()[msglen++] = 0xff;
+        const size_t size = (message.capacity() > msglen) ? message.capacity() - msglen : 0;
+        const int data_len = data_writer((char*)message.buf() + msglen,
+                std::min(size, MAX_EVENT_DATA_LENGTH), data_writer_data);
+        if (data_len < 0) {
+            handler.setError(data_len);
+            return INSUFFICIENT_STORAGE;
+        }
+        limiter(is_system_event).acquire(time);
+        message.set_length(msglen + data_len);
+        return send_event_message(channel, message, flags, handler);
+    }
+    // Queued and batched events keep a copy of their data, so it's serialized separately
+    std::unique_ptr<char[]> data(new(std::nothrow) char[MAX_EVENT_DATA_LENGTH + 1]);
+    if (!data) {
+        handler.setError(SYSTEM_ERROR_NO_MEMORY);
+        return NO_MEMORY;
+    }
+    const int data_len = data_writer(data.get(), MAX_EVENT_DATA_LENGTH, data_writer_data);
+    if (data_len < 0) {
+        handler.setError(data_len);
+        return INSUFFICIENT_STORAGE;
+    }
+    data[data_len] = '\0';
+    if (send_now) {
+        limiter(is_system_event).acquire(time);
+        return send_event_now(channel, event_name, data.get(), ttl, event_type, flags, time, handler);
+    }
+    return defer_event(event_name, data.get(), ttl, event_type, flags, is_system_event, handler);
+}
+
+bool Publisher::is_send_allowed(bool is_system_event, system_tick_t time) {
+    // Events of the same class that are already queued go out first
+    for (const PendingEvent& event: backlog) {
+        if (event.is_system_event == is_system_event) {
+            return false;
+        }
+    }
+    return limiter(is_system_event).can_acquire(time);
+}
+
+bool Publisher::can_send_now(bool is_system_event, system_tick_t time) {
+    return is_send_allowed(is_system_event, time) && !is_rate_limited(is_system_event, time);
+}
+
+ProtocolError Publisher::defer_event(const char* event_name, const char* data, int ttl,
+        EventType::Enum event_type, int flags, bool is_system_event, CompletionHandler& handler) {
+    g_rateLimitedEventsCounter++;
+    const ProtocolError error = enqueue_event(event_name, data, ttl, event_type, flags, is_system_event, handler);
+    if (error != NO_ERROR) {
+        // Report the actual error rather than letting the handler go out of scope
+        handler.setError(toSystemError(error));
+    }
+    return error;
+}
+
+ProtocolError Publisher::process(MessageChannel& channel, system_tick_t time) {
+    ProtocolError error = NO_ERROR;
+    if (batch_size && (!is_batching() || time - batch_started >= batch_window)) {
+        error = flush_batch(channel);
+        if (error != NO_ERROR) {
+            return error;
+        }
+    }
+    bool limited[2] = { false, false };
+    int i = 0;
+    while (i < backlog.size()) {
+        PendingEvent& event = backlog[i];
+        bool& class_limited = limited[event.is_system_event ? SYSTEM_EVENT : APPLICATION_EVENT];
+        if (class_limited || !limiter(event.is_system_event).acquire(time)) {
+            // Keep the order of events within the same class
+            class_limited = true;
+            ++i;
+            continue;
+        }
+        error = send_event_now(channel, event.name(), event.data(), event.ttl,
+                event.event_type, event.flags, time, event.handler);
+        if (error != NO_ERROR) {
+            LOG(ERROR, "Unable to send queued event: %d", (int)error);
+            event.handler.setError(SYSTEM_ERROR_IO);
+            g_droppedEventsCounter++;
+            backlog.removeAt(i);
+            return error;
+        }
+        g_drainedEventsCounter++;
+        backlog.removeAt(i);
+    }
+    return NO_ERROR;
+}
+
+void Publisher::set_backlog_size(size_t size) {
+    backlog_capacity = size;
+    while (backlog.size() > (int)size) {
+        backlog.last().handler.setError(SYSTEM_ERROR_LIMIT_EXCEEDED);
+        backlog.removeAt(backlog.size() - 1);
+        g_droppedEventsCounter++;
+    }
+}
+
+void Publisher::clear_backlog(int error) {
+    for (PendingEvent& event: backlog) {
+        event.handler.setError(error);
+        g_droppedEventsCounter++;
+    }
+    backlog.clear();
+}
+
+void Publisher::reset(int error) {
+    clear_backlog(error);
+    for (BatchedHandler& h: batch_handlers) {
+        h.handler.setError(error);
+        g_droppedEventsCounter++;
+    }
+    batch_handlers.clear();
+    batch_size = 0;
+}
+
+ProtocolError Publisher::enqueue_event(const char* event_name, const char* data, int ttl,
+        EventType::Enum event_type, int flags, bool is_system_event, CompletionHandler& handler) {
+    if ((size_t)backlog.size() >= backlog_capacity || !backlog.reserve(backlog.size() + 1)) {
+        g_droppedEventsCounter++;
+        return BANDWIDTH_EXCEEDED;
+    }
+    const size_t name_len = strnlen(event_name, MAX_EVENT_NAME_LENGTH);
+    const size_t data_len = data ? strnlen(data, MAX_EVENT_DATA_LENGTH) : 0;
+    PendingEvent event;
+    event.name_data.reset(new(std::nothrow) char[name_len + data_len + 2]);
+    if (!event.name_data) {
+        g_droppedEventsCounter++;
+        return BANDWIDTH_EXCEEDED;
+    }
+    char* p = event.name_data.get();
+    memcpy(p, event_name, name_len);
+    p[name_len] = '\0';
+    p += name_len + 1;
+    if (data) {
+        memcpy(p, data, data_len);
+    }
+    p[data_len] = '\0';
+    event.has_data = (data != nullptr);
+    event.is_system_event = is_system_event;
+    event.event_type = event_type;
+    event.ttl = ttl;
+    event.flags = flags;
+    event.handler = std::move(handler);
+    backlog.append(std::move(event)); // Can't fail, the storage has been reserved above
+    g_queuedEventsCounter++;
+    return NO_ERROR;
+}
+
+ProtocolError Publisher::flush_batch(MessageChannel& channel) {
+    if (!batch_size) {
+        return NO_ERROR;
+    }
+    bool with_ack = false;
+    bool no_ack = true;
+    for (const BatchedHandler& h: batch_handlers) {
+        if (h.flags & EventType::WITH_ACK) {
+            with_ack = true;
+        }
+        if (!(h.flags & EventType::NO_ACK)) {
+            no_ack = false;
+        }
+    }
+    bool confirmable = channel.is_unreliable();
+    if (with_ack) {
+        confirmable = true;
+    } else if (no_ack) {
+        confirmable = false;
+    }
+    Message message;
+    channel.create(message);
+    size_t msglen = Messages::event_batch(message.buf(), 0, confirmable);
+    memcpy(message.buf() + msglen, batch_buffer.get(), batch_size);
+    msglen += batch_size;
+    message.set_length(msglen);
+    batch_size = 0;
+    const ProtocolError result = channel.send(message);
+    if (result != NO_ERROR) {
+        for (BatchedHandler& h: batch_handlers) {
+            h.handler.setError(SYSTEM_ERROR_IO);
+        }
+    } else if (with_ack && message.has_id()) {
+        // Handlers of events that requested an acknowledgement are completed when the batch is acknowledged
+        BatchAckHandler* ack = new(std::nothrow) BatchAckHandler();
+        if (ack && !ack->handlers.reserve(batch_handlers.size())) {
+            delete ack;
+            ack = nullptr;
+        }
+        for (BatchedHandler& h: batch_handlers) {
+            if (!(h.flags & EventType::WITH_ACK)) {
+                h.handler.setResult();
+            } else if (ack) {
+                ack->handlers.append(std::move(h.handler)); // Can't fail, the storage has been reserved above
+            } else {
+                // The acknowledgement can't be tracked, so the delivery can't be confirmed
+                h.handler.setError(SYSTEM_ERROR_NO_MEMORY);
+            }
+        }
+        if (ack) {
+            add_ack_handler(message.get_id(), CompletionHandler(BatchAckHandler::callback, ack));
+        }
+    } else {
+        for (BatchedHandler& h: batch_handlers) {
+            h.handler.setResult();
+        }
+    }
+    batch_handlers.clear();
+    if (!batch_window) {
+        batch_buffer.reset();
+    }
+    return result;
+}
+
+ProtocolError Publisher::add_to_batch(MessageChannel& channel, const char* event_name,
+        const char* data, int ttl, EventType::Enum event_type, int flags,
+        system_tick_t time, CompletionHandler& handler) {
+    const size_t record_size = Messages::event_batch_record_size(event_name, data);
+    if (batch_size && batch_size + record_size > batch_limit) {
+        const ProtocolError error = flush_batch(channel);
+        if (error != NO_ERROR) {
+            return error;
+        }
+    }
+    if (!batch_size) {
+        if (!batch_buffer) {
+            batch_buffer.reset(new(std::nothrow) uint8_t[PROTOCOL_BUFFER_SIZE]);
+        }
+        Message message;
+        channel.create(message);
+        batch_limit = std::min<size_t>(message.capacity(), PROTOCOL_BUFFER_SIZE);
+        batch_limit = (batch_limit > Messages::event_batch_header_size) ? batch_limit - Messages::event_batch_header_size : 0;
+        batch_started = time;
+    }
+    if (!batch_buffer || record_size > batch_limit || !batch_handlers.reserve(batch_handlers.size() + 1)) {
+        return INSUFFICIENT_STORAGE;
+    }
+    batch_size += Messages::event_batch_record(batch_buffer.get() + batch_size, event_name, data, ttl, event_type);
+    batch_handlers.append(BatchedHandler{ std::move(handler), flags });
+    return NO_ERROR;
+}
+
+ProtocolError Publisher::send_event_now(MessageChannel& channel, const char* event_name,
+        const char* data, int ttl, EventType::Enum event_type, int flags,
+        system_tick_t time, CompletionHandler& handler) {
+    if (is_batching() && add_to_batch(channel, event_name, data, ttl, event_type, flags, time, handler) == NO_ERROR) {
+        return NO_ERROR;
+    }
+    Message message;
+    channel.create(message);
+    size_t msglen = Messages::event(message.buf(), 0, event_name, data, ttl,
+            event_type, is_confirmable(channel, flags));
+    message.set_length(msglen);
+    return send_event_message(channel, message, flags, handler);
+}
+
+ProtocolError Publisher::send_event_message(MessageChannel& channel, Message& message, int flags,
+        CompletionHandler& handler) {
+    const ProtocolError result = channel.send(message);
+    if (result == NO_ERROR) {
+        // Register completion handler only if acknowledgement was requested explicitly
+        if ((flags & EventType::WITH_ACK) && message.has_id()) {
+            add_ack_handler(message.get_id(), std::move(handler));
+        } else {
+            handler.setResult();
+        }
+    }
+    return result;
+}
+
+bool Publisher::is_confirmable(MessageChannel& channel, int flags) {
+    if (flags & EventType::NO_ACK) {
+        return false;
+    }
+    if (flags & EventType::WITH_ACK) {
+        return true;
+    }
+    return channel.is_unreliable();
+}
+
+void Publisher::add_ack_handler(message_id_t msg_id, CompletionHandler handler) {
     protocol->add_ack_handler(msg_id, std::move(handler), SEND_EVENT_ACK_TIMEOUT);
 }
+
+}} // namespace particle::protocol
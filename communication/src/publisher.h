@@ -26,6 +26,9 @@
 
 #include "completion_handler.h"
 #include "communication_diagnostic.h"
+#include "spark_wiring_vector.h"
+
+#include <memory>
 
 namespace particle
 {
@@ -34,11 +37,120 @@ namespace protocol
 
 class Protocol;
 
+/**
+ * A token bucket. The bucket holds up to `burst` tokens and regains one token every
+ * `period` milliseconds. A period of 0 disables rate limiting.
+ */
+class RateLimiter
+{
+public:
+	RateLimiter(uint16_t burst, system_tick_t period) :
+			period(period),
+			last_refill(0),
+			burst(burst),
+			tokens(burst),
+			started(false)
+	{
+	}
+
+	void set_limits(uint16_t burst, system_tick_t period)
+	{
+		this->burst = burst;
+		this->period = period;
+		if (tokens > burst)
+			tokens = burst;
+	}
+
+	/**
+	 * Returns {@code true} if a token is available at the given time.
+	 */
+	bool can_acquire(system_tick_t millis)
+	{
+		refill(millis);
+		return !period || tokens > 0;
+	}
+
+	/**
+	 * Takes a token from the bucket. Returns {@code false} if the bucket is empty.
+	 */
+	bool acquire(system_tick_t millis)
+	{
+		if (!can_acquire(millis))
+			return false;
+		if (period)
+			tokens--;
+		return true;
+	}
+
+private:
+	system_tick_t period;
+	system_tick_t last_refill;
+	uint16_t burst;
+	uint16_t tokens;
+	bool started;
+
+	void refill(system_tick_t millis)
+	{
+		if (!started)
+		{
+			started = true;
+			last_refill = millis;
+			tokens = burst;
+			return;
+		}
+		if (!period)
+			return;
+		const system_tick_t elapsed = millis - last_refill;	// handles millis() overflow
+		if (tokens >= burst)
+		{
+			last_refill = millis;
+			return;
+		}
+		const system_tick_t count = elapsed / period;
+		if (count)
+		{
+			tokens = (count >= system_tick_t(burst - tokens)) ? burst : tokens + count;
+			last_refill += count * period;
+		}
+	}
+};
+
 class Publisher
 {
 public:
+	enum EventClass
+	{
+		APPLICATION_EVENT = 0,
+		SYSTEM_EVENT = 1
+	};
+
+	/**
+	 * Default budget for application events: bursts of up to 4 events, 4 events per second sustained.
+	 */
+	static const uint16_t DEFAULT_APPLICATION_BURST = 4;
+	static const system_tick_t DEFAULT_APPLICATION_PERIOD = 250;
+
+	/**
+	 * Default budget for system events: 255 events in about a minute.
+	 */
+	static const uint16_t DEFAULT_SYSTEM_BURST = 255;
+	static const system_tick_t DEFAULT_SYSTEM_PERIOD = 65536 / 255;
+
+	/**
+	 * Default maximum number of rate limited events that are held in RAM until they can be sent.
+	 */
+	static const size_t DEFAULT_BACKLOG_SIZE = 8;
+
 	explicit Publisher(Protocol* protocol) :
-			protocol(protocol)
+			protocol(protocol),
+			application_limiter(DEFAULT_APPLICATION_BURST, DEFAULT_APPLICATION_PERIOD),
+			system_limiter(DEFAULT_SYSTEM_BURST, DEFAULT_SYSTEM_PERIOD),
+			backlog_capacity(DEFAULT_BACKLOG_SIZE),
+			batch_size(0),
+			batch_limit(0),
+			batch_started(0),
+			batch_window(0),
+			batching_supported(false)
 	{
 	}
 
@@ -47,82 +159,179 @@ public:
 		return !strncmp(event_name, "spark", 5) || !strncmp(event_name, "particle", 8);
 	}
 
+	/**
+	 * Takes a token from the budget of the given event class. Returns {@code true} if the budget
+	 * is exhausted.
+	 */
 	bool is_rate_limited(bool is_system_event, system_tick_t millis)
 	{
-		if (is_system_event)
-		{
-			static uint16_t lastMinute = 0;
-			static uint8_t eventsThisMinute = 0;
-
-			uint16_t currentMinute = uint16_t(millis >> 16);
-			if (currentMinute == lastMinute)
-			{      // == handles millis() overflow
-				if (eventsThisMinute == 255)
-					return true;
-			}
-			else
-			{
-				lastMinute = currentMinute;
-				eventsThisMinute = 0;
-			}
-			eventsThisMinute++;
-		}
-		else
-		{
-			static system_tick_t recent_event_ticks[5] =
-			{ (system_tick_t) -1000, (system_tick_t) -1000,
-					(system_tick_t) -1000, (system_tick_t) -1000,
-					(system_tick_t) -1000 };
-			static int evt_tick_idx = 0;
-
-			system_tick_t now = recent_event_ticks[evt_tick_idx] = millis;
-			evt_tick_idx++;
-			evt_tick_idx %= 5;
-			if (now - recent_event_ticks[evt_tick_idx] < 1000)
-			{
-				// exceeded allowable burst of 4 events per second
-				return true;
-			}
-		}
-		return false;
+		return !limiter(is_system_event).acquire(millis);
 	}
 
-	ProtocolError send_event(MessageChannel& channel, const char* event_name,
-			const char* data, int ttl, EventType::Enum event_type, int flags,
-			system_tick_t time, CompletionHandler handler)
+	/**
+	 * Sets the budget of the given event class.
+	 *
+	 * @param burst The maximum number of events that can be sent back to back.
+	 * @param period The number of milliseconds it takes to regain the budget for one event,
+	 *        or 0 to disable rate limiting.
+	 */
+	void set_rate_limit(EventClass event_class, uint16_t burst, system_tick_t period)
 	{
-		bool is_system_event = is_system(event_name);
-		bool rate_limited = is_rate_limited(is_system_event, time);
-		if (rate_limited) {
-			g_rateLimitedEventsCounter++;
-			return BANDWIDTH_EXCEEDED;
-		}
+		limiter(event_class == SYSTEM_EVENT).set_limits(burst, period);
+	}
 
-		Message message;
-		channel.create(message);
-		bool confirmable = channel.is_unreliable();
-		if (flags & EventType::NO_ACK) {
-			confirmable = false;
-		} else if (flags & EventType::WITH_ACK) {
-			confirmable = true;
-		}
-		size_t msglen = Messages::event(message.buf(), 0, event_name, data, ttl,
-				event_type, confirmable);
-		message.set_length(msglen);
-		const ProtocolError result = channel.send(message);
-		if (result == NO_ERROR) {
-			// Register completion handler only if acknowledgement was requested explicitly
-			if ((flags & EventType::WITH_ACK) && message.has_id()) {
-			    add_ack_handler(message.get_id(), std::move(handler));
-			} else {
-			    handler.setResult();
-			}
-		}
-		return result;
+	/**
+	 * Sets the maximum number of rate limited events that are queued. Setting the size to 0
+	 * restores the original behavior of failing rate limited events immediately.
+	 */
+	void set_backlog_size(size_t size);
+
+	size_t backlog_size() const
+	{
+		return backlog.size();
+	}
+
+	bool has_pending_events() const
+	{
+		return !backlog.isEmpty() || batch_size;
+	}
+
+	/**
+	 * Enables packing of events published within `window` milliseconds into a single message.
+	 * A window of 0 disables batching. Batching is only used if the server supports it.
+	 */
+	void set_batching_window(system_tick_t window)
+	{
+		batch_window = window;
+	}
+
+	system_tick_t batching_window() const
+	{
+		return batch_window;
+	}
+
+	/**
+	 * Sets whether the server accepts batches of events. This is negotiated in the hello exchange.
+	 */
+	void set_batching_supported(bool supported)
+	{
+		batching_supported = supported;
+	}
+
+	bool is_batching() const
+	{
+		return batch_window && batching_supported;
 	}
 
+	/**
+	 * Sends the events accumulated in the current batch, if any.
+	 */
+	ProtocolError flush_batch(MessageChannel& channel);
+
+	/**
+	 * Sends an event, or queues it if the event budget is exhausted. Queued events are sent
+	 * by {@link #process()} once the budget allows.
+	 */
+	ProtocolError send_event(MessageChannel& channel, const char* event_name,
+			const char* data, int ttl, EventType::Enum event_type, int flags,
+			system_tick_t time, CompletionHandler handler);
+
+	/**
+	 * Sends an event whose data is written by `data_writer`. If the event can be sent right away,
+	 * the data is written directly into the message buffer, otherwise it's written into a
+	 * temporary buffer and the event is queued or batched as usual.
+	 */
+	ProtocolError send_event(MessageChannel& channel, const char* event_name,
+			EventDataWriter data_writer, void* data_writer_data, int ttl, EventType::Enum event_type,
+			int flags, system_tick_t time, CompletionHandler handler);
+
+	/**
+	 * Sends queued events for as long as the event budget allows.
+	 */
+	ProtocolError process(MessageChannel& channel, system_tick_t time);
+
+	/**
+	 * Discards all queued events. Their completion handlers are invoked with the given error.
+	 */
+	void clear_backlog(int error);
+
+	/**
+	 * Discards all queued and batched events that haven't been sent yet. This is called when
+	 * the session ends, so that no events are sent into a new session. The completion handlers
+	 * of the discarded events are invoked with the given error.
+	 */
+	void reset(int error);
+
 private:
+	struct PendingEvent
+	{
+		std::unique_ptr<char[]> name_data;	// Event name and data as consecutive NUL-terminated strings
+		bool has_data;
+		bool is_system_event;
+		EventType::Enum event_type;
+		int ttl;
+		int flags;
+		CompletionHandler handler;
+
+		const char* name() const { return name_data.get(); }
+		const char* data() const { return has_data ? name_data.get() + strlen(name_data.get()) + 1 : nullptr; }
+	};
+
+	struct BatchedHandler
+	{
+		CompletionHandler handler;
+		int flags;
+	};
+
 	Protocol* protocol;
+	RateLimiter application_limiter;
+	RateLimiter system_limiter;
+	spark::Vector<PendingEvent> backlog;
+	size_t backlog_capacity;
+
+	std::unique_ptr<uint8_t[]> batch_buffer;	// Event records of the current batch
+	spark::Vector<BatchedHandler> batch_handlers;
+	size_t batch_size;
+	size_t batch_limit;
+	system_tick_t batch_started;
+	system_tick_t batch_window;
+	bool batching_supported;
+
+	RateLimiter& limiter(bool is_system_event)
+	{
+		return is_system_event ? system_limiter : application_limiter;
+	}
+
+	/**
+	 * Returns {@code true} if no events of the same class are queued and the budget allows
+	 * sending an event. No token is taken from the budget.
+	 */
+	bool is_send_allowed(bool is_system_event, system_tick_t time);
+
+	/**
+	 * Returns {@code true} if no events of the same class are queued and a token has been taken
+	 * from the budget.
+	 */
+	bool can_send_now(bool is_system_event, system_tick_t time);
+
+	ProtocolError defer_event(const char* event_name, const char* data, int ttl,
+			EventType::Enum event_type, int flags, bool is_system_event, CompletionHandler& handler);
+
+	ProtocolError enqueue_event(const char* event_name, const char* data, int ttl,
+			EventType::Enum event_type, int flags, bool is_system_event, CompletionHandler& handler);
+
+	ProtocolError send_event_now(MessageChannel& channel, const char* event_name,
+			const char* data, int ttl, EventType::Enum event_type, int flags,
+			system_tick_t time, CompletionHandler& handler);
+
+	ProtocolError add_to_batch(MessageChannel& channel, const char* event_name,
+			const char* data, int ttl, EventType::Enum event_type, int flags,
+			system_tick_t time, CompletionHandler& handler);
+
+	ProtocolError send_event_message(MessageChannel& channel, Message& message, int flags,
+			CompletionHandler& handler);
+
+	bool is_confirmable(MessageChannel& channel, int flags);
 
 	void add_ack_handler(message_id_t msg_id, CompletionHandler handler);
 };
@@ -23,6 +23,7 @@
 #include "handshake.h"
 #include "debug.h"
 #include <stdlib.h>
+#include <cstddef>
 
 using particle::CompletionHandler;
 
@@ -123,19 +124,32 @@ int spark_protocol_presence_announcement(ProtocolFacade* protocol, uint8_t *buf,
 
 int spark_protocol_post_description(ProtocolFacade* protocol, int desc_flags, void* reserved) {
     ASSERT_ON_SYSTEM_THREAD();
-    (void)reserved;
-    return protocol->post_description(desc_flags);
+    CompletionHandler handler;
+    if (reserved) {
+        auto r = static_cast<const completion_handler_data*>(reserved);
+        handler = CompletionHandler(r->handler_callback, r->handler_data);
+    }
+    return protocol->post_description(desc_flags, std::move(handler));
 }
 
 bool spark_protocol_send_event(ProtocolFacade* protocol, const char *event_name, const char *data,
                 int ttl, uint32_t flags, void* reserved) {
     ASSERT_ON_SYSTEM_THREAD();
 	CompletionHandler handler;
+	EventDataWriter data_writer = nullptr;
+	void* data_writer_data = nullptr;
 	if (reserved) {
 		auto r = static_cast<const spark_protocol_send_event_data*>(reserved);
 		handler = CompletionHandler(r->handler_callback, r->handler_data);
+		if (r->size >= sizeof(spark_protocol_send_event_data)) {
+			data_writer = r->data_writer;
+			data_writer_data = r->data_writer_data;
+		}
 	}
 	EventType::Enum event_type = EventType::extract_event_type(flags);
+	if (data_writer) {
+		return protocol->send_event(event_name, data_writer, data_writer_data, ttl, event_type, flags, std::move(handler));
+	}
 	return protocol->send_event(event_name, data, ttl, event_type, flags, std::move(handler));
 }
 
@@ -199,6 +213,16 @@ int spark_protocol_set_connection_property(ProtocolFacade* protocol, unsigned pr
     } else if (property_id == particle::protocol::Connection::FAST_OTA)
     {
         protocol->set_fast_ota(data);
+    } else if (property_id == particle::protocol::Connection::PUBLISH_RATE_LIMIT)
+    {
+        const bool has_burst = conn_prop && conn_prop->size >= offsetof(particle::protocol::connection_properties_t, publish_burst) + sizeof(conn_prop->publish_burst);
+        protocol->set_publish_rate_limit(has_burst ? conn_prop->publish_burst : particle::protocol::Publisher::DEFAULT_APPLICATION_BURST, data);
+    } else if (property_id == particle::protocol::Connection::PUBLISH_BACKLOG)
+    {
+        protocol->set_publish_backlog_size(data);
+    } else if (property_id == particle::protocol::Connection::PUBLISH_BATCHING)
+    {
+        protocol->set_publish_batching_window(data);
     }
     return 0;
 }
@@ -237,3 +261,10 @@ int spark_protocol_get_status(ProtocolFacade* protocol, protocol_status* status,
     return protocol->get_status(status);
 }
 
+int spark_protocol_describe_changed(ProtocolFacade* protocol, int desc_flags, void* reserved)
+{
+    (void)reserved;
+    protocol->describe_changed(desc_flags);
+    return 0;
+}
+
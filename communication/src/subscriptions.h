@@ -19,6 +19,10 @@
 
 #pragma once
 
+#include "spark_wiring_vector.h"
+#include <algorithm>
+#include <new>
+
 namespace particle
 {
 namespace protocol
@@ -35,8 +39,213 @@ public:
 	typedef uint32_t (*calculate_crc_fn)(const unsigned char *buf, uint32_t buflen);
 
 private:
+	/**
+	 * The first MAX_SUBSCRIPTIONS handlers are stored inline.
+	 */
 	FilteringEventHandler event_handlers[MAX_SUBSCRIPTIONS];
 
+	/**
+	 * Handlers beyond MAX_SUBSCRIPTIONS are allocated individually. They are reused after
+	 * removal but never freed, since the handler address is passed to the application
+	 * thread when an event is dispatched.
+	 */
+	spark::Vector<FilteringEventHandler*> extra_handlers;
+
+	/**
+	 * The number of registered handlers. Registered handlers are stored contiguously from index 0
+	 * in the order they were added, so the index of a handler is its registration order.
+	 */
+	uint16_t handler_count;
+
+	static const uint16_t NONE = 0xFFFF;
+
+	/**
+	 * A node in the radix tree of subscription filters. The node label is a substring of
+	 * the filter of one of the handlers.
+	 */
+	struct FilterNode
+	{
+		uint16_t label_handler;
+		uint8_t label_start;
+		uint8_t label_length;
+		uint16_t child;
+		uint16_t sibling;
+		/**
+		 * The first handler whose filter ends at this node.
+		 */
+		uint16_t handler;
+	};
+
+	/**
+	 * The radix tree of filters, with the root (the empty filter) at index 0.
+	 * It is rebuilt lazily when the handlers change, so that handlers may subscribe or
+	 * unsubscribe while an event is being dispatched.
+	 */
+	spark::Vector<FilterNode> filter_nodes;
+
+	/**
+	 * For each handler, the next handler with the same filter.
+	 */
+	spark::Vector<uint16_t> next_handler;
+
+	/**
+	 * The handlers matching the event being dispatched, sorted by their registration order.
+	 */
+	spark::Vector<uint16_t> matched_handlers;
+
+	bool filters_valid;
+
+	FilteringEventHandler& handler_at(unsigned index)
+	{
+		return index < MAX_SUBSCRIPTIONS ? event_handlers[index] : *extra_handlers[index - MAX_SUBSCRIPTIONS];
+	}
+
+	unsigned handler_capacity() const
+	{
+		return MAX_SUBSCRIPTIONS + extra_handlers.size();
+	}
+
+	static size_t filter_length(const FilteringEventHandler& handler)
+	{
+		return strnlen(handler.filter, sizeof(handler.filter));
+	}
+
+	const char* node_label(const FilterNode& node)
+	{
+		return handler_at(node.label_handler).filter + node.label_start;
+	}
+
+	/**
+	 * Finds the child of the given node whose label starts with the given character.
+	 */
+	uint16_t find_child(uint16_t node, char c)
+	{
+		uint16_t child = filter_nodes[node].child;
+		while (child != NONE && node_label(filter_nodes[child])[0] != c)
+		{
+			child = filter_nodes[child].sibling;
+		}
+		return child;
+	}
+
+	bool add_filter_node(uint16_t handler, uint8_t start, uint8_t length, uint16_t child, uint16_t sibling)
+	{
+		FilterNode node = { handler, start, length, child, sibling, NONE };
+		return filter_nodes.append(node);
+	}
+
+	/**
+	 * Adds the filter of the given handler to the radix tree.
+	 */
+	bool insert_filter(uint16_t index)
+	{
+		const char* filter = handler_at(index).filter;
+		const size_t length = filter_length(handler_at(index));
+		uint16_t node = 0;
+		size_t pos = 0;
+		while (pos < length)
+		{
+			const uint16_t child = find_child(node, filter[pos]);
+			if (child == NONE)
+			{
+				// new leaf holding the rest of the filter
+				if (!add_filter_node(index, pos, length - pos, NONE, filter_nodes[node].child))
+					return false;
+				filter_nodes[node].child = filter_nodes.size() - 1;
+				node = filter_nodes.size() - 1;
+				break;
+			}
+			const char* label = node_label(filter_nodes[child]);
+			const size_t label_length = filter_nodes[child].label_length;
+			size_t common = 1;
+			while (common < label_length && pos + common < length && label[common] == filter[pos + common])
+			{
+				common++;
+			}
+			if (common < label_length)
+			{
+				// split the child so that the common part of the label is a node of its own
+				FilterNode& c = filter_nodes[child];
+				if (!add_filter_node(c.label_handler, c.label_start, common, child, c.sibling))
+					return false;
+				const uint16_t split = filter_nodes.size() - 1;
+				FilterNode& split_child = filter_nodes[child];
+				split_child.label_start += common;
+				split_child.label_length -= common;
+				split_child.sibling = NONE;
+				uint16_t* link = &filter_nodes[node].child;
+				while (*link != child)
+				{
+					link = &filter_nodes[*link].sibling;
+				}
+				*link = split;
+				node = split;
+			}
+			else
+			{
+				node = child;
+			}
+			pos += common;
+		}
+		// append the handler so that handlers with the same filter are called in the order they were added
+		uint16_t* link = &filter_nodes[node].handler;
+		while (*link != NONE)
+		{
+			link = &next_handler[*link];
+		}
+		*link = index;
+		return true;
+	}
+
+	/**
+	 * Rebuilds the radix tree of filters if the handlers have changed.
+	 * Returns false if there is insufficient memory.
+	 */
+	bool update_filters()
+	{
+		if (filters_valid)
+			return true;
+		filter_nodes.clear();
+		bool success = filter_nodes.reserve(handler_count * 2 + 1) && next_handler.resize(handler_count)
+				&& matched_handlers.reserve(handler_count) && add_filter_node(0, 0, 0, NONE, NONE);
+		for (unsigned i = 0; success && i < handler_count; i++)
+		{
+			next_handler[i] = NONE;
+			success = insert_filter(i);
+		}
+		filters_valid = success;
+		return success;
+	}
+
+	void invalidate_filters()
+	{
+		filters_valid = false;
+	}
+
+	void call_handler(FilteringEventHandler& handler, const char* event_name, const char* data,
+			void (*call_event_handler)(uint16_t size,
+					FilteringEventHandler* handler, const char* event,
+					const char* data, void* reserved))
+	{
+		// don't call the handler directly, use a callback for it.
+		if (!call_event_handler)
+		{
+			if (handler.handler_data)
+			{
+				EventHandlerWithData fn = (EventHandlerWithData) handler.handler;
+				fn(handler.handler_data, (char *) event_name, (char *) data);
+			}
+			else
+			{
+				handler.handler((char *) event_name, (char *) data);
+			}
+		}
+		else
+		{
+			call_event_handler(sizeof(FilteringEventHandler), &handler, event_name, data, NULL);
+		}
+	}
+
 protected:
 
 	ProtocolError send_subscription(MessageChannel& channel, const char* filter, const char* device_id, SubscriptionScope::Enum scope)
@@ -60,11 +269,19 @@ protected:
 
 public:
 
-	Subscriptions()
+	Subscriptions() : handler_count(0), filters_valid(false)
 	{
 		memset(&event_handlers, 0, sizeof(event_handlers));
 	}
 
+	~Subscriptions()
+	{
+		for (FilteringEventHandler* handler : extra_handlers)
+		{
+			delete handler;
+		}
+	}
+
 	uint32_t compute_subscriptions_checksum(calculate_crc_fn calculate_crc)
 	{
 		uint32_t checksum = 0;
@@ -150,103 +367,85 @@ public:
 		// null terminate event name string
 		event_name[event_name_length] = 0;
 
-		const int NUM_HANDLERS = sizeof(event_handlers)
-				/ sizeof(FilteringEventHandler);
-		for (int i = 0; i < NUM_HANDLERS; i++)
+		if (update_filters())
 		{
-			if (NULL == event_handlers[i].handler)
+			// walk the radix tree along the event name, collecting the handlers of each filter passed.
+			// The cost depends on the length of the event name rather than the number of handlers.
+			matched_handlers.clear();
+			uint16_t node = 0;
+			size_t pos = 0;
+			for (;;)
 			{
-				break;
+				for (uint16_t h = filter_nodes[node].handler; h != NONE; h = next_handler[h])
+				{
+					matched_handlers.append(h);
+				}
+				if (pos >= event_name_length)
+					break;
+				node = find_child(node, event_name[pos]);
+				if (node == NONE)
+					break;
+				const FilterNode& n = filter_nodes[node];
+				if (event_name_length - pos < n.label_length || memcmp(node_label(n), event_name + pos, n.label_length))
+					break;
+				pos += n.label_length;
 			}
-			const size_t MAX_FILTER_LENGTH = sizeof(event_handlers[i].filter);
-			const size_t filter_length = strnlen(event_handlers[i].filter,
-					MAX_FILTER_LENGTH);
-
-			if (event_name_length < filter_length)
+			// the tree yields the handlers by filter length, but they are called in the order they were added
+			std::sort(matched_handlers.begin(), matched_handlers.end());
+			for (uint16_t h : matched_handlers)
 			{
-				// does not match this filter, try the next event handler
-				continue;
+				// stop if a handler subscribed or unsubscribed, since the handler indices may have changed
+				if (!filters_valid)
+					break;
+				if (handler_at(h).handler)
+					call_handler(handler_at(h), (const char*) event_name, (const char*) data, call_event_handler);
 			}
+			return NO_ERROR;
+		}
 
-			const int cmp = memcmp(event_handlers[i].filter, event_name,
-					filter_length);
-			if (0 == cmp)
-			{
-				// don't call the handler directly, use a callback for it.
-				if (!call_event_handler)
-				{
-					if (event_handlers[i].handler_data)
-					{
-						EventHandlerWithData handler =
-								(EventHandlerWithData) event_handlers[i].handler;
-						handler(event_handlers[i].handler_data,
-								(char *) event_name, (char *) data);
-					}
-					else
-					{
-						event_handlers[i].handler((char *) event_name,
-								(char *) data);
-					}
-				}
-				else
-				{
-					call_event_handler(sizeof(FilteringEventHandler),
-							&event_handlers[i], (const char*) event_name,
-							(const char*) data, NULL);
-				}
-			}
-			// else continue the for loop to try the next handler
+		// insufficient memory for the filter tree, so check each handler in turn
+		for (unsigned i = 0; i < handler_count; i++)
+		{
+			const size_t length = filter_length(handler_at(i));
+			if (event_name_length >= length && !memcmp(handler_at(i).filter, event_name, length))
+				call_handler(handler_at(i), (const char*) event_name, (const char*) data, call_event_handler);
 		}
 		return NO_ERROR;
 	}
 
 	template<typename F> ProtocolError for_each(F callback)
 	{
-		const int NUM_HANDLERS = sizeof(event_handlers)
-				/ sizeof(FilteringEventHandler);
 		ProtocolError error = NO_ERROR;
-		for (unsigned i = 0; i < NUM_HANDLERS; i++)
+		for (unsigned i = 0; i < handler_count; i++)
 		{
-			if (nullptr != event_handlers[i].handler)
-			{
-				error = callback(event_handlers[i]);
-				if (error)
-					break;
-			}
+			error = callback(handler_at(i));
+			if (error)
+				break;
 		}
 		return error;
 	}
 
 	void remove_event_handlers(const char* event_name)
 	{
-		if (NULL == event_name)
-		{
-			memset(event_handlers, 0, sizeof(event_handlers));
-		}
-		else
+		unsigned dest = 0;
+		for (unsigned i = 0; i < handler_count; i++)
 		{
-			const int NUM_HANDLERS = sizeof(event_handlers)
-					/ sizeof(FilteringEventHandler);
-			int dest = 0;
-			for (int i = 0; i < NUM_HANDLERS; i++)
+			if (!event_name || !strcmp(event_name, handler_at(i).filter))
 			{
-				if (!strcmp(event_name, event_handlers[i].filter))
-				{
-					memset(&event_handlers[i], 0, sizeof(event_handlers[i]));
-				}
-				else
+				memset(&handler_at(i), 0, sizeof(FilteringEventHandler));
+			}
+			else
+			{
+				if (dest != i)
 				{
-					if (dest != i)
-					{
-						memcpy(event_handlers + dest, event_handlers + i,
-								sizeof(event_handlers[i]));
-						memset(event_handlers + i, 0,
-								sizeof(event_handlers[i]));
-					}
-					dest++;
+					memcpy(&handler_at(dest), &handler_at(i), sizeof(FilteringEventHandler));
+					memset(&handler_at(i), 0, sizeof(FilteringEventHandler));
 				}
+				dest++;
 			}
 		}
+		handler_count = dest;
+		invalidate_filters();
 	}
 
 	/**
@@ -255,25 +454,24 @@ public:
 	bool event_handler_exists(const char *event_name, EventHandler handler,
 			void *handler_data, SubscriptionScope::Enum scope, const char* id)
 	{
-		const int NUM_HANDLERS = sizeof(event_handlers)
-				/ sizeof(FilteringEventHandler);
-		for (int i = 0; i < NUM_HANDLERS; i++)
+		for (unsigned i = 0; i < handler_count; i++)
 		{
-			if (event_handlers[i].handler == handler
-					&& event_handlers[i].handler_data == handler_data
-					&& event_handlers[i].scope == scope)
+			const FilteringEventHandler& h = handler_at(i);
+			if (h.handler == handler
+					&& h.handler_data == handler_data
+					&& h.scope == scope)
 			{
-				const size_t MAX_FILTER_LEN = sizeof(event_handlers[i].filter);
+				const size_t MAX_FILTER_LEN = sizeof(h.filter);
 				const size_t FILTER_LEN = strnlen(event_name, MAX_FILTER_LEN);
-				if (!strncmp(event_handlers[i].filter, event_name, FILTER_LEN))
+				if (!strncmp(h.filter, event_name, FILTER_LEN))
 				{
 					const size_t MAX_ID_LEN =
-							sizeof(event_handlers[i].device_id) - 1;
+							sizeof(h.device_id) - 1;
 					const size_t id_len = id ? strnlen(id, MAX_ID_LEN) : 0;
 					if (id_len)
-						return !strncmp(event_handlers[i].device_id, id, id_len);
+						return !strncmp(h.device_id, id, id_len);
 					else
-						return !event_handlers[i].device_id[0];
+						return !h.device_id[0];
 				}
 			}
 		}
@@ -289,27 +487,31 @@ public:
 		if (event_handler_exists(event_name, handler, handler_data, scope, id))
 			return NO_ERROR;
 
-		const int NUM_HANDLERS = sizeof(event_handlers) / sizeof(FilteringEventHandler);
-		for (int i = 0; i < NUM_HANDLERS; i++)
+		if (handler_count == handler_capacity())
 		{
-			if (NULL == event_handlers[i].handler)
-			{
-				const size_t MAX_FILTER_LEN = sizeof(event_handlers[i].filter);
-				const size_t FILTER_LEN = strnlen(event_name, MAX_FILTER_LEN);
-				memcpy(event_handlers[i].filter, event_name, FILTER_LEN);
-				memset(event_handlers[i].filter + FILTER_LEN, 0, MAX_FILTER_LEN - FILTER_LEN);
-				event_handlers[i].handler = handler;
-				event_handlers[i].handler_data = handler_data;
-				event_handlers[i].device_id[0] = 0;
-				const size_t MAX_ID_LEN = sizeof(event_handlers[i].device_id) - 1;
-				const size_t id_len = id ? strnlen(id, MAX_ID_LEN) : 0;
-				memcpy(event_handlers[i].device_id, id, id_len);
-				event_handlers[i].device_id[id_len] = 0;
-				event_handlers[i].scope = scope;
-				return NO_ERROR;
-			}
+			if (handler_count == NONE || !extra_handlers.reserve(extra_handlers.size() + 1))
+				return INSUFFICIENT_STORAGE;
+			FilteringEventHandler* h = new(std::nothrow) FilteringEventHandler();
+			if (!h)
+				return INSUFFICIENT_STORAGE;
+			extra_handlers.append(h);
 		}
-		return INSUFFICIENT_STORAGE;
+		FilteringEventHandler& h = handler_at(handler_count);
+		const size_t MAX_FILTER_LEN = sizeof(h.filter);
+		const size_t FILTER_LEN = strnlen(event_name, MAX_FILTER_LEN);
+		memcpy(h.filter, event_name, FILTER_LEN);
+		memset(h.filter + FILTER_LEN, 0, MAX_FILTER_LEN - FILTER_LEN);
+		h.handler = handler;
+		h.handler_data = handler_data;
+		h.device_id[0] = 0;
+		const size_t MAX_ID_LEN = sizeof(h.device_id) - 1;
+		const size_t id_len = id ? strnlen(id, MAX_ID_LEN) : 0;
+		memcpy(h.device_id, id, id_len);
+		h.device_id[id_len] = 0;
+		h.scope = scope;
+		handler_count++;
+		invalidate_filters();
+		return NO_ERROR;
 	}
 
 	inline ProtocolError send_subscriptions(MessageChannel& channel)
@@ -53,6 +53,11 @@ size_t HAL_EEPROM_Length();
 void HAL_EEPROM_Clear();
 bool HAL_EEPROM_Has_Pending_Erase();
 void HAL_EEPROM_Perform_Pending_Erase();
+/**
+ * Performs one step of a background page swap or erase, if the platform supports it.
+ * Called periodically by the system. Returns true if more steps are pending.
+ */
+bool HAL_EEPROM_Compact_Step(void* reserved);
 
 #ifdef __cplusplus
 }
@@ -83,6 +83,7 @@ DYNALIB_FN(BASE_IDX + 20, hal, HAL_RTC_Time_Is_Valid, uint8_t(void*))
 
 DYNALIB_FN(BASE_IDX + 21, hal, hal_timer_millis, uint64_t(void*))
 DYNALIB_FN(BASE_IDX + 22, hal, hal_timer_micros, uint64_t(void*))
+DYNALIB_FN(BASE_IDX + 23, hal, HAL_EEPROM_Compact_Step, bool(void*))
 
 DYNALIB_END(hal)
 
@@ -688,6 +688,7 @@ bool MDMParser::_powerOn(void)
         // modem still keeps the CTS pin in a correct state even if doesn't support the CTS/RTS
         // flow control
         electronMDM.begin(115200, true /* hwFlowControl */);
+        _lineParser.reset();
         _init = true;
     }
 
@@ -745,6 +746,7 @@ bool MDMParser::_powerOn(void)
         if (_dev.dev == DEV_SARA_R410) {
             // SARA-R410 doesn't support hardware flow control, reinitialize the UART
             electronMDM.begin(115200, false /* hwFlowControl */);
+            _lineParser.reset();
             // Power saving modes defined by the +UPSV command are not supported
             _dev.lpm = LPM_DISABLED;
         }
@@ -1140,6 +1142,7 @@ bool MDMParser::powerOff(void)
 
     // Close serial connection
     electronMDM.end();
+    _lineParser.reset();
     _init = false;
     MDM_INFO("[ ElectronSerialPipe::end ] pipeTx=%d pipeRx=%d", electronMDM.txSize(), electronMDM.rxSize());
 
@@ -2748,7 +2751,15 @@ int MDMParser::_cbUSORD(int type, const char* buf, int len, USORDparam* param)
 #ifndef SOCKET_HEX_MODE
     if ((type == TYPE_PLUS) && param) {
         int sz, sk;
-        if ((sscanf(buf, "\r\n+USORD: %d,%d,", &sk, &sz) == 2) &&
+        if (param->received >= 0) {
+            // The line parser has copied the data to param->buf already
+            if ((sscanf(buf, "\r\n+USORD: %d,%d,", &sk, &sz) == 2) && (sz == param->received)) {
+                param->len = sz;
+            } else {
+                param->len = 0;
+            }
+            param->received = -1;
+        } else if ((sscanf(buf, "\r\n+USORD: %d,%d,", &sk, &sz) == 2) &&
             (buf[len-sz-2] == '\"') && (buf[len-1] == '\"')) {
             memcpy(param->buf, &buf[len-1-sz], sz);
             param->len = sz;
@@ -2813,7 +2824,13 @@ int MDMParser::socketRecv(int socket, char* buf, int len)
                             sendFormated("AT+USORD=%d,%d\r\n",_sockets[socket].handle, blk);
                             USORDparam param;
                             param.buf = buf;
-                            if (RESP_OK == waitFinalResp(_cbUSORD, &param)) {
+                            param.received = -1;
+#ifndef SOCKET_HEX_MODE
+                            _lineParser.setPayloadBuffer(buf, blk, &param.received);
+#endif
+                            const int resp = waitFinalResp(_cbUSORD, &param);
+                            _lineParser.setPayloadBuffer(NULL, 0, NULL);
+                            if (RESP_OK == resp) {
                                 blk = param.len;
                                 _sockets[socket].pending -= blk;
                                 len -= blk;
@@ -2859,6 +2876,22 @@ int MDMParser::_cbUSORF(int type, const char* buf, int len, USORFparam* param)
     if ((type == TYPE_PLUS) && param) {
         int sz, sk, p, a,b,c,d;
         int r;
+        if (param->received >= 0) {
+            // The line parser has copied the data to param->buf already
+            r = sscanf(buf, "\r\n\r\n+USORF: %d,\"" IPSTR "\",%d,%d,", &sk,&a,&b,&c,&d,&p,&sz);
+            if (r != 7) {
+                r = sscanf(buf, "\r\n+USORF: %d,\"" IPSTR "\",%d,%d,", &sk,&a,&b,&c,&d,&p,&sz);
+            }
+            if ((r == 7) && (sz == param->received)) {
+                param->ip = IPADR(a,b,c,d);
+                param->port = p;
+                param->len = sz;
+            } else {
+                param->len = 0;
+            }
+            param->received = -1;
+            return WAIT;
+        }
         r = sscanf(buf, "\r\n\r\n+USORF: %d,\"" IPSTR "\",%d,%d,", &sk,&a,&b,&c,&d,&p,&sz);
         if ((r == 7) && (buf[len-sz-2-2] == '\"') && (buf[len-1-2] == '\"')) {
             memcpy(param->buf, &buf[len-1-sz-2], sz);
@@ -2920,7 +2953,13 @@ int MDMParser::socketRecvFrom(int socket, MDM_IP* ip, int* port, char* buf, int
                     sendFormated("AT+USORF=%d,%d\r\n",_sockets[socket].handle, blk);
                     USORFparam param;
                     param.buf = buf;
-                    if (RESP_OK == waitFinalResp(_cbUSORF, &param)) {
+                    param.received = -1;
+#ifndef SOCKET_HEX_MODE
+                    _lineParser.setPayloadBuffer(buf, blk, &param.received);
+#endif
+                    const int resp = waitFinalResp(_cbUSORF, &param);
+                    _lineParser.setPayloadBuffer(NULL, 0, NULL);
+                    if (RESP_OK == resp) {
                         *ip = param.ip;
                         *port = param.port;
                         blk = param.len;
@@ -3215,200 +3254,9 @@ void MDMParser::dumpIp(MDM_IP ip)
 }
 
 // ----------------------------------------------------------------
-int MDMParser::_parseMatch(Pipe<char>* pipe, int len, const char* sta, const char* end)
-{
-    int o = 0;
-    if (sta) {
-        while (*sta) {
-            if (++o > len)                  return WAIT;
-            char ch = pipe->next();
-            if (*sta++ != ch)               return NOT_FOUND;
-        }
-    }
-    if (!end)                               return o; // no termination
-    // at least any char
-    if (++o > len)                      return WAIT;
-    pipe->next();
-    // check the end
-    int x = 0;
-    while (end[x]) {
-        if (++o > len)                      return WAIT;
-        char ch = pipe->next();
-        x = (end[x] == ch) ? x + 1 :
-            (end[0] == ch) ? 1 :
-                            0;
-    }
-    return o;
-}
-
-int MDMParser::_parseFormated(Pipe<char>* pipe, int len, const char* fmt)
-{
-    int o = 0;
-    int num = 0;
-    if (fmt) {
-        while (*fmt) {
-            if (++o > len)                  return WAIT;
-            char ch = pipe->next();
-            if (*fmt == '%') {
-                fmt++;
-                if (*fmt == 'd') { // numeric
-                    fmt ++;
-                    num = 0;
-                    while (ch >= '0' && ch <= '9') {
-                        num = num * 10 + (ch - '0');
-                        if (++o > len)      return WAIT;
-                        ch = pipe->next();
-                    }
-                }
-                else if (*fmt == 'c') { // char buffer (takes last numeric as length)
-                    fmt ++;
-                    while (num --) {
-                        if (++o > len)      return WAIT;
-                        ch = pipe->next();
-                    }
-                }
-                else if (*fmt == 's') {
-                    fmt ++;
-                    if (ch != '\"')         return NOT_FOUND;
-                    do {
-                        if (++o > len)      return WAIT;
-                        ch = pipe->next();
-                    } while (ch != '\"');
-                    if (++o > len)          return WAIT;
-                    ch = pipe->next();
-                }
-            }
-            if (*fmt++ != ch)               return NOT_FOUND;
-        }
-    }
-    return o;
-}
-
 int MDMParser::_getLine(Pipe<char>* pipe, char* buf, int len)
 {
-    int unkn = 0;
-    int sz = pipe->size();
-    int fr = pipe->free();
-    if (len > sz)
-        len = sz;
-    while (len > 0)
-    {
-        static struct {
-              const char* fmt;                              int type;
-        } lutF[] = {
-            { "\r\n+USORD: %d,%d,\"%c\"",                   TYPE_PLUS       },
-            { "\r\n\r\n+USORF: %d,\"" IPSTR "\",%d,%d,\"%c\"\r\n",  TYPE_PLUS }, // R410 firmware L0.0.00.00.05.08,A.02.04
-            { "\r\n+USORF: %d,\"" IPSTR "\",%d,%d,\"%c\"\r\n",  TYPE_PLUS     },
-            { "\r\n+USORF: %d,\"" IPSTR "\",%d,%d,\"%c\"",  TYPE_PLUS       },
-            { "\r\n+URDFILE: %s,%d,\"%c\"",                 TYPE_PLUS       },
-        };
-        static struct {
-              const char* sta;          const char* end;    int type;
-        } lut[] = {
-            { "\r\n\r\r\nOK\r\n",       NULL,               TYPE_OK         }, // R410 firmware L0.0.00.00.05.08,A.02.04
-            { "\r\nOK\r\n",             NULL,               TYPE_OK         },
-            { "OK\r\n",                 NULL,               TYPE_OK         }, // Necessary to clean up after TYPE_USORF_1 is parsed
-            { "\r\nERROR\r\n",          NULL,               TYPE_ERROR      },
-            { "\r\n+CME ERROR:",        "\r\n",             TYPE_ERROR      },
-            { "\r\n+CMS ERROR:",        "\r\n",             TYPE_ERROR      },
-            { "\r\nRING\r\n",           NULL,               TYPE_RING       },
-            { "\r\nCONNECT\r\n",        NULL,               TYPE_CONNECT    },
-            { "\r\nNO CARRIER\r\n",     NULL,               TYPE_NOCARRIER  },
-            { "\r\nNO DIALTONE\r\n",    NULL,               TYPE_NODIALTONE },
-            { "\r\nBUSY\r\n",           NULL,               TYPE_BUSY       },
-            { "\r\nNO ANSWER\r\n",      NULL,               TYPE_NOANSWER   },
-            { "\r\r\n\r\r\n+USORF:",    NULL,               TYPE_USORF_1    }, // R410 firmware L0.0.00.00.05.08,A.02.04
-            { "\r\n+",                  "\r\n",             TYPE_PLUS       },
-            { "\r\n@",                  NULL,               TYPE_PROMPT     }, // Sockets
-            { "\r\n>",                  NULL,               TYPE_PROMPT     }, // SMS
-            { "\n>",                    NULL,               TYPE_PROMPT     }, // File
-            { "\r\nABORTED\r\n",        NULL,               TYPE_ABORTED    }, // Current command aborted
-            { "\r\n\r\n",               NULL,               TYPE_DBLNEWLINE }, // Double CRLF detected, R410 firmware L0.0.00.00.05.07,A.02.02
-            { "\r\n",                   "\r\n",             TYPE_UNKNOWN    }, // If all else fails, break up generic strings
-        };
-        for (int i = 0; i < (int)(sizeof(lutF)/sizeof(*lutF)); i ++) {
-            pipe->set(unkn);
-#ifdef MDM_DEBUG_RX_PIPE
-            // electronMDM.rxDump();
-#endif // MDM_DEBUG_RX_PIPE
-            // MDM_PRINTF("lutF [%d] len:%d sz:%d sz now:%d\r\n", i, len, sz, pipe->size());
-            int ln = _parseFormated(pipe, len, lutF[i].fmt);
-            if (ln == WAIT && fr) {
-                // MDM_PRINTF("lutF ln == WAIT len:%d\r\n", len);
-#ifdef MDM_DEBUG_RX_PIPE
-                // electronMDM.rxDump();
-#endif // MDM_DEBUG_RX_PIPE
-                return WAIT;
-            }
-            if ((ln != NOT_FOUND) && (unkn > 0)) {
-                // MDM_PRINTF("lutF ln != NOT_FOUND (%d) len:%d\r\n", i, len);
-#ifdef MDM_DEBUG_RX_PIPE
-                // electronMDM.rxDump();
-#endif // MDM_DEBUG_RX_PIPE
-                return TYPE_UNKNOWN | pipe->get(buf, unkn);
-            }
-            if (ln > 0) {
-                // MDM_PRINTF("lutF matched (%d)\r\n", i);
-                return lutF[i].type  | pipe->get(buf, ln);
-            }
-        }
-        for (int i = 0; i < (int)(sizeof(lut)/sizeof(*lut)); i ++) {
-            pipe->set(unkn);
-#ifdef MDM_DEBUG_RX_PIPE
-            // electronMDM.rxDump();
-#endif // MDM_DEBUG_RX_PIPE
-            // MDM_PRINTF("lut [%d] len:%d sz:%d sz now:%d\r\n", i, len, sz, pipe->size());
-            int ln = _parseMatch(pipe, len, lut[i].sta, lut[i].end);
-            if (ln == WAIT && fr) {
-                // MDM_PRINTF("lut ln == WAIT len:%d\r\n", len);
-#ifdef MDM_DEBUG_RX_PIPE
-                // electronMDM.rxDump();
-#endif // MDM_DEBUG_RX_PIPE
-                return WAIT;
-            }
-
-            // Double CRLF detected, discard these two bytes
-            // This resolves a case on R410 where double "\r\n" is generated after +CME ERROR response specifically
-            // following a USOST command, but missing on U260/U270, which would otherwise generate "\r\n\r\n@" prompt
-            // which is not parseable.  We do it this way because it's safer to detect and discard these instead
-            // of parsing CME ERROR with double CRLF endings because that can strip CRLF from the beginning of
-            // some URCs which make them unparseable.
-            //
-            // This also fixes the previous TYPE_DBLNEWLINE usage:
-            // Double CRLF detected, discard these two bytes
-            // This resolves a case on G350 where "\r\n" is generated after +USORF response, but missing
-            // on U260/U270, which would otherwise generate "\r\n\r\nOK\r\n" which is not parseable.
-            if ((ln > 0) && (lut[i].type == TYPE_DBLNEWLINE) && (unkn == 0)) {
-                // MDM_PRINTF("lut TYPE_DBLNEWLINE\r\n");
-                return TYPE_UNKNOWN | pipe->get(buf, 2);
-            }
-
-            // Double CRLF and CR detected, discard these 4 bytes
-            // This resolves a case on R410 firmware L0.0.00.00.05.08,A.02.04 where "\r\r\n\r" is generated
-            // before a "\r\n+USORF:" response, which would otherwise generate "\r\r\n\r\r\n+USORF:" which is not parseable.
-            if ((ln > 0) && (lut[i].type == TYPE_USORF_1) && (unkn == 0)) {
-                // MDM_PRINTF("lut TYPE_USORF_1\r\n");
-                return TYPE_UNKNOWN | pipe->get(buf, 4);
-            }
-
-            if ((ln != NOT_FOUND) && (unkn > 0)) {
-                // MDM_PRINTF("lut ln != NOT_FOUND (%d) len:%d\r\n", i, len);
-#ifdef MDM_DEBUG_RX_PIPE
-                // electronMDM.rxDump();
-#endif // MDM_DEBUG_RX_PIPE
-                return TYPE_UNKNOWN | pipe->get(buf, unkn);
-            }
-
-            if (ln > 0) {
-                // MDM_PRINTF("lut matched (%d)\r\n", i);
-                return lut[i].type | pipe->get(buf, ln);
-            }
-        }
-        // UNKNOWN
-        unkn ++;
-        len--;
-    }
-    return WAIT;
+    return _lineParser.getLine(pipe, buf, len);
 }
 
 // ----------------------------------------------------------------
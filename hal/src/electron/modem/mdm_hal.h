@@ -25,6 +25,7 @@
 
 #include "cellular_hal_cellular_global_identity.h"
 #include "pipe_hal.h"
+#include "mdm_line_parser.h"
 #include "electronserialpipe_hal.h"
 #include "pinmap_hal.h"
 #include "system_tick_hal.h"
@@ -502,24 +503,7 @@ protected:
                 WAIT if not enough data is available
                 NOT_FOUND if nothing was found
     */
-    static int _getLine(Pipe<char>* pipe, char* buffer, int length);
-
-    /** Helper: Parse a match from the pipe
-        \param pipe the buffered pipe
-        \param number of bytes to parse at maximum,
-        \param sta the starting string, NULL if none
-        \param end the terminating string, NULL if none
-        \return size of parsed match
-    */
-    static int _parseMatch(Pipe<char>* pipe, int len, const char* sta, const char* end);
-
-    /** Helper: Parse a match from the pipe
-        \param pipe the buffered pipe
-        \param number of bytes to parse at maximum,
-        \param fmt the formating string (%d any number, %c any char of last %d len)
-        \return size of parsed match
-    */
-    static int _parseFormated(Pipe<char>* pipe, int len, const char* fmt);
+    int _getLine(Pipe<char>* pipe, char* buffer, int length);
 
     /** Helper: Send SMS received index to callback
         \param index the index of the received SMS
@@ -577,9 +561,9 @@ protected:
         }
     };
     static int _cbUSOCTL(int type, const char* buf, int len, Usoctl* usoctl);
-    typedef struct { char* buf; int len; } USORDparam;
+    typedef struct { char* buf; int len; int received; } USORDparam;
     static int _cbUSORD(int type, const char* buf, int len, USORDparam* param);
-    typedef struct { char* buf; MDM_IP ip; int port; int len; } USORFparam;
+    typedef struct { char* buf; MDM_IP ip; int port; int len; int received; } USORFparam;
     static int _cbUSORF(int type, const char* buf, int len, USORFparam* param);
     typedef struct { char* buf; char* num; } CMGRparam;
     static int _cbCUSD(int type, const char* buf, int len, char* resp);
@@ -634,6 +618,7 @@ protected:
     bool _attached_urc;
     int _power_mode;
     volatile bool _cancel_all_operations;
+    MDMLineParser _lineParser;
 #ifdef MDM_DEBUG
     int _debugLevel;
     system_tick_t _debugTime;
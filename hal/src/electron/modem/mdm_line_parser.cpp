@@ -0,0 +1,311 @@
+/*
+ ******************************************************************************
+ *  Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#ifndef HAL_CELLULAR_EXCLUDE
+
+#include "mdm_line_parser.h"
+#include "cellular_enums_hal.h"
+
+namespace {
+
+struct {
+      const char* fmt;                              int type;       bool payload;
+} const lutF[] = {
+    { "\r\n+USORD: %d,%d,\"%c\"",                   TYPE_PLUS,      true  },
+    { "\r\n\r\n+USORF: %d,\"" IPSTR "\",%d,%d,\"%c\"\r\n",  TYPE_PLUS, true }, // R410 firmware L0.0.00.00.05.08,A.02.04
+    { "\r\n+USORF: %d,\"" IPSTR "\",%d,%d,\"%c\"\r\n",  TYPE_PLUS,  true  },
+    { "\r\n+USORF: %d,\"" IPSTR "\",%d,%d,\"%c\"",  TYPE_PLUS,      true  },
+    { "\r\n+URDFILE: %s,%d,\"%c\"",                 TYPE_PLUS,      false },
+};
+
+struct {
+      const char* sta;          const char* end;    int type;
+} const lut[] = {
+    { "\r\n\r\r\nOK\r\n",       NULL,               TYPE_OK         }, // R410 firmware L0.0.00.00.05.08,A.02.04
+    { "\r\nOK\r\n",             NULL,               TYPE_OK         },
+    { "OK\r\n",                 NULL,               TYPE_OK         }, // Necessary to clean up after TYPE_USORF_1 is parsed
+    { "\r\nERROR\r\n",          NULL,               TYPE_ERROR      },
+    { "\r\n+CME ERROR:",        "\r\n",             TYPE_ERROR      },
+    { "\r\n+CMS ERROR:",        "\r\n",             TYPE_ERROR      },
+    { "\r\nRING\r\n",           NULL,               TYPE_RING       },
+    { "\r\nCONNECT\r\n",        NULL,               TYPE_CONNECT    },
+    { "\r\nNO CARRIER\r\n",     NULL,               TYPE_NOCARRIER  },
+    { "\r\nNO DIALTONE\r\n",    NULL,               TYPE_NODIALTONE },
+    { "\r\nBUSY\r\n",           NULL,               TYPE_BUSY       },
+    { "\r\nNO ANSWER\r\n",      NULL,               TYPE_NOANSWER   },
+    { "\r\r\n\r\r\n+USORF:",    NULL,               TYPE_USORF_1    }, // R410 firmware L0.0.00.00.05.08,A.02.04
+    { "\r\n+",                  "\r\n",             TYPE_PLUS       },
+    { "\r\n@",                  NULL,               TYPE_PROMPT     }, // Sockets
+    { "\r\n>",                  NULL,               TYPE_PROMPT     }, // SMS
+    { "\n>",                    NULL,               TYPE_PROMPT     }, // File
+    { "\r\nABORTED\r\n",        NULL,               TYPE_ABORTED    }, // Current command aborted
+    { "\r\n\r\n",               NULL,               TYPE_DBLNEWLINE }, // Double CRLF detected, R410 firmware L0.0.00.00.05.07,A.02.02
+    { "\r\n",                   "\r\n",             TYPE_UNKNOWN    }, // If all else fails, break up generic strings
+};
+
+// Every line starts with one of these characters
+inline bool isLineStart(char ch) {
+    return ch == '\r' || ch == '\n' || ch == 'O';
+}
+
+} // namespace
+
+MDMLineParser::MDMLineParser()
+{
+    reset();
+    _payload = NULL;
+    _payloadSize = 0;
+    _payloadReceived = NULL;
+}
+
+void MDMLineParser::reset()
+{
+    _scanned = 0;
+    _need = 0;
+    _size = 0;
+    _read = 0;
+    _len = 0;
+}
+
+void MDMLineParser::setPayloadBuffer(char* buf, int size, int* received)
+{
+    _payload = buf;
+    _payloadSize = buf ? size : 0;
+    _payloadReceived = buf ? received : NULL;
+    if (_payloadReceived) {
+        *_payloadReceived = -1;
+    }
+}
+
+int MDMLineParser::getLine(Pipe<char>* pipe, char* buf, int len)
+{
+    const int sz = pipe->size();
+    if (sz < _size || pipe->readCount() != _read || len != _len) {
+        // The pipe was read or reset by someone else, or the line buffer has changed
+        _scanned = 0;
+        _need = 0;
+    }
+    _size = sz;
+    _read = pipe->readCount();
+    _len = len;
+    // Nothing that was waited for has arrived since the last call
+    if (sz < _need && pipe->free()) {
+        return WAIT;
+    }
+    _need = 0;
+    int fr = pipe->free();
+    if (len > sz)
+        len = sz;
+    // Bytes that didn't match any pattern during the previous calls will not match now
+    int unkn = _scanned;
+    len -= unkn;
+    // Cleared when a pattern runs out of data in a full pipe, the offset needs to be checked again
+    bool skip = true;
+    while (len > 0)
+    {
+        pipe->set(unkn);
+        const char ch = pipe->next();
+        if (isLineStart(ch)) {
+            for (int i = 0; i < (int)(sizeof(lutF)/sizeof(*lutF)); i ++) {
+                if (lutF[i].fmt[0] != ch) {
+                    continue;
+                }
+                pipe->set(unkn);
+                int need = 0, data = 0, dataLen = 0;
+                int ln = parseFormated(pipe, len, lutF[i].fmt, &need, &data, &dataLen);
+                if (ln == WAIT && fr) {
+                    _need = unkn + need;
+                    return WAIT;
+                }
+                if (ln == WAIT) {
+                    skip = false;
+                }
+                if ((ln != NOT_FOUND) && (unkn > 0)) {
+                    return consumed(pipe, TYPE_UNKNOWN | pipe->get(buf, unkn));
+                }
+                if (ln > 0) {
+                    if (lutF[i].payload && _payload && (dataLen <= _payloadSize)) {
+                        // Copy the data straight to the payload buffer and leave an empty string in the line
+                        pipe->get(buf, data);
+                        pipe->get(_payload, dataLen);
+                        ln = data + pipe->get(buf + data, ln - data - dataLen);
+                        *_payloadReceived = dataLen;
+                        _payload = NULL;
+                        _payloadSize = 0;
+                        _payloadReceived = NULL;
+                        return consumed(pipe, lutF[i].type | ln);
+                    }
+                    return consumed(pipe, lutF[i].type | pipe->get(buf, ln));
+                }
+            }
+            for (int i = 0; i < (int)(sizeof(lut)/sizeof(*lut)); i ++) {
+                if (lut[i].sta[0] != ch) {
+                    continue;
+                }
+                pipe->set(unkn);
+                int ln = parseMatch(pipe, len, lut[i].sta, lut[i].end);
+                if (ln == WAIT && fr) {
+                    _need = unkn + len + 1;
+                    return WAIT;
+                }
+                if (ln == WAIT) {
+                    skip = false;
+                }
+
+                // Double CRLF detected, discard these two bytes
+                // This resolves a case on R410 where double "\r\n" is generated after +CME ERROR response specifically
+                // following a USOST command, but missing on U260/U270, which would otherwise generate "\r\n\r\n@" prompt
+                // which is not parseable.  We do it this way because it's safer to detect and discard these instead
+                // of parsing CME ERROR with double CRLF endings because that can strip CRLF from the beginning of
+                // some URCs which make them unparseable.
+                //
+                // This also fixes the previous TYPE_DBLNEWLINE usage:
+                // Double CRLF detected, discard these two bytes
+                // This resolves a case on G350 where "\r\n" is generated after +USORF response, but missing
+                // on U260/U270, which would otherwise generate "\r\n\r\nOK\r\n" which is not parseable.
+                if ((ln > 0) && (lut[i].type == TYPE_DBLNEWLINE) && (unkn == 0)) {
+                    return consumed(pipe, TYPE_UNKNOWN | pipe->get(buf, 2));
+                }
+
+                // Double CRLF and CR detected, discard these 4 bytes
+                // This resolves a case on R410 firmware L0.0.00.00.05.08,A.02.04 where "\r\r\n\r" is generated
+                // before a "\r\n+USORF:" response, which would otherwise generate "\r\r\n\r\r\n+USORF:" which is not parseable.
+                if ((ln > 0) && (lut[i].type == TYPE_USORF_1) && (unkn == 0)) {
+                    return consumed(pipe, TYPE_UNKNOWN | pipe->get(buf, 4));
+                }
+
+                if ((ln != NOT_FOUND) && (unkn > 0)) {
+                    return consumed(pipe, TYPE_UNKNOWN | pipe->get(buf, unkn));
+                }
+
+                if (ln > 0) {
+                    return consumed(pipe, lut[i].type | pipe->get(buf, ln));
+                }
+            }
+        }
+        // UNKNOWN
+        unkn ++;
+        len--;
+        if (skip) {
+            _scanned = unkn;
+        }
+    }
+    _need = sz + 1;
+    return WAIT;
+}
+
+int MDMLineParser::consumed(Pipe<char>* pipe, int ret)
+{
+    _scanned = 0;
+    _need = 0;
+    _size = pipe->size();
+    _read = pipe->readCount();
+    return ret;
+}
+
+int MDMLineParser::parseMatch(Pipe<char>* pipe, int len, const char* sta, const char* end)
+{
+    int o = 0;
+    if (sta) {
+        while (*sta) {
+            if (++o > len)                  return WAIT;
+            char ch = pipe->next();
+            if (*sta++ != ch)               return NOT_FOUND;
+        }
+    }
+    if (!end)                               return o; // no termination
+    // at least any char
+    if (++o > len)                      return WAIT;
+    pipe->next();
+    // check the end
+    int x = 0;
+    while (end[x]) {
+        if (++o > len)                      return WAIT;
+        char ch = pipe->next();
+        x = (end[x] == ch) ? x + 1 :
+            (end[0] == ch) ? 1 :
+                            0;
+    }
+    return o;
+}
+
+int MDMLineParser::parseFormated(Pipe<char>* pipe, int len, const char* fmt, int* need, int* data, int* dataLen)
+{
+    int o = 0;
+    int num = 0;
+    if (fmt) {
+        while (*fmt) {
+            if (++o > len) {
+                if (need) *need = o;
+                return WAIT;
+            }
+            char ch = pipe->next();
+            if (*fmt == '%') {
+                fmt++;
+                if (*fmt == 'd') { // numeric
+                    fmt ++;
+                    num = 0;
+                    while (ch >= '0' && ch <= '9') {
+                        num = num * 10 + (ch - '0');
+                        if (++o > len) {
+                            if (need) *need = o;
+                            return WAIT;
+                        }
+                        ch = pipe->next();
+                    }
+                }
+                else if (*fmt == 'c') { // char buffer (takes last numeric as length)
+                    fmt ++;
+                    if (data) *data = o - 1;
+                    if (dataLen) *dataLen = num;
+                    // The data isn't checked, the next byte that matters is the one following it
+                    if (o + num > len) {
+                        if (need) *need = o + num;
+                        return WAIT;
+                    }
+                    if (num > 0) {
+                        pipe->skip(num - 1);
+                        ch = pipe->next();
+                        o += num;
+                    }
+                }
+                else if (*fmt == 's') {
+                    fmt ++;
+                    if (ch != '\"')         return NOT_FOUND;
+                    do {
+                        if (++o > len) {
+                            if (need) *need = o;
+                            return WAIT;
+                        }
+                        ch = pipe->next();
+                    } while (ch != '\"');
+                    if (++o > len) {
+                        if (need) *need = o;
+                        return WAIT;
+                    }
+                    ch = pipe->next();
+                }
+            }
+            if (*fmt++ != ch)               return NOT_FOUND;
+        }
+    }
+    return o;
+}
+
+#endif // !defined(HAL_CELLULAR_EXCLUDE)
@@ -0,0 +1,95 @@
+/*
+ ******************************************************************************
+ *  Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#pragma once
+
+#include "pipe_hal.h"
+
+/** Splits the modem's AT response stream into lines.
+
+    The parser keeps its position in the receive pipe between calls, so bytes
+    that were already classified are not scanned again while a line is still
+    arriving, and a call that finds no new data returns without scanning at all.
+
+    The binary payload of a socket read response (+USORD, +USORF) can be copied
+    from the pipe straight into a caller-provided buffer, see #setPayloadBuffer.
+*/
+class MDMLineParser
+{
+public:
+    MDMLineParser();
+
+    /** Parse a line from the receiving buffered pipe
+        \param pipe the receiving buffer pipe
+        \param buf the parsed line
+        \param len the size of the line buffer
+        \return type and length if something was found,
+                WAIT if not enough data is available
+                NOT_FOUND if nothing was found
+    */
+    int getLine(Pipe<char>* pipe, char* buf, int len);
+
+    /** Set the buffer for the payload of the next socket read response.
+        The payload is not copied to the line buffer: the returned line
+        contains an empty quoted string in its place, and the number of
+        payload bytes is stored in \a received. The buffer is used once.
+        \param buf the payload buffer, NULL to cancel
+        \param size the size of the payload buffer
+        \param received where to store the payload size, set to -1 by this call
+    */
+    void setPayloadBuffer(char* buf, int size, int* received);
+
+    /** Forget the parsing state, needs to be called when the pipe is reset
+    */
+    void reset();
+
+    /** Helper: Parse a match from the pipe
+        \param pipe the buffered pipe
+        \param len number of bytes to parse at maximum,
+        \param sta the starting string, NULL if none
+        \param end the terminating string, NULL if none
+        \return size of parsed match
+    */
+    static int parseMatch(Pipe<char>* pipe, int len, const char* sta, const char* end);
+
+    /** Helper: Parse a match from the pipe
+        \param pipe the buffered pipe
+        \param len number of bytes to parse at maximum,
+        \param fmt the formating string (%d any number, %c any char of last %d len)
+        \param need if not NULL, set to the minimum number of bytes
+                    needed for a match when WAIT is returned
+        \param data if not NULL, set to the offset of the %c data
+        \param dataLen if not NULL, set to the size of the %c data
+        \return size of parsed match
+    */
+    static int parseFormated(Pipe<char>* pipe, int len, const char* fmt,
+            int* need = NULL, int* data = NULL, int* dataLen = NULL);
+
+private:
+    int _scanned;   //!< leading bytes of the pipe that can't start a line
+    int _need;      //!< pipe size needed to make progress since WAIT was returned
+    int _size;      //!< pipe size seen by the last call
+    unsigned _read; //!< pipe read count seen by the last call
+    int _len;       //!< line buffer size used by the last call
+    char* _payload; //!< payload buffer of the next socket read response
+    int _payloadSize;
+    int* _payloadReceived;
+
+    int consumed(Pipe<char>* pipe, int ret);
+};
@@ -27,6 +27,7 @@
 #include "service_debug.h"
 #include "interrupts_hal.h"
 #include "mdm_debug.h"
+#include "spsc_ring_buffer.h"
 
 #ifdef putc
 #undef putc
@@ -37,24 +38,35 @@
 /** Pipe: this class implements a buffered pipe that can be safely
     written and read between two context. I.e., Written from a task
     and read from a interrupt.
+
+    The indices are kept by a lock-free single-producer/single-consumer
+    ring buffer, so neither side needs to disable interrupts.
 */
 template <class T>
 class Pipe
 {
 public:
     /* Constructor
-        \param n size of the pipe/buffer
-        \param b optional buffer that should be used.
+        \param n size of the pipe/buffer, rounded up to a power of two
+        \param b optional buffer of n + 1 elements that should be used.
                  if NULL the constructor will allocate a buffer of size n.
     */
     Pipe(int n, T* b = NULL)
     {
-        _a = b ? NULL : n ? new T[n + 1] : NULL;
-        _r = 0;
-        _w = 0;
-        _o = 0;
+        size_t s = 1;
+        if (b) {
+            // Largest power of two that fits in the buffer
+            while (s * 2 <= (size_t)n + 1)
+                s *= 2;
+        } else {
+            while (s < (size_t)n)
+                s *= 2;
+        }
+        _a = b ? NULL : n ? new T[s] : NULL;
         _b = b ? b : _a;
-        _s = n + 1;
+        _o = 0;
+        if (_b)
+            _rb.init(_b, s);
     }
     /** Destructor
         frees a allocated buffer.
@@ -70,13 +82,12 @@ public:
     */
     void dump(void)
     {
-        int o = _r;
         char temp1[1024];
         char temp2[10];
-        sprintf(temp1, "pipe: %d/%d ", size(), _s);
-        while (o != _w) {
-            // char ch = *buf++;
-            T t = _b[o];
+        const int sz = size();
+        sprintf(temp1, "pipe: %d/%d ", sz, (int)_rb.size());
+        for (int o = 0; o < sz; o++) {
+            T t = _rb.peekAt(o);
             if (((char)t > 0x1F) && ((char)t < 0x7F)) { // is printable
                 if      ((char)t == '%')  strcat(temp1, "%%");
                 else if ((char)t == '"')  strcat(temp1, "\\\"");
@@ -98,7 +109,6 @@ public:
                     strcat(temp1, temp2);
                 }
             }
-            o = _inc(o);
         }
         strcat(temp1, "\r\n");
         MDM_PRINTF("%s", temp1);
@@ -120,7 +130,7 @@ public:
     */
     int free(void)
     {
-        return _s - size() - 1;
+        return _rb.space();
     }
 
     /* Add a single element to the buffer. (blocking)
@@ -129,13 +139,8 @@ public:
     */
     T putc(T c)
     {
-        int i = _w;
-        int j = i;
-        i = _inc(i);
-        while (i == _r) // = !writeable()
+        while (!_rb.put(c)) // = !writeable()
             /* nothing / just wait */;
-        _b[j] = c;
-        _w = i;
         return c;
     }
 
@@ -150,24 +155,9 @@ public:
         int c = n;
         while (c)
         {
-            int f;
-            for (;;) // wait for space
-            {
-                f = free();
-                if (f > 0) break;     // data avail
-                if (!t) return n - c; // no more space and not blocking
-                /* nothing / just wait */;
-            }
-            // check free space
-            if (c < f) f = c;
-            int w = _w;
-            int m = _s - w;
-            // check wrap
-            if (f > m) f = m;
-            memcpy(&_b[w], p, f);
-            _w = _inc(w, f);
-            c -= f;
-            p += f;
+            c -= _rb.put(p + (n - c), c);
+            if (!t) break;        // no more space and not blocking
+            /* nothing / just wait */;
         }
         return n - c;
     }
@@ -180,7 +170,7 @@ public:
     */
     bool readable(void)
     {
-        return (_r != _w);
+        return !_rb.empty();
     }
 
     /** Get the number of values available in the buffer
@@ -188,10 +178,7 @@ public:
     */
     int size(void)
     {
-        int s = _w - _r;
-        if (s < 0)
-            s += _s;
-        return s;
+        return _rb.data();
     }
 
     /** get a single value from buffered pipe (this function will block if no values available)
@@ -199,11 +186,9 @@ public:
     */
     T getc(void)
     {
-        int r = _r;
-        while (r == _w) // = !readable()
+        T t;
+        while (!_rb.get(&t)) // = !readable()
             /* nothing / just wait */;
-        T t = _b[r];
-        _r = _inc(r);
         return t;
     }
 
@@ -218,28 +203,21 @@ public:
         int c = n;
         while (c)
         {
-            int f;
-            for (;;) // wait for data
-            {
-                f = size();
-                if (f)  break;        // free space
-                if (!t) return n - c; // no space and not blocking
-                /* nothing / just wait */;
-            }
-            // check available data
-            if (c < f) f = c;
-            int r = _r;
-            int m = _s - r;
-            // check wrap
-            if (f > m) f = m;
-            memcpy(p, &_b[r], f);
-            _r = _inc(r, f);
-            c -= f;
-            p += f;
+            c -= _rb.get(p + (n - c), c);
+            if (!t) break;        // no data and not blocking
+            /* nothing / just wait */;
         }
         return n - c;
     }
 
+    /** Get the total number of values extracted from the buffer
+        \return the number of elements extracted since the last reset, wraps around
+    */
+    unsigned readCount(void)
+    {
+        return _rb.readCount();
+    }
+
     // the following functions are useful if you like to inspect
     // or parse the buffer in the reading thread/context
     // --------------------------------------------------------
@@ -253,7 +231,7 @@ public:
     {
         int sz = size();
         ix = (ix > sz) ? sz : ix;
-        _o = _inc(_r, ix);
+        _o = ix;
         return sz - ix;
     }
 
@@ -262,17 +240,23 @@ public:
     */
     T next(void)
     {
-        int o = _o;
-        T t = _b[o];
-        _o = _inc(o);
-        return t;
+        return _rb.peekAt(_o++);
+    }
+
+    /** skip elements from the parsing position
+        \param n the number of elements to skip
+    */
+    void skip(int n)
+    {
+        _o += n;
     }
 
     /** commit the index, mark the current parsing index as consumed data.
     */
     void done(void)
     {
-        _r = _o;
+        _rb.consumeCommit(_o);
+        _o = 0;
     }
 
     /** reset all indexes to empty the pipe
@@ -280,30 +264,14 @@ public:
     void reset()
     {
         auto prev = HAL_disable_irq();
-        _r = 0;
-        _w = 0;
+        _rb.reset();
         _o = 0;
         HAL_enable_irq(prev);
     }
 
 private:
-    /** increment the index
-        \param i index to increment
-        \param n the step to increment
-        \return the incremented index.
-    */
-    inline int _inc(int i, int n = 1)
-    {
-        i += n;
-        if (i >= _s)
-            i -= _s;
-        return i;
-    }
-
+    particle::services::SpscRingBuffer<T> _rb; //!< indices of the buffer
     T*            _b; //!< buffer
     T*            _a; //!< allocated buffer
-    int           _s; //!< size of buffer (s - 1) elements can be stored
-    volatile int  _w; //!< write index
-    volatile int  _r; //!< read index
-    int           _o; //!< offest index used by parsing functions
+    int           _o; //!< offset from the read index used by parsing functions
 };
@@ -98,6 +98,11 @@ void HAL_EEPROM_Perform_Pending_Erase()
 {
 }
 
+bool HAL_EEPROM_Compact_Step(void* reserved)
+{
+	return false;
+}
+
 void GCC_EEPROM_Load(const char* filename)
 {
 	read_file(filename, eeprom, sizeof(eeprom));
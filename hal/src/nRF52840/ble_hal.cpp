@@ -49,8 +49,11 @@ LOG_SOURCE_CATEGORY("hal.ble");
 #include "sdk_config_system.h"
 #include "spark_wiring_vector.h"
 #include "simple_pool_allocator.h"
+#include "fixed_block_pool.h"
+#include "fixed_lru_map.h"
 #include <string.h>
 #include <memory>
+#include <atomic>
 #include "check_nrf.h"
 #include "check.h"
 #include "scope_guard.h"
@@ -158,6 +161,23 @@ bool addressEqual(const hal_ble_addr_t& srcAddr, const hal_ble_addr_t& destAddr)
     return (srcAddr.addr_type == destAddr.addr_type && !memcmp(srcAddr.addr, destAddr.addr, BLE_SIG_ADDR_LEN));
 }
 
+struct AddressHash {
+    size_t operator()(const hal_ble_addr_t& addr) const {
+        // FNV-1a
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < BLE_SIG_ADDR_LEN; i++) {
+            h = (h ^ addr.addr[i]) * 16777619u;
+        }
+        return (h ^ addr.addr_type) * 16777619u;
+    }
+};
+
+struct AddressEqual {
+    bool operator()(const hal_ble_addr_t& addr1, const hal_ble_addr_t& addr2) const {
+        return addressEqual(addr1, addr2);
+    }
+};
+
 hal_ble_addr_t chipDefaultAddress() {
     uint32_t addrMsb = NRF_FICR->DEVICEADDR[1];
     uint32_t addrLsb = NRF_FICR->DEVICEADDR[0];
@@ -219,25 +239,49 @@ public:
     BleEventDispatcher()
             : evtDispatcherinitialized_(false),
               evtQueue_(nullptr),
-              evtThread_(nullptr) {
+              evtThread_(nullptr),
+              droppedEvents_(0) {
     }
     ~BleEventDispatcher() = default;
     int init();
     bool initialized() const {
         return evtDispatcherinitialized_;
     }
-    void enqueue(ble_evt_t** event);
+    int enqueue(ble_evt_t** event);
 
     void* allocEventData(size_t size) {
-        return pool_.alloc(size);
+        // Events and scanned data come from the fixed pools, larger data from the shared pool
+        void* p = nullptr;
+        if (size <= ScanDataPool::blockSize()) {
+            p = scanDataPool_.alloc();
+        } else if (size <= EventPool::blockSize()) {
+            p = evtPool_.alloc();
+        }
+        if (!p) {
+            p = pool_.alloc(size);
+        }
+        return p;
     }
 
     void freeEventData(void* p) {
-        if (p) {
+        if (evtPool_.owns(p)) {
+            evtPool_.free(p);
+        } else if (scanDataPool_.owns(p)) {
+            scanDataPool_.free(p);
+        } else if (p) {
             pool_.free(p);
         }
     }
 
+    // Called when an event can't be allocated or enqueued
+    void dropEvent() {
+        droppedEvents_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint32_t droppedEvents() const {
+        return droppedEvents_.load(std::memory_order_relaxed);
+    }
+
 private:
     static os_thread_return_t processBleEventFromThread(void* param);
 
@@ -245,6 +289,11 @@ private:
     os_queue_t evtQueue_;                                   /**< BLE event queue. */
     os_thread_t evtThread_;                                 /**< BLE event thread. */
     AtomicAllocedPool pool_;
+    typedef particle::services::FixedBlockPool<sizeof(ble_evt_t), BLE_EVENT_POOL_BLOCK_COUNT> EventPool;
+    typedef particle::services::FixedBlockPool<BLE_MAX_SCAN_REPORT_BUF_LEN, BLE_SCAN_DATA_POOL_BLOCK_COUNT> ScanDataPool;
+    EventPool evtPool_;                                     /**< Copies of BLE events. */
+    ScanDataPool scanDataPool_;                             /**< Copies of scanned advertising data. */
+    std::atomic<uint32_t> droppedEvents_;                   /**< Number of events dropped since boot. */
 };
 
 class BleObject::BleGap {
@@ -380,8 +429,10 @@ private:
     ble_data_t bleScanData_;                                /**< BLE scanned data. */
     hal_ble_on_scan_result_cb_t scanResultCallback_;        /**< Callback function on scan result. */
     void* context_;                                         /**< Context of the scan result callback function. */
-    Vector<hal_ble_addr_t> cachedDevices_;
-    Vector<hal_ble_scan_result_evt_t> pendingResults_;
+    particle::services::FixedLruMap<hal_ble_addr_t, bool, BLE_SCAN_CACHED_DEVICE_COUNT,
+            AddressHash, AddressEqual> cachedDevices_;              /**< Devices that have been reported. */
+    particle::services::FixedLruMap<hal_ble_addr_t, hal_ble_scan_result_evt_t, BLE_SCAN_PENDING_RESULT_COUNT,
+            AddressHash, AddressEqual> pendingResults_;             /**< Results waiting for the scan response data. */
 };
 
 class BleObject::ConnectionsManager {
@@ -647,18 +698,27 @@ error:
     return SYSTEM_ERROR_INTERNAL;
 }
 
-void BleObject::BleEventDispatcher::enqueue(ble_evt_t** event) {
+int BleObject::BleEventDispatcher::enqueue(ble_evt_t** event) {
     if (os_queue_put(evtQueue_, event, 0, nullptr)) {
-        LOG(ERROR, "os_queue_put() failed.");
-        SPARK_ASSERT(false);
+        // The event thread is falling behind, drop the event rather than stalling the SoftDevice
+        freeEventData(*event);
+        dropEvent();
+        return SYSTEM_ERROR_BUSY;
     }
+    return SYSTEM_ERROR_NONE;
 }
 
 os_thread_return_t BleObject::BleEventDispatcher::processBleEventFromThread(void* param) {
     BleEventDispatcher* dispatcher = static_cast<BleEventDispatcher*>(param);
+    uint32_t reportedDroppedEvents = 0;
     while (1) {
         ble_evt_t* event;
         if (!os_queue_take(dispatcher->evtQueue_, &event, CONCURRENT_WAIT_FOREVER, nullptr)) {
+            const uint32_t droppedEvents = dispatcher->droppedEvents();
+            if (droppedEvents != reportedDroppedEvents) {
+                LOG(WARN, "%u BLE events dropped", (unsigned)(droppedEvents - reportedDroppedEvents));
+                reportedDroppedEvents = droppedEvents;
+            }
             SCOPE_GUARD ({
                 dispatcher->freeEventData(event);
             });
@@ -1369,60 +1429,66 @@ ble_gap_scan_params_t BleObject::Observer::toPlatformScanParams() const {
     return params;
 }
 
+// The lookups are also done from the SoftDevice event handler, so the caches are modified with
+// interrupts disabled. Each operation takes constant time.
 bool BleObject::Observer::isCachedDevice(const hal_ble_addr_t& address) const {
-    for (const auto& addr : cachedDevices_) {
-        if (addressEqual(addr, address)) {
-            return true;
-        }
-    }
-    return false;
+    return cachedDevices_.contains(address);
 }
 
 int BleObject::Observer::addCachedDevice(const hal_ble_addr_t& address) {
-    CHECK_TRUE(cachedDevices_.append(address), SYSTEM_ERROR_NO_MEMORY);
+    // When the cache is full, the least recently reported device is forgotten
+    ATOMIC_BLOCK() {
+        cachedDevices_.put(address, true);
+    }
     return SYSTEM_ERROR_NONE;
 }
 
 void BleObject::Observer::clearCachedDevice() {
-    cachedDevices_.clear();
+    ATOMIC_BLOCK() {
+        cachedDevices_.clear();
+    }
 }
 
 hal_ble_scan_result_evt_t* BleObject::Observer::getPendingResult(const hal_ble_addr_t& address) {
-    for (auto& result : pendingResults_) {
-        if (addressEqual(result.peer_addr, address)) {
-            return &result;
-        }
-    }
-    return nullptr;
+    return const_cast<hal_ble_scan_result_evt_t*>(pendingResults_.peek(address));
 }
 
 int BleObject::Observer::addPendingResult(const hal_ble_scan_result_evt_t& result) {
     if (getPendingResult(result.peer_addr) != nullptr) {
         return SYSTEM_ERROR_INTERNAL;
     }
-    CHECK_TRUE(pendingResults_.append(result), SYSTEM_ERROR_NO_MEMORY);
+    hal_ble_scan_result_evt_t evicted = {};
+    bool hasEvicted = false;
+    ATOMIC_BLOCK() {
+        if (pendingResults_.full()) {
+            // The scan response of the oldest result is unlikely to arrive anymore
+            hasEvicted = pendingResults_.removeOldest(nullptr, &evicted);
+        }
+        pendingResults_.put(result.peer_addr, result);
+    }
+    if (hasEvicted && evicted.adv_data) {
+        BleObject::getInstance().dispatcher()->freeEventData(evicted.adv_data);
+    }
     return SYSTEM_ERROR_NONE;
 }
 
 void BleObject::Observer::removePendingResult(const hal_ble_addr_t& address) {
     // Note: this function isn't responsible for freeing the memory allocated for the advertising data.
-    for (int i = 0; i < pendingResults_.size(); i = i) {
-        if (addressEqual(pendingResults_[i].peer_addr, address)) {
-            pendingResults_.removeAt(i);
-            continue;
-        }
-        i++;
+    ATOMIC_BLOCK() {
+        pendingResults_.remove(address);
     }
 }
 
 void BleObject::Observer::clearPendingResult() {
     // Note: this function is responsible for freeing the memory allocated for the advertising data.
-    for (const auto& result : pendingResults_) {
-        if (result.adv_data) {
-            BleObject::getInstance().dispatcher()->freeEventData(result.adv_data);
-        }
+    ATOMIC_BLOCK() {
+        pendingResults_.forEach([](const hal_ble_addr_t& address, hal_ble_scan_result_evt_t& result) {
+            if (result.adv_data) {
+                BleObject::getInstance().dispatcher()->freeEventData(result.adv_data);
+            }
+        });
+        pendingResults_.clear();
     }
-    pendingResults_.clear();
 }
 
 int BleObject::Observer::constructObserverEvent(hal_ble_scan_result_evt_t& result, const ble_gap_evt_adv_report_t& advReport) const {
@@ -1531,29 +1597,34 @@ void BleObject::Observer::processObserverEvents(const ble_evt_t* event, void* co
                     break;
                 }
             }
-            ble_evt_t* observerEvent = (ble_evt_t*)BleObject::getInstance().dispatcher()->allocEventData(sizeof(ble_evt_t));
+            // If the event thread is falling behind, the report is dropped and scanning continues
+            BleEventDispatcher* dispatcher = BleObject::getInstance().dispatcher();
+            ble_evt_t* observerEvent = (ble_evt_t*)dispatcher->allocEventData(sizeof(ble_evt_t));
             if (!observerEvent) {
-                LOG(ERROR, "Allocate memory for BLE event failed.");
-                observer->stopScanning();
+                dispatcher->dropEvent();
+                observer->continueScanning();
                 break;
             }
             // Copy the SoftDevice event.
             memcpy(observerEvent, event, sizeof(ble_evt_t));
             ble_gap_evt_adv_report_t& advReport = observerEvent->evt.gap_evt.params.adv_report;
+            uint8_t* data = nullptr;
             if (event->evt.gap_evt.params.adv_report.data.len > 0) {
-                advReport.data.p_data = (uint8_t*)BleObject::getInstance().dispatcher()->allocEventData(advReport.data.len);
-                if (!advReport.data.p_data) {
-                    LOG(ERROR, "Allocate memory for adv report data failed.");
-                    BleObject::getInstance().dispatcher()->freeEventData(observerEvent);
-                    observer->stopScanning();
+                data = (uint8_t*)dispatcher->allocEventData(advReport.data.len);
+                if (!data) {
+                    dispatcher->freeEventData(observerEvent);
+                    dispatcher->dropEvent();
+                    observer->continueScanning();
                     break;
                 }
                 // Copy the advertising packet data payload.
-                memcpy(advReport.data.p_data, event->evt.gap_evt.params.adv_report.data.p_data, advReport.data.len);
-            } else {
-                advReport.data.p_data = nullptr;
+                memcpy(data, event->evt.gap_evt.params.adv_report.data.p_data, advReport.data.len);
+            }
+            advReport.data.p_data = data;
+            if (dispatcher->enqueue(&observerEvent) != SYSTEM_ERROR_NONE) {
+                dispatcher->freeEventData(data);
+                observer->continueScanning();
             }
-            BleObject::getInstance().dispatcher()->enqueue(&observerEvent);
             break;
         }
         case BLE_GAP_EVT_TIMEOUT: {
@@ -43,6 +43,16 @@
 /* BLE event queue depth */
 #define BLE_EVENT_QUEUE_ITEM_COUNT                  30
 
+/* Number of preallocated copies of BLE events and of scanned advertising data (32 at most) */
+#define BLE_EVENT_POOL_BLOCK_COUNT                  30
+#define BLE_SCAN_DATA_POOL_BLOCK_COUNT              32
+
+/* Number of devices remembered to report each scanned device only once */
+#define BLE_SCAN_CACHED_DEVICE_COUNT                128
+
+/* Number of advertising reports waiting for their scan response data */
+#define BLE_SCAN_PENDING_RESULT_COUNT               16
+
 /* Maximum length of device name, non null-terminated */
 #define BLE_MAX_DEV_NAME_LEN                        20
 
@@ -217,3 +217,7 @@ bool HAL_EEPROM_Has_Pending_Erase() {
 void HAL_EEPROM_Perform_Pending_Erase() {
 
 }
+
+bool HAL_EEPROM_Compact_Step(void* reserved) {
+    return false;
+}
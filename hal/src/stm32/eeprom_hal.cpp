@@ -29,15 +29,33 @@
 #include "eeprom_hal.h"
 #include "eeprom_emulation_impl.h"
 
+#if EEPROM_EMULATION_BACKGROUND_COMPACTION && PLATFORM_THREADING
+#include "static_recursive_mutex.h"
+#include <mutex>
+
+namespace {
+
+// Compaction steps are performed by the system thread
+StaticRecursiveMutex eepromMutex;
+
+} // namespace
+
+#define EEPROM_LOCK() std::lock_guard<StaticRecursiveMutex> lk(eepromMutex)
+#else
+#define EEPROM_LOCK()
+#endif
+
 FlashEEPROM flashEEPROM;
 
 void HAL_EEPROM_Init(void)
 {
+  EEPROM_LOCK();
   flashEEPROM.init();
 }
 
 uint8_t HAL_EEPROM_Read(uint32_t index)
 {
+  EEPROM_LOCK();
   uint8_t value = 0xFF;
   flashEEPROM.get(index, value);
   return value;
@@ -45,6 +63,7 @@ uint8_t HAL_EEPROM_Read(uint32_t index)
 
 void HAL_EEPROM_Write(uint32_t index, uint8_t data)
 {
+  EEPROM_LOCK();
   flashEEPROM.put(index, data);
 }
 
@@ -55,25 +74,40 @@ size_t HAL_EEPROM_Length()
 
 void HAL_EEPROM_Get(uint32_t index, void *data, size_t length)
 {
+    EEPROM_LOCK();
     flashEEPROM.get(index, data, length);
 }
 
 void HAL_EEPROM_Put(uint32_t index, const void *data, size_t length)
 {
+    EEPROM_LOCK();
     flashEEPROM.put(index, data, length);
 }
 
 void HAL_EEPROM_Clear()
 {
+    EEPROM_LOCK();
     flashEEPROM.clear();
 }
 
 bool HAL_EEPROM_Has_Pending_Erase()
 {
+    EEPROM_LOCK();
     return flashEEPROM.hasPendingErase();
 }
 
 void HAL_EEPROM_Perform_Pending_Erase()
 {
+    EEPROM_LOCK();
     flashEEPROM.performPendingErase();
 }
+
+bool HAL_EEPROM_Compact_Step(void* reserved)
+{
+#if EEPROM_EMULATION_BACKGROUND_COMPACTION
+    EEPROM_LOCK();
+    return flashEEPROM.compactStep();
+#else
+    return false;
+#endif
+}
@@ -28,4 +28,15 @@ constexpr uintptr_t EEPROM_SectorBase2 = 0x08010000;
 constexpr size_t EEPROM_SectorSize1 = 16*1024;
 constexpr size_t EEPROM_SectorSize2 = 64*1024;
 
-using FlashEEPROM = EEPROMEmulation<InternalFlashStore, EEPROM_SectorBase1, EEPROM_SectorSize1, EEPROM_SectorBase2, EEPROM_SectorSize2>;
+// Keep a copy of the emulated EEPROM in RAM to speed up reads
+#ifndef EEPROM_EMULATION_RAM_SHADOW
+#define EEPROM_EMULATION_RAM_SHADOW 0
+#endif
+
+// Swap pages and erase the old page in the background, from the system loop
+#ifndef EEPROM_EMULATION_BACKGROUND_COMPACTION
+#define EEPROM_EMULATION_BACKGROUND_COMPACTION 0
+#endif
+
+using FlashEEPROM = EEPROMEmulation<InternalFlashStore, EEPROM_SectorBase1, EEPROM_SectorSize1, EEPROM_SectorBase2, EEPROM_SectorSize2,
+        EEPROM_EMULATION_RAM_SHADOW>;
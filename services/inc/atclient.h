@@ -22,6 +22,7 @@
 #include <cstdarg>
 #include <limits>
 #include <unistd.h>
+#include "system_tick_hal.h"
 
 namespace particle {
 
@@ -33,6 +34,14 @@ namespace services {
 namespace at {
 
 const size_t ATCLIENT_BUFFER_SIZE = 1024;
+// Maximum number of queued commands
+const size_t ATCLIENT_QUEUE_SIZE = 8;
+// Maximum number of pipelined commands awaiting a response
+const size_t ATCLIENT_PIPELINE_DEPTH = 4;
+const size_t ATCLIENT_COMMAND_SIZE = 128;
+// Information text and intermediate result codes of a queued command
+const size_t ATCLIENT_RESPONSE_SIZE = 256;
+const size_t ATCLIENT_URC_HANDLER_COUNT = 8;
 
 class AtClientBase {
 public:
@@ -83,6 +92,39 @@ public:
         ERROR
     };
 
+    // Ordering of a queued command relative to the other queued commands
+    enum class Order {
+        // The command is sent after all earlier commands have completed, and no later
+        // command is sent until it completes
+        SEQUENTIAL,
+        // The command is sent right after the preceding pipelined commands, without waiting
+        // for their responses. Only for independent queries, and only if the DCE buffers
+        // the commands it receives while busy
+        PIPELINED
+    };
+
+    // Invoked when a queued command completes. `error` is 0 if a final result code was received.
+    // `response` contains the information text and intermediate result code lines of the command,
+    // each followed by the terminator
+    typedef void (*CommandCallback)(int error, ResultCode code, const char* response, void* data);
+
+    // Invoked for each line starting with a registered prefix, e.g. "+CREG"
+    typedef void (*UrcHandler)(const char* line, void* data);
+
+    // Timeout of 0 means the client's timeout
+    int queueCommand(CommandCallback callback, void* data, unsigned int timeout, Order order,
+            const char* fmt, ...) __attribute__((format(printf, 6, 7)));
+    // Sends queued commands and processes the available input, doesn't wait for responses
+    int processQueue();
+    // Processes the queue until all queued commands have completed
+    int flushQueue(unsigned int timeout);
+    // Completes all queued commands with SYSTEM_ERROR_CANCELLED
+    void cancelQueue();
+    size_t getQueuedCommandCount() const;
+
+    int addUrcHandler(const char* prefix, UrcHandler handler, void* data);
+    void removeUrcHandler(const char* prefix);
+
 // protected:
     int run();
 
@@ -125,15 +167,51 @@ public:
     };
 
 private:
+    struct QueuedCommand {
+        char command[ATCLIENT_COMMAND_SIZE];
+        CommandCallback callback;
+        void* data;
+        unsigned int timeout;
+        Order order;
+    };
+
+    struct UrcHandlerEntry {
+        const char* prefix;
+        UrcHandler handler;
+        void* data;
+    };
+
     void setState(State state);
     int waitState(State state);
     int writeCommand(const char* fmt, ...);
     int writeCommand(const char* fmt, va_list args);
     void resetData();
 
+    QueuedCommand& queuedCommand(size_t index);
+    int sendQueuedCommands();
+    int readAvailableLine();
+    void processQueuedLine(char* line, size_t len);
+    void completeQueuedCommand(int error, ResultCode code);
+    void abortSentCommands(int error);
+    bool handleUrc(char* line, size_t len);
+
 private:
     ::particle::Stream* stream_;
 
+    QueuedCommand queue_[ATCLIENT_QUEUE_SIZE] = {};
+    size_t queueHead_ = 0;
+    size_t queueCount_ = 0;
+    // Number of commands at the head of the queue that have been sent
+    size_t sentCount_ = 0;
+    // Time when the DCE started processing the command at the head of the queue
+    system_tick_t headStart_ = 0;
+    size_t linePos_ = 0;
+    char response_[ATCLIENT_RESPONSE_SIZE] = {};
+    size_t responsePos_ = 0;
+    bool responseTruncated_ = false;
+
+    UrcHandlerEntry urcHandlers_[ATCLIENT_URC_HANDLER_COUNT] = {};
+
     State state_ = State::NOT_READY;
 
     // Intermediate result code, e.g. +CMDNAME (with an optional value)
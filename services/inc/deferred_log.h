@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+
+namespace particle {
+
+/**
+ * A buffer of log messages whose formatting is deferred.
+ *
+ * `write()` captures a message in binary form: the level, timestamp, pointers to the category and
+ * format string, and the raw values of the arguments. The message is formatted later by `read()`,
+ * normally in a low priority thread. String arguments are copied, up to `MAX_STRING_ARG_LENGTH`
+ * characters, but the category and format string are not, so they must outlive the message, as
+ * string literals do.
+ *
+ * Any number of threads and interrupt handlers can write messages without locking. Only one thread
+ * may read them. Messages that don't fit in the buffer are dropped and counted.
+ */
+class DeferredLogBuffer {
+public:
+    static const size_t MAX_STRING_ARG_LENGTH = 32;
+    static const size_t MAX_ARGS_SIZE = 128;
+    static const size_t MIN_BUFFER_SIZE = 512;
+
+    DeferredLogBuffer();
+
+    /**
+     * The buffer must be 4-byte aligned and its size must be a power of two and at least
+     * `MIN_BUFFER_SIZE` bytes.
+     */
+    int init(void* buffer, size_t size);
+
+    bool isInitialized() const {
+        return buf_;
+    }
+
+    /**
+     * Captures a message. Returns false if the message was dropped.
+     */
+    bool write(int level, const char* category, uint32_t time, const char* fmt, va_list args);
+
+    /**
+     * Formats the oldest message into `buf` and removes it from the buffer. Returns false if there
+     * are no complete messages.
+     */
+    bool read(char* buf, size_t size, int* level, const char** category, uint32_t* time);
+
+    bool isEmpty() const;
+
+    /**
+     * The number of messages dropped because the buffer was full.
+     */
+    uint32_t dropped() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+private:
+    uint8_t* buf_;
+    uint32_t mask_;
+    // Free running offsets. The head is advanced by the writers when they reserve space for a
+    // message, and the tail by the reader once a message is formatted
+    std::atomic<uint32_t> head_;
+    std::atomic<uint32_t> tail_;
+    std::atomic<uint32_t> dropped_;
+
+    bool reserve(size_t size, uint32_t* offset);
+};
+
+} // particle
@@ -55,9 +55,29 @@
 #define DIAG_NAME_CLOUD_DISCONNECTION_REASON "cloud:dconnrsn"
 #define DIAG_NAME_CLOUD_REPEATED_MESSAGES "coap:resend"
 #define DIAG_NAME_CLOUD_UNACKNOWLEDGED_MESSAGES "coap:unack"
+#define DIAG_NAME_CLOUD_PENDING_MESSAGES_PEAK "coap:peak"
+#define DIAG_NAME_CLOUD_MESSAGE_ALLOC_FAILURES "coap:nomem"
 #define DIAG_NAME_CLOUD_RATE_LIMITED_EVENTS "pub:limit"
+#define DIAG_NAME_CLOUD_QUEUED_EVENTS "pub:queue"
+#define DIAG_NAME_CLOUD_DROPPED_EVENTS "pub:drop"
+#define DIAG_NAME_CLOUD_DRAINED_EVENTS "pub:drain"
+#define DIAG_NAME_CLOUD_STORED_EVENTS "pub:store"
+#define DIAG_NAME_CLOUD_STORE_BYTES_WRITTEN "pub:storewr"
+#define DIAG_NAME_CLOUD_STORE_WRAPS "pub:storewrap"
+#define DIAG_NAME_CLOUD_STORE_DROPS "pub:storedrop"
 #define DIAG_NAME_SYSTEM_TOTAL_RAM "sys:tram"
 #define DIAG_NAME_SYSTEM_USED_RAM "sys:uram"
+#define DIAG_NAME_SYSTEM_THREAD_QUEUE_PEAK "sys:thrq"
+#define DIAG_NAME_SYSTEM_THREAD_LATENCY_PEAK "sys:thrlat"
+#define DIAG_NAME_CLOUD_ACK_LATENCY "coap:acklat"
+#define DIAG_NAME_CLOUD_HANDSHAKE_TIME "cloud:hstime"
+#define DIAG_NAME_CLOUD_SEND_TIME "cloud:sendtime"
+
+// Enables the built-in histogram sources (coap:acklat, cloud:hstime and cloud:sendtime). Each of
+// them takes about 250 bytes of RAM
+#ifndef DIAG_ENABLE_HISTOGRAMS
+#define DIAG_ENABLE_HISTOGRAMS 0
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -100,15 +120,30 @@ typedef enum diag_id {
     DIAG_ID_CLOUD_DISCONNECTION_REASON = 30, // cloud:dconnrsn
     DIAG_ID_CLOUD_REPEATED_MESSAGES = 21, // coap:resend
     DIAG_ID_CLOUD_UNACKNOWLEDGED_MESSAGES = 22, // coap:unack
+    DIAG_ID_CLOUD_PENDING_MESSAGES_PEAK = 47, // coap:peak
+    DIAG_ID_CLOUD_MESSAGE_ALLOC_FAILURES = 48, // coap:nomem
     DIAG_ID_CLOUD_RATE_LIMITED_EVENTS = 20, // pub:throttle
+    DIAG_ID_CLOUD_QUEUED_EVENTS = 44, // pub:queue
+    DIAG_ID_CLOUD_DROPPED_EVENTS = 45, // pub:drop
+    DIAG_ID_CLOUD_DRAINED_EVENTS = 46, // pub:drain
+    DIAG_ID_CLOUD_STORED_EVENTS = 49, // pub:store
+    DIAG_ID_CLOUD_STORE_BYTES_WRITTEN = 50, // pub:storewr
+    DIAG_ID_CLOUD_STORE_WRAPS = 51, // pub:storewrap
     DIAG_ID_SYSTEM_TOTAL_RAM = 25, // sys:tram
     DIAG_ID_SYSTEM_USED_RAM = 26, // sys:uram
+    DIAG_ID_SYSTEM_THREAD_QUEUE_PEAK = 52, // sys:thrq
+    DIAG_ID_SYSTEM_THREAD_LATENCY_PEAK = 53, // sys:thrlat
+    DIAG_ID_CLOUD_ACK_LATENCY = 54, // coap:acklat
+    DIAG_ID_CLOUD_HANDSHAKE_TIME = 55, // cloud:hstime
+    DIAG_ID_CLOUD_SEND_TIME = 56, // cloud:sendtime
+    DIAG_ID_CLOUD_STORE_DROPS = 57, // pub:storedrop
     DIAG_ID_USER = 32768 // Base value for application-specific source IDs
 } diag_id;
 
 // Data types
 typedef enum diag_type {
-    DIAG_TYPE_INT = 1 // 32-bit integer
+    DIAG_TYPE_INT = 1, // 32-bit integer
+    DIAG_TYPE_HISTOGRAM = 2 // Distribution of unsigned 32-bit values (diag_histogram_summary)
 } diag_type;
 
 // Data source commands
@@ -137,6 +172,16 @@ struct diag_source {
     diag_source_cmd_callback callback; // Source callback
 };
 
+// Summary of a histogram data source. The percentiles are approximate
+typedef struct diag_histogram_summary {
+    uint32_t count; // Number of recorded values
+    uint32_t min; // Smallest recorded value
+    uint32_t max; // Largest recorded value
+    uint32_t p50; // Median
+    uint32_t p90; // 90th percentile
+    uint32_t p99; // 99th percentile
+} diag_histogram_summary;
+
 typedef struct diag_source_get_cmd_data {
     uint16_t size; // Size of this structure
     uint16_t reserved; // Reserved (should be set to 0)
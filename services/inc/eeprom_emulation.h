@@ -20,6 +20,8 @@
  ******************************************************************************
  */
 
+#include <algorithm>
+#include <array>
 #include <cstring>
 #include <memory>
 #include <vector>
@@ -89,9 +91,20 @@
  * not call performPendingErase() before the next page swap, the
  * alternate page will be erased just before the page swap.
  *
+ * Alternatively, compactStep() can be called periodically to do the
+ * page swap in the background in small steps, ahead of the write that
+ * would otherwise trigger it, and to erase the old page afterwards.
+ *
+ * Optionally (RamShadow = true), a copy of the latest value of every
+ * EEPROM byte is kept in RAM. It is built when the active page is
+ * determined and updated on every write, so reads don't need to go
+ * through the records and writes only go through them to find where to
+ * append new records. This costs capacity() bytes of RAM.
+ *
  */
 
-template <typename Store, uintptr_t PageBase1, size_t PageSize1, uintptr_t PageBase2, size_t PageSize2>
+template <typename Store, uintptr_t PageBase1, size_t PageSize1, uintptr_t PageBase2, size_t PageSize2,
+        bool RamShadow = false>
 class EEPROMEmulation
 {
 public:
@@ -101,6 +114,9 @@ public:
 
     static constexpr size_t SmallestPageSize = (PageSize1 < PageSize2) ? PageSize1 : PageSize2;
 
+    // Same as capacity(), which cannot be used before the class is complete
+    static constexpr size_t ShadowSize = RamShadow ? SmallestPageSize / 4 /* sizeof(Record) */ / 2 : 0;
+
     enum class LogicalPage
     {
         NoPage,
@@ -167,6 +183,12 @@ public:
         }
     };
 
+    // Start a background page swap when there's room for fewer records
+    // in the active page. A page swap leaves room for at least capacity()
+    // records
+    static constexpr size_t CompactionThreshold = SmallestPageSize / sizeof(Record) / 8;
+    static constexpr size_t CompactionBatchSize = 32;
+
     /* Public API */
 
     // Initialize the EEPROM pages
@@ -306,6 +328,50 @@ public:
             activePage = LogicalPage::NoPage;
             alternatePage = LogicalPage::NoPage;
         }
+
+        compactionState = CompactionState::Idle;
+        compactionCheck = true;
+        rebuildShadow();
+    }
+
+    // Load the latest value of each byte of the active page in the RAM
+    // shadow
+    void rebuildShadow()
+    {
+        static_assert(!RamShadow || ShadowSize == capacity(), "Invalid shadow size");
+        if(!RamShadow)
+        {
+            return;
+        }
+
+        std::memset(shadowData.data(), FLASH_ERASED, shadowData.size());
+        shadowValid = false;
+        shadowComplete = true;
+
+        if(getActivePage() == LogicalPage::NoPage)
+        {
+            return;
+        }
+
+        forEachValidRecord(getActivePage(), [&](Address address, const Record &record)
+        {
+            if(record.index < ShadowSize)
+            {
+                shadowData[record.index] = record.data;
+            }
+            else
+            {
+                // Only possible with records migrated from the legacy format
+                shadowComplete = false;
+            }
+        });
+        shadowValid = true;
+    }
+
+    // True if the range can be served from the RAM shadow
+    bool inShadow(Index indexBegin, uint16_t length)
+    {
+        return RamShadow && shadowValid && (size_t)indexBegin + length <= ShadowSize;
     }
 
     // Which page should currently be read from/written to
@@ -337,6 +403,12 @@ public:
     // Iterate through a page to extract the latest value of each address
     void readRange(Index indexBegin, Data *data, uint16_t length)
     {
+        if(inShadow(indexBegin, length))
+        {
+            std::memcpy(data, shadowData.data() + indexBegin, length);
+            return;
+        }
+
         std::memset(data, FLASH_ERASED, length);
 
         Index indexEnd = indexBegin + length;
@@ -359,31 +431,102 @@ public:
             return;
         }
 
-        // Read existing values for range
-        std::unique_ptr<Data[]> existingData(new Data[length]);
-        // don't write anything if memory is full
-        if(!existingData)
+        if(tryWriteRange(indexBegin, data, length))
         {
             return;
         }
 
+        // If any writes failed because the page was full or a marginal
+        // write error occured, complete the background page swap if
+        // one is in progress, otherwise do a page swap then write all
+        // the records
+        if(finishCompaction() && tryWriteRange(indexBegin, data, length))
+        {
+            return;
+        }
+
+        if(!swapPagesAndWrite(indexBegin, data, length))
+        {
+            // The page swap reloads the shadow when it succeeds
+            rebuildShadow();
+        }
+    }
+
+    // Append records for the changed values to the active page
+    //
+    // Returns false if the page is full or has invalid records, or if
+    // a write failed
+    bool tryWriteRange(Index indexBegin, const Data *data, uint16_t length)
+    {
+        std::unique_ptr<Data[]> readData;
+        const Data *existingData;
         Address writeAddressBegin;
+        bool success;
 
-        // Read the data and make sure there are no previous invalid
-        // records before starting to write
-        bool success = readRangeAndFindEmpty(getActivePage(),
-                existingData.get(), indexBegin, length, writeAddressBegin);
+        if(inShadow(indexBegin, length))
+        {
+            existingData = shadowData.data() + indexBegin;
+            success = findEmpty(getActivePage(), writeAddressBegin);
+        }
+        else
+        {
+            // Read existing values for range
+            readData.reset(new Data[length]);
+            // don't write anything if memory is full
+            if(!readData)
+            {
+                return true;
+            }
+            existingData = readData.get();
+
+            // Read the data and make sure there are no previous invalid
+            // records before starting to write
+            success = readRangeAndFindEmpty(getActivePage(),
+                    readData.get(), indexBegin, length, writeAddressBegin);
+        }
 
         // Write records for all new values
-        success = success && writeRangeChanged(writeAddressBegin, indexBegin, data, existingData.get(), length);
+        success = success && writeRangeChanged(writeAddressBegin, indexBegin, data, existingData, length);
 
-        // If any writes failed because the page was full or a marginal
-        // write error occured, do a page swap then write all the
-        // records
-        if(!success)
+        if(success)
         {
-            swapPagesAndWrite(indexBegin, data, length);
+            copyChangedToCompaction(indexBegin, data, existingData, length);
+            if(inShadow(indexBegin, length))
+            {
+                std::memcpy(shadowData.data() + indexBegin, data, length);
+            }
+            compactionCheck = true;
         }
+        return success;
+    }
+
+    // Find the address where to write new records
+    //
+    // Return false if there are invalid records, true if page can be
+    // written to
+    bool findEmpty(LogicalPage page, Address &emptyAddress)
+    {
+        bool hasInvalidRecords = false;
+        emptyAddress = getPageEnd(page);
+
+        forEachRecord(page, [&](Address address, const Record &record) -> bool
+        {
+            if(record.valid())
+            {
+                return false;
+            }
+            if(record.empty())
+            {
+                emptyAddress = address;
+            }
+            else
+            {
+                hasInvalidRecords = true;
+            }
+            return true;
+        });
+
+        return !hasInvalidRecords;
     }
 
     // Read values and find the address where to write new records
@@ -643,6 +786,9 @@ public:
         LogicalPage sourcePage = getActivePage();
         LogicalPage destinationPage = getAlternatePage();
 
+        // Abort a background page swap in progress
+        compactionState = CompactionState::Idle;
+
         // loop protects against marginal erase: if a page was kind of
         // erased and read back as all 0xFF but when values are written
         // some bits written as 1 actually become 0
@@ -689,6 +835,176 @@ public:
         return false;
     }
 
+    // Performs one step of a background page swap, or erases the old
+    // page after a page swap. Each step erases at most one page or
+    // writes at most CompactionBatchSize records, so that it can be
+    // called from an idle loop. Puts can be done between steps.
+    //
+    // A background page swap starts when the room left in the active
+    // page falls below CompactionThreshold records. The alternate page
+    // stays in the COPY state until all the values are copied, so a
+    // reset at any point leaves the active page untouched.
+    //
+    // Returns true if more steps are needed
+    bool compactStep()
+    {
+        switch(compactionState)
+        {
+            case CompactionState::Idle:
+                return startCompaction();
+            case CompactionState::Copy:
+                copyCompactionBatch();
+                return true;
+            case CompactionState::Activate:
+                activateCompaction();
+                return true;
+        }
+        return false;
+    }
+
+    // Completes a background page swap in progress
+    //
+    // Returns true if the active page changed
+    bool finishCompaction()
+    {
+        LogicalPage page = getActivePage();
+        while(compactionState != CompactionState::Idle)
+        {
+            compactStep();
+        }
+        return getActivePage() != page;
+    }
+
+    bool startCompaction()
+    {
+        LogicalPage sourcePage = getActivePage();
+        LogicalPage destinationPage = getAlternatePage();
+        if(sourcePage == LogicalPage::NoPage)
+        {
+            return false;
+        }
+
+        if(hasPendingErase())
+        {
+            performPendingErase();
+            return true;
+        }
+
+        if(!compactionCheck)
+        {
+            return false;
+        }
+
+        Address emptyAddress;
+        if(findEmpty(sourcePage, emptyAddress) &&
+                emptyAddress + CompactionThreshold * sizeof(Record) <= getPageEnd(sourcePage))
+        {
+            compactionCheck = false;
+            return false;
+        }
+
+        // Protect against a marginal erase
+        if(!verifyPage(destinationPage))
+        {
+            erasePage(destinationPage);
+            return true;
+        }
+
+        // If this fails, the page is erased again on the next step
+        if(writePageStatus(destinationPage, PageHeader::COPY))
+        {
+            compactionState = CompactionState::Copy;
+            compactionIndex = 0;
+            compactionAddress = getPageBegin(destinationPage) + sizeof(PageHeader);
+        }
+        return true;
+    }
+
+    void copyCompactionBatch()
+    {
+        LogicalPage sourcePage = getActivePage();
+        Address endAddress = getPageEnd(getAlternatePage());
+        bool success = true;
+
+        if(compactionIndex < capacity())
+        {
+            uint32_t indexEnd = std::min<uint32_t>(compactionIndex + CompactionBatchSize, capacity());
+            Data data[CompactionBatchSize];
+            readRange(compactionIndex, data, indexEnd - compactionIndex);
+
+            for(uint32_t index = compactionIndex; index < indexEnd && success; index++)
+            {
+                // Don't copy records that are 0xFF
+                if(data[index - compactionIndex] != FLASH_ERASED)
+                {
+                    success = writeRecord(compactionAddress, endAddress, Record(index, data[index - compactionIndex]));
+                    compactionAddress += sizeof(Record);
+                }
+            }
+            compactionIndex = indexEnd;
+        }
+        else
+        {
+            // Records beyond the capacity, only possible with records
+            // migrated from the legacy format
+            forEachUniqueValidRecord(sourcePage, [&](Address address, const Record &record)
+            {
+                if(record.index >= capacity() && record.data != FLASH_ERASED)
+                {
+                    success = success && writeRecord(compactionAddress, endAddress, Record(record.index, record.data));
+                    compactionAddress += sizeof(Record);
+                }
+            });
+            compactionIndex = std::numeric_limits<Index>::max() + 1;
+            compactionState = CompactionState::Activate;
+        }
+
+        if(!success)
+        {
+            // Give up, the alternate page is erased on the next step
+            compactionState = CompactionState::Idle;
+        }
+    }
+
+    void activateCompaction()
+    {
+        LogicalPage sourcePage = getActivePage();
+        LogicalPage destinationPage = getAlternatePage();
+
+        // Same order as in swapPagesAndWrite(). The old page gets
+        // erased on the next step
+        if(writePageStatus(destinationPage, PageHeader::ACTIVE))
+        {
+            writePageStatus(sourcePage, PageHeader::INACTIVE);
+        }
+        updateActivePage();
+    }
+
+    // Values that were already copied by a background page swap need to
+    // be written to the alternate page too
+    void copyChangedToCompaction(Index indexBegin, const Data *data, const Data *existingData, uint16_t length)
+    {
+        if(compactionState == CompactionState::Idle)
+        {
+            return;
+        }
+
+        Address endAddress = getPageEnd(getAlternatePage());
+        for(uint16_t i = 0; i < length; i++)
+        {
+            Index index = indexBegin + i;
+            if(index < compactionIndex && existingData[i] != data[i])
+            {
+                if(!writeRecord(compactionAddress, endAddress, Record(index, data[i])))
+                {
+                    compactionState = CompactionState::Idle;
+                    return;
+                }
+                compactionAddress += sizeof(Record);
+            }
+        }
+    }
+
     // Perform the actual copy of records during page swap
     bool copyAllRecordsToPageExcept(LogicalPage sourcePage,
             LogicalPage destinationPage,
@@ -698,6 +1014,22 @@ public:
     {
         bool success = true;
         Address endAddress = getPageEnd(destinationPage);
+
+        // The shadow holds the same records in the same index order
+        if(RamShadow && shadowValid && shadowComplete && sourcePage == getActivePage())
+        {
+            for(size_t index = 0; index < ShadowSize && success; index++)
+            {
+                const Data data = shadowData[index];
+                if(!(index >= exceptIndexBegin && index < exceptIndexEnd) && data != FLASH_ERASED)
+                {
+                    success = writeRecord(writeAddress, endAddress, Record(index, data));
+                    writeAddress += sizeof(Record);
+                }
+            }
+            return success;
+        }
+
         forEachUniqueValidRecord(sourcePage, [&](Address address, const Record &record)
         {
             // Don't copy the records that are being replaced or records that are 0xFF
@@ -756,4 +1088,25 @@ public:
 protected:
     LogicalPage activePage;
     LogicalPage alternatePage;
+
+    // Latest value of each byte when RamShadow is enabled
+    std::array<Data, ShadowSize> shadowData;
+    bool shadowValid = false;
+    // False if the active page has records beyond the capacity
+    bool shadowComplete = true;
+
+    enum class CompactionState
+    {
+        Idle,
+        Copy,
+        Activate
+    };
+
+    CompactionState compactionState = CompactionState::Idle;
+    // Next index to copy during a background page swap
+    uint32_t compactionIndex = 0;
+    // Where to write the next record in the alternate page
+    Address compactionAddress = 0;
+    // True if the active page was written to since it was last checked
+    bool compactionCheck = true;
 };
@@ -56,13 +56,15 @@ public:
     }
 
     int _open() {
+        if (fs_) {
+            return 0;
+        }
         auto fs = filesystem_get_instance(nullptr);
         SPARK_ASSERT(fs);
 
         FsLock lk(fs);
+        SPARK_ASSERT(!filesystem_mount(fs));
         fs_ = fs;
-
-        SPARK_ASSERT(!filesystem_mount(fs_));
         return 0;
     }
 
@@ -71,8 +73,8 @@ public:
      */
     int pushBack(void* item, uint16_t size) {
         // append a new item to the file
-        FsLock lk(fs_);
         _open();
+        FsLock lk(fs_);
         int ret = lfs_file_open(lfs(), &write_file_, path_, LFS_O_WRONLY | LFS_O_APPEND | LFS_O_CREAT);
         if (ret>=0) {
             QueueEntry entry = { .size = uint16_t(size+sizeof(QueueEntry)), .flags = QueueEntry::ACTIVE };
@@ -80,7 +82,7 @@ public:
             ret = preserve_error(file_write(&write_file_, item, size), ret);
             ret = preserve_error(lfs_file_close(lfs(), &write_file_), ret);   // always close even if there are other errors
         }
-        LOG(INFO, "add item to file queue %s, size %d, result %d", path_, size, ret);
+        LOG_DEBUG(TRACE, "add item to file queue %s, size %d, result %d", path_, size, ret);
         return ret;
     }
 
@@ -94,6 +96,7 @@ public:
      * @return SYSTEM_ERROR_NOT_FOUND when there is no such entry.
      */
     int front(QueueEntry& entry, void* buffer, uint16_t length) {
+        _open();
         FsLock lk(fs_);
         int ret = _front(entry, true);
         if (ret>=0) {
@@ -109,7 +112,7 @@ public:
 					ret = LFS_ERR_IO;
 				} else {
 					ret = 0;	// no error
-					LOG(INFO, "Retrieved entry from file queue, size %d", entry.size);
+					LOG_DEBUG(TRACE, "Retrieved entry from file queue, size %d", entry.size);
 				}
         	}
             ret = preserve_error(lfs_file_close(lfs(), &read_file_), ret);
@@ -155,6 +158,7 @@ public:
      * Remove the front item in the queue. This is done by clearing the ACTIVE flag in the queue entry.
      */
     int popFront() {
+        _open();
         FsLock lk(fs_);
         QueueEntry entry;
         int ret = _front(entry, true);
@@ -181,7 +185,7 @@ public:
             }
         }
         if (isLast && !ret) {
-        	LOG(INFO, "Removed last entry from file queue, deleting file %s", path_);
+        	LOG_DEBUG(TRACE, "Removed last entry from file queue, deleting file %s", path_);
             // when the last entry has been cleared remove the file
             ret = clear();
         }
@@ -189,6 +193,7 @@ public:
     }
 
     int clear() {
+    	_open();
     	FsLock lk(fs_);
     	return lfs_remove(lfs(), path_);
     }
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SERVICES_FIXED_BLOCK_POOL_H
+#define SERVICES_FIXED_BLOCK_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace particle {
+namespace services {
+
+/**
+ * A pool of up to 32 blocks of the same size.
+ *
+ * Blocks are claimed and released lock-free from a bitmask, so the pool can be shared between
+ * threads and interrupt handlers without disabling interrupts. Allocation fails instead of
+ * waiting when all blocks are in use.
+ */
+template<size_t BlockSize, size_t BlockCount>
+class FixedBlockPool {
+public:
+    FixedBlockPool();
+
+    void* alloc();
+    void free(void* ptr);
+
+    // Returns true if the pointer refers to a block of this pool
+    bool owns(const void* ptr) const;
+
+    size_t available() const;
+
+    static constexpr size_t blockSize() {
+        return BlockSize;
+    }
+
+    static constexpr size_t blockCount() {
+        return BlockCount;
+    }
+
+private:
+    static_assert(BlockCount > 0 && BlockCount <= 32, "Unsupported number of blocks");
+
+    static const size_t ALIGNED_BLOCK_SIZE = (BlockSize + alignof(std::max_align_t) - 1) &
+            ~(alignof(std::max_align_t) - 1);
+
+    alignas(std::max_align_t) uint8_t blocks_[BlockCount * ALIGNED_BLOCK_SIZE];
+    std::atomic<uint32_t> free_; // A bit per free block
+};
+
+template<size_t BlockSize, size_t BlockCount>
+inline FixedBlockPool<BlockSize, BlockCount>::FixedBlockPool() :
+        free_((BlockCount == 32) ? 0xffffffffu : (1u << BlockCount) - 1) {
+}
+
+template<size_t BlockSize, size_t BlockCount>
+inline void* FixedBlockPool<BlockSize, BlockCount>::alloc() {
+    uint32_t f = free_.load(std::memory_order_relaxed);
+    while (f) {
+        const uint32_t bit = f & (~f + 1);
+        if (free_.compare_exchange_weak(f, f & ~bit, std::memory_order_acquire, std::memory_order_relaxed)) {
+            return blocks_ + __builtin_ctz(bit) * ALIGNED_BLOCK_SIZE;
+        }
+    }
+    return nullptr;
+}
+
+template<size_t BlockSize, size_t BlockCount>
+inline void FixedBlockPool<BlockSize, BlockCount>::free(void* ptr) {
+    if (ptr) {
+        const size_t i = ((uint8_t*)ptr - blocks_) / ALIGNED_BLOCK_SIZE;
+        free_.fetch_or(1u << i, std::memory_order_release);
+    }
+}
+
+template<size_t BlockSize, size_t BlockCount>
+inline bool FixedBlockPool<BlockSize, BlockCount>::owns(const void* ptr) const {
+    const uint8_t* p = (const uint8_t*)ptr;
+    return p >= blocks_ && p < blocks_ + sizeof(blocks_);
+}
+
+template<size_t BlockSize, size_t BlockCount>
+inline size_t FixedBlockPool<BlockSize, BlockCount>::available() const {
+    return __builtin_popcount(free_.load(std::memory_order_relaxed));
+}
+
+} // namespace services
+} // namespace particle
+
+#endif // SERVICES_FIXED_BLOCK_POOL_H
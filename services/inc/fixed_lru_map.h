@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SERVICES_FIXED_LRU_MAP_H
+#define SERVICES_FIXED_LRU_MAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace particle {
+namespace services {
+
+/**
+ * A hash map with a fixed number of entries that never allocates memory.
+ *
+ * Lookups and updates take constant time. When the map is full, inserting a new key evicts the
+ * least recently used entry. Keys and values are expected to be plain data: they are copied in
+ * and out, and storage for all of the entries is part of the map object.
+ *
+ * `peek()` and `contains()` don't modify the map. All other methods do, and need to be serialized
+ * with any concurrent lookups.
+ */
+template<typename KeyT, typename ValueT, size_t N, typename HashT = std::hash<KeyT>,
+        typename EqualT = std::equal_to<KeyT>>
+class FixedLruMap {
+public:
+    typedef KeyT Key;
+    typedef ValueT Value;
+
+    FixedLruMap();
+
+    // Returns the value of the entry without marking it as recently used, or nullptr
+    const Value* peek(const Key& key) const;
+    bool contains(const Key& key) const;
+
+    // Returns the value of the entry and marks it as the most recently used one, or nullptr
+    Value* get(const Key& key);
+
+    // Adds or replaces an entry and marks it as the most recently used one. If the map is full,
+    // the least recently used entry is evicted
+    Value* put(const Key& key, const Value& value);
+
+    bool remove(const Key& key, Value* value = nullptr);
+    // Removes the least recently used entry. Returns false if the map is empty
+    bool removeOldest(Key* key = nullptr, Value* value = nullptr);
+    void clear();
+
+    // Calls `fn(const Key&, Value&)` for each entry, from the least to the most recently used one
+    template<typename F>
+    void forEach(F fn);
+
+    size_t size() const;
+    bool empty() const;
+    bool full() const;
+
+    static constexpr size_t capacity() {
+        return N;
+    }
+
+private:
+    static_assert(N > 0 && N < 0xffff, "Unsupported number of entries");
+
+    typedef uint16_t Index;
+
+    static const Index NONE = 0xffff;
+
+    // At least twice as many buckets as entries, and a power of two
+    static constexpr size_t bucketCount(size_t n = 1) {
+        return (n >= 2 * N) ? n : bucketCount(n * 2);
+    }
+
+    static const size_t BUCKET_COUNT = bucketCount();
+
+    struct Entry {
+        Key key;
+        Value value;
+        Index next; // Next entry in the same bucket, or in the list of free entries
+        Index newer;
+        Index older;
+    };
+
+    Entry entries_[N];
+    Index buckets_[BUCKET_COUNT];
+    Index newest_;
+    Index oldest_;
+    Index free_;
+    size_t size_;
+
+    size_t bucket(const Key& key) const;
+    Index find(const Key& key) const;
+    void touch(Index i);
+    void link(Index i);
+    void unlink(Index i);
+    void removeAt(Index i);
+};
+
+template<typename KeyT, typename ValueT, size_t N, typename HashT, typename EqualT>
+inline FixedLruMap<KeyT, ValueT, N, HashT, EqualT>::FixedLruMap() {
+    clear();
+}
+
+template<typename KeyT, typename ValueT, size_t N, typename HashT, typename EqualT>
+inline const ValueT* FixedLruMap<KeyT, ValueT, N, HashT, EqualT>::peek(const Key& key) const {
+    const Index i = find(key);
+    return (i != NONE) ? &entries_[i].value : nullptr;
+}
+
+template<typename KeyT, typename ValueT, size_t N, typename HashT, typename EqualT>
+inline bool FixedLruMap<KeyT, ValueT, N, HashT, EqualT>::contains(const Key& key) const {
+    return find(key) != NONE;
+}
+
+template<typename KeyT, typename ValueT, size_t N, typename HashT, typename EqualT>
+inline ValueT* FixedLruMap<KeyT, ValueT, N, HashT, EqualT>::get(const Key& key) {
+    const Index i = find(key);
+    if (i == NONE) {
+        return nullptr;
+    }
+    touch(i);
+    return &entries_[i].value;
+}
+
+template<typename KeyT, typename ValueT, size_t N, typename HashT, typename EqualT>
+inline ValueT* FixedLruMap<KeyT, ValueT, N, HashT, EqualT>::put(const Key& key, const Value& value) {
+    Index i = find(key);
+    if (i != NONE) {
+        entries_[i].value = value;
+        touch(i);
+        return &entries_[i].value;
+    }
+    if (free_ == NONE) {
+        removeAt(oldest_);
+    }
+    i = free_;
+    Entry& e = entries_[i];
+    free_ = e.next;
+    e.key = key;
+    e.value = value;
+    const size_t b = bucket(key);
+    e.next = buckets_[b];
+    buckets_[b] = i;
+    link(i);
+    ++size_;
+    return &e.value;
+}
+
+template<typename KeyT, typename ValueT, size_t N, typename HashT, typename EqualT>
+inline bool FixedLruMap<KeyT, ValueT, N, HashT, EqualT>::remove(const Key& key, Value* value) {
+    const Index i = find(key);
+    if (i == NONE) {
+        return false;
+    }
+    if (value) {
+        *value = entries_[i].value;
+    }
+    removeAt(i);
+    return true;
+}
+
+template<typename KeyT, typename ValueT, size_t N, typename HashT, typename EqualT>
+inline bool FixedLruMap<KeyT, ValueT, N, HashT, EqualT>::removeOldest(Key* key, Value* value) {
+    if (oldest_ == NONE) {
+        return false;
+    }
+    if (key) {
+        *key = entries_[oldest_].key;
+    }
+    if (value) {
+        *value = entries_[oldest_].value;
+    }
+    removeAt(oldest_);
+    return true;
+}
+
+template<typename KeyT, typename ValueT, size_t N, typename HashT, typename EqualT>
+inline void FixedLruMap<KeyT, ValueT, N, HashT, EqualT>::clear() {
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        buckets_[i] = NONE;
+    }
+    for (size_t i = 0; i < N; ++i) {
+        entries_[i].next = (i + 1 < N) ? i + 1 : NONE;
+    }
+    free_ = 0;
+    newest_ = NONE;
+    oldest_ = NONE;
+    size_ = 0;
+}
+
+template<typename KeyT, typename ValueT, size_t N, typename HashT, typename EqualT>
+template<typename F>
+inline void FixedLruMap<KeyT, ValueT, N, HashT, EqualT>::forEach(F fn) {
+    for (Index i = oldest_; i != NONE; i = entries_[i].newer) {
+        fn(static_cast<const Key&>(entries_[i].key), entries_[i].value);
+    }
+}
+
+template<typename KeyT, typename ValueT, size_t N, typename HashT, typename EqualT>
+inline size_t FixedLruMap<KeyT, ValueT, N, HashT, EqualT>::size() const {
+    return size_;
+}
+
+template<typename KeyT, typename ValueT, size_t N, typename HashT, typename EqualT>
+inline bool FixedLruMap<KeyT, ValueT, N, HashT, EqualT>::empty() const {
+    return size_ == 0;
+}
+
+template<typename KeyT, typename ValueT, size_t N, typename HashT, typename EqualT>
+inline bool FixedLruMap<KeyT, ValueT, N, HashT, EqualT>::full() const {
+    return size_ == N;
+}
+
+template<typename KeyT, typename ValueT, size_t N, typename HashT, typename EqualT>
+inline size_t FixedLruMap<KeyT, ValueT, N, HashT, EqualT>::bucket(const Key& key) const {
+    return HashT()(key) & (BUCKET_COUNT - 1);
+}
+
+template<typename KeyT, typename ValueT, size_t N, typename HashT, typename EqualT>
+inline typename FixedLruMap<KeyT, ValueT, N, HashT, EqualT>::Index
+FixedLruMap<KeyT, ValueT, N, HashT, EqualT>::find(const Key& key) const {
+    for (Index i = buckets_[bucket(key)]; i != NONE; i = entries_[i].next) {
+        if (EqualT()(entries_[i].key, key)) {
+            return i;
+        }
+    }
+    return NONE;
+}
+
+template<typename KeyT, typename ValueT, size_t N, typename HashT, typename EqualT>
+inline void FixedLruMap<KeyT, ValueT, N, HashT, EqualT>::touch(Index i) {
+    if (i != newest_) {
+        unlink(i);
+        link(i);
+    }
+}
+
+template<typename KeyT, typename ValueT, size_t N, typename HashT, typename EqualT>
+inline void FixedLruMap<KeyT, ValueT, N, HashT, EqualT>::link(Index i) {
+    Entry& e = entries_[i];
+    e.newer = NONE;
+    e.older = newest_;
+    if (newest_ != NONE) {
+        entries_[newest_].newer = i;
+    } else {
+        oldest_ = i;
+    }
+    newest_ = i;
+}
+
+template<typename KeyT, typename ValueT, size_t N, typename HashT, typename EqualT>
+inline void FixedLruMap<KeyT, ValueT, N, HashT, EqualT>::unlink(Index i) {
+    const Entry& e = entries_[i];
+    if (e.newer != NONE) {
+        entries_[e.newer].older = e.older;
+    } else {
+        newest_ = e.older;
+    }
+    if (e.older != NONE) {
+        entries_[e.older].newer = e.newer;
+    } else {
+        oldest_ = e.newer;
+    }
+}
+
+template<typename KeyT, typename ValueT, size_t N, typename HashT, typename EqualT>
+inline void FixedLruMap<KeyT, ValueT, N, HashT, EqualT>::removeAt(Index i) {
+    Entry& e = entries_[i];
+    Index* p = &buckets_[bucket(e.key)];
+    while (*p != i) {
+        p = &entries_[*p].next;
+    }
+    *p = e.next;
+    unlink(i);
+    e.next = free_;
+    free_ = i;
+    --size_;
+}
+
+} // namespace services
+} // namespace particle
+
+#endif // SERVICES_FIXED_LRU_MAP_H
@@ -128,6 +128,11 @@ public:
         write_count = count;
     }
 
+    int getWriteCount()
+    {
+        return write_count;
+    }
+
     int getEraseCount()
     {
         return erase_count;
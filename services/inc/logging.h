@@ -222,6 +222,19 @@ const char* log_level_name(int level, void *reserved);
 void log_set_callbacks(log_message_callback_type log_msg, log_write_callback_type log_write,
         log_enabled_callback_type log_enabled, void *reserved);
 
+// Enables deferred formatting of the messages generated by log_message(). Messages are captured in
+// binary form in the provided buffer and passed to the message callback by log_process_deferred(),
+// which is called periodically by a low priority thread on platforms with threading support. Format
+// strings and category names must remain valid until the messages are processed. The buffer must be
+// 4-byte aligned and its size must be a power of two, not smaller than 512 bytes
+int log_set_deferred_buffer(void *buffer, size_t size, void *reserved);
+
+// Formats deferred messages and passes them to the message callback. Returns the number of processed messages
+int log_process_deferred(void *reserved);
+
+// Returns the number of deferred messages dropped because the buffer was full
+uint32_t log_deferred_dropped(void *reserved);
+
 extern void HAL_Delay_Microseconds(uint32_t delay);
 
 #ifdef __cplusplus
@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "hal_platform.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if (defined(HAL_PLATFORM_FILESYSTEM) && HAL_PLATFORM_FILESYSTEM == 1)
+#include "filesystem.h"
+#endif
+
+namespace particle {
+
+namespace fs {
+
+/**
+ * A persistent FIFO queue of variable sized entries laid out as a ring in fixed size storage.
+ *
+ * Entries are appended at the tail and removed from the head without moving any other entry,
+ * so the storage never needs to be compacted. Appended entries are collected in a RAM buffer
+ * and written in batches. The position of the head is kept in a header at the start of the
+ * storage, which is only written by `sync()` or when the space freed by removed entries is
+ * needed. Entries removed since the header was last written are delivered again after a reset.
+ *
+ * Each entry carries a sequence number and a checksum, which is how the tail is found
+ * when the queue is loaded.
+ */
+class RingFileQueue {
+public:
+    /**
+     * The storage of the queue, addressed by byte offset.
+     */
+    class Storage {
+    public:
+        virtual ~Storage() = default;
+
+        /**
+         * Reads data. Data that has never been written reads as zeros.
+         */
+        virtual int read(size_t offset, void* data, size_t size) = 0;
+
+        virtual int write(size_t offset, const void* data, size_t size) = 0;
+
+        /**
+         * Makes the data written so far persistent. Called at the end of each operation
+         * on the queue that accessed the storage.
+         */
+        virtual int sync() = 0;
+    };
+
+    static const size_t WRITE_BUFFER_SIZE = 128;
+
+    /**
+     * Two copies of the header are written alternately, followed by the entries.
+     */
+    static const size_t DATA_OFFSET = 72;
+
+    /**
+     * @param storage The storage of the queue.
+     * @param capacity The size of the storage in bytes.
+     */
+    RingFileQueue(Storage* storage, size_t capacity);
+
+    /**
+     * Loads the queue from storage, or creates an empty queue if the storage doesn't hold a
+     * valid queue.
+     *
+     * @param seed A random number that distinguishes the entries of the new queue from any
+     *        data left in the storage.
+     */
+    int init(uint32_t seed);
+
+    /**
+     * Adds an entry to the back of the queue.
+     *
+     * @return SYSTEM_ERROR_LIMIT_EXCEEDED if the queue is full.
+     */
+    int pushBack(const void* data, size_t size);
+
+    /**
+     * Retrieves the entry at the front of the queue.
+     *
+     * @return The size of the entry, SYSTEM_ERROR_NOT_FOUND if the queue is empty, or
+     *         SYSTEM_ERROR_TOO_LARGE if the buffer is too small.
+     */
+    int front(void* data, size_t size);
+
+    /**
+     * Removes the entry at the front of the queue.
+     */
+    int popFront();
+
+    /**
+     * Writes the buffered entries and the position of the head to storage.
+     */
+    int sync();
+
+    /**
+     * Removes all entries.
+     */
+    int clear();
+
+    size_t size() const {
+        return count_;
+    }
+
+    bool isEmpty() const {
+        return !count_;
+    }
+
+    /**
+     * Returns true if there is data that hasn't been written to storage yet.
+     */
+    bool isDirty() const {
+        return bufLen_ || headDirty_;
+    }
+
+    size_t maxEntrySize() const;
+
+    /**
+     * The number of bytes written to storage over the lifetime of the queue.
+     */
+    uint32_t bytesWritten() const {
+        return written_;
+    }
+
+    /**
+     * The number of times the tail wrapped around to the start of the storage. Each wrap
+     * writes every byte of the storage once.
+     */
+    uint32_t wraps() const {
+        return wraps_;
+    }
+
+private:
+    struct __attribute__((packed)) Header {
+        uint32_t magic;
+        uint32_t epoch;
+        uint32_t generation;
+        uint32_t capacity;
+        uint32_t head;
+        uint32_t headSeq;
+        uint32_t wraps;
+        uint32_t written;
+        uint32_t check;
+    };
+
+    struct __attribute__((packed)) EntryHeader {
+        uint32_t seq;
+        uint16_t size;
+        uint16_t reserved;
+        uint32_t check;
+    };
+
+    Storage* storage_;
+    size_t capacity_;
+    uint32_t epoch_;
+    uint32_t generation_;
+    size_t head_;
+    uint32_t headSeq_;
+    size_t tail_;
+    uint32_t tailSeq_;
+    size_t count_;
+    // Position of the head when the header was last written, and the number of entries removed since
+    size_t savedHead_;
+    size_t savedPops_;
+    uint32_t wraps_;
+    uint32_t written_;
+    bool headDirty_;
+
+    uint8_t buf_[WRITE_BUFFER_SIZE];
+    size_t bufOffset_;
+    size_t bufLen_;
+
+    int load(const Header& h);
+    int format(uint32_t epoch);
+    int writeHeader();
+    int readEntryHeader(size_t offset, EntryHeader* h);
+    int append(size_t offset, const void* data, size_t size);
+    int read(size_t offset, void* data, size_t size);
+    int flush();
+    int skipWrap();
+    int syncStorage(int result);
+    size_t wrap(size_t offset) const;
+    size_t place(size_t size, size_t head, bool empty) const;
+    uint32_t entryCheck(uint32_t seq, uint16_t size) const;
+};
+
+#if (defined(HAL_PLATFORM_FILESYSTEM) && HAL_PLATFORM_FILESYSTEM == 1)
+
+/**
+ * Storage for a `RingFileQueue` split across a directory of fixed size files.
+ *
+ * The filesystem can only have one file open at a time, and rewrites the rest of a file
+ * when data in the middle of it changes. Using small segment files bounds the cost of
+ * writing anywhere in the ring to a single segment, and the file is only kept open
+ * (with the filesystem locked) until the queue syncs its storage.
+ */
+class SegmentedFileStorage: public RingFileQueue::Storage {
+public:
+    /**
+     * @param dir The directory holding the segment files.
+     * @param segmentSize The size of each segment file. The queue header has a file of its own.
+     */
+    SegmentedFileStorage(const char* dir, size_t segmentSize);
+    ~SegmentedFileStorage();
+
+    int read(size_t offset, void* data, size_t size) override;
+    int write(size_t offset, const void* data, size_t size) override;
+    int sync() override;
+
+private:
+    const char* dir_;
+    size_t segmentSize_;
+    filesystem_t* fs_;
+    lfs_file_t file_;
+    int segment_; // Segment of the open file, or -1
+    bool locked_;
+    bool dirCreated_;
+
+    int open(int segment);
+    int closeFile();
+    int segmentOf(size_t offset, size_t* segmentOffset, size_t* segmentLeft) const;
+};
+
+#endif // HAL_PLATFORM_FILESYSTEM
+
+} // fs
+
+} // particle
@@ -110,6 +110,10 @@ DYNALIB_FN(55, services, pb_encode_varint, bool(pb_ostream_t*, pb_uint64_t))
 # define BASE_IDX 40
 #endif
 
+DYNALIB_FN(BASE_IDX + 0, services, log_set_deferred_buffer, int(void*, size_t, void*))
+DYNALIB_FN(BASE_IDX + 1, services, log_process_deferred, int(void*))
+DYNALIB_FN(BASE_IDX + 2, services, log_deferred_dropped, uint32_t(void*))
+
 DYNALIB_END(services)
 
 #undef BASE_IDX
@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SERVICES_SPSC_RING_BUFFER_H
+#define SERVICES_SPSC_RING_BUFFER_H
+
+#include <atomic>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include "system_error.h"
+
+namespace particle {
+namespace services {
+
+/**
+ * A lock-free ring buffer for a single producer and a single consumer.
+ *
+ * The producer and the consumer may run in different threads, or one of them in an interrupt
+ * handler, without disabling interrupts: only the producer advances the head and only the consumer
+ * advances the tail. The size of the buffer must be a power of two. The head and tail are free
+ * running counters, so the whole buffer can be filled.
+ *
+ * `acquire()` and `consume()` return contiguous regions of the buffer that can be handed to DMA or
+ * `memcpy()`, and the data is published or released with `acquireCommit()` and `consumeCommit()`.
+ *
+ * `reset()` is not thread-safe.
+ */
+template <typename T>
+class SpscRingBuffer {
+public:
+    SpscRingBuffer();
+    SpscRingBuffer(T* buffer, size_t size);
+
+    int init(T* buffer, size_t size);
+    void reset();
+
+    size_t size() const;
+
+    // Number of elements that can be read
+    size_t data() const;
+    // Number of elements that can be written
+    size_t space() const;
+
+    bool empty() const;
+    bool full() const;
+
+    // Producer
+
+    bool put(const T& v);
+    // Returns the number of elements written, which may be less than `size`
+    size_t put(const T* v, size_t size);
+
+    // Returns the largest contiguous region that can be written and its size, or nullptr if the buffer is full
+    T* acquire(size_t* size);
+    void acquireCommit(size_t size);
+
+    // Consumer
+
+    bool get(T* v);
+    // Returns the number of elements read, which may be less than `size`
+    size_t get(T* v, size_t size);
+    size_t peek(T* v, size_t size, size_t offset = 0) const;
+    // Returns the element at the given offset from the tail. The offset must be less than `data()`
+    T peekAt(size_t offset) const;
+    size_t skip(size_t size);
+
+    // Returns the largest contiguous region that can be read and its size, or nullptr if the buffer is empty
+    T* consume(size_t* size);
+    void consumeCommit(size_t size);
+
+    // Total number of elements read since the last reset, wraps around
+    size_t readCount() const;
+
+private:
+    T* buffer_;
+    size_t mask_;
+    std::atomic<size_t> head_; // Written by the producer
+    std::atomic<size_t> tail_; // Written by the consumer
+
+    static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+};
+
+template <typename T>
+inline SpscRingBuffer<T>::SpscRingBuffer()
+        : buffer_(nullptr),
+          mask_(0),
+          head_(0),
+          tail_(0) {
+}
+
+template <typename T>
+inline SpscRingBuffer<T>::SpscRingBuffer(T* buffer, size_t size)
+        : SpscRingBuffer() {
+    init(buffer, size);
+}
+
+template <typename T>
+inline int SpscRingBuffer<T>::init(T* buffer, size_t size) {
+    if (!buffer || !size || (size & (size - 1))) {
+        return SYSTEM_ERROR_INVALID_ARGUMENT;
+    }
+    buffer_ = buffer;
+    mask_ = size - 1;
+    reset();
+    return 0;
+}
+
+template <typename T>
+inline void SpscRingBuffer<T>::reset() {
+    head_.store(0, std::memory_order_relaxed);
+    tail_.store(0, std::memory_order_relaxed);
+}
+
+template <typename T>
+inline size_t SpscRingBuffer<T>::size() const {
+    return buffer_ ? mask_ + 1 : 0;
+}
+
+template <typename T>
+inline size_t SpscRingBuffer<T>::data() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+}
+
+template <typename T>
+inline size_t SpscRingBuffer<T>::space() const {
+    return size() - data();
+}
+
+template <typename T>
+inline bool SpscRingBuffer<T>::empty() const {
+    return data() == 0;
+}
+
+template <typename T>
+inline bool SpscRingBuffer<T>::full() const {
+    return space() == 0;
+}
+
+template <typename T>
+inline bool SpscRingBuffer<T>::put(const T& v) {
+    return put(&v, 1) == 1;
+}
+
+template <typename T>
+inline size_t SpscRingBuffer<T>::put(const T* v, size_t size) {
+    size_t n = 0;
+    while (n < size) {
+        size_t avail = 0;
+        T* p = acquire(&avail);
+        if (!p) {
+            break;
+        }
+        avail = std::min(avail, size - n);
+        memcpy(p, v + n, avail * sizeof(T));
+        acquireCommit(avail);
+        n += avail;
+    }
+    return n;
+}
+
+template <typename T>
+inline T* SpscRingBuffer<T>::acquire(size_t* size) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    const size_t free = this->size() - (head - tail_.load(std::memory_order_acquire));
+    if (!free) {
+        *size = 0;
+        return nullptr;
+    }
+    const size_t pos = head & mask_;
+    *size = std::min(free, mask_ + 1 - pos);
+    return buffer_ + pos;
+}
+
+template <typename T>
+inline void SpscRingBuffer<T>::acquireCommit(size_t size) {
+    head_.store(head_.load(std::memory_order_relaxed) + size, std::memory_order_release);
+}
+
+template <typename T>
+inline bool SpscRingBuffer<T>::get(T* v) {
+    return get(v, 1) == 1;
+}
+
+template <typename T>
+inline size_t SpscRingBuffer<T>::get(T* v, size_t size) {
+    size_t n = 0;
+    while (n < size) {
+        size_t avail = 0;
+        T* p = consume(&avail);
+        if (!p) {
+            break;
+        }
+        avail = std::min(avail, size - n);
+        memcpy(v + n, p, avail * sizeof(T));
+        consumeCommit(avail);
+        n += avail;
+    }
+    return n;
+}
+
+template <typename T>
+inline size_t SpscRingBuffer<T>::peek(T* v, size_t size, size_t offset) const {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    const size_t avail = head_.load(std::memory_order_acquire) - tail;
+    if (offset >= avail) {
+        return 0;
+    }
+    size = std::min(size, avail - offset);
+    const size_t pos = (tail + offset) & mask_;
+    const size_t first = std::min(size, mask_ + 1 - pos);
+    memcpy(v, buffer_ + pos, first * sizeof(T));
+    memcpy(v + first, buffer_, (size - first) * sizeof(T));
+    return size;
+}
+
+template <typename T>
+inline T SpscRingBuffer<T>::peekAt(size_t offset) const {
+    return buffer_[(tail_.load(std::memory_order_relaxed) + offset) & mask_];
+}
+
+template <typename T>
+inline size_t SpscRingBuffer<T>::skip(size_t size) {
+    size = std::min(size, data());
+    consumeCommit(size);
+    return size;
+}
+
+template <typename T>
+inline size_t SpscRingBuffer<T>::readCount() const {
+    return tail_.load(std::memory_order_relaxed);
+}
+
+template <typename T>
+inline T* SpscRingBuffer<T>::consume(size_t* size) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    const size_t avail = head_.load(std::memory_order_acquire) - tail;
+    if (!avail) {
+        *size = 0;
+        return nullptr;
+    }
+    const size_t pos = tail & mask_;
+    *size = std::min(avail, mask_ + 1 - pos);
+    return buffer_ + pos;
+}
+
+template <typename T>
+inline void SpscRingBuffer<T>::consumeCommit(size_t size) {
+    tail_.store(tail_.load(std::memory_order_relaxed) + size, std::memory_order_release);
+}
+
+} // services
+} // particle
+
+#endif // SERVICES_SPSC_RING_BUFFER_H
@@ -0,0 +1,398 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SERVICES_TIMER_WHEEL_H
+#define SERVICES_TIMER_WHEEL_H
+
+#include "spark_wiring_interrupts.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace particle {
+namespace services {
+
+/**
+ * A hierarchical timer wheel.
+ *
+ * Four levels of 64 slots cover 2^24 ticks, timers that are due later are parked in the top level
+ * and cascaded again. Starting and stopping a timer takes constant time, and all timers due on the
+ * same tick expire in one pass over a single slot. Timers are owned by the caller, the wheel never
+ * allocates memory.
+ *
+ * `start()` and `stop()` can be called from any thread or an ISR, including from a timer callback.
+ * `advance()` needs to be called from one thread at a time.
+ */
+class TimerWheel {
+public:
+    typedef void (*Callback)(void* data);
+
+    class Timer {
+    public:
+        Timer(Callback callback, void* data);
+
+        bool isActive() const;
+        uint32_t period() const;
+
+    private:
+        Timer* next_;
+        Timer* prev_;
+        Callback callback_;
+        void* data_;
+        uint32_t expiry_;
+        uint32_t period_;
+        int16_t slot_; // Index in the slot table, or -1 if the timer is not active
+
+        friend class TimerWheel;
+    };
+
+    struct Stats {
+        // Number of expirations
+        uint32_t expired;
+        // Number of periodic expirations skipped because the wheel was advanced too late
+        uint32_t overruns;
+        // Maximum and total number of ticks between the expiration time of a timer and the time
+        // at which the wheel was advanced past it
+        uint32_t maxLateness;
+        uint64_t totalLateness;
+    };
+
+    enum: uint32_t {
+        NO_TIMERS = 0xffffffff
+    };
+
+    explicit TimerWheel(uint32_t now = 0);
+
+    /**
+     * Starts or restarts a timer.
+     *
+     * The timer expires `delay` ticks after the time the wheel was last advanced to, and then
+     * every `period` ticks if `period` is not 0. A delay of 0 is treated as 1 tick.
+     */
+    void start(Timer* timer, uint32_t delay, uint32_t period = 0);
+    /**
+     * Starts or restarts a timer that expires at the time `expiry`. A timer that is due at or
+     * before the time the wheel was last advanced to expires on the next tick.
+     */
+    void startAt(Timer* timer, uint32_t expiry, uint32_t period = 0);
+    /**
+     * Stops a timer. Doesn't wait for a callback that is already running.
+     */
+    void stop(Timer* timer);
+
+    /**
+     * Advances the wheel to the time `now` and invokes the callbacks of the expired timers.
+     *
+     * Returns the number of expired timers.
+     */
+    size_t advance(uint32_t now);
+
+    /**
+     * Returns the number of ticks after which the wheel needs to be advanced again, or
+     * `NO_TIMERS` if no timers are active. The returned value is less than the time until the
+     * next expiration when the timers of an upper level need to be cascaded first.
+     */
+    uint32_t nextTimeout() const;
+
+    /**
+     * Returns true if the callback of the timer is being invoked by `advance()`. Can be used to
+     * wait for the callback to return before destroying the timer.
+     */
+    bool isExpiring(const Timer* timer) const;
+
+    uint32_t time() const;
+    size_t activeCount() const;
+
+    Stats stats() const;
+    void resetStats();
+
+private:
+    static const unsigned LEVEL_BITS = 6;
+    static const unsigned SLOTS = 1 << LEVEL_BITS;
+    static const unsigned LEVELS = 4;
+
+    Timer* slots_[LEVELS * SLOTS];
+    uint64_t occupied_[LEVELS]; // A bit per non-empty slot
+    uint32_t next_; // Next tick to process
+    uint32_t time_; // Time the wheel was last advanced to
+    size_t count_;
+    const Timer* volatile expiring_;
+    Stats stats_;
+
+    Timer* popExpired(uint32_t now);
+    uint32_t nextTick() const;
+    void cascade(unsigned level);
+    void insert(Timer* timer);
+    void remove(Timer* timer);
+};
+
+inline TimerWheel::Timer::Timer(Callback callback, void* data) :
+        next_(nullptr),
+        prev_(nullptr),
+        callback_(callback),
+        data_(data),
+        expiry_(0),
+        period_(0),
+        slot_(-1) {
+}
+
+inline bool TimerWheel::Timer::isActive() const {
+    return slot_ >= 0;
+}
+
+inline uint32_t TimerWheel::Timer::period() const {
+    return period_;
+}
+
+inline uint32_t TimerWheel::time() const {
+    return time_;
+}
+
+inline size_t TimerWheel::activeCount() const {
+    return count_;
+}
+
+inline bool TimerWheel::isExpiring(const Timer* timer) const {
+    return expiring_ == timer;
+}
+
+inline TimerWheel::TimerWheel(uint32_t now) :
+        slots_(),
+        occupied_(),
+        next_(now + 1),
+        time_(now),
+        count_(0),
+        expiring_(nullptr),
+        stats_() {
+}
+
+inline void TimerWheel::start(Timer* timer, uint32_t delay, uint32_t period) {
+    ATOMIC_BLOCK() {
+        if (timer->isActive()) {
+            remove(timer);
+        }
+        // Relative to the time passed to advance(), so that a timer restarted from its callback
+        // doesn't expire again during the same call
+        timer->expiry_ = time_ + (delay ? delay : 1);
+        timer->period_ = period;
+        insert(timer);
+    }
+}
+
+inline void TimerWheel::startAt(Timer* timer, uint32_t expiry, uint32_t period) {
+    ATOMIC_BLOCK() {
+        if (timer->isActive()) {
+            remove(timer);
+        }
+        timer->expiry_ = ((int32_t)(expiry - time_) > 0) ? expiry : time_ + 1;
+        timer->period_ = period;
+        insert(timer);
+    }
+}
+
+inline void TimerWheel::stop(Timer* timer) {
+    ATOMIC_BLOCK() {
+        if (timer->isActive()) {
+            remove(timer);
+        }
+    }
+}
+
+inline size_t TimerWheel::advance(uint32_t now) {
+    ATOMIC_BLOCK() {
+        time_ = now;
+    }
+    size_t n = 0;
+    for (;;) {
+        Callback callback = nullptr;
+        void* data = nullptr;
+        ATOMIC_BLOCK() {
+            const auto timer = popExpired(now);
+            if (timer) {
+                callback = timer->callback_;
+                data = timer->data_;
+                expiring_ = timer;
+            }
+        }
+        if (!callback) {
+            break;
+        }
+        // The timer can be restarted, stopped or destroyed by its callback
+        callback(data);
+        expiring_ = nullptr;
+        ++n;
+    }
+    return n;
+}
+
+inline uint32_t TimerWheel::nextTimeout() const {
+    uint32_t ticks = NO_TIMERS;
+    ATOMIC_BLOCK() {
+        if (count_ > 0) {
+            ticks = nextTick() - time_;
+        }
+    }
+    return ticks;
+}
+
+inline TimerWheel::Stats TimerWheel::stats() const {
+    Stats s = {};
+    ATOMIC_BLOCK() {
+        s = stats_;
+    }
+    return s;
+}
+
+inline void TimerWheel::resetStats() {
+    ATOMIC_BLOCK() {
+        stats_ = Stats();
+    }
+}
+
+inline TimerWheel::Timer* TimerWheel::popExpired(uint32_t now) {
+    while ((int32_t)(now - next_) >= 0) {
+        const unsigned index = next_ & (SLOTS - 1);
+        const auto timer = slots_[index];
+        if (timer) {
+            remove(timer);
+            const uint32_t lateness = now - timer->expiry_;
+            ++stats_.expired;
+            stats_.totalLateness += lateness;
+            if (lateness > stats_.maxLateness) {
+                stats_.maxLateness = lateness;
+            }
+            if (timer->period_) {
+                // Keep the phase of the timer, skip the periods that have already passed
+                timer->expiry_ += timer->period_;
+                if ((int32_t)(timer->expiry_ - now) <= 0) {
+                    const uint32_t missed = (now - timer->expiry_) / timer->period_ + 1;
+                    stats_.overruns += missed;
+                    timer->expiry_ += missed * timer->period_;
+                }
+                insert(timer);
+            }
+            return timer;
+        }
+        // Skip the ticks on which there's nothing to do
+        uint32_t next = count_ ? nextTick() : now + 1;
+        if ((int32_t)(next - (now + 1)) > 0) {
+            next = now + 1;
+        }
+        next_ = next;
+        if (!(next_ & (SLOTS - 1))) {
+            for (unsigned level = 1; level < LEVELS; ++level) {
+                cascade(level);
+                if ((next_ >> (level * LEVEL_BITS)) & (SLOTS - 1)) {
+                    break;
+                }
+            }
+        }
+    }
+    return nullptr;
+}
+
+// Returns the next tick on which a slot of the first level is occupied or an occupied slot of an
+// upper level needs to be cascaded
+inline uint32_t TimerWheel::nextTick() const {
+    uint32_t ticks = NO_TIMERS;
+    for (unsigned level = 0; level < LEVELS; ++level) {
+        if (!occupied_[level]) {
+            continue;
+        }
+        // The current slot of an upper level has already been cascaded
+        const unsigned shift = level * LEVEL_BITS;
+        const unsigned first = level ? 1 : 0;
+        const unsigned index = ((next_ >> shift) + first) & (SLOTS - 1);
+        const uint64_t occupied = index ? (occupied_[level] >> index) | (occupied_[level] << (SLOTS - index)) :
+                occupied_[level];
+        const uint32_t t = ((next_ >> shift) + first + __builtin_ctzll(occupied)) << shift;
+        if (t - next_ < ticks) {
+            ticks = t - next_;
+        }
+    }
+    return next_ + ticks;
+}
+
+inline void TimerWheel::cascade(unsigned level) {
+    const unsigned index = (next_ >> (level * LEVEL_BITS)) & (SLOTS - 1);
+    auto timer = slots_[level * SLOTS + index];
+    if (!timer) {
+        return;
+    }
+    slots_[level * SLOTS + index] = nullptr;
+    occupied_[level] &= ~(1ull << index);
+    while (timer) {
+        const auto next = timer->next_;
+        --count_;
+        insert(timer);
+        timer = next;
+    }
+}
+
+inline void TimerWheel::insert(Timer* timer) {
+    const int32_t delta = timer->expiry_ - next_;
+    unsigned level = 0;
+    unsigned index = 0;
+    if (delta < 0) {
+        // Overdue, expire on the next tick
+        index = next_ & (SLOTS - 1);
+    } else {
+        uint32_t expiry = timer->expiry_;
+        while (level < LEVELS - 1 && (uint32_t)delta >= (1u << ((level + 1) * LEVEL_BITS))) {
+            ++level;
+        }
+        if ((uint32_t)delta >= (1u << (LEVELS * LEVEL_BITS))) {
+            // Park the timer in the furthest slot, it's cascaded again when that slot is reached
+            expiry = next_ + (1u << (LEVELS * LEVEL_BITS)) - 1;
+        }
+        index = (expiry >> (level * LEVEL_BITS)) & (SLOTS - 1);
+    }
+    const unsigned slot = level * SLOTS + index;
+    timer->prev_ = nullptr;
+    timer->next_ = slots_[slot];
+    if (timer->next_) {
+        timer->next_->prev_ = timer;
+    }
+    slots_[slot] = timer;
+    timer->slot_ = slot;
+    occupied_[level] |= 1ull << index;
+    ++count_;
+}
+
+inline void TimerWheel::remove(Timer* timer) {
+    const unsigned slot = timer->slot_;
+    if (timer->prev_) {
+        timer->prev_->next_ = timer->next_;
+    } else {
+        slots_[slot] = timer->next_;
+        if (!timer->next_) {
+            occupied_[slot / SLOTS] &= ~(1ull << (slot % SLOTS));
+        }
+    }
+    if (timer->next_) {
+        timer->next_->prev_ = timer->prev_;
+    }
+    timer->next_ = nullptr;
+    timer->prev_ = nullptr;
+    timer->slot_ = -1;
+    --count_;
+}
+
+} // namespace services
+} // namespace particle
+
+#endif // SERVICES_TIMER_WHEEL_H
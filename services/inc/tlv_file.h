@@ -19,16 +19,40 @@
 #define SERVICES_TLV_FILE_H
 
 #include "filesystem.h"
+#include "spark_wiring_vector.h"
 #include <stdio.h>
 
 namespace particle { namespace services { namespace settings {
 
 static constexpr uint32_t TLV_FILE_MAGICK = 0x714f11e5;
+/* Footer magick of a file that contains tombstones. Firmware that doesn't know about tombstones
+ * discards such a file instead of reading deleted entries back */
+static constexpr uint32_t TLV_FILE_TOMBSTONES_MAGICK = 0x714f11e6;
+/* Footer version of a file that contains tombstones. Other files have version 0 */
+static constexpr uint16_t TLV_FILE_VERSION = 1;
 static constexpr uint32_t TLV_HEADER_MAGICK = 0x4ead;
+/* Header of a record that deletes the entry at the offset stored in its data */
+static constexpr uint32_t TLV_TOMBSTONE_MAGICK = 0x4dea;
+
+/*
+ * By default, entries are looked up by scanning the file, deleted entries are removed by moving
+ * the entries that follow them, and the file never contains tombstones.
+ *
+ * With INDEXED, entries are never modified in place. New entries and tombstones marking deleted
+ * entries are appended to the end of the file, and the file is rewritten without the deleted
+ * entries once they take up more space than the live ones. The offsets of the live entries are
+ * kept in a directory in RAM, which is loaded with a single pass over the file on first access.
+ * A file without tombstones is readable in either mode, a file with tombstones is rewritten
+ * without them when it's opened without INDEXED.
+ */
 
 class TlvFile {
 public:
-    TlvFile(const char* path);
+    enum Flag {
+        INDEXED = 0x01 /* Keep a directory of the entries in RAM and append updates */
+    };
+
+    TlvFile(const char* path, unsigned flags = 0);
     ~TlvFile();
 
     int init();
@@ -65,6 +89,17 @@ private:
     } __attribute__((__packed__));
     static_assert(sizeof(TlvHeader) == sizeof(uint32_t) * 2, "sizeof(TlvHeader) != 8");
 
+    struct DirEntry {
+        uint32_t offset;
+        uint16_t key;
+        uint16_t length;
+    };
+
+    /* The file is compacted once deleted entries take up at least this many bytes */
+    static constexpr size_t COMPACT_MIN_GARBAGE = 1024;
+    /* Size of the chunks in which entries are moved or copied */
+    static constexpr size_t COPY_CHUNK_SIZE = 256;
+
 private:
     lfs_t* lfs();
 
@@ -75,18 +110,34 @@ private:
     int mkdir(char* dir);
 
     ssize_t find(uint16_t key, int index, uint16_t* dataSize);
+    ssize_t scan(uint16_t key, int index, uint16_t* dataSize);
     int readFooter(FileFooter& footer);
 
+    int append(uint16_t key, const uint8_t* value, uint16_t length);
+    int erase(uint16_t key, int index);
+    int migrate();
+
+    int loadDirectory();
+    int findEntry(uint16_t key, int* count);
+    int update(uint16_t key, int first, int count, const uint8_t* value, uint16_t length, bool addValue);
+    int writeRecord(uint16_t magick, uint16_t key, const uint8_t* value, uint16_t length);
+    int compact();
+
     ssize_t seek(ssize_t offset, int whence = SEEK_SET);
     ssize_t read(uint8_t* buf, size_t length);
     ssize_t write(const uint8_t* buf, size_t length);
 
 private:
     char* path_;
+    bool indexed_ = false;
 
     bool open_ = false;
     filesystem_t* fs_ = nullptr;
     lfs_file_t file_ = {};
+
+    spark::Vector<DirEntry> dir_; /* Sorted by key, entries with the same key are in file order */
+    size_t garbage_ = 0; /* Size of deleted entries and tombstones */
+    bool dirValid_ = false;
 };
 
 } } } /* namespace particle::services::settings */
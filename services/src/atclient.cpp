@@ -115,8 +115,11 @@ int AtClientBase::run() {
         case State::COMMAND_SENT:
         case State::INTERMEDIATE_RESULT_CODE:
         case State::INFORMATION_TEXT: {
-            resetData();
-            int r = readLine(buffer_, sizeof(buffer_), true);
+            int r = 0;
+            do {
+                resetData();
+                r = readLine(buffer_, sizeof(buffer_), true);
+            } while (r > 0 && handleUrc(buffer_, r));
             if (r < 0) {
                 setState(State::ERROR);
             } else {
@@ -234,6 +237,8 @@ bool AtClientBase::isFinalResultCode(ResultCode code) {
 }
 
 int AtClientBase::sendCommand(const char* fmt, ...) {
+    // The responses of the queued commands would be mixed with the response of this one
+    CHECK_TRUE(queueCount_ == 0, SYSTEM_ERROR_BUSY);
     waitReady(ATCLIENT_DEFAULT_TIMEOUT * 2);
     CHECK_TRUE(state_ == State::READY || state_ == State::FINAL_RESULT_CODE, SYSTEM_ERROR_INVALID_STATE);
 
@@ -296,6 +301,233 @@ int AtClientBase::waitState(State state) {
     return 0;
 }
 
+int AtClientBase::queueCommand(CommandCallback callback, void* data, unsigned int timeout, Order order,
+        const char* fmt, ...) {
+    CHECK_TRUE(queueCount_ < ATCLIENT_QUEUE_SIZE, SYSTEM_ERROR_LIMIT_EXCEEDED);
+    QueuedCommand& cmd = queuedCommand(queueCount_);
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(cmd.command, sizeof(cmd.command), fmt, args);
+    va_end(args);
+    CHECK_TRUE(n > 0, SYSTEM_ERROR_UNKNOWN);
+    CHECK_TRUE(n < (int)(sizeof(cmd.command) - strlen(getTerminator())), SYSTEM_ERROR_TOO_LARGE);
+    strcpy(cmd.command + n, getTerminator());
+    cmd.callback = callback;
+    cmd.data = data;
+    cmd.timeout = timeout ? timeout : timeout_;
+    cmd.order = order;
+    ++queueCount_;
+    return 0;
+}
+
+int AtClientBase::processQueue() {
+    if (state_ == State::NOT_READY || state_ == State::ERROR) {
+        // Synchronize with the DCE before sending anything
+        run();
+        CHECK_TRUE(state_ == State::READY, SYSTEM_ERROR_INVALID_STATE);
+    }
+    CHECK_TRUE(state_ == State::READY || state_ == State::FINAL_RESULT_CODE, SYSTEM_ERROR_INVALID_STATE);
+    int r = sendQueuedCommands();
+    while (r == 0) {
+        const int n = readAvailableLine();
+        if (n <= 0) {
+            r = n;
+            break;
+        }
+        processQueuedLine(buffer_, n);
+        // Send the next command as soon as the previous one has completed
+        r = sendQueuedCommands();
+    }
+    if (sentCount_ > 0 && millis() - headStart_ >= queuedCommand(0).timeout) {
+        LOG(WARN, "Command timeout: \"%s\"", queuedCommand(0).command);
+        completeQueuedCommand(SYSTEM_ERROR_TIMEOUT, ResultCode::UNKNOWN);
+        // The response of the timed out command may still arrive and be taken for the response
+        // of the next pipelined command
+        abortSentCommands(SYSTEM_ERROR_ABORTED);
+    }
+    return r;
+}
+
+int AtClientBase::flushQueue(unsigned int timeout) {
+    const auto start = millis();
+    while (queueCount_ > 0) {
+        CHECK_TRUE(millis() - start < timeout, SYSTEM_ERROR_TIMEOUT);
+        const int r = processQueue();
+        if (r < 0 && r != SYSTEM_ERROR_TIMEOUT) {
+            return r;
+        }
+    }
+    return 0;
+}
+
+void AtClientBase::cancelQueue() {
+    if (sentCount_ > 0) {
+        abortSentCommands(SYSTEM_ERROR_CANCELLED);
+    }
+    while (queueCount_ > 0) {
+        completeQueuedCommand(SYSTEM_ERROR_CANCELLED, ResultCode::UNKNOWN);
+    }
+}
+
+size_t AtClientBase::getQueuedCommandCount() const {
+    return queueCount_;
+}
+
+int AtClientBase::addUrcHandler(const char* prefix, UrcHandler handler, void* data) {
+    CHECK_TRUE(prefix && handler, SYSTEM_ERROR_INVALID_ARGUMENT);
+    removeUrcHandler(prefix);
+    for (auto& h: urcHandlers_) {
+        if (!h.prefix) {
+            h.prefix = prefix;
+            h.handler = handler;
+            h.data = data;
+            return 0;
+        }
+    }
+    return SYSTEM_ERROR_LIMIT_EXCEEDED;
+}
+
+void AtClientBase::removeUrcHandler(const char* prefix) {
+    for (auto& h: urcHandlers_) {
+        if (h.prefix && !strcmp(h.prefix, prefix)) {
+            h = UrcHandlerEntry();
+        }
+    }
+}
+
+AtClientBase::QueuedCommand& AtClientBase::queuedCommand(size_t index) {
+    return queue_[(queueHead_ + index) % ATCLIENT_QUEUE_SIZE];
+}
+
+int AtClientBase::sendQueuedCommands() {
+    while (sentCount_ < queueCount_) {
+        const QueuedCommand& cmd = queuedCommand(sentCount_);
+        if (sentCount_ > 0 && (cmd.order == Order::SEQUENTIAL ||
+                queuedCommand(sentCount_ - 1).order == Order::SEQUENTIAL ||
+                sentCount_ >= ATCLIENT_PIPELINE_DEPTH)) {
+            break;
+        }
+        const size_t n = strlen(cmd.command);
+        const int r = stream_->write(cmd.command, n);
+        if (r != (int)n) {
+            if (sentCount_ == 0) {
+                completeQueuedCommand(r < 0 ? r : SYSTEM_ERROR_IO, ResultCode::UNKNOWN);
+                continue;
+            }
+            // Some bytes of the command might have been sent already
+            abortSentCommands(r < 0 ? r : SYSTEM_ERROR_IO);
+            return r < 0 ? r : SYSTEM_ERROR_IO;
+        }
+        LOG_DEBUG(TRACE, "Sending command: \"%s\"", cmd.command);
+        if (sentCount_ == 0) {
+            headStart_ = millis();
+        }
+        ++sentCount_;
+    }
+    return 0;
+}
+
+int AtClientBase::readAvailableLine() {
+    const size_t termLen = strlen(getTerminator());
+    while (stream_->availForRead() > 0) {
+        char c;
+        const int r = stream_->read(&c, 1);
+        if (r <= 0) {
+            return r;
+        }
+        if (linePos_ >= sizeof(buffer_) - 1) {
+            // Discard the beginning of a line that doesn't fit in the buffer
+            linePos_ = 0;
+        }
+        buffer_[linePos_++] = c;
+        if (endsWith(buffer_, linePos_, getTerminator(), termLen)) {
+            size_t n = stripNonPrintable(buffer_, linePos_ - termLen);
+            linePos_ = 0;
+            if (n == 0) {
+                continue;
+            }
+            buffer_[n] = '\0';
+            return n;
+        }
+    }
+    return 0;
+}
+
+void AtClientBase::processQueuedLine(char* line, size_t len) {
+    if (handleUrc(line, len)) {
+        return;
+    }
+    if (sentCount_ == 0) {
+        LOG_DEBUG(TRACE, "Unexpected line: \"%s\"", line);
+        return;
+    }
+    const auto code = parseResultCode(line, len);
+    if (isFinalResultCode(code)) {
+        completeQueuedCommand(0, code);
+        return;
+    }
+    const size_t termLen = strlen(getTerminator());
+    if (responsePos_ + len + termLen < sizeof(response_)) {
+        memcpy(response_ + responsePos_, line, len);
+        memcpy(response_ + responsePos_ + len, getTerminator(), termLen);
+        responsePos_ += len + termLen;
+        response_[responsePos_] = '\0';
+    } else {
+        responseTruncated_ = true;
+    }
+}
+
+void AtClientBase::completeQueuedCommand(int error, ResultCode code) {
+    // Copy the command, so that the callback can queue more commands
+    const QueuedCommand cmd = queuedCommand(0);
+    queueHead_ = (queueHead_ + 1) % ATCLIENT_QUEUE_SIZE;
+    --queueCount_;
+    if (sentCount_ > 0) {
+        --sentCount_;
+        // The DCE starts processing the next pipelined command now
+        headStart_ = millis();
+    }
+    if (!error && responseTruncated_) {
+        error = SYSTEM_ERROR_TOO_LARGE;
+    }
+    response_[responsePos_] = '\0';
+    if (cmd.callback) {
+        cmd.callback(error, code, response_, cmd.data);
+    }
+    responsePos_ = 0;
+    responseTruncated_ = false;
+    response_[0] = '\0';
+}
+
+void AtClientBase::abortSentCommands(int error) {
+    while (sentCount_ > 0) {
+        completeQueuedCommand(error, ResultCode::UNKNOWN);
+    }
+    // Responses of the aborted commands may still arrive, synchronize with the DCE again
+    linePos_ = 0;
+    setState(State::NOT_READY);
+}
+
+bool AtClientBase::handleUrc(char* line, size_t len) {
+    for (const auto& h: urcHandlers_) {
+        if (!h.prefix) {
+            continue;
+        }
+        const size_t n = strlen(h.prefix);
+        if (startsWith(line, len, h.prefix, n) && (len == n || line[n] == ':' || line[n] == '\r')) {
+            // The line is consumed by the handler, strip the terminator in place
+            const size_t termLen = strlen(getTerminator());
+            if (endsWith(line, len, getTerminator(), termLen)) {
+                line[len - termLen] = '\0';
+            }
+            LOG_DEBUG(TRACE, "URC: \"%s\"", line);
+            h.handler(line, h.data);
+            return true;
+        }
+    }
+    return false;
+}
+
 const char* AtClientBase::getInformationText() const {
     return informationText_;
 }
@@ -562,19 +794,26 @@ int BoronNcpAtClient::startMuxer() {
 }
 
 int BoronNcpAtClient::registerNet() {
-    int r = sendCommand("AT+CREG=2");
-    CHECK_TRUE(r > 0, r);
-
-    CHECK(waitFinalResultCode());
-    CHECK_TRUE(getFinalResultCode() == ResultCode::OK, SYSTEM_ERROR_UNKNOWN);
-
-    r = sendCommand("AT+CGREG=2");
-    CHECK_TRUE(r > 0, r);
-
-    CHECK(waitFinalResultCode());
-    CHECK_TRUE(getFinalResultCode() == ResultCode::OK, SYSTEM_ERROR_UNKNOWN);
-
-    return 0;
+    // The second command is sent as soon as the response to the first one is received
+    int result = 0;
+    const auto done = [](int error, ResultCode code, const char* response, void* data) {
+        const auto result = (int*)data;
+        if (*result == 0) {
+            *result = error ? error : (code == ResultCode::OK ? 0 : SYSTEM_ERROR_UNKNOWN);
+        }
+    };
+    int r = queueCommand(done, &result, 0, Order::SEQUENTIAL, "AT+CREG=2");
+    if (!r) {
+        r = queueCommand(done, &result, 0, Order::SEQUENTIAL, "AT+CGREG=2");
+    }
+    if (!r) {
+        r = flushQueue(getTimeout() * 2);
+    }
+    if (r < 0) {
+        cancelQueue();
+        return r;
+    }
+    return result;
 }
 
 int BoronNcpAtClient::isRegistered(bool w) {
@@ -0,0 +1,654 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "deferred_log.h"
+
+#include "system_error.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace particle {
+
+namespace {
+
+/*
+    A message is stored as a record that starts at a 4-byte boundary and never wraps around the
+    end of the buffer:
+
+    uint32_t state; // Size of the record and the flags below; written last
+    uint32_t time;
+    const char* fmt;
+    const char* category;
+    int32_t level;
+    uint8_t args[]; // Argument values, each padded to a multiple of 4 bytes
+
+    A string argument is stored as its length followed by its characters. A padding record fills
+    the end of the buffer when the next record doesn't fit there.
+*/
+const uint32_t RECORD_SIZE_MASK = 0x1fffffff;
+const uint32_t RECORD_COMMITTED = 0x80000000;
+const uint32_t RECORD_PADDING = 0x40000000;
+const uint32_t RECORD_TRUNCATED = 0x20000000; // Some of the arguments didn't fit
+
+const uint32_t STRING_TRUNCATED = 0x80000000;
+
+struct RecordHeader {
+    uint32_t state;
+    uint32_t time;
+    const char* fmt;
+    const char* category;
+    int32_t level;
+};
+
+const size_t RECORD_HEADER_SIZE = (sizeof(RecordHeader) + 3) & ~(size_t)3;
+
+enum ArgType {
+    ARG_NONE,
+    ARG_INT,
+    ARG_LONG,
+    ARG_LONG_LONG,
+    ARG_SIZE,
+    ARG_INTMAX,
+    ARG_PTRDIFF,
+    ARG_DOUBLE,
+    ARG_LONG_DOUBLE,
+    ARG_POINTER,
+    ARG_STRING,
+    ARG_COUNT // %n
+};
+
+struct FormatSpec {
+    const char* begin; // Points to '%'
+    const char* end; // Points past the conversion specifier
+    ArgType type;
+    int precision; // -1 if not specified
+    bool starWidth;
+    bool starPrecision;
+};
+
+inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Parses a conversion specification starting at `p`, which points to '%'
+void parseSpec(const char* p, FormatSpec* spec) {
+    spec->begin = p++;
+    spec->type = ARG_NONE;
+    spec->precision = -1;
+    spec->starWidth = false;
+    spec->starPrecision = false;
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') {
+        ++p;
+    }
+    if (*p == '*') {
+        spec->starWidth = true;
+        ++p;
+    } else {
+        while (isDigit(*p)) {
+            ++p;
+        }
+    }
+    if (*p == '.') {
+        ++p;
+        if (*p == '*') {
+            spec->starPrecision = true;
+            ++p;
+        } else {
+            spec->precision = 0;
+            while (isDigit(*p)) {
+                spec->precision = spec->precision * 10 + (*p++ - '0');
+            }
+        }
+    }
+    ArgType intType = ARG_INT;
+    bool longDouble = false;
+    switch (*p) {
+    case 'h':
+        if (*++p == 'h') {
+            ++p;
+        }
+        break;
+    case 'l':
+        if (*++p == 'l') {
+            intType = ARG_LONG_LONG;
+            ++p;
+        } else {
+            intType = ARG_LONG;
+        }
+        break;
+    case 'z':
+        intType = ARG_SIZE;
+        ++p;
+        break;
+    case 'j':
+        intType = ARG_INTMAX;
+        ++p;
+        break;
+    case 't':
+        intType = ARG_PTRDIFF;
+        ++p;
+        break;
+    case 'L':
+        longDouble = true;
+        ++p;
+        break;
+    default:
+        break;
+    }
+    switch (*p) {
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+        spec->type = intType;
+        break;
+    case 'c':
+        spec->type = ARG_INT;
+        break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        spec->type = longDouble ? ARG_LONG_DOUBLE : ARG_DOUBLE;
+        break;
+    case 's':
+        spec->type = ARG_STRING;
+        break;
+    case 'p':
+        spec->type = ARG_POINTER;
+        break;
+    case 'n':
+        spec->type = ARG_COUNT;
+        break;
+    case '\0':
+        // Incomplete specification at the end of the format string
+        spec->end = p;
+        return;
+    default: // '%' or an unsupported specifier
+        break;
+    }
+    spec->end = p + 1;
+}
+
+class ArgWriter {
+public:
+    ArgWriter(uint8_t* buf, size_t size) :
+            buf_(buf),
+            size_(size),
+            len_(0),
+            truncated_(false) {
+    }
+
+    template<typename T>
+    bool put(const T& val) {
+        const size_t n = (sizeof(T) + 3) & ~(size_t)3;
+        if (len_ + n > size_) {
+            truncated_ = true;
+            return false;
+        }
+        memcpy(buf_ + len_, &val, sizeof(T));
+        len_ += n;
+        return true;
+    }
+
+    bool putString(const char* str, int precision) {
+        if (!str) {
+            str = "(null)";
+        }
+        size_t maxLen = DeferredLogBuffer::MAX_STRING_ARG_LENGTH;
+        if (precision >= 0 && (size_t)precision < maxLen) {
+            maxLen = precision;
+        }
+        // The string doesn't need to be terminated if its length is limited by the precision
+        uint32_t len = strnlen(str, maxLen + 1);
+        if (len > maxLen) {
+            len = maxLen;
+            if (precision < 0 || (size_t)precision > maxLen) {
+                len |= STRING_TRUNCATED;
+            }
+        }
+        const size_t n = len & ~STRING_TRUNCATED;
+        const size_t padded = (n + 3) & ~(size_t)3;
+        if (len_ + sizeof(len) + padded > size_ || !put(len)) {
+            truncated_ = true;
+            return false;
+        }
+        memcpy(buf_ + len_, str, n);
+        len_ += padded;
+        return true;
+    }
+
+    size_t length() const {
+        return len_;
+    }
+
+    bool isTruncated() const {
+        return truncated_;
+    }
+
+private:
+    uint8_t* buf_;
+    size_t size_;
+    size_t len_;
+    bool truncated_;
+};
+
+class ArgReader {
+public:
+    ArgReader(const uint8_t* data, size_t size) :
+            data_(data),
+            left_(size) {
+    }
+
+    template<typename T>
+    bool get(T* val) {
+        const size_t n = (sizeof(T) + 3) & ~(size_t)3;
+        if (n > left_) {
+            return false;
+        }
+        memcpy(val, data_, sizeof(T));
+        data_ += n;
+        left_ -= n;
+        return true;
+    }
+
+    bool getString(const char** str, size_t* len, bool* truncated) {
+        uint32_t v = 0;
+        if (!get(&v)) {
+            return false;
+        }
+        const size_t n = v & ~STRING_TRUNCATED;
+        const size_t padded = (n + 3) & ~(size_t)3;
+        if (padded > left_) {
+            return false;
+        }
+        *str = (const char*)data_;
+        *len = n;
+        *truncated = v & STRING_TRUNCATED;
+        data_ += padded;
+        left_ -= padded;
+        return true;
+    }
+
+private:
+    const uint8_t* data_;
+    size_t left_;
+};
+
+class Output {
+public:
+    Output(char* buf, size_t size) :
+            buf_(buf),
+            size_(size),
+            len_(0),
+            overflow_(false) {
+        buf_[0] = '\0';
+    }
+
+    void append(const char* str, size_t len) {
+        const size_t n = std::min(len, size_ - len_ - 1);
+        memcpy(buf_ + len_, str, n);
+        len_ += n;
+        buf_[len_] = '\0';
+        if (n < len) {
+            overflow_ = true;
+        }
+    }
+
+    template<typename... ArgsT>
+    void format(const char* fmt, ArgsT... args) {
+        const size_t left = size_ - len_;
+        const int n = snprintf(buf_ + len_, left, fmt, args...);
+        if (n < 0) {
+            return;
+        }
+        if ((size_t)n >= left) {
+            len_ = size_ - 1;
+            overflow_ = true;
+        } else {
+            len_ += n;
+        }
+    }
+
+    // Marks the output as truncated the same way log_message() does
+    void finish(bool truncated) {
+        if ((overflow_ || truncated) && size_ > 1) {
+            if (len_ > size_ - 2) {
+                len_ = size_ - 2;
+            }
+            buf_[len_++] = '~';
+            buf_[len_] = '\0';
+        }
+    }
+
+private:
+    char* buf_;
+    size_t size_;
+    size_t len_;
+    bool overflow_;
+};
+
+// Copies a conversion specification into `buf`, replacing asterisks with the given width and
+// precision, and omitting the 'L' length modifier of long doubles, which are passed to snprintf()
+// as double
+bool makeSpec(const FormatSpec& spec, int width, int precision, char* buf, size_t size) {
+    size_t n = 0;
+    for (const char* p = spec.begin; p != spec.end; ++p) {
+        int r = 1;
+        if (*p == '*' && p[-1] == '.') {
+            r = snprintf(buf + n, size - n, "%d", precision);
+        } else if (*p == '*') {
+            r = snprintf(buf + n, size - n, "%d", width);
+        } else if (*p == '.' && p[1] == '*' && precision < 0) {
+            ++p; // A negative precision is taken as if it was omitted
+            r = 0;
+        } else if (*p == 'L' && spec.type == ARG_LONG_DOUBLE) {
+            r = 0;
+        } else if (n < size) {
+            buf[n] = *p;
+        }
+        if (r < 0 || n + r >= size) {
+            return false;
+        }
+        n += r;
+    }
+    buf[n] = '\0';
+    return true;
+}
+
+// Formats a single argument. Returns false if the argument couldn't be read
+bool formatArg(const FormatSpec& spec, ArgReader* args, Output* out) {
+    int width = 0;
+    int precision = -1;
+    if ((spec.starWidth && !args->get(&width)) || (spec.starPrecision && !args->get(&precision))) {
+        return false;
+    }
+    char fmt[24];
+    if (!makeSpec(spec, width, precision, fmt, sizeof(fmt))) {
+        // Should not happen with a sensible format string
+        out->append(spec.begin, spec.end - spec.begin);
+        return spec.type == ARG_NONE || spec.type == ARG_COUNT;
+    }
+    switch (spec.type) {
+    case ARG_INT: {
+        int v = 0;
+        if (!args->get(&v)) {
+            return false;
+        }
+        out->format(fmt, v);
+        break;
+    }
+    case ARG_LONG: {
+        long v = 0;
+        if (!args->get(&v)) {
+            return false;
+        }
+        out->format(fmt, v);
+        break;
+    }
+    case ARG_LONG_LONG: {
+        long long v = 0;
+        if (!args->get(&v)) {
+            return false;
+        }
+        out->format(fmt, v);
+        break;
+    }
+    case ARG_SIZE: {
+        size_t v = 0;
+        if (!args->get(&v)) {
+            return false;
+        }
+        out->format(fmt, v);
+        break;
+    }
+    case ARG_INTMAX: {
+        intmax_t v = 0;
+        if (!args->get(&v)) {
+            return false;
+        }
+        out->format(fmt, v);
+        break;
+    }
+    case ARG_PTRDIFF: {
+        ptrdiff_t v = 0;
+        if (!args->get(&v)) {
+            return false;
+        }
+        out->format(fmt, v);
+        break;
+    }
+    case ARG_DOUBLE:
+    case ARG_LONG_DOUBLE: {
+        double v = 0;
+        if (!args->get(&v)) {
+            return false;
+        }
+        out->format(fmt, v);
+        break;
+    }
+    case ARG_POINTER: {
+        const void* v = nullptr;
+        if (!args->get(&v)) {
+            return false;
+        }
+        out->format(fmt, v);
+        break;
+    }
+    case ARG_STRING: {
+        const char* s = nullptr;
+        size_t len = 0;
+        bool truncated = false;
+        if (!args->getString(&s, &len, &truncated)) {
+            return false;
+        }
+        char str[DeferredLogBuffer::MAX_STRING_ARG_LENGTH + 2];
+        memcpy(str, s, len);
+        if (truncated) {
+            str[len++] = '~';
+        }
+        str[len] = '\0';
+        out->format(fmt, str);
+        break;
+    }
+    case ARG_COUNT:
+        break;
+    default: // ARG_NONE
+        if (spec.end[-1] == '%') {
+            out->append("%", 1);
+        } else {
+            out->append(spec.begin, spec.end - spec.begin);
+        }
+        break;
+    }
+    return true;
+}
+
+} // unnamed
+
+DeferredLogBuffer::DeferredLogBuffer() :
+        buf_(nullptr),
+        mask_(0),
+        head_(0),
+        tail_(0),
+        dropped_(0) {
+}
+
+int DeferredLogBuffer::init(void* buffer, size_t size) {
+    if (!buffer || ((uintptr_t)buffer & 3) || size < MIN_BUFFER_SIZE || (size & (size - 1))) {
+        return SYSTEM_ERROR_INVALID_ARGUMENT;
+    }
+    memset(buffer, 0, size);
+    buf_ = (uint8_t*)buffer;
+    mask_ = size - 1;
+    head_.store(0, std::memory_order_relaxed);
+    tail_.store(0, std::memory_order_relaxed);
+    dropped_.store(0, std::memory_order_relaxed);
+    return 0;
+}
+
+bool DeferredLogBuffer::write(int level, const char* category, uint32_t time, const char* fmt, va_list args) {
+    if (!buf_) {
+        return false;
+    }
+    // Collect the arguments first, as the size of the record needs to be known to reserve space for it
+    uint8_t data[MAX_ARGS_SIZE];
+    ArgWriter w(data, sizeof(data));
+    const char* p = fmt;
+    while ((p = strchr(p, '%')) && !w.isTruncated()) {
+        FormatSpec spec;
+        parseSpec(p, &spec);
+        p = spec.end;
+        int precision = spec.precision;
+        if (spec.starWidth) {
+            w.put(va_arg(args, int));
+        }
+        if (spec.starPrecision) {
+            precision = va_arg(args, int);
+            w.put(precision);
+        }
+        switch (spec.type) {
+        case ARG_INT:
+            w.put(va_arg(args, int));
+            break;
+        case ARG_LONG:
+            w.put(va_arg(args, long));
+            break;
+        case ARG_LONG_LONG:
+            w.put(va_arg(args, long long));
+            break;
+        case ARG_SIZE:
+            w.put(va_arg(args, size_t));
+            break;
+        case ARG_INTMAX:
+            w.put(va_arg(args, intmax_t));
+            break;
+        case ARG_PTRDIFF:
+            w.put(va_arg(args, ptrdiff_t));
+            break;
+        case ARG_DOUBLE:
+            w.put(va_arg(args, double));
+            break;
+        case ARG_LONG_DOUBLE:
+            w.put((double)va_arg(args, long double));
+            break;
+        case ARG_POINTER:
+            w.put((const void*)va_arg(args, void*));
+            break;
+        case ARG_STRING:
+            w.putString(va_arg(args, const char*), precision);
+            break;
+        case ARG_COUNT:
+            (void)va_arg(args, void*);
+            break;
+        default:
+            break;
+        }
+    }
+    const size_t size = RECORD_HEADER_SIZE + w.length();
+    uint32_t offs = 0;
+    if (!reserve(size, &offs)) {
+        return false;
+    }
+    uint8_t* const rec = buf_ + (offs & mask_);
+    RecordHeader h = {};
+    h.time = time;
+    h.fmt = fmt;
+    h.category = category;
+    h.level = level;
+    memcpy(rec + sizeof(h.state), (const uint8_t*)&h + sizeof(h.state), sizeof(h) - sizeof(h.state));
+    memcpy(rec + RECORD_HEADER_SIZE, data, w.length());
+    uint32_t state = size | RECORD_COMMITTED;
+    if (w.isTruncated()) {
+        state |= RECORD_TRUNCATED;
+    }
+    __atomic_store_n((uint32_t*)rec, state, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool DeferredLogBuffer::read(char* buf, size_t size, int* level, const char** category, uint32_t* time) {
+    if (!buf_) {
+        return false;
+    }
+    for (;;) {
+        const uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        uint8_t* const rec = buf_ + (tail & mask_);
+        const uint32_t state = __atomic_load_n((uint32_t*)rec, __ATOMIC_ACQUIRE);
+        if (!(state & RECORD_COMMITTED)) {
+            return false; // The writer hasn't finished yet
+        }
+        const size_t recSize = state & RECORD_SIZE_MASK;
+        const bool padding = state & RECORD_PADDING;
+        if (!padding) {
+            RecordHeader h = {};
+            memcpy(&h, rec, sizeof(h));
+            *level = h.level;
+            *category = h.category;
+            *time = h.time;
+            Output out(buf, size);
+            ArgReader args(rec + RECORD_HEADER_SIZE, recSize - RECORD_HEADER_SIZE);
+            bool truncated = false;
+            const char* p = h.fmt;
+            const char* spec = nullptr;
+            while ((spec = strchr(p, '%'))) {
+                out.append(p, spec - p);
+                FormatSpec s;
+                parseSpec(spec, &s);
+                p = s.end;
+                if (!formatArg(s, &args, &out)) {
+                    truncated = true;
+                    break;
+                }
+            }
+            if (!truncated) {
+                out.append(p, strlen(p));
+            }
+            out.finish(truncated || (state & RECORD_TRUNCATED));
+        }
+        __atomic_store_n((uint32_t*)rec, 0, __ATOMIC_RELAXED);
+        tail_.store(tail + recSize, std::memory_order_release);
+        if (!padding) {
+            return true;
+        }
+    }
+}
+
+bool DeferredLogBuffer::isEmpty() const {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+}
+
+bool DeferredLogBuffer::reserve(size_t size, uint32_t* offset) {
+    const uint32_t capacity = mask_ + 1;
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    for (;;) {
+        const uint32_t pos = head & mask_;
+        // Records don't wrap around the end of the buffer
+        const uint32_t pad = (pos + size > capacity) ? capacity - pos : 0;
+        if (head + pad + size - tail_.load(std::memory_order_acquire) > capacity) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (head_.compare_exchange_weak(head, head + pad + size, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+            if (pad) {
+                __atomic_store_n((uint32_t*)(buf_ + pos), pad | RECORD_PADDING | RECORD_COMMITTED, __ATOMIC_RELEASE);
+            }
+            *offset = head + pad;
+            return true;
+        }
+    }
+}
+
+} // particle
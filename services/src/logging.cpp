@@ -19,7 +19,11 @@
 
 #include <algorithm>
 #include <cstdio>
+#include "deferred_log.h"
 #include "timer_hal.h"
+#include "delay_hal.h"
+#include "concurrent_hal.h"
+#include "system_error.h"
 #include "service_debug.h"
 #include "static_assert.h"
 
@@ -68,6 +72,28 @@ volatile log_message_callback_type log_msg_callback = 0;
 volatile log_write_callback_type log_write_callback = 0;
 volatile log_enabled_callback_type log_enabled_callback = 0;
 
+particle::DeferredLogBuffer deferred_log;
+volatile bool deferred_log_enabled = false;
+
+#if PLATFORM_THREADING
+
+// Interval at which the logging thread formats the deferred messages
+const system_tick_t DEFERRED_LOG_INTERVAL = 10;
+
+const os_thread_prio_t DEFERRED_LOG_THREAD_PRIORITY = (OS_THREAD_PRIORITY_DEFAULT > 0) ?
+        OS_THREAD_PRIORITY_DEFAULT - 1 : OS_THREAD_PRIORITY_DEFAULT;
+
+os_thread_t deferred_log_thread = nullptr;
+
+os_thread_return_t deferred_log_thread_run(void* data) {
+    for (;;) {
+        log_process_deferred(nullptr);
+        HAL_Delay_Milliseconds(DEFERRED_LOG_INTERVAL);
+    }
+}
+
+#endif // PLATFORM_THREADING
+
 } // namespace
 
 void log_set_callbacks(log_message_callback_type log_msg, log_write_callback_type log_write,
@@ -86,6 +112,11 @@ void log_message_v(int level, const char *category, LogAttributes *attr, void *r
     if (!attr->has_time) {
         LOG_ATTR_SET(*attr, time, HAL_Timer_Get_Milli_Seconds());
     }
+    if (msg_callback && deferred_log_enabled && level < LOG_LEVEL_PANIC) {
+        // Source info and other attributes are not retained by the deferred buffer
+        deferred_log.write(level, category, attr->time, fmt, args);
+        return;
+    }
     char buf[LOG_MAX_STRING_LENGTH];
     if (msg_callback) {
         const int n = vsnprintf(buf, sizeof(buf), fmt, args);
@@ -221,6 +252,51 @@ int log_enabled(int level, const char *category, void *reserved) {
     return 0;
 }
 
+int log_set_deferred_buffer(void *buffer, size_t size, void *reserved) {
+    if (deferred_log_enabled) {
+        return SYSTEM_ERROR_INVALID_STATE;
+    }
+    const int ret = deferred_log.init(buffer, size);
+    if (ret < 0) {
+        return ret;
+    }
+#if PLATFORM_THREADING
+    if (os_thread_create(&deferred_log_thread, "log", DEFERRED_LOG_THREAD_PRIORITY, deferred_log_thread_run, nullptr,
+            OS_THREAD_STACK_SIZE_DEFAULT) != 0) {
+        deferred_log_thread = nullptr;
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+#endif
+    deferred_log_enabled = true;
+    return 0;
+}
+
+int log_process_deferred(void *reserved) {
+    if (!deferred_log_enabled) {
+        return 0;
+    }
+    int count = 0;
+    char buf[LOG_MAX_STRING_LENGTH];
+    int level = 0;
+    const char* category = nullptr;
+    uint32_t time = 0;
+    while (deferred_log.read(buf, sizeof(buf), &level, &category, &time)) {
+        const log_message_callback_type msg_callback = log_msg_callback;
+        if (msg_callback) {
+            LogAttributes attr = {};
+            attr.size = sizeof(LogAttributes);
+            LOG_ATTR_SET(attr, time, time);
+            msg_callback(buf, level, category, &attr, 0);
+        }
+        ++count;
+    }
+    return count;
+}
+
+uint32_t log_deferred_dropped(void *reserved) {
+    return deferred_log.dropped();
+}
+
 const char* log_level_name(int level, void *reserved) {
     static const char* const names[] = {
         "TRACE",
@@ -0,0 +1,533 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ring_file_queue.h"
+
+#include "system_error.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace particle {
+
+namespace fs {
+
+namespace {
+
+const uint32_t MAGIC = 0x52465131; // "RFQ1"
+
+// Size of an entry that marks the end of the data before the tail wraps to the start of the storage
+const uint16_t WRAP_MARKER = 0xffff;
+
+const uint32_t HASH_INIT = 2166136261u;
+
+uint32_t hash(uint32_t h, const void* data, size_t size) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < size; ++i) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+inline bool isNewer(uint32_t generation, uint32_t other) {
+    return (int32_t)(generation - other) > 0;
+}
+
+} // unnamed
+
+RingFileQueue::RingFileQueue(Storage* storage, size_t capacity) :
+        storage_(storage),
+        capacity_(capacity),
+        epoch_(0),
+        generation_(0),
+        head_(DATA_OFFSET),
+        headSeq_(0),
+        tail_(DATA_OFFSET),
+        tailSeq_(0),
+        count_(0),
+        savedHead_(DATA_OFFSET),
+        savedPops_(0),
+        wraps_(0),
+        written_(0),
+        headDirty_(false),
+        bufOffset_(0),
+        bufLen_(0) {
+    static_assert(DATA_OFFSET == 2 * sizeof(Header), "DATA_OFFSET must hold two copies of the header");
+}
+
+int RingFileQueue::init(uint32_t seed) {
+    if (capacity_ <= DATA_OFFSET + sizeof(EntryHeader)) {
+        return SYSTEM_ERROR_INVALID_ARGUMENT;
+    }
+    Header h[2];
+    int r = storage_->read(0, h, sizeof(h));
+    if (r < 0) {
+        return syncStorage(r);
+    }
+    const Header* latest = nullptr;
+    for (const Header& header: h) {
+        if (header.magic == MAGIC && header.capacity == capacity_ &&
+                header.check == hash(HASH_INIT, &header, sizeof(header) - sizeof(header.check)) &&
+                header.head >= DATA_OFFSET && header.head < capacity_ &&
+                (!latest || isNewer(header.generation, latest->generation))) {
+            latest = &header;
+        }
+    }
+    r = latest ? load(*latest) : format(seed);
+    return syncStorage(r);
+}
+
+int RingFileQueue::pushBack(const void* data, size_t size) {
+    if (size > maxEntrySize()) {
+        return SYSTEM_ERROR_TOO_LARGE;
+    }
+    const size_t total = sizeof(EntryHeader) + size;
+    int r = 0;
+    size_t offset = place(total, savedHead_, count_ + savedPops_ == 0);
+    if (!offset) {
+        // Reuse the space of removed entries once the header no longer refers to it
+        offset = place(total, head_, count_ == 0);
+        if (!offset) {
+            return SYSTEM_ERROR_LIMIT_EXCEEDED;
+        }
+        r = writeHeader();
+        if (r < 0) {
+            return syncStorage(r);
+        }
+    }
+    if (offset != tail_) {
+        const EntryHeader marker = { tailSeq_, WRAP_MARKER, 0, entryCheck(tailSeq_, WRAP_MARKER) };
+        r = append(tail_, &marker, sizeof(marker));
+        if (r < 0) {
+            return syncStorage(r);
+        }
+        tail_ = offset;
+        ++tailSeq_;
+        ++wraps_;
+    }
+    const EntryHeader entry = { tailSeq_, (uint16_t)size, 0, hash(entryCheck(tailSeq_, size), data, size) };
+    r = append(offset, &entry, sizeof(entry));
+    if (r >= 0) {
+        r = append(offset + sizeof(entry), data, size);
+    }
+    if (r < 0) {
+        return syncStorage(r);
+    }
+    if (!count_) {
+        head_ = offset;
+        headSeq_ = tailSeq_;
+    }
+    tail_ = wrap(offset + total);
+    if (tail_ == DATA_OFFSET) {
+        ++wraps_;
+    }
+    ++tailSeq_;
+    ++count_;
+    return syncStorage(0);
+}
+
+int RingFileQueue::front(void* data, size_t size) {
+    if (!count_) {
+        return SYSTEM_ERROR_NOT_FOUND;
+    }
+    EntryHeader entry;
+    int r = readEntryHeader(head_, &entry);
+    if (r >= 0) {
+        if (entry.seq != headSeq_ || entry.size == WRAP_MARKER) {
+            r = SYSTEM_ERROR_BAD_DATA;
+        } else if (entry.size > size) {
+            r = SYSTEM_ERROR_TOO_LARGE;
+        } else {
+            r = read(head_ + sizeof(entry), data, entry.size);
+            if (r >= 0) {
+                r = entry.size;
+            }
+        }
+    }
+    return syncStorage(r);
+}
+
+int RingFileQueue::popFront() {
+    if (!count_) {
+        return SYSTEM_ERROR_NOT_FOUND;
+    }
+    EntryHeader entry;
+    int r = readEntryHeader(head_, &entry);
+    if (r >= 0) {
+        if (entry.seq != headSeq_ || entry.size == WRAP_MARKER) {
+            r = SYSTEM_ERROR_BAD_DATA;
+        } else {
+            head_ = wrap(head_ + sizeof(entry) + entry.size);
+            ++headSeq_;
+            --count_;
+            ++savedPops_;
+            headDirty_ = true;
+            r = skipWrap();
+        }
+    }
+    return syncStorage(r);
+}
+
+int RingFileQueue::sync() {
+    int r = flush();
+    if (r >= 0 && headDirty_) {
+        r = writeHeader();
+    }
+    return syncStorage(r);
+}
+
+int RingFileQueue::clear() {
+    bufLen_ = 0;
+    return syncStorage(format(epoch_ + 1));
+}
+
+size_t RingFileQueue::maxEntrySize() const {
+    return std::min<size_t>(WRAP_MARKER - 1, capacity_ - DATA_OFFSET - sizeof(EntryHeader));
+}
+
+int RingFileQueue::load(const Header& h) {
+    epoch_ = h.epoch;
+    generation_ = h.generation;
+    wraps_ = h.wraps;
+    written_ = h.written;
+    head_ = wrap(h.head);
+    headSeq_ = h.headSeq;
+    savedHead_ = head_;
+    savedPops_ = 0;
+    headDirty_ = false;
+    count_ = 0;
+    // Follow the entries from the head for as long as their sequence numbers and checksums are valid
+    size_t pos = head_;
+    uint32_t seq = headSeq_;
+    for (size_t n = capacity_ / sizeof(EntryHeader); n > 0; --n) {
+        EntryHeader entry;
+        int r = readEntryHeader(pos, &entry);
+        if (r < 0) {
+            return r;
+        }
+        if (entry.seq != seq) {
+            break;
+        }
+        if (entry.size == WRAP_MARKER) {
+            if (entry.check != entryCheck(seq, WRAP_MARKER)) {
+                break;
+            }
+            pos = DATA_OFFSET;
+            ++seq;
+            continue;
+        }
+        if (pos + sizeof(entry) + entry.size > capacity_) {
+            break;
+        }
+        uint32_t check = entryCheck(seq, entry.size);
+        uint8_t chunk[32];
+        for (size_t offset = pos + sizeof(entry), left = entry.size; left > 0;) {
+            const size_t size = std::min(left, sizeof(chunk));
+            r = storage_->read(offset, chunk, size);
+            if (r < 0) {
+                return r;
+            }
+            check = hash(check, chunk, size);
+            offset += size;
+            left -= size;
+        }
+        if (check != entry.check) {
+            break;
+        }
+        pos = wrap(pos + sizeof(entry) + entry.size);
+        ++seq;
+        ++count_;
+    }
+    tail_ = pos;
+    tailSeq_ = seq;
+    return skipWrap();
+}
+
+int RingFileQueue::format(uint32_t epoch) {
+    epoch_ = epoch;
+    head_ = DATA_OFFSET;
+    tail_ = DATA_OFFSET;
+    headSeq_ = 0;
+    tailSeq_ = 0;
+    count_ = 0;
+    return writeHeader();
+}
+
+int RingFileQueue::writeHeader() {
+    int r = flush();
+    if (r < 0) {
+        return r;
+    }
+    Header h = {};
+    h.magic = MAGIC;
+    h.epoch = epoch_;
+    h.generation = generation_ + 1;
+    h.capacity = capacity_;
+    h.head = head_;
+    h.headSeq = headSeq_;
+    h.wraps = wraps_;
+    h.written = written_ + sizeof(h);
+    h.check = hash(HASH_INIT, &h, sizeof(h) - sizeof(h.check));
+    r = storage_->write((h.generation & 1) * sizeof(h), &h, sizeof(h));
+    if (r < 0) {
+        return r;
+    }
+    generation_ = h.generation;
+    written_ = h.written;
+    savedHead_ = head_;
+    savedPops_ = 0;
+    headDirty_ = false;
+    return 0;
+}
+
+int RingFileQueue::readEntryHeader(size_t offset, EntryHeader* h) {
+    return read(offset, h, sizeof(EntryHeader));
+}
+
+int RingFileQueue::append(size_t offset, const void* data, size_t size) {
+    if (bufLen_ && offset == bufOffset_ + bufLen_ && bufLen_ + size <= WRITE_BUFFER_SIZE) {
+        memcpy(buf_ + bufLen_, data, size);
+        bufLen_ += size;
+        return 0;
+    }
+    int r = flush();
+    if (r < 0) {
+        return r;
+    }
+    if (size <= WRITE_BUFFER_SIZE) {
+        memcpy(buf_, data, size);
+        bufOffset_ = offset;
+        bufLen_ = size;
+        return 0;
+    }
+    r = storage_->write(offset, data, size);
+    if (r < 0) {
+        return r;
+    }
+    written_ += size;
+    return 0;
+}
+
+int RingFileQueue::read(size_t offset, void* data, size_t size) {
+    if (bufLen_ && offset < bufOffset_ + bufLen_ && offset + size > bufOffset_) {
+        const int r = flush();
+        if (r < 0) {
+            return r;
+        }
+    }
+    return storage_->read(offset, data, size);
+}
+
+int RingFileQueue::flush() {
+    if (!bufLen_) {
+        return 0;
+    }
+    const int r = storage_->write(bufOffset_, buf_, bufLen_);
+    if (r < 0) {
+        return r;
+    }
+    written_ += bufLen_;
+    bufLen_ = 0;
+    return 0;
+}
+
+int RingFileQueue::skipWrap() {
+    if (!count_) {
+        head_ = tail_;
+        headSeq_ = tailSeq_;
+        return 0;
+    }
+    EntryHeader entry;
+    const int r = readEntryHeader(head_, &entry);
+    if (r < 0) {
+        return r;
+    }
+    if (entry.seq == headSeq_ && entry.size == WRAP_MARKER) {
+        head_ = DATA_OFFSET;
+        ++headSeq_;
+    }
+    return 0;
+}
+
+int RingFileQueue::syncStorage(int result) {
+    const int r = storage_->sync();
+    return (result < 0 || r >= 0) ? result : r;
+}
+
+size_t RingFileQueue::wrap(size_t offset) const {
+    // An entry header doesn't fit at the end of the storage
+    return (capacity_ - offset < sizeof(EntryHeader)) ? DATA_OFFSET : offset;
+}
+
+size_t RingFileQueue::place(size_t size, size_t head, bool empty) const {
+    if (empty || tail_ > head) {
+        if (tail_ + size <= capacity_) {
+            return tail_;
+        }
+        const size_t end = empty ? capacity_ : head;
+        return (DATA_OFFSET + size <= end) ? DATA_OFFSET : 0;
+    }
+    if (tail_ < head) {
+        return (tail_ + size <= head) ? tail_ : 0;
+    }
+    return 0; // Full
+}
+
+uint32_t RingFileQueue::entryCheck(uint32_t seq, uint16_t size) const {
+    uint32_t h = hash(HASH_INIT, &epoch_, sizeof(epoch_));
+    h = hash(h, &seq, sizeof(seq));
+    return hash(h, &size, sizeof(size));
+}
+
+#if (defined(HAL_PLATFORM_FILESYSTEM) && HAL_PLATFORM_FILESYSTEM == 1)
+
+SegmentedFileStorage::SegmentedFileStorage(const char* dir, size_t segmentSize) :
+        dir_(dir),
+        segmentSize_(segmentSize),
+        fs_(nullptr),
+        file_(),
+        segment_(-1),
+        locked_(false),
+        dirCreated_(false) {
+}
+
+SegmentedFileStorage::~SegmentedFileStorage() {
+    sync();
+}
+
+int SegmentedFileStorage::read(size_t offset, void* data, size_t size) {
+    uint8_t* p = (uint8_t*)data;
+    while (size > 0) {
+        size_t segmentOffset = 0;
+        size_t left = 0;
+        const int segment = segmentOf(offset, &segmentOffset, &left);
+        const size_t n = std::min(size, left);
+        int r = open(segment);
+        if (r < 0) {
+            return r;
+        }
+        if (lfs_file_seek(&fs_->instance, &file_, segmentOffset, LFS_SEEK_SET) < 0) {
+            return SYSTEM_ERROR_FILE;
+        }
+        r = lfs_file_read(&fs_->instance, &file_, p, n);
+        if (r < 0) {
+            return SYSTEM_ERROR_FILE;
+        }
+        // Past the end of the file
+        memset(p + r, 0, n - r);
+        p += n;
+        offset += n;
+        size -= n;
+    }
+    return 0;
+}
+
+int SegmentedFileStorage::write(size_t offset, const void* data, size_t size) {
+    const uint8_t* p = (const uint8_t*)data;
+    while (size > 0) {
+        size_t segmentOffset = 0;
+        size_t left = 0;
+        const int segment = segmentOf(offset, &segmentOffset, &left);
+        const size_t n = std::min(size, left);
+        const int r = open(segment);
+        if (r < 0) {
+            return r;
+        }
+        if (lfs_file_seek(&fs_->instance, &file_, segmentOffset, LFS_SEEK_SET) < 0 ||
+                lfs_file_write(&fs_->instance, &file_, p, n) != (lfs_ssize_t)n) {
+            return SYSTEM_ERROR_FILE;
+        }
+        p += n;
+        offset += n;
+        size -= n;
+    }
+    return 0;
+}
+
+int SegmentedFileStorage::sync() {
+    const int r = closeFile();
+    if (locked_) {
+        filesystem_unlock(fs_);
+        locked_ = false;
+    }
+    return r;
+}
+
+int SegmentedFileStorage::open(int segment) {
+    if (segment_ == segment) {
+        return 0;
+    }
+    int r = closeFile();
+    if (r < 0) {
+        return r;
+    }
+    if (!fs_) {
+        fs_ = filesystem_get_instance(nullptr);
+        if (!fs_) {
+            return SYSTEM_ERROR_FILE;
+        }
+    }
+    if (!locked_) {
+        // Only one file can be open at a time, so the filesystem stays locked until sync()
+        filesystem_lock(fs_);
+        locked_ = true;
+    }
+    if (filesystem_mount(fs_)) {
+        return SYSTEM_ERROR_FILE;
+    }
+    if (!dirCreated_) {
+        r = lfs_mkdir(&fs_->instance, dir_);
+        if (r < 0 && r != LFS_ERR_EXIST) {
+            return SYSTEM_ERROR_FILE;
+        }
+        dirCreated_ = true;
+    }
+    char path[LFS_NAME_MAX + 1];
+    snprintf(path, sizeof(path), "%s/%d", dir_, segment);
+    if (lfs_file_open(&fs_->instance, &file_, path, LFS_O_RDWR | LFS_O_CREAT) < 0) {
+        return SYSTEM_ERROR_FILE;
+    }
+    segment_ = segment;
+    return 0;
+}
+
+int SegmentedFileStorage::closeFile() {
+    if (segment_ < 0) {
+        return 0;
+    }
+    segment_ = -1;
+    return (lfs_file_close(&fs_->instance, &file_) < 0) ? SYSTEM_ERROR_FILE : 0;
+}
+
+int SegmentedFileStorage::segmentOf(size_t offset, size_t* segmentOffset, size_t* segmentLeft) const {
+    if (offset < RingFileQueue::DATA_OFFSET) {
+        *segmentOffset = offset;
+        *segmentLeft = RingFileQueue::DATA_OFFSET - offset;
+        return 0;
+    }
+    offset -= RingFileQueue::DATA_OFFSET;
+    *segmentOffset = offset % segmentSize_;
+    *segmentLeft = segmentSize_ - *segmentOffset;
+    return 1 + offset / segmentSize_;
+}
+
+#endif // HAL_PLATFORM_FILESYSTEM
+
+} // fs
+
+} // particle
@@ -24,6 +24,8 @@
 #include "service_debug.h"
 #include "system_error.h"
 #include <algorithm>
+#include <memory>
+#include <new>
 
 /* FIXME: once filesystem interface is finalized, convert the implementation not to use
  * LittleFS API.
@@ -32,10 +34,11 @@
 using namespace particle::services::settings;
 using namespace particle::fs;
 
-TlvFile::TlvFile(const char* path) {
+TlvFile::TlvFile(const char* path, unsigned flags) {
     SPARK_ASSERT(path != nullptr);
     path_ = strdup(path);
     SPARK_ASSERT(path_ != nullptr);
+    indexed_ = flags & INDEXED;
 }
 
 TlvFile::~TlvFile() {
@@ -67,6 +70,10 @@ int TlvFile::init() {
         ret = open();
     }
 
+    if (!ret && !indexed_) {
+        ret = migrate();
+    }
+
     return ret;
 }
 
@@ -98,6 +105,26 @@ int TlvFile::sync() {
     return SYSTEM_ERROR_INVALID_STATE;
 }
 
+uint16_t TlvFile::currentVersion() const {
+    return TLV_FILE_VERSION;
+}
+
+int TlvFile::fileVersion() {
+    FsLock lk(fs_);
+
+    if (!open_) {
+        return SYSTEM_ERROR_INVALID_STATE;
+    }
+
+    FileFooter footer;
+    int ret = readFooter(footer);
+    if (ret < 0) {
+        return ret;
+    }
+
+    return footer.version;
+}
+
 ssize_t TlvFile::size() {
     FsLock lk(fs_);
 
@@ -143,13 +170,34 @@ int TlvFile::set(uint16_t key, const uint8_t* value, uint16_t length, int index)
         return SYSTEM_ERROR_INVALID_STATE;
     }
 
-    /* Delete previous entry */
-    int ret = del(key, index);
-    if (!(ret == 0 || ret == SYSTEM_ERROR_NOT_FOUND)) {
+    if (!indexed_) {
+        /* Delete previous entry */
+        int ret = del(key, index);
+        if (!(ret == 0 || ret == SYSTEM_ERROR_NOT_FOUND)) {
+            return ret;
+        }
+
+        return append(key, value, length);
+    }
+
+    int ret = loadDirectory();
+    if (ret < 0) {
         return ret;
     }
 
-    return add(key, value, length);
+    /* Delete previous entry and add the new one in a single update */
+    int count = 0;
+    int first = findEntry(key, &count);
+    if (index >= 0) {
+        if (index < count) {
+            first += index;
+            count = 1;
+        } else {
+            count = 0;
+        }
+    }
+
+    return update(key, first, count, value, length, true);
 }
 
 int TlvFile::add(uint16_t key, const uint8_t* value, uint16_t length) {
@@ -159,46 +207,16 @@ int TlvFile::add(uint16_t key, const uint8_t* value, uint16_t length) {
         return SYSTEM_ERROR_INVALID_STATE;
     }
 
-    FileFooter footer;
-    int ret = readFooter(footer);
-    if (ret < 0) {
-        return ret;
-    }
-    ssize_t pos = footer.size;
-
-    if (pos < 0) {
-        return pos;
-    }
-
-    ret = seek(pos);
-    if (ret < 0) {
-        return ret;
+    if (!indexed_) {
+        return append(key, value, length);
     }
 
-    TlvHeader header = {};
-    header.magick = TLV_HEADER_MAGICK;
-    header.key = key;
-    header.length = length;
-
-    /* Write entry header */
-    ret = write((const uint8_t*)&header, sizeof(header));
-    if (ret < 0) {
-        return ret;
-    }
-    /* Write data */
-    ret = write((const uint8_t*)value, length);
-    if (ret < 0) {
-        return ret;
-    }
-    /* Write file footer */
-    footer.magick = TLV_FILE_MAGICK;
-    footer.size += sizeof(header) + length;
-    ret = write((const uint8_t*)&footer, sizeof(footer));
+    int ret = loadDirectory();
     if (ret < 0) {
         return ret;
     }
 
-    return sync();
+    return update(key, 0, 0, value, length, true);
 }
 
 int TlvFile::del(uint16_t key, int index) {
@@ -208,84 +226,35 @@ int TlvFile::del(uint16_t key, int index) {
         return SYSTEM_ERROR_INVALID_STATE;
     }
 
-    int ret = 0;
-
-    for (;;) {
-        uint16_t dataSize = 0;
-        ssize_t pos = find(key, index, &dataSize);
-        if (pos < 0) {
-            return pos;
-        }
-
-        /* FIXME: this will only work on LittleFS. Provide a different implementation later
-         * when filesystem API is finalized and TlvFile implementation is refactored not to use
-         * LittleFS API.
-         */
-        const ssize_t fileSize = size();
-
-        FileFooter footer;
-        ret = readFooter(footer);
-
-        while (ret == 0) {
-            lfs_file_t f;
-            ret = lfs_file_open(lfs(), &f, path_, LFS_O_RDONLY);
-            if (ret) {
-                break;
-            }
-
-            size_t wpos = pos;
-            size_t rpos = wpos + sizeof(TlvHeader) + dataSize;
-
-            ret = seek(wpos);
-            if (ret < 0) {
-                break;
-            }
-
-            ret = lfs_file_seek(lfs(), &f, rpos, LFS_SEEK_SET);
-            if (ret < 0) {
-                break;
-            }
-
-            for (; rpos < footer.size && ret > 0; ++wpos, ++rpos) {
-                uint8_t tmp;
-                ret = lfs_file_read(lfs(), &f, &tmp, sizeof(tmp));
-                if (ret < 0) {
-                    break;
-                }
-
-                ret = write(&tmp, sizeof(tmp));
-                if (ret < 0) {
-                    break;
-                }
-            }
-
-            if (ret > 0) {
-                /* Write footer */
-                footer.size -= sizeof(TlvHeader) + dataSize;
-                ret = write((const uint8_t*)&footer, sizeof(footer));
-                if (ret < 0) {
-                    break;
-                }
-                /* Truncate */
-                ret = lfs_file_truncate(lfs(), &file_, fileSize - (sizeof(TlvHeader) + dataSize));
-                if (ret < 0) {
-                    break;
-                }
-                ret = sync();
-            }
+    if (!indexed_) {
+        return erase(key, index);
+    }
 
-            lfs_file_close(lfs(), &f);
+    int ret = loadDirectory();
+    if (ret < 0) {
+        return ret;
+    }
 
-            break;
+    int count = 0;
+    int first = findEntry(key, &count);
+    if (index >= 0) {
+        if (index >= count) {
+            return SYSTEM_ERROR_NOT_FOUND;
         }
+        first += index;
+        count = 1;
+    }
+    if (!count) {
+        return SYSTEM_ERROR_NOT_FOUND;
+    }
 
-
-        if (ret || index >= 0) {
-            break;
-        }
+    ret = update(key, first, count, nullptr, 0, false);
+    if (ret < 0 || index >= 0) {
+        return ret;
     }
 
-    return ret;
+    /* Like erase(), deleting all entries with the key ends once none are found */
+    return SYSTEM_ERROR_NOT_FOUND;
 }
 
 lfs_t* TlvFile::lfs() {
@@ -300,6 +269,9 @@ int TlvFile::open() {
         return 0;
     }
 
+    /* The directory is loaded on first access */
+    dirValid_ = false;
+
     /* Open */
     int r = lfs_file_open(lfs(), &file_, path_, LFS_O_CREAT | LFS_O_RDWR);
     if (r) {
@@ -346,7 +318,8 @@ int TlvFile::validate() {
     FileFooter footer = {};
     int ret = readFooter(footer);
     if (!ret) {
-        if (footer.magick != TLV_FILE_MAGICK) {
+        const bool tombstones = footer.magick == TLV_FILE_TOMBSTONES_MAGICK && footer.version == TLV_FILE_VERSION;
+        if (footer.magick != TLV_FILE_MAGICK && !tombstones) {
             ret = SYSTEM_ERROR_BAD_DATA;
         }
     }
@@ -364,6 +337,7 @@ int TlvFile::close() {
     /* Close */
 
     open_ = false;
+    dirValid_ = false;
 
     return lfs_file_close(lfs(), &file_);
 }
@@ -442,6 +416,29 @@ int TlvFile::readFooter(FileFooter& footer) {
 }
 
 ssize_t TlvFile::find(uint16_t key, int index, uint16_t* dataSize) {
+    if (!indexed_) {
+        return scan(key, index, dataSize);
+    }
+
+    int r = loadDirectory();
+    if (r < 0) {
+        return r;
+    }
+
+    int count = 0;
+    const int first = findEntry(key, &count);
+    if (!count || index >= count) {
+        return SYSTEM_ERROR_NOT_FOUND;
+    }
+
+    const DirEntry& entry = dir_.at(first + (index < 0 ? count - 1 : index));
+    if (dataSize) {
+        *dataSize = entry.length;
+    }
+    return entry.offset;
+}
+
+ssize_t TlvFile::scan(uint16_t key, int index, uint16_t* dataSize) {
     FileFooter footer;
     int r = readFooter(footer);
     if (r) {
@@ -492,4 +489,370 @@ ssize_t TlvFile::find(uint16_t key, int index, uint16_t* dataSize) {
     return SYSTEM_ERROR_NOT_FOUND;
 }
 
+int TlvFile::append(uint16_t key, const uint8_t* value, uint16_t length) {
+    FileFooter footer;
+    int ret = readFooter(footer);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = seek(footer.size);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = writeRecord(TLV_HEADER_MAGICK, key, value, length);
+    if (ret < 0) {
+        return ret;
+    }
+    /* Write file footer */
+    footer.size += sizeof(TlvHeader) + length;
+    ret = write((const uint8_t*)&footer, sizeof(footer));
+    if (ret < 0) {
+        return ret;
+    }
+
+    return sync();
+}
+
+int TlvFile::erase(uint16_t key, int index) {
+    uint8_t buf[COPY_CHUNK_SIZE];
+    for (;;) {
+        uint16_t dataSize = 0;
+        ssize_t pos = scan(key, index, &dataSize);
+        if (pos < 0) {
+            return pos;
+        }
+
+        FileFooter footer;
+        ssize_t ret = readFooter(footer);
+        if (ret < 0) {
+            return ret;
+        }
+
+        /* Move the entries that follow the deleted one. Only one file can be open at a time,
+         * so the entries are moved in chunks through a buffer on the stack */
+        const size_t entrySize = sizeof(TlvHeader) + dataSize;
+        for (size_t rpos = pos + entrySize; rpos < footer.size && ret >= 0;) {
+            const size_t n = std::min(sizeof(buf), footer.size - rpos);
+            ret = seek(rpos);
+            if (ret >= 0) {
+                ret = read(buf, n);
+                if (ret >= 0 && ret != (ssize_t)n) {
+                    ret = SYSTEM_ERROR_BAD_DATA;
+                }
+            }
+            if (ret >= 0) {
+                ret = seek(rpos - entrySize);
+            }
+            if (ret >= 0) {
+                ret = write(buf, n);
+            }
+            rpos += n;
+        }
+        footer.size -= entrySize;
+        if (ret >= 0) {
+            ret = seek(footer.size);
+        }
+        if (ret >= 0) {
+            ret = write((const uint8_t*)&footer, sizeof(footer));
+        }
+        if (ret >= 0) {
+            ret = lfs_file_truncate(lfs(), &file_, footer.size + sizeof(footer));
+        }
+        if (ret >= 0) {
+            ret = sync();
+        }
+
+        if (ret < 0 || index >= 0) {
+            return ret;
+        }
+    }
+}
+
+int TlvFile::migrate() {
+    FileFooter footer;
+    int ret = readFooter(footer);
+    if (ret < 0 || footer.magick != TLV_FILE_TOMBSTONES_MAGICK) {
+        return ret;
+    }
+
+    /* Written with INDEXED, rewrite the file without the tombstones and the entries they delete */
+    ret = loadDirectory();
+    if (ret >= 0) {
+        ret = compact();
+    }
+    dir_.clear();
+    dir_.trimToSize();
+    dirValid_ = false;
+
+    return ret;
+}
+
+int TlvFile::loadDirectory() {
+    if (dirValid_) {
+        return 0;
+    }
+
+    dir_.clear();
+    garbage_ = 0;
+
+    FileFooter footer;
+    int r = readFooter(footer);
+    if (r) {
+        return r;
+    }
+
+    TlvHeader header;
+    for (size_t pos = 0; (pos + sizeof(TlvHeader)) <= footer.size;) {
+        r = seek(pos);
+        if (r < 0) {
+            return r;
+        }
+
+        ssize_t rd = read((uint8_t*)&header, sizeof(header));
+        if (rd < (ssize_t)sizeof(TlvHeader)) {
+            return SYSTEM_ERROR_BAD_DATA;
+        }
+
+        int count = 0;
+        const int first = findEntry(header.key, &count);
+
+        if (header.magick == TLV_HEADER_MAGICK) {
+            DirEntry entry = {};
+            entry.offset = pos;
+            entry.key = header.key;
+            entry.length = header.length;
+            if (!dir_.insert(first + count, entry)) {
+                dir_.clear();
+                return SYSTEM_ERROR_NO_MEMORY;
+            }
+        } else if (header.magick == TLV_TOMBSTONE_MAGICK && header.length == sizeof(uint32_t)) {
+            uint32_t offset = 0;
+            rd = read((uint8_t*)&offset, sizeof(offset));
+            if (rd < (ssize_t)sizeof(offset)) {
+                return SYSTEM_ERROR_BAD_DATA;
+            }
+            for (int i = first; i < first + count; ++i) {
+                if (dir_.at(i).offset == offset) {
+                    garbage_ += sizeof(TlvHeader) + dir_.at(i).length;
+                    dir_.removeAt(i);
+                    break;
+                }
+            }
+            garbage_ += sizeof(TlvHeader) + header.length;
+        } else {
+            /* Attempt to recover */
+            pos += sizeof(uint16_t);
+            garbage_ += sizeof(uint16_t);
+            continue;
+        }
+
+        pos += sizeof(TlvHeader) + header.length;
+    }
+
+    dirValid_ = true;
+    return 0;
+}
+
+int TlvFile::findEntry(uint16_t key, int* count) {
+    const DirEntry* begin = dir_.data();
+    const DirEntry* end = begin + dir_.size();
+    const DirEntry* first = std::lower_bound(begin, end, key, [](const DirEntry& e, uint16_t key) {
+        return e.key < key;
+    });
+    const DirEntry* last = first;
+    while (last != end && last->key == key) {
+        ++last;
+    }
+    *count = last - first;
+    return first - begin;
+}
+
+int TlvFile::update(uint16_t key, int first, int count, const uint8_t* value, uint16_t length, bool addValue) {
+    /* Make sure the directory can be updated once the file is */
+    if (addValue && !dir_.reserve(dir_.size() + 1)) {
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+
+    FileFooter footer;
+    int ret = readFooter(footer);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = seek(footer.size);
+    for (int i = first; i < first + count && ret >= 0; ++i) {
+        const uint32_t offset = dir_.at(i).offset;
+        ret = writeRecord(TLV_TOMBSTONE_MAGICK, key, (const uint8_t*)&offset, sizeof(offset));
+    }
+    const uint32_t valueOffset = footer.size + count * (sizeof(TlvHeader) + sizeof(uint32_t));
+    if (ret >= 0 && addValue) {
+        ret = writeRecord(TLV_HEADER_MAGICK, key, value, length);
+    }
+    if (ret >= 0) {
+        /* Write file footer */
+        if (count) {
+            footer.magick = TLV_FILE_TOMBSTONES_MAGICK;
+            footer.version = TLV_FILE_VERSION;
+        }
+        footer.size = valueOffset + (addValue ? sizeof(TlvHeader) + length : 0);
+        ret = write((const uint8_t*)&footer, sizeof(footer));
+    }
+    if (ret >= 0) {
+        ret = sync();
+    }
+    if (ret < 0) {
+        /* Reload the directory from whatever made it to the file */
+        dirValid_ = false;
+        return ret;
+    }
+
+    for (int i = first; i < first + count; ++i) {
+        garbage_ += sizeof(TlvHeader) * 2 + sizeof(uint32_t) + dir_.at(i).length;
+    }
+    dir_.removeAt(first, count);
+    if (addValue) {
+        DirEntry entry = {};
+        entry.offset = valueOffset;
+        entry.key = key;
+        entry.length = length;
+        int n = 0;
+        const int pos = findEntry(key, &n);
+        dir_.insert(pos + n, entry); /* Can't fail, the storage has been reserved above */
+    }
+
+    if (garbage_ >= COMPACT_MIN_GARBAGE && garbage_ >= footer.size - garbage_) {
+        /* The update itself is complete even if this fails */
+        compact();
+    }
+
+    return 0;
+}
+
+int TlvFile::writeRecord(uint16_t magick, uint16_t key, const uint8_t* value, uint16_t length) {
+    TlvHeader header = {};
+    header.magick = magick;
+    header.key = key;
+    header.length = length;
+
+    /* Write entry header */
+    int ret = write((const uint8_t*)&header, sizeof(header));
+    if (ret < 0) {
+        return ret;
+    }
+    /* Write data */
+    if (length) {
+        ret = write(value, length);
+    }
+    return ret;
+}
+
+int TlvFile::compact() {
+    FileFooter footer;
+    int ret = readFooter(footer);
+    if (ret < 0) {
+        return ret;
+    }
+
+    const size_t pathLen = strlen(path_);
+    std::unique_ptr<char[]> tmpPath(new(std::nothrow) char[pathLen + sizeof(".tmp")]);
+    if (!tmpPath) {
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+    memcpy(tmpPath.get(), path_, pathLen);
+    memcpy(tmpPath.get() + pathLen, ".tmp", sizeof(".tmp"));
+
+    /* All open files share the file buffer of the filesystem, so only one file can be open at
+     * a time. The live entries are copied in chunks: each chunk is read from the original file
+     * into a buffer on the stack and then appended to the temporary file. The offsets in the
+     * directory are updated as entries are copied, and the directory is reloaded if compaction
+     * fails.
+     */
+    close();
+
+    uint8_t buf[COPY_CHUNK_SIZE];
+    lfs_file_t f = {};
+    int tmpFlags = LFS_O_CREAT | LFS_O_WRONLY | LFS_O_TRUNC;
+    size_t pos = 0; /* Size of the entries copied so far */
+    size_t entryPos = 0; /* Number of bytes of the current entry copied so far */
+    int i = 0;
+    bool done = false;
+    while (ret >= 0 && !done) {
+        size_t n = 0;
+        if (i < dir_.size()) {
+            ret = lfs_file_open(lfs(), &f, path_, LFS_O_RDONLY);
+            if (ret < 0) {
+                break;
+            }
+            while (ret >= 0 && i < dir_.size() && n < sizeof(buf)) {
+                DirEntry& entry = dir_.at(i);
+                const size_t size = sizeof(TlvHeader) + entry.length;
+                const size_t chunk = std::min(size - entryPos, sizeof(buf) - n);
+                ret = lfs_file_seek(lfs(), &f, entry.offset + entryPos, LFS_SEEK_SET);
+                if (ret >= 0) {
+                    ret = lfs_file_read(lfs(), &f, buf + n, chunk);
+                    if (ret >= 0 && ret != (int)chunk) {
+                        ret = SYSTEM_ERROR_BAD_DATA;
+                    }
+                }
+                n += chunk;
+                entryPos += chunk;
+                if (entryPos == size) {
+                    entry.offset = pos;
+                    pos += size;
+                    entryPos = 0;
+                    ++i;
+                }
+            }
+            const int closeRet = lfs_file_close(lfs(), &f);
+            if (ret >= 0) {
+                ret = closeRet;
+            }
+        }
+        if (ret >= 0 && i == dir_.size() && n + sizeof(footer) <= sizeof(buf)) {
+            /* Without tombstones, the file can be read by any version */
+            footer.magick = TLV_FILE_MAGICK;
+            footer.version = 0;
+            footer.size = pos;
+            memcpy(buf + n, &footer, sizeof(footer));
+            n += sizeof(footer);
+            done = true;
+        }
+        if (ret >= 0) {
+            ret = lfs_file_open(lfs(), &f, tmpPath.get(), tmpFlags);
+            if (ret < 0) {
+                break;
+            }
+            tmpFlags = LFS_O_WRONLY | LFS_O_APPEND;
+            ret = lfs_file_write(lfs(), &f, buf, n);
+            if (ret >= 0 && ret != (int)n) {
+                ret = SYSTEM_ERROR_IO;
+            }
+            const int closeRet = lfs_file_close(lfs(), &f);
+            if (ret >= 0) {
+                ret = closeRet;
+            }
+        }
+    }
+    if (ret >= 0) {
+        ret = lfs_rename(lfs(), tmpPath.get(), path_);
+    }
+    if (ret < 0) {
+        lfs_remove(lfs(), tmpPath.get());
+    }
+    /* This invalidates the directory */
+    const int openRet = open();
+    if (ret >= 0) {
+        ret = openRet;
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    garbage_ = 0;
+    dirValid_ = true;
+    return 0;
+}
+
 #endif /* HAL_PLATFORM_FILESYSTEM == 1 */
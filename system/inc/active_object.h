@@ -23,13 +23,19 @@
 
 #if PLATFORM_THREADING
 
+#include <atomic>
 #include <functional>
+#include <memory>
 #include <mutex>
+#include <new>
 #include <thread>
 #include <future>
+#include <type_traits>
+#include <utility>
 
 #include "channel.h"
 #include "concurrent_hal.h"
+#include "timer_hal.h"
 
 /**
  * Configuratino data for an active object.
@@ -245,12 +251,119 @@ public:
     }
 };
 
+class ActiveObjectBase;
+
+/**
+ * A task stored in one of the fixed task slots of an active object. The callable is kept inline,
+ * so posting the task doesn't allocate memory.
+ */
+class InlineTask : public Message
+{
+public:
+    /**
+     * The maximum size of a callable that can be stored in a slot.
+     */
+    static const size_t STORAGE_SIZE = 6 * sizeof(void*);
+
+    InlineTask() : invoke(nullptr), owner(nullptr), result(nullptr), complete(nullptr), queued_at(0) {}
+
+    virtual ~InlineTask()
+    {
+        if (complete)
+        {
+            os_semaphore_destroy(complete);
+        }
+    }
+
+    inline void operator()() override;
+
+private:
+    typedef void (*invoke_fn)(InlineTask* task);
+
+    typename std::aligned_storage<STORAGE_SIZE>::type storage;
+    invoke_fn invoke;
+    ActiveObjectBase* owner;
+    /**
+     * Receives the result of a synchronous call.
+     */
+    void* result;
+    /**
+     * Given when a synchronous call completes. Created the first time the slot is used for a
+     * synchronous call and reused afterwards.
+     */
+    os_semaphore_t complete;
+    uint32_t queued_at;
+
+    friend class ActiveObjectBase;
+};
+
+template<typename R> struct InlineTaskResult
+{
+    R value = R();
+
+    template<typename F> void call(F& fn)
+    {
+        value = fn();
+    }
+
+    R get()
+    {
+        return value;
+    }
+};
+
+template<> struct InlineTaskResult<void>
+{
+    template<typename F> void call(F& fn)
+    {
+        fn();
+    }
+
+    void get()
+    {
+    }
+};
+
+/**
+ * Statistics of the tasks processed by an active object.
+ */
+struct ActiveObjectStats
+{
+    /**
+     * Number of tasks waiting in the queue.
+     */
+    uint32_t queued;
+    /**
+     * Peak number of tasks waiting in the queue.
+     */
+    uint32_t max_queued;
+    /**
+     * Number of tasks that were run from a task slot.
+     */
+    uint32_t inline_tasks;
+    /**
+     * Number of tasks that had to be allocated on the heap, either because the callable didn't fit
+     * in a slot or because all slots were in use.
+     */
+    uint32_t heap_tasks;
+    /**
+     * Peak and total time between posting a task and running it, in microseconds. Only measured
+     * for the tasks run from a task slot.
+     */
+    uint32_t max_latency;
+    uint32_t total_latency;
+};
 
 class ActiveObjectBase
 {
 public:
     using Item = Message*;
 
+    /**
+     * Number of tasks that can be posted without allocating memory.
+     */
+    static const unsigned TASK_SLOT_COUNT = 8;
+
 protected:
 
     ActiveObjectConfiguration configuration;
@@ -289,7 +402,17 @@ public:
     ActiveObjectBase(const ActiveObjectConfiguration& config) :
             configuration(config),
             _thread(OS_THREAD_INVALID_HANDLE),
-            started(false) {
+            started(false),
+            free_tasks((1u << TASK_SLOT_COUNT) - 1),
+            queued(0),
+            max_queued(0),
+            inline_tasks(0),
+            heap_tasks(0),
+            max_latency(0),
+            total_latency(0) {
+        for (auto& task: tasks) {
+            task.owner = this;
+        }
     }
 
     bool process();
@@ -306,34 +429,210 @@ public:
         return started;
     }
 
-    template<typename R> void invoke_async(const std::function<R(void)>& work)
+    /**
+     * Runs a callable on the thread of this active object. The callable is copied into a task slot
+     * if it fits and a slot is free, otherwise it is wrapped in a heap allocated task. Returns
+     * false if the task couldn't be posted, in which case the callable is destroyed without
+     * being invoked.
+     */
+    template<typename F> bool invoke_async(F&& work)
     {
-        auto task = new AsyncTask<R>(work);
-        if (task)
-        {
-			Item message = task;
-			if (!put(message))
-				delete task;
-        }
-	}
+        return invoke_async(std::forward<F>(work), fits_task_slot<typename std::decay<F>::type>());
+    }
+
+    /**
+     * Runs a callable on the thread of this active object and waits for its result. Returns a
+     * value-initialized result if the call couldn't be posted.
+     */
+    template<typename F> auto invoke_sync(F&& work) -> decltype(work())
+    {
+        return invoke_sync(std::forward<F>(work), fits_task_slot<typename std::decay<F>::type>());
+    }
 
     template<typename R> SystemPromise<R>* invoke_future(const std::function<R(void)>& work)
     {
         auto promise = new SystemPromise<R>(work);
         if (promise)
         {
-			Item message = promise;
-			if (!put(message))
-			{
-				delete promise;
-				promise = nullptr;
-			}
+            ++heap_tasks;
+            if (!post(promise))
+            {
+                delete promise;
+                promise = nullptr;
+            }
         }
         return promise;
     }
 
+    void stats(ActiveObjectStats* stats) const
+    {
+        stats->queued = queued.load(std::memory_order_relaxed);
+        stats->max_queued = max_queued.load(std::memory_order_relaxed);
+        stats->inline_tasks = inline_tasks;
+        stats->heap_tasks = heap_tasks;
+        stats->max_latency = max_latency;
+        stats->total_latency = total_latency;
+    }
+
+private:
+    InlineTask tasks[TASK_SLOT_COUNT];
+    std::atomic<uint32_t> free_tasks; // A bit per free slot
+    std::atomic<uint32_t> queued;
+    std::atomic<uint32_t> max_queued;
+    // Updated by the thread of the active object
+    uint32_t inline_tasks;
+    std::atomic<uint32_t> heap_tasks;
+    uint32_t max_latency;
+    uint32_t total_latency;
+
+    // Checked at compile time so that a task slot is only ever constructed with a callable that fits it
+    template<typename Fn> using fits_task_slot = std::integral_constant<bool,
+            sizeof(Fn) <= InlineTask::STORAGE_SIZE && alignof(Fn) <= alignof(decltype(InlineTask::storage))>;
+
+    template<typename F> bool invoke_async(F&& work, std::true_type)
+    {
+        typedef typename std::decay<F>::type Fn;
+        InlineTask* task = acquire_task();
+        if (!task)
+            return invoke_async(std::forward<F>(work), std::false_type());
+        new (&task->storage) Fn(std::forward<F>(work));
+        task->invoke = run_async<Fn>;
+        if (!post(task))
+        {
+            reinterpret_cast<Fn*>(&task->storage)->~Fn();
+            release_task(task);
+            return false;
+        }
+        return true;
+    }
+
+    template<typename F> bool invoke_async(F&& work, std::false_type)
+    {
+        typedef decltype(work()) R;
+        auto heap_task = new AsyncTask<R>(std::function<R(void)>(std::forward<F>(work)));
+        if (!heap_task)
+            return false;
+        ++heap_tasks;
+        if (!post(heap_task))
+        {
+            delete heap_task;
+            return false;
+        }
+        return true;
+    }
+
+    template<typename F> auto invoke_sync(F&& work, std::true_type) -> decltype(work())
+    {
+        typedef typename std::decay<F>::type Fn;
+        typedef decltype(work()) R;
+        InlineTask* task = acquire_task();
+        if (task && !task->complete && os_semaphore_create(&task->complete, 1, 0) != 0)
+        {
+            task->complete = nullptr;
+            release_task(task);
+            task = nullptr;
+        }
+        if (!task)
+            return invoke_sync(std::forward<F>(work), std::false_type());
+        InlineTaskResult<R> result;
+        new (&task->storage) Fn(std::forward<F>(work));
+        task->invoke = run_sync<Fn, R>;
+        task->result = &result;
+        if (post(task))
+        {
+            os_semaphore_take(task->complete, CONCURRENT_WAIT_FOREVER, false);
+            release_task(task);
+            return result.get();
+        }
+        reinterpret_cast<Fn*>(&task->storage)->~Fn();
+        release_task(task);
+        return R();
+    }
+
+    template<typename F> auto invoke_sync(F&& work, std::false_type) -> decltype(work())
+    {
+        typedef decltype(work()) R;
+        std::unique_ptr<SystemPromise<R>> promise(invoke_future(std::function<R(void)>(std::forward<F>(work))));
+        return promise ? promise->get() : R();
+    }
+
+    InlineTask* acquire_task()
+    {
+        uint32_t free = free_tasks.load(std::memory_order_relaxed);
+        while (free)
+        {
+            const uint32_t bit = free & (~free + 1);
+            if (free_tasks.compare_exchange_weak(free, free & ~bit, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                return &tasks[__builtin_ctz(bit)];
+            }
+        }
+        return nullptr;
+    }
+
+    void release_task(InlineTask* task)
+    {
+        free_tasks.fetch_or(1u << (task - tasks), std::memory_order_release);
+    }
+
+    bool post(Message* task)
+    {
+        if (is_inline_task(task))
+            static_cast<InlineTask*>(task)->queued_at = HAL_Timer_Get_Micro_Seconds();
+        const uint32_t n = queued.fetch_add(1, std::memory_order_relaxed) + 1;
+        uint32_t max = max_queued.load(std::memory_order_relaxed);
+        while (n > max && !max_queued.compare_exchange_weak(max, n, std::memory_order_relaxed))
+        {
+        }
+        Item message = task;
+        if (!put(message))
+        {
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    bool is_inline_task(const Message* task) const
+    {
+        return task >= tasks && task < tasks + TASK_SLOT_COUNT;
+    }
+
+    void task_started(InlineTask* task)
+    {
+        const uint32_t latency = HAL_Timer_Get_Micro_Seconds() - task->queued_at;
+        if (latency > max_latency)
+            max_latency = latency;
+        total_latency += latency;
+        ++inline_tasks;
+    }
+
+    template<typename Fn> static void run_async(InlineTask* task)
+    {
+        Fn* fn = reinterpret_cast<Fn*>(&task->storage);
+        (*fn)();
+        fn->~Fn();
+        task->owner->release_task(task);
+    }
+
+    template<typename Fn, typename R> static void run_sync(InlineTask* task)
+    {
+        Fn* fn = reinterpret_cast<Fn*>(&task->storage);
+        static_cast<InlineTaskResult<R>*>(task->result)->call(*fn);
+        fn->~Fn();
+        // The caller releases the slot
+        os_semaphore_give(task->complete, false);
+    }
+
+    friend class InlineTask;
 };
 
+inline void InlineTask::operator()()
+{
+    owner->task_started(this);
+    invoke(this);
+}
+
 
 template <size_t queue_size=50>
 class ActiveObjectChannel : public ActiveObjectBase
@@ -19,6 +19,9 @@
 #pragma once
 
 #include "logging.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits>
 
 /**
  * A simple append-only list. The elements are never deallocated.
@@ -32,7 +35,7 @@ template <typename T> class append_list
     T* store;
 
     bool expand(unsigned capacity) {
-        if (capacity>255)
+        if (capacity>max_size)
             return false;
 
         T* new_store = (T*)realloc(store, sizeof(T)*capacity);
@@ -45,6 +48,11 @@ template <typename T> class append_list
 
 public:
 
+    /**
+     * The maximum number of elements, as limited by the width of the element count.
+     */
+    static const unsigned max_size = 255;
+
     append_list(unsigned block=5) : count(0), capacity(0), block_size(block), store(NULL) {}
 
     T* add() {
@@ -64,7 +72,7 @@ public:
     bool removeAt(unsigned int i) {
     	if (i<count) {
 			T* const p = store + i;
-			memmove(p, p + 1, count - i - 1);
+			memmove(p, p + 1, (count - i - 1) * sizeof(T));
 			count--;
     	}
         return true;
@@ -74,4 +82,113 @@ public:
     unsigned size() { return count; }
 };
 
+/**
+ * An append_list that also maintains an open-addressing hash index of its elements,
+ * keyed by a fixed-size string member. Lookups compare at most N-1 characters of the key.
+ * When memory for the index cannot be allocated, lookups fall back to a linear scan.
+ *
+ * @param T the element type
+ * @param N the size of the key array in T
+ * @param Key the key member of T
+ */
+template <typename T, size_t N, char (T::*Key)[N]> class indexed_append_list : public append_list<T>
+{
+    using base = append_list<T>;
+    using slot_type = uint8_t;
+
+    static_assert(base::max_size <= std::numeric_limits<slot_type>::max(),
+            "The slot type must be able to hold the index of any element plus 1");
+
+    /**
+     * Each slot holds the index of an element plus 1, or 0 when unused.
+     */
+    slot_type* slots;
+    uint16_t slot_count;
+
+    static uint32_t hash(const char* key) {
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < N - 1 && key[i]; i++) {
+            h = (h ^ uint8_t(key[i])) * 16777619u;
+        }
+        return h;
+    }
+
+    bool matches(unsigned index, const char* key) {
+        return !strncmp((*this)[index].*Key, key, N - 1);
+    }
+
+    void insert(unsigned index) {
+        unsigned slot = hash((*this)[index].*Key) & (slot_count - 1);
+        while (slots[slot]) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        slots[slot] = index + 1;
+    }
+
+    /**
+     * Rebuilds the index so that it is at most half full.
+     */
+    void rebuild() {
+        unsigned count = 8;
+        while (count < this->size() * 2) {
+            count *= 2;
+        }
+        if (count != slot_count) {
+            free(slots);
+            slots = (slot_type*)malloc(count * sizeof(slot_type));
+            slot_count = slots ? count : 0;
+        }
+        if (slots) {
+            memset(slots, 0, slot_count * sizeof(slot_type));
+            for (unsigned i = 0; i < this->size(); i++) {
+                insert(i);
+            }
+        }
+    }
+
+public:
 
+    indexed_append_list(unsigned block=5) : base(block), slots(NULL), slot_count(0) {}
+
+    T* add() {
+        return add(T());
+    }
+
+    T* add(const T& item) {
+        T* result = base::add(item);
+        if (result) {
+            if (this->size() * 2 > slot_count) {
+                rebuild();
+            } else {
+                insert(this->size() - 1);
+            }
+        }
+        return result;
+    }
+
+    bool removeAt(unsigned int i) {
+        bool result = base::removeAt(i);
+        rebuild();
+        return result;
+    }
+
+    /**
+     * Retrieves the element with the given key, or NULL if there is no such element.
+     */
+    T* find(const char* key) {
+        if (!slots) {
+            for (unsigned i = this->size(); i-- > 0; ) {
+                if (matches(i, key)) {
+                    return &(*this)[i];
+                }
+            }
+            return NULL;
+        }
+        for (unsigned slot = hash(key) & (slot_count - 1); slots[slot]; slot = (slot + 1) & (slot_count - 1)) {
+            if (matches(slots[slot] - 1, key)) {
+                return &(*this)[slots[slot] - 1];
+            }
+        }
+        return NULL;
+    }
+};
@@ -0,0 +1,134 @@
+/**
+  Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see <http://www.gnu.org/licenses/>.
+  ******************************************************************************
+ */
+
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <utility>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * A reference-counted copy of the name and data of a received event.
+ *
+ * The protocol delivers events as strings in its receive buffer, which is reused as soon as
+ * the event has been dispatched. Handlers that run on another thread need a copy of the event;
+ * a single copy is shared by all of them and freed when the last handler has run.
+ */
+class SharedEventData {
+public:
+    SharedEventData() :
+            d_(nullptr) {
+    }
+
+    SharedEventData(const SharedEventData& other) :
+            d_(other.d_) {
+        if (d_) {
+            d_->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    SharedEventData(SharedEventData&& other) :
+            d_(other.d_) {
+        other.d_ = nullptr;
+    }
+
+    ~SharedEventData() {
+        release();
+    }
+
+    SharedEventData& operator=(SharedEventData other) {
+        std::swap(d_, other.d_);
+        return *this;
+    }
+
+    /**
+     * Copies the given event. Returns an empty instance if there is insufficient memory.
+     * A null `data` is stored as an empty string.
+     */
+    static SharedEventData create(const char* name, const char* data) {
+        const size_t nameLen = strlen(name);
+        const size_t dataLen = data ? strlen(data) : 0;
+        SharedEventData event;
+        void* mem = malloc(sizeof(Data) + nameLen + dataLen + 2);
+        if (mem) {
+            event.d_ = new(mem) Data(nameLen, dataLen);
+            memcpy(event.d_->chars(), name, nameLen + 1);
+            char* const d = event.d_->chars() + nameLen + 1;
+            memcpy(d, data ? data : "", dataLen + 1);
+        }
+        return event;
+    }
+
+    /**
+     * Determines if this is a copy of the given event.
+     */
+    bool matches(const char* name, const char* data) const {
+        if (!d_) {
+            return false;
+        }
+        const size_t nameLen = strlen(name);
+        const size_t dataLen = data ? strlen(data) : 0;
+        return nameLen == d_->nameLen && dataLen == d_->dataLen && !memcmp(d_->chars(), name, nameLen) &&
+                (!dataLen || !memcmp(d_->chars() + nameLen + 1, data, dataLen));
+    }
+
+    const char* name() const {
+        return d_ ? d_->chars() : "";
+    }
+
+    const char* data() const {
+        return d_ ? d_->chars() + d_->nameLen + 1 : "";
+    }
+
+    unsigned useCount() const {
+        return d_ ? d_->refs.load(std::memory_order_relaxed) : 0;
+    }
+
+    explicit operator bool() const {
+        return d_;
+    }
+
+private:
+    struct Data {
+        std::atomic<unsigned> refs;
+        size_t nameLen;
+        size_t dataLen;
+
+        Data(size_t nameLen, size_t dataLen) :
+                refs(1),
+                nameLen(nameLen),
+                dataLen(dataLen) {
+        }
+
+        char* chars() {
+            return reinterpret_cast<char*>(this + 1);
+        }
+    };
+
+    Data* d_;
+
+    void release() {
+        if (d_ && d_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            d_->~Data();
+            free(d_);
+        }
+        d_ = nullptr;
+    }
+};
@@ -158,6 +158,12 @@ const uint32_t PUBLISH_EVENT_FLAG_WITH_ACK = 0x8;
  * This is a stop-gap solution until all synchronous APIs return futures, allowing asynchronous operation.
  */
 const uint32_t PUBLISH_EVENT_FLAG_ASYNC = EventType::ASYNC;
+/**
+ * Events that can't be sent because the device is offline or the event budget is exhausted are
+ * stored in flash and sent once the device is connected. Only supported on platforms with a filesystem;
+ * elsewhere the event fails with SYSTEM_ERROR_NOT_SUPPORTED.
+ */
+const uint32_t PUBLISH_EVENT_FLAG_STORE = 0x20;
 
 
 PARTICLE_STATIC_ASSERT(publish_no_ack_flag_matches, PUBLISH_EVENT_FLAG_NO_ACK==EventType::NO_ACK);
@@ -231,6 +237,10 @@ typedef struct {
     size_t size;
     completion_callback handler_callback;
     void* handler_data;
+    // If set, the event data is written by this callback directly into the message buffer of the
+    // protocol, and the `data` argument of spark_send_event() is ignored
+    EventDataWriter data_writer;
+    void* data_writer_data;
 } spark_send_event_data;
 
 /**
@@ -256,6 +266,21 @@ typedef struct {
  *
  */
 int spark_publish_vitals(system_tick_t period_s, void *reserved);
+
+/**
+ * @brief Enable or disable delta encoding of vitals
+ *
+ * When enabled, a vitals message only contains the vitals that changed since the last message
+ * acknowledged by the cloud, and all vitals are sent every \p interval messages. The cloud
+ * backend must support the delta-encoded format.
+ *
+ * @param[in] interval The keyframe interval, or 0 to send all vitals in every message (default)
+ * @param[in,out] reserved Reserved for future use.
+ *
+ * @returns \p system_error_t result code
+ * @retval \p system_error_t::SYSTEM_ERROR_NONE
+ */
+int spark_set_vitals_keyframe_interval(unsigned interval, void* reserved);
 bool spark_send_event(const char* name, const char* data, int ttl, uint32_t flags, void* reserved);
 bool spark_subscribe(const char *eventName, EventHandler handler, void* handler_data,
         Spark_Subscription_Scope_TypeDef scope, const char* deviceID, void* reserved);
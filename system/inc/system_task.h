@@ -87,8 +87,20 @@ uint8_t application_thread_current(void* reserved);
 uint8_t system_thread_current(void* reserved);
 uint8_t main_thread_current(void* reserved);
 
+/**
+ * Runs a callback asynchronously on the application thread. Returns 0 if the callback was run or
+ * scheduled, or a non-zero value if it couldn't be scheduled and will never run.
+ */
 uint8_t application_thread_invoke(void (*callback)(void* data), void* data, void* reserved);
 
+/**
+ * Runs a callback asynchronously on the system thread, or on the application thread if the system
+ * thread is not enabled. Doesn't allocate memory unless the system thread's task slots are in use.
+ * Returns 0 if the callback was run or scheduled, or a non-zero value if it couldn't be scheduled
+ * and will never run.
+ */
+uint8_t system_thread_invoke(void (*callback)(void* data), void* data, void* reserved);
+
 /**
  * Cancels current network connection attempt and aborts cloud connection. This function can be
  * called from an ISR and is used to unblock the system thread in order to perform some other
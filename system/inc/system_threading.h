@@ -75,25 +75,19 @@ FFL(F const &func)
 
 #define _THREAD_CONTEXT_ASYNC_RESULT(thread, fn, result) \
     if (thread.isStarted() && !thread.isCurrentThread()) { \
-        auto lambda = [=]() { (fn); }; \
-        thread.invoke_async(FFL(lambda)); \
+        thread.invoke_async([=]() { (fn); }); \
         return result; \
     }
 
 #define _THREAD_CONTEXT_ASYNC(thread, fn) \
     if (thread.isStarted() && !thread.isCurrentThread()) { \
-        auto lambda = [=]() { (fn); }; \
-        thread.invoke_async(FFL(lambda)); \
+        thread.invoke_async([=]() { (fn); }); \
         return; \
     }
 
 #define SYSTEM_THREAD_CONTEXT_SYNC(fn) \
     if (SystemThread.isStarted() && !SystemThread.isCurrentThread()) { \
-        auto callable = FFL([=]() { return (fn); }); \
-        auto future = SystemThread.invoke_future(callable); \
-        auto result = future ? future->get() : 0;  \
-        delete future; \
-        return result; \
+        return SystemThread.invoke_sync([=]() { return (fn); }); \
     }
 
 #else
@@ -156,12 +156,24 @@ int system_set_flag(system_flag_t flag, uint8_t value, void* reserved);
 int system_get_flag(system_flag_t flag, uint8_t* value,void* reserved);
 int system_refresh_flag(system_flag_t flag);
 
+/**
+ * Flags for `system_format_diag_data()`.
+ */
+typedef enum diag_format_flag {
+    DIAG_FORMAT_BINARY = 0x01, ///< Binary format.
+    /**
+     * Binary format, delta-encoded against the last snapshot delivered to the cloud. The
+     * snapshot is kept as pending until the caller commits or discards it.
+     */
+    DIAG_FORMAT_DELTA = 0x02
+} diag_format_flag;
+
 /**
  * Formats the diagnostic data using an appender function.
  *
  * @param id Array of data source IDs. This argument can be set to NULL to format all registered data sources.
  * @param count Number of data source IDs in the array.
- * @param flags Formatting flags.
+ * @param flags Formatting flags (see `diag_format_flag`).
  * @param append Appender function.
  * @param append_data Opaque data passed to the appender function.
  * @param reserved Reserved argument (should be set to NULL).
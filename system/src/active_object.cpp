@@ -29,6 +29,9 @@
 #include "timer_hal.h"
 #include "rng_hal.h"
 
+const size_t InlineTask::STORAGE_SIZE;
+const unsigned ActiveObjectBase::TASK_SLOT_COUNT;
+
 void ActiveObjectBase::start_thread()
 {
     const auto r = os_thread_create(&_thread, "active_object", configuration.priority, run_active_object, this,
@@ -74,6 +77,7 @@ bool ActiveObjectBase::process()
     Item item = nullptr;
     if (take(item) && item)
     {
+        queued.fetch_sub(1, std::memory_order_relaxed);
         Message& msg = *item;
         msg();
         result = true;
@@ -26,6 +26,7 @@
  */
 
 #include <cstdarg>
+#include <memory>
 
 #include "logging.h"
 #include "protocol_defs.h"
@@ -33,6 +34,7 @@
 #include "spark_wiring_timer.h"
 #include "system_cloud.h"
 #include "system_cloud_internal.h"
+#include "system_publish_store.h"
 #include "system_publish_vitals.h"
 #include "system_task.h"
 #include "system_threading.h"
@@ -101,6 +103,13 @@ int spark_publish_vitals(system_tick_t period_s_, void* reserved_)
     return result;
 }
 
+int spark_set_vitals_keyframe_interval(unsigned interval, void* reserved)
+{
+    SYSTEM_THREAD_CONTEXT_SYNC(spark_set_vitals_keyframe_interval(interval, reserved));
+    _vitals.keyframeInterval(interval);
+    return 0;
+}
+
 bool spark_subscribe(const char *eventName, EventHandler handler, void* handler_data,
         Spark_Subscription_Scope_TypeDef scope, const char* deviceID, void* reserved)
 {
@@ -150,13 +159,54 @@ system_tick_t spark_sync_time_last(time_t* tm, void* reserved)
  */
 inline uint32_t convert(uint32_t flags) {
 	bool priv = flags & PUBLISH_EVENT_FLAG_PRIVATE;
-	flags &= ~PUBLISH_EVENT_FLAG_PRIVATE;
+	flags &= ~(PUBLISH_EVENT_FLAG_PRIVATE | PUBLISH_EVENT_FLAG_STORE);
 	flags |= !priv ? EventType::PUBLIC : EventType::PRIVATE;
 	return flags;
 }
 
 bool spark_send_event(const char* name, const char* data, int ttl, uint32_t flags, void* reserved)
 {
+    auto r = static_cast<const spark_send_event_data*>(reserved);
+#if !HAL_PLATFORM_FILESYSTEM
+    if (flags & PUBLISH_EVENT_FLAG_STORE) {
+        // There's no storage for the event, and sending it right away would drop it while offline
+        if (r && r->handler_callback) {
+            r->handler_callback(SYSTEM_ERROR_NOT_SUPPORTED, nullptr, r->handler_data, nullptr);
+        }
+        return false;
+    }
+#endif // !HAL_PLATFORM_FILESYSTEM
+    if (r && r->size >= sizeof(spark_send_event_data) && r->data_writer &&
+            (flags & (PUBLISH_EVENT_FLAG_ASYNC | PUBLISH_EVENT_FLAG_STORE))) {
+        // The writer can only be called while the caller waits, so stored and asynchronous events
+        // are serialized up front. The buffer holds the data followed by a copy of the event name,
+        // so that both outlive the caller's arguments if the event is sent asynchronously
+        const size_t dataSize = particle::protocol::MAX_EVENT_DATA_LENGTH + 1;
+        const size_t nameSize = strlen(name) + 1;
+        std::shared_ptr<char> buf(new(std::nothrow) char[dataSize + nameSize], std::default_delete<char[]>());
+        const int n = buf ? r->data_writer(buf.get(), particle::protocol::MAX_EVENT_DATA_LENGTH,
+                r->data_writer_data) : SYSTEM_ERROR_NO_MEMORY;
+        if (n < 0) {
+            if (r->handler_callback) {
+                r->handler_callback(n, nullptr, r->handler_data, nullptr);
+            }
+            return false;
+        }
+        buf.get()[n] = '\0';
+        memcpy(buf.get() + dataSize, name, nameSize);
+        spark_send_event_data d = *r;
+        d.data_writer = nullptr;
+#if PLATFORM_THREADING
+        if ((flags & PUBLISH_EVENT_FLAG_ASYNC) && SystemThread.isStarted() && !SystemThread.isCurrentThread()) {
+            SystemThread.invoke_async([=]() {
+                spark_send_event(buf.get() + dataSize, buf.get(), ttl, flags, (void*)&d);
+            });
+            return true;
+        }
+#endif // PLATFORM_THREADING
+        return spark_send_event(name, buf.get(), ttl, flags, &d);
+    }
+
     if (flags & PUBLISH_EVENT_FLAG_ASYNC) {
         SYSTEM_THREAD_CONTEXT_ASYNC_RESULT(spark_send_event(name, data, ttl, flags, reserved), true);
     }
@@ -164,12 +214,22 @@ bool spark_send_event(const char* name, const char* data, int ttl, uint32_t flag
     SYSTEM_THREAD_CONTEXT_SYNC(spark_send_event(name, data, ttl, flags, reserved));
     }
 
+#if HAL_PLATFORM_FILESYSTEM
+    if (flags & PUBLISH_EVENT_FLAG_STORE) {
+        return particle::system::PublishStore::instance()->publish(name, data, ttl, flags,
+                static_cast<const spark_send_event_data*>(reserved));
+    }
+#endif // HAL_PLATFORM_FILESYSTEM
+
     spark_protocol_send_event_data d = { sizeof(spark_protocol_send_event_data) };
-    if (reserved) {
+    if (r) {
         // Forward completion callback to the protocol implementation
-        auto r = static_cast<const spark_send_event_data*>(reserved);
         d.handler_callback = r->handler_callback;
         d.handler_data = r->handler_data;
+        if (r->size >= sizeof(spark_send_event_data)) {
+            d.data_writer = r->data_writer;
+            d.data_writer_data = r->data_writer_data;
+        }
     }
 
     return spark_protocol_send_event(sp, name, data, ttl, convert(flags), &d);
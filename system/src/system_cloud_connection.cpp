@@ -19,6 +19,7 @@
 #include "system_cloud_internal.h"
 #include "system_cloud.h"
 #include "core_hal.h"
+#include "timer_hal.h"
 #include "service_debug.h"
 #include "system_task.h"
 #include "spark_wiring_ticks.h"
@@ -42,6 +43,22 @@ static volatile int s_ipv6_cloud_keepalive = HAL_PLATFORM_DEFAULT_CLOUD_KEEPALIV
 
 using namespace particle::system::cloud;
 
+namespace {
+
+int timed_cloud_send(const unsigned char* buf, uint32_t buflen)
+{
+#if DIAG_ENABLE_HISTOGRAMS
+    const system_tick_t start = HAL_Timer_Get_Micro_Seconds();
+    const int ret = system_cloud_send(buf, buflen, 0);
+    particle::CloudDiagnostics::instance()->sendTime(HAL_Timer_Get_Micro_Seconds() - start);
+    return ret;
+#else
+    return system_cloud_send(buf, buflen, 0);
+#endif
+}
+
+} // namespace
+
 #if HAL_PLATFORM_CLOUD_UDP
 SessionConnection g_system_cloud_session_data = {};
 #endif /* HAL_PLATFORM_CLOUD_UDP */
@@ -208,7 +225,7 @@ int Spark_Send_UDP(const unsigned char* buf, uint32_t buflen, void* reserved)
         return -1;
     }
 
-    return system_cloud_send(buf, buflen, 0);
+    return timed_cloud_send(buf, buflen);
 }
 
 int Spark_Receive_UDP(unsigned char *buf, uint32_t buflen, void* reserved)
@@ -235,7 +252,7 @@ int Spark_Send(const unsigned char *buf, uint32_t buflen, void* reserved)
         return -1;
     }
 
-    return system_cloud_send(buf, buflen, 0);
+    return timed_cloud_send(buf, buflen);
 }
 
 // Returns number of bytes received or -1 if an error occurred
@@ -31,6 +31,7 @@
 #include "spark_wiring_string.h"
 #include "spark_protocol_functions.h"
 #include "append_list.h"
+#include "shared_event_data.h"
 #include "core_hal.h"
 #include "deviceid_hal.h"
 #include "ota_flash_hal.h"
@@ -92,22 +93,25 @@ ProtocolFacade* system_cloud_protocol_instance(void)
     return sp;
 }
 
-static append_list<User_Var_Lookup_Table_t> vars(5);
-static append_list<User_Func_Lookup_Table_t> funcs(5);
+static indexed_append_list<User_Var_Lookup_Table_t, USER_VAR_KEY_LENGTH+1, &User_Var_Lookup_Table_t::userVarKey> vars(5);
+static indexed_append_list<User_Func_Lookup_Table_t, USER_FUNC_KEY_LENGTH+1, &User_Func_Lookup_Table_t::userFuncKey> funcs(5);
+
+/**
+ * Running sums of the per-entry checksums of the registered variables and functions,
+ * and the number of entries included in each sum. Entries registered since are added
+ * to the sum the next time the checksum is retrieved.
+ */
+static uint32_t vars_checksum = 0;
+static uint32_t funcs_checksum = 0;
+static unsigned vars_checksummed = 0;
+static unsigned funcs_checksummed = 0;
 
 User_Var_Lookup_Table_t* find_var_by_key(const char* varKey)
 {
-    for (int i = vars.size(); i-->0; )
-    {
-        if (0 == strncmp(vars[i].userVarKey, varKey, USER_VAR_KEY_LENGTH))
-        {
-            return &vars[i];
-        }
-    }
-    return NULL;
+    return vars.find(varKey);
 }
 
-template<typename T> T* add_if_sufficient_describe(append_list<T>& list, const char* name, const char* itemType, const T& value) {
+template<typename L, typename T> T* add_if_sufficient_describe(L& list, const char* name, const char* itemType, const T& value) {
 	T* result = list.add(value);
 	if (result) {
 		spark_protocol_describe_data data;
@@ -126,6 +130,9 @@ template<typename T> T* add_if_sufficient_describe(append_list<T>& list, const c
 	if (!result) {
 		ERROR("Cannot add %s named %d: insufficient storage", itemType, name);
 	}
+	else {
+		spark_protocol_describe_changed(spark_protocol_instance(), particle::protocol::DESCRIBE_APPLICATION, nullptr);
+	}
 	return result;
 }
 
@@ -148,6 +155,12 @@ User_Var_Lookup_Table_t* find_var_by_key_or_add(const char* varKey, const void*
     	result = add_if_sufficient_describe(vars, varKey, "variable", item);
     }
     else {
+    	if (result->userVarType != item.userVarType) {
+    		// the type is part of the checksum
+    		vars_checksum = 0;
+    		vars_checksummed = 0;
+    		spark_protocol_describe_changed(spark_protocol_instance(), particle::protocol::DESCRIBE_APPLICATION, nullptr);
+    	}
     	*result = item;
     }
     return result;
@@ -155,14 +168,7 @@ User_Var_Lookup_Table_t* find_var_by_key_or_add(const char* varKey, const void*
 
 User_Func_Lookup_Table_t* find_func_by_key(const char* funcKey)
 {
-    for (int i = funcs.size(); i-->0; )
-    {
-        if (0 == strncmp(funcs[i].userFuncKey, funcKey, USER_FUNC_KEY_LENGTH))
-        {
-            return &funcs[i];
-        }
-    }
-    return NULL;
+    return funcs.find(funcKey);
 }
 
 User_Func_Lookup_Table_t* find_func_by_key_or_add(const char* funcKey, const cloud_function_descriptor* desc)
@@ -206,32 +212,43 @@ uint32_t string_crc(const char* s)
 }
 
 /**
- * Computes the checksum of the registered functions.
- * The function name is used to compute the checksum.
+ * The checksum of a variable is derived from the variable name and type.
+ */
+uint32_t variable_checksum(const User_Var_Lookup_Table_t& item)
+{
+	return string_crc(item.userVarKey) + crc(item.userVarType);
+}
+
+/**
+ * The function name is used to compute the checksum of a function.
+ */
+uint32_t function_checksum(const User_Func_Lookup_Table_t& item)
+{
+	return string_crc(item.userFuncKey);
+}
+
+/**
+ * Retrieves the checksum of the registered functions.
  */
 uint32_t compute_functions_checksum()
 {
-	uint32_t checksum = 0;
-	for (int i = funcs.size(); i-->0; )
-    {
-		checksum += string_crc(funcs[i].userFuncKey);
-    }
-	return checksum;
+	for (; funcs_checksummed < funcs.size(); funcs_checksummed++)
+	{
+		funcs_checksum += function_checksum(funcs[funcs_checksummed]);
+	}
+	return funcs_checksum;
 }
 
 /**
- * Computes the checksum of the registered variables.
- * The checksum is derived from the variable name and type.
+ * Retrieves the checksum of the registered variables.
  */
 uint32_t compute_variables_checksum()
 {
-	uint32_t checksum = 0;
-	for (int i = vars.size(); i-->0; )
+	for (; vars_checksummed < vars.size(); vars_checksummed++)
 	{
-		checksum += string_crc(vars[i].userVarKey);
-		checksum += crc(vars[i].userVarType);
+		vars_checksum += variable_checksum(vars[vars_checksummed]);
 	}
-	return checksum;
+	return vars_checksum;
 }
 
 /**
@@ -292,12 +309,35 @@ void invokeEventHandlerInternal(uint16_t handlerInfoSize, FilteringEventHandler*
     }
 }
 
-void invokeEventHandlerString(uint16_t handlerInfoSize, FilteringEventHandler* handlerInfo,
-                const String& name, const String& data, void* reserved)
+void invokeEventHandlerShared(uint16_t handlerInfoSize, FilteringEventHandler* handlerInfo,
+                const SharedEventData& event, void* reserved)
 {
-    invokeEventHandlerInternal(handlerInfoSize, handlerInfo, name.c_str(), data.c_str(), reserved);
+    invokeEventHandlerInternal(handlerInfoSize, handlerInfo, event.name(), event.data(), reserved);
 }
 
+namespace {
+
+/**
+ * The copy of the event most recently dispatched on the system thread. All the handlers of an
+ * event share the one copy. Released after each iteration of the communication loop.
+ */
+SharedEventData g_dispatchedEvent;
+
+SharedEventData sharedEventData(const char* event_name, const char* event_data)
+{
+    if (!SYSTEM_THREAD_CURRENT())
+    {
+        return SharedEventData::create(event_name, event_data);
+    }
+    if (!g_dispatchedEvent.matches(event_name, event_data))
+    {
+        g_dispatchedEvent = SharedEventData::create(event_name, event_data);
+    }
+    return g_dispatchedEvent;
+}
+
+} // namespace
+
 void SystemEvents(const char* name, const char* data);
 
 bool is_system_handler(uint16_t handlerInfoSize, FilteringEventHandler* handlerInfo) {
@@ -314,10 +354,14 @@ void invokeEventHandler(uint16_t handlerInfoSize, FilteringEventHandler* handler
     }
     else
     {
-        // copy the buffers to dynamically allocated storage.
-        String name(event_name);
-        String data(event_data);
-        APPLICATION_THREAD_CONTEXT_ASYNC(invokeEventHandlerString(handlerInfoSize, handlerInfo, name, data, reserved));
+        // the receive buffer is reused once the event is dispatched, so the handler gets a shared copy
+        SharedEventData event = sharedEventData(event_name, event_data);
+        if (!event)
+        {
+            LOG(ERROR, "Insufficient memory to dispatch event %s", event_name);
+            return;
+        }
+        APPLICATION_THREAD_CONTEXT_ASYNC(invokeEventHandlerShared(handlerInfoSize, handlerInfo, event, reserved));
     }
 }
 
@@ -498,11 +542,26 @@ uint32_t compute_cloud_state_checksum(SparkAppStateSelector::Enum stateSelector,
             break;
 		}
 	}
-	else if (operation==SparkAppStateUpdate::PERSIST && stateSelector==SparkAppStateSelector::SUBSCRIPTIONS)
+	else if (operation==SparkAppStateUpdate::PERSIST)
 	{
-		update_persisted_state([value](SessionPersistData& data){
-			data.subscriptions_crc = value;
-		});
+		switch (stateSelector)
+		{
+		case SparkAppStateSelector::SUBSCRIPTIONS:
+			update_persisted_state([value](SessionPersistData& data){
+				data.subscriptions_crc = value;
+			});
+			break;
+		case SparkAppStateSelector::DESCRIBE_APP:
+			update_persisted_state([value](SessionPersistData& data){
+				data.describe_app_crc = value;
+			});
+			break;
+		case SparkAppStateSelector::DESCRIBE_SYSTEM:
+			update_persisted_state([value](SessionPersistData& data){
+				data.describe_system_crc = value;
+			});
+			break;
+		}
 	}
 	else if (operation==SparkAppStateUpdate::COMPUTE)
 	{
@@ -738,6 +797,10 @@ int finish_ota_firmware_update(FileTransfer::Descriptor& file, uint32_t flags, v
     hal_module_t module;
 
     int result = Spark_Finish_Firmware_Update(file, flags, &module);
+    if (result == 0 && (flags & (UpdateFlag::SUCCESS | UpdateFlag::VALIDATE_ONLY)) == UpdateFlag::SUCCESS) {
+        // The modules in flash are described by the system part of the describe message
+        spark_protocol_describe_changed(spark_protocol_instance(), DESCRIBE_SYSTEM, nullptr);
+    }
 
     if (buf && (flags & (UpdateFlag::SUCCESS | UpdateFlag::VALIDATE_ONLY)) == (UpdateFlag::SUCCESS | UpdateFlag::VALIDATE_ONLY)) {
         formatOtaUpdateStatusEventData(flags, result, &module, (uint8_t*)buf, 255);
@@ -1110,7 +1173,10 @@ int Spark_Handshake(bool presence_announce)
 
 bool Spark_Communication_Loop(void)
 {
-    return spark_protocol_event_loop(sp);
+    const bool ok = spark_protocol_event_loop(sp);
+    // the application thread holds its own references to the events it has yet to handle
+    g_dispatchedEvent = SharedEventData();
+    return ok;
 }
 
 /**
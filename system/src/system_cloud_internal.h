@@ -87,7 +87,12 @@ public:
             disconnReason_(DIAG_ID_CLOUD_DISCONNECTION_REASON, DIAG_NAME_CLOUD_DISCONNECTION_REASON, CLOUD_DISCONNECT_REASON_NONE),
             disconnCount_(DIAG_ID_CLOUD_DISCONNECTS, DIAG_NAME_CLOUD_DISCONNECTS),
             connCount_(DIAG_ID_CLOUD_CONNECTION_ATTEMPTS, DIAG_NAME_CLOUD_CONNECTION_ATTEMPTS),
-            lastError_(DIAG_ID_CLOUD_CONNECTION_ERROR_CODE, DIAG_NAME_CLOUD_CONNECTION_ERROR_CODE) {
+            lastError_(DIAG_ID_CLOUD_CONNECTION_ERROR_CODE, DIAG_NAME_CLOUD_CONNECTION_ERROR_CODE)
+#if DIAG_ENABLE_HISTOGRAMS
+            , handshakeTime_(DIAG_ID_CLOUD_HANDSHAKE_TIME, DIAG_NAME_CLOUD_HANDSHAKE_TIME)
+            , sendTime_(DIAG_ID_CLOUD_SEND_TIME, DIAG_NAME_CLOUD_SEND_TIME)
+#endif
+    {
     }
 
     CloudDiagnostics& status(Status status) {
@@ -120,6 +125,22 @@ public:
         return *this;
     }
 
+    // Duration of a successful handshake in milliseconds
+    CloudDiagnostics& handshakeTime(system_tick_t ms) {
+#if DIAG_ENABLE_HISTOGRAMS
+        handshakeTime_.record(ms);
+#endif
+        return *this;
+    }
+
+    // Time spent sending a packet to the cloud socket in microseconds
+    CloudDiagnostics& sendTime(system_tick_t us) {
+#if DIAG_ENABLE_HISTOGRAMS
+        sendTime_.record(us);
+#endif
+        return *this;
+    }
+
     static CloudDiagnostics* instance();
 
 private:
@@ -130,6 +151,10 @@ private:
     SimpleIntegerDiagnosticData disconnCount_;
     SimpleIntegerDiagnosticData connCount_;
     SimpleIntegerDiagnosticData lastError_;
+#if DIAG_ENABLE_HISTOGRAMS
+    HistogramDiagnosticData<> handshakeTime_;
+    HistogramDiagnosticData<> sendTime_;
+#endif
 };
 
 // Use this function instead of Particle.publish() in the system code
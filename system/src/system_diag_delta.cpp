@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "system_diag_delta.h"
+
+#include "system_error.h"
+
+#include <algorithm>
+
+namespace particle {
+namespace system {
+
+namespace {
+
+class DeltaWriter {
+public:
+    DeltaWriter(appender_fn append, void* data) :
+            append_(append),
+            data_(data) {
+    }
+
+    bool writeByte(uint8_t b) {
+        return append_(data_, &b, 1);
+    }
+
+    bool writeVarint(uint32_t value) {
+        uint8_t buf[5];
+        size_t n = 0;
+        do {
+            buf[n] = value & 0x7f;
+            value >>= 7;
+            if (value) {
+                buf[n] |= 0x80;
+            }
+            ++n;
+        } while (value);
+        return append_(data_, buf, n);
+    }
+
+    bool writeZigzag(int32_t value) {
+        return writeVarint(((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+    }
+
+private:
+    appender_fn append_;
+    void* data_;
+};
+
+} // namespace
+
+DiagnosticsDeltaEncoder::DiagnosticsDeltaEncoder() :
+        baseSeq_(0),
+        seq_(0),
+        interval_(0),
+        sinceKeyframe_(0),
+        hasBase_(false),
+        hasPending_(false),
+        pendingKeyframe_(false) {
+}
+
+void DiagnosticsDeltaEncoder::keyframeInterval(unsigned interval) {
+    interval_ = interval;
+}
+
+unsigned DiagnosticsDeltaEncoder::keyframeInterval() const {
+    return interval_;
+}
+
+bool DiagnosticsDeltaEncoder::isEnabled() const {
+    return interval_ > 0;
+}
+
+int DiagnosticsDeltaEncoder::encode(const Entry* entries, size_t count, appender_fn append, void* appendData) {
+    if (!pending_.resize(count)) {
+        hasPending_ = false;
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+    std::copy(entries, entries + count, pending_.begin());
+    std::sort(pending_.begin(), pending_.end(), [](const Entry& a, const Entry& b) {
+        return a.id < b.id;
+    });
+    pendingKeyframe_ = isKeyframeNeeded();
+    hasPending_ = true;
+    ++seq_;
+
+    DeltaWriter w(append, appendData);
+    if (!w.writeByte(pendingKeyframe_ ? KEYFRAME : DELTA) || !w.writeVarint(seq_) ||
+            (!pendingKeyframe_ && !w.writeVarint(baseSeq_))) {
+        return SYSTEM_ERROR_TOO_LARGE;
+    }
+    uint16_t prevId = 0;
+    int b = 0; // Index in the base snapshot
+    for (const Entry& e: pending_) {
+        const Entry* base = nullptr;
+        if (!pendingKeyframe_) {
+            while (b < base_.size() && base_[b].id < e.id) {
+                ++b;
+            }
+            if (b < base_.size() && base_[b].id == e.id) {
+                base = &base_[b];
+                if (base->value == e.value && base->error == e.error) {
+                    continue; // Unchanged
+                }
+            }
+        }
+        int32_t value = e.value;
+        if (base && !base->error && !e.error) {
+            value = (int32_t)((uint32_t)e.value - (uint32_t)base->value);
+        }
+        if (!w.writeVarint(((uint32_t)(e.id - prevId) << 1) | (e.error ? 1 : 0)) || !w.writeZigzag(value)) {
+            return SYSTEM_ERROR_TOO_LARGE;
+        }
+        prevId = e.id;
+    }
+    return 0;
+}
+
+void DiagnosticsDeltaEncoder::commit() {
+    if (!hasPending_) {
+        return;
+    }
+    swap(base_, pending_);
+    baseSeq_ = seq_;
+    hasBase_ = true;
+    hasPending_ = false;
+    sinceKeyframe_ = pendingKeyframe_ ? 1 : sinceKeyframe_ + 1;
+}
+
+void DiagnosticsDeltaEncoder::discard() {
+    hasPending_ = false;
+}
+
+void DiagnosticsDeltaEncoder::commit(uint32_t seq) {
+    if (seq == seq_) {
+        commit();
+    }
+}
+
+void DiagnosticsDeltaEncoder::discard(uint32_t seq) {
+    if (seq == seq_) {
+        discard();
+    }
+}
+
+uint32_t DiagnosticsDeltaEncoder::sequence() const {
+    return seq_;
+}
+
+void DiagnosticsDeltaEncoder::reset() {
+    hasBase_ = false;
+    hasPending_ = false;
+}
+
+DiagnosticsDeltaEncoder* DiagnosticsDeltaEncoder::instance() {
+    static DiagnosticsDeltaEncoder encoder;
+    return &encoder;
+}
+
+bool DiagnosticsDeltaEncoder::isKeyframeNeeded() const {
+    if (!hasBase_ || sinceKeyframe_ >= interval_) {
+        return true;
+    }
+    // A delta can't express that a source was removed
+    int i = 0;
+    for (const Entry& e: base_) {
+        while (i < pending_.size() && pending_[i].id < e.id) {
+            ++i;
+        }
+        if (i == pending_.size() || pending_[i].id != e.id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace system
+} // namespace particle
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "appender.h"
+#include "spark_wiring_vector.h"
+
+#include <cstdint>
+
+namespace particle {
+namespace system {
+
+/**
+ * Delta encoding of diagnostic data snapshots.
+ *
+ * A snapshot is encoded either as a keyframe, which contains all data sources, or as a delta
+ * against the last snapshot that was delivered to the cloud, which contains only the sources
+ * whose value changed. A keyframe is sent periodically so that the receiver can recover from
+ * lost state.
+ *
+ * Format (all integers are unsigned LEB128 varints unless stated otherwise):
+ * - Type (1 byte): `KEYFRAME` or `DELTA`.
+ * - Sequence number of the snapshot.
+ * - `DELTA` only: sequence number of the snapshot the values are relative to.
+ * - For each source, in ascending ID order:
+ *   - `(id - previous id) << 1 | error`, where the previous ID is 0 for the first source and
+ *     `error` is set if the value is an error code.
+ *   - Zigzag-encoded difference between the value and the value of the source in the base
+ *     snapshot, or the value itself in a keyframe, for a source not in the base snapshot, or
+ *     if either value is an error code.
+ */
+class DiagnosticsDeltaEncoder {
+public:
+    struct Entry {
+        uint16_t id;
+        int32_t value;
+        bool error; // The value is an error code
+    };
+
+    enum Type: uint8_t {
+        KEYFRAME = 0,
+        DELTA = 1
+    };
+
+    /**
+     * Default number of snapshots sent between keyframes.
+     */
+    static const unsigned DEFAULT_KEYFRAME_INTERVAL = 10;
+
+    DiagnosticsDeltaEncoder();
+
+    /**
+     * Sets the maximum number of snapshots between keyframes, including the keyframe. 0 disables
+     * delta encoding.
+     */
+    void keyframeInterval(unsigned interval);
+    unsigned keyframeInterval() const;
+
+    bool isEnabled() const;
+
+    /**
+     * Encodes a snapshot. The entries don't need to be sorted. The snapshot is kept as pending
+     * until it's either committed or discarded.
+     */
+    int encode(const Entry* entries, size_t count, appender_fn append, void* appendData);
+
+    /**
+     * Marks the pending snapshot as delivered, so that the next deltas are relative to it.
+     */
+    void commit();
+    /**
+     * Drops the pending snapshot. The next deltas are still relative to the last delivered one.
+     */
+    void discard();
+    /**
+     * Same as above, but only if \p seq is the sequence number of the pending snapshot. A
+     * delivery that completes after the next snapshot has been encoded is ignored.
+     */
+    void commit(uint32_t seq);
+    void discard(uint32_t seq);
+    /**
+     * Returns the sequence number of the last encoded snapshot.
+     */
+    uint32_t sequence() const;
+    /**
+     * Makes the next snapshot a keyframe.
+     */
+    void reset();
+
+    static DiagnosticsDeltaEncoder* instance();
+
+private:
+    Vector<Entry> base_;
+    Vector<Entry> pending_;
+    uint32_t baseSeq_;
+    uint32_t seq_;
+    unsigned interval_;
+    unsigned sinceKeyframe_;
+    bool hasBase_;
+    bool hasPending_;
+    bool pendingKeyframe_;
+
+    bool isKeyframeNeeded() const;
+};
+
+} // namespace system
+} // namespace particle
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logging.h"
+LOG_SOURCE_CATEGORY("system.ota")
+
+#include "system_ota_writer.h"
+
+#include <cstring>
+#include <new>
+
+namespace particle {
+
+namespace system {
+
+OtaChunkWriter::OtaChunkWriter(WriteFn write) :
+        write_(write),
+        chunks_(),
+        chunkSize_(0),
+        pending_(nullptr),
+        free_(nullptr),
+        thread_(OS_THREAD_INVALID_HANDLE),
+        error_(0) {
+}
+
+OtaChunkWriter::~OtaChunkWriter() {
+    end();
+    if (pending_) {
+        os_queue_destroy(pending_, nullptr);
+    }
+    if (free_) {
+        os_queue_destroy(free_, nullptr);
+    }
+}
+
+int OtaChunkWriter::begin(size_t chunkSize) {
+    end();
+    error_ = 0;
+#if PLATFORM_THREADING
+    // The queues are kept for later transfers, the buffers and the thread only live as long as a transfer
+    if (!pending_ && os_queue_create(&pending_, sizeof(uint8_t), BUFFER_COUNT + 1, nullptr) != 0) {
+        pending_ = nullptr;
+    }
+    if (!free_ && os_queue_create(&free_, sizeof(uint8_t), BUFFER_COUNT + 1, nullptr) != 0) {
+        free_ = nullptr;
+    }
+    if (pending_ && free_) {
+        buf_.reset(new(std::nothrow) uint8_t[chunkSize * BUFFER_COUNT]);
+    }
+    if (!buf_) {
+        LOG(WARN, "Unable to allocate chunk buffers, writing chunks synchronously");
+        return 0;
+    }
+    chunkSize_ = chunkSize;
+    if (os_thread_create(&thread_, "ota", OS_THREAD_PRIORITY_DEFAULT, run, this, OS_THREAD_STACK_SIZE_DEFAULT) != 0) {
+        LOG(WARN, "Unable to create writer thread, writing chunks synchronously");
+        thread_ = OS_THREAD_INVALID_HANDLE;
+        buf_.reset();
+        return 0;
+    }
+    for (uint8_t i = 0; i < BUFFER_COUNT; ++i) {
+        os_queue_put(free_, &i, CONCURRENT_WAIT_FOREVER, nullptr);
+    }
+#endif // PLATFORM_THREADING
+    return 0;
+}
+
+int OtaChunkWriter::write(const uint8_t* data, uint32_t address, size_t size) {
+    if (error_) {
+        return error_;
+    }
+    if (!buf_ || size > chunkSize_) {
+        const int r = flush();
+        if (r) {
+            return r;
+        }
+        return write_(data, address, size, nullptr);
+    }
+    uint8_t i = 0;
+    os_queue_take(free_, &i, CONCURRENT_WAIT_FOREVER, nullptr);
+    memcpy(buf_.get() + i * chunkSize_, data, size);
+    chunks_[i].address = address;
+    chunks_[i].size = size;
+    os_queue_put(pending_, &i, CONCURRENT_WAIT_FOREVER, nullptr);
+    return 0;
+}
+
+int OtaChunkWriter::flush() {
+    if (buf_) {
+        // All buffers are free once the pending writes have completed
+        uint8_t ids[BUFFER_COUNT] = {};
+        for (auto& i: ids) {
+            os_queue_take(free_, &i, CONCURRENT_WAIT_FOREVER, nullptr);
+        }
+        for (auto& i: ids) {
+            os_queue_put(free_, &i, CONCURRENT_WAIT_FOREVER, nullptr);
+        }
+    }
+    return error_;
+}
+
+int OtaChunkWriter::end() {
+    if (buf_) {
+        uint8_t i = 0;
+        for (size_t n = 0; n < BUFFER_COUNT; ++n) {
+            os_queue_take(free_, &i, CONCURRENT_WAIT_FOREVER, nullptr);
+        }
+        i = STOP;
+        os_queue_put(pending_, &i, CONCURRENT_WAIT_FOREVER, nullptr);
+        // The thread acknowledges STOP before it exits
+        os_queue_take(free_, &i, CONCURRENT_WAIT_FOREVER, nullptr);
+        thread_ = OS_THREAD_INVALID_HANDLE;
+        buf_.reset();
+    }
+    return error_;
+}
+
+void OtaChunkWriter::run(void* data) {
+    const auto self = static_cast<OtaChunkWriter*>(data);
+    uint8_t i = 0;
+    for (;;) {
+        os_queue_take(self->pending_, &i, CONCURRENT_WAIT_FOREVER, nullptr);
+        if (i == STOP) {
+            break;
+        }
+        // Once a write fails, the transfer fails, don't bother writing the remaining chunks
+        if (!self->error_) {
+            const Chunk& chunk = self->chunks_[i];
+            const int r = self->write_(self->buf_.get() + i * self->chunkSize_, chunk.address, chunk.size, nullptr);
+            if (r) {
+                LOG(ERROR, "Unable to write chunk at 0x%08x: %d", (unsigned)chunk.address, r);
+                self->error_ = r;
+            }
+        }
+        os_queue_put(self->free_, &i, CONCURRENT_WAIT_FOREVER, nullptr);
+    }
+    os_queue_put(self->free_, &i, CONCURRENT_WAIT_FOREVER, nullptr);
+    os_thread_exit(nullptr);
+}
+
+} // namespace system
+
+} // namespace particle
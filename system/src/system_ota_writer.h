@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "concurrent_hal.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+
+namespace particle {
+namespace system {
+
+/**
+ * Writes OTA chunks to flash on a separate thread, so that the next chunk can be received while
+ * the previous one is being written.
+ *
+ * Chunks are copied into a small pool of buffers. When all of them are in use, write() waits for
+ * the oldest write to complete. A write that fails is reported by the next call to write(),
+ * flush() or end(). Without threading, or if the buffers can't be allocated, chunks are written
+ * synchronously.
+ */
+class OtaChunkWriter {
+public:
+    typedef int(*WriteFn)(const uint8_t* data, uint32_t address, uint32_t size, void* reserved);
+
+    /**
+     * Number of chunks that can be pending at a time.
+     */
+    static const size_t BUFFER_COUNT = 4;
+
+    explicit OtaChunkWriter(WriteFn write);
+    ~OtaChunkWriter();
+
+    /**
+     * Starts a transfer of chunks no larger than `chunkSize`.
+     */
+    int begin(size_t chunkSize);
+
+    /**
+     * Writes a chunk, or queues it to be written.
+     */
+    int write(const uint8_t* data, uint32_t address, size_t size);
+
+    /**
+     * Waits for the pending writes to complete.
+     */
+    int flush();
+
+    /**
+     * Waits for the pending writes to complete and releases the buffers.
+     */
+    int end();
+
+    bool isPipelined() const {
+        return buf_ != nullptr;
+    }
+
+private:
+    struct Chunk {
+        uint32_t address;
+        uint32_t size;
+    };
+
+    WriteFn write_;
+    std::unique_ptr<uint8_t[]> buf_;
+    Chunk chunks_[BUFFER_COUNT];
+    size_t chunkSize_;
+    os_queue_t pending_; // Indices of the buffers to write, or STOP
+    os_queue_t free_; // Indices of the buffers that can be reused
+    os_thread_t thread_;
+    volatile int error_;
+
+    static const uint8_t STOP = 0xff;
+
+    int takeError();
+
+    static void run(void* data);
+};
+
+} // namespace system
+} // namespace particle
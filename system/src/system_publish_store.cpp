@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logging.h"
+LOG_SOURCE_CATEGORY("system.pubstore")
+
+#include "system_publish_store.h"
+
+#if HAL_PLATFORM_FILESYSTEM
+
+#include "system_error.h"
+#include "spark_wiring_diagnostics.h"
+#include "protocol_defs.h"
+#include "rng_hal.h"
+#include "timer_hal.h"
+
+#include <cstring>
+#include <memory>
+#include <new>
+
+namespace particle {
+
+namespace system {
+
+namespace {
+
+using particle::protocol::MAX_EVENT_NAME_LENGTH;
+using particle::protocol::MAX_EVENT_DATA_LENGTH;
+
+// An entry in the queue: the header is followed by the event name and data, neither of which is
+// NUL-terminated
+struct __attribute__((packed)) StoredEvent {
+    uint8_t flags;
+    uint8_t nameLength;
+    int32_t ttl;
+};
+
+const size_t MAX_STORED_EVENT_SIZE = sizeof(StoredEvent) + MAX_EVENT_NAME_LENGTH + MAX_EVENT_DATA_LENGTH;
+
+// Flags kept with a stored event
+const uint32_t STORED_FLAGS_MASK = PUBLISH_EVENT_FLAG_PRIVATE | PUBLISH_EVENT_FLAG_NO_ACK | PUBLISH_EVENT_FLAG_WITH_ACK;
+
+// Completion of an event that is sent without being stored first. The event is kept in its
+// stored form until the send completes, so that it can be stored if sending it fails
+struct DirectSend {
+    completion_callback callback;
+    void* callbackData;
+    std::unique_ptr<char[]> entry;
+    size_t entrySize;
+    int error;
+    bool pending; // Set while spark_send_event() hasn't returned yet
+    bool done;
+};
+
+// Errors after which an event can be sent again later
+inline bool canStoreOnError(int error) {
+    return error == SYSTEM_ERROR_LIMIT_EXCEEDED || error == SYSTEM_ERROR_INVALID_STATE || error == SYSTEM_ERROR_IO ||
+            error == SYSTEM_ERROR_ABORTED || error == SYSTEM_ERROR_TIMEOUT;
+}
+
+// Errors that don't count as an attempt to send a stored event
+inline bool isConnectionError(int error) {
+    return error == SYSTEM_ERROR_LIMIT_EXCEEDED || error == SYSTEM_ERROR_INVALID_STATE || error == SYSTEM_ERROR_ABORTED;
+}
+
+std::unique_ptr<char[]> makeEntry(const char* name, const char* data, int ttl, uint32_t flags, size_t* size) {
+    const size_t nameLen = strnlen(name, MAX_EVENT_NAME_LENGTH);
+    const size_t dataLen = data ? strnlen(data, MAX_EVENT_DATA_LENGTH) : 0;
+    *size = sizeof(StoredEvent) + nameLen + dataLen;
+    std::unique_ptr<char[]> buf(new(std::nothrow) char[*size]);
+    if (!buf) {
+        return buf;
+    }
+    StoredEvent e = {};
+    e.flags = flags & STORED_FLAGS_MASK;
+    e.nameLength = nameLen;
+    e.ttl = ttl;
+    memcpy(buf.get(), &e, sizeof(e));
+    memcpy(buf.get() + sizeof(e), name, nameLen);
+    if (dataLen) {
+        memcpy(buf.get() + sizeof(e) + nameLen, data, dataLen);
+    }
+    return buf;
+}
+
+inline void complete(const spark_send_event_data* d, int error) {
+    if (d && d->handler_callback) {
+        d->handler_callback(error, nullptr, d->handler_data, nullptr);
+    }
+}
+
+class PublishStoreDiagnosticData: public AbstractIntegerDiagnosticData {
+public:
+    typedef IntType(*func_t)(const PublishStore&);
+
+    PublishStoreDiagnosticData(uint16_t id, const char* name, func_t f) :
+            AbstractIntegerDiagnosticData(id, name),
+            f_(f) {
+    }
+
+    virtual int get(IntType& val) override {
+        val = f_(*PublishStore::instance());
+        return 0; // OK
+    }
+
+private:
+    func_t f_;
+};
+
+PublishStoreDiagnosticData g_storedEvents(DIAG_ID_CLOUD_STORED_EVENTS, DIAG_NAME_CLOUD_STORED_EVENTS,
+        [](const PublishStore& s) -> PublishStoreDiagnosticData::IntType { return s.size(); });
+PublishStoreDiagnosticData g_storeBytesWritten(DIAG_ID_CLOUD_STORE_BYTES_WRITTEN, DIAG_NAME_CLOUD_STORE_BYTES_WRITTEN,
+        [](const PublishStore& s) -> PublishStoreDiagnosticData::IntType { return s.bytesWritten(); });
+PublishStoreDiagnosticData g_storeWraps(DIAG_ID_CLOUD_STORE_WRAPS, DIAG_NAME_CLOUD_STORE_WRAPS,
+        [](const PublishStore& s) -> PublishStoreDiagnosticData::IntType { return s.wraps(); });
+PublishStoreDiagnosticData g_storeDrops(DIAG_ID_CLOUD_STORE_DROPS, DIAG_NAME_CLOUD_STORE_DROPS,
+        [](const PublishStore& s) -> PublishStoreDiagnosticData::IntType { return s.dropped(); });
+
+} // unnamed
+
+PublishStore::PublishStore() :
+        storage_("pubq", FILESYSTEM_BLOCK_SIZE),
+        queue_(&storage_, CAPACITY),
+        dirtySince_(0),
+        retryTime_(0),
+        dropped_(0),
+        sendAttempts_(0),
+        initResult_(0),
+        inited_(false),
+        sending_(false) {
+}
+
+PublishStore* PublishStore::instance() {
+    static PublishStore store;
+    return &store;
+}
+
+bool PublishStore::publish(const char* name, const char* data, int ttl, uint32_t flags, const spark_send_event_data* d) {
+    flags &= ~(PUBLISH_EVENT_FLAG_STORE | PUBLISH_EVENT_FLAG_ASYNC);
+    const bool canStore = (init() == 0);
+    if (spark_cloud_flag_connected() && (!canStore || (queue_.isEmpty() && !sending_))) {
+        // Nothing is stored ahead of this event, try sending it right away
+        if (!canStore) {
+            return spark_send_event(name, data, ttl, flags, const_cast<spark_send_event_data*>(d));
+        }
+        std::unique_ptr<DirectSend> ds(new(std::nothrow) DirectSend());
+        if (ds) {
+            ds->entry = makeEntry(name, data, ttl, flags, &ds->entrySize);
+        }
+        if (ds && ds->entry) {
+            ds->callback = d ? d->handler_callback : nullptr;
+            ds->callbackData = d ? d->handler_data : nullptr;
+            ds->pending = true;
+            spark_send_event_data sd = { sizeof(spark_send_event_data) };
+            sd.handler_callback = directSendComplete;
+            sd.handler_data = ds.get();
+            const bool ok = spark_send_event(name, data, ttl, flags, &sd);
+            if (!ds->done) {
+                // The completion handler will forward the result
+                ds->pending = false;
+                ds.release();
+                return ok;
+            }
+            const int error = ds->error;
+            if (!canStoreOnError(error)) {
+                complete(d, error);
+                return ok;
+            }
+            LOG_DEBUG(TRACE, "Unable to send event: %d, storing it", error);
+            const int r = store(ds->entry.get(), ds->entrySize);
+            complete(d, r);
+            return r == 0;
+        }
+    }
+    size_t size = 0;
+    const auto entry = makeEntry(name, data, ttl, flags, &size);
+    const int r = entry ? store(entry.get(), size) : SYSTEM_ERROR_NO_MEMORY;
+    complete(d, r);
+    return r == 0;
+}
+
+void PublishStore::process(system_tick_t now) {
+    if (!spark_cloud_flag_connected() && !inited_) {
+        // Stored events are only loaded once the device is able to send them
+        return;
+    }
+    if (init() < 0) {
+        return;
+    }
+    if (spark_cloud_flag_connected() && !sending_ && !queue_.isEmpty() && (int)(now - retryTime_) >= 0) {
+        const int r = sendNext();
+        if (r < 0) {
+            retryTime_ = now + RETRY_DELAY;
+        }
+    }
+    if (queue_.isDirty() && now - dirtySince_ >= SYNC_DELAY) {
+        sync();
+    }
+}
+
+int PublishStore::sync() {
+    if (!inited_ || !queue_.isDirty()) {
+        return 0;
+    }
+    const int r = queue_.sync();
+    if (r < 0) {
+        LOG(ERROR, "Unable to sync event queue: %d", r);
+    }
+    return r;
+}
+
+int PublishStore::init() {
+    if (!inited_) {
+        inited_ = true;
+        initResult_ = queue_.init(HAL_RNG_GetRandomNumber());
+        if (initResult_ < 0) {
+            LOG(ERROR, "Unable to load event queue: %d", initResult_);
+        } else if (!queue_.isEmpty()) {
+            LOG(INFO, "Loaded %u stored events", (unsigned)queue_.size());
+        }
+    }
+    return initResult_;
+}
+
+int PublishStore::store(const char* entry, size_t size) {
+    markDirty();
+    int r = queue_.pushBack(entry, size);
+    if (r == 0) {
+        // Small entries are buffered in RAM by the queue, make sure the event survives a reset
+        // before reporting it as stored
+        r = sync();
+    }
+    if (r < 0) {
+        LOG(ERROR, "Unable to store event: %d", r);
+    }
+    return r;
+}
+
+int PublishStore::sendNext() {
+    // Leave room for the terminators of the name and data
+    std::unique_ptr<char[]> buf(new(std::nothrow) char[MAX_STORED_EVENT_SIZE + 2]);
+    if (!buf) {
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+    const int size = queue_.front(buf.get(), MAX_STORED_EVENT_SIZE);
+    if (size < 0) {
+        if (size != SYSTEM_ERROR_NOT_FOUND) {
+            LOG(ERROR, "Unable to read stored event: %d, discarding stored events", size);
+            queue_.clear();
+        }
+        return size;
+    }
+    StoredEvent e = {};
+    if ((size_t)size < sizeof(e)) {
+        LOG(WARN, "Discarding invalid stored event");
+        dropFront();
+        return SYSTEM_ERROR_BAD_DATA;
+    }
+    memcpy(&e, buf.get(), sizeof(e));
+    const size_t nameLen = e.nameLength;
+    const size_t dataLen = size - sizeof(e) - nameLen;
+    if (!nameLen || nameLen > size - sizeof(e)) {
+        LOG(WARN, "Discarding invalid stored event");
+        dropFront();
+        return SYSTEM_ERROR_BAD_DATA;
+    }
+    // Move the name and data apart to make room for their terminators
+    char* const name = buf.get();
+    char* const data = name + nameLen + 1;
+    memmove(name, buf.get() + sizeof(e), nameLen);
+    name[nameLen] = '\0';
+    memmove(data, buf.get() + sizeof(e) + nameLen, dataLen);
+    data[dataLen] = '\0';
+    uint32_t flags = e.flags;
+    if (!(flags & PUBLISH_EVENT_FLAG_NO_ACK)) {
+        // Keep the event until it has been acknowledged
+        flags |= PUBLISH_EVENT_FLAG_WITH_ACK;
+    }
+    sending_ = true;
+    spark_send_event_data d = { sizeof(spark_send_event_data) };
+    d.handler_callback = sendComplete;
+    d.handler_data = this;
+    // The completion handler is invoked even if the event can't be sent
+    spark_send_event(name, data, e.ttl, flags, &d);
+    return 0;
+}
+
+void PublishStore::markDirty() {
+    if (!queue_.isDirty()) {
+        dirtySince_ = HAL_Timer_Get_Milli_Seconds();
+    }
+}
+
+void PublishStore::dropFront() {
+    ++dropped_;
+    sendAttempts_ = 0;
+    markDirty();
+    const int r = queue_.popFront();
+    if (r < 0) {
+        LOG(ERROR, "Unable to remove stored event: %d", r);
+    }
+}
+
+void PublishStore::sendComplete(int error, const void* data, void* callbackData, void* reserved) {
+    const auto self = static_cast<PublishStore*>(callbackData);
+    self->sending_ = false;
+    if (error < 0) {
+        if (isConnectionError(error) || (canStoreOnError(error) && ++self->sendAttempts_ < MAX_SEND_ATTEMPTS)) {
+            LOG_DEBUG(TRACE, "Unable to send stored event: %d", error);
+            self->retryTime_ = HAL_Timer_Get_Milli_Seconds() + RETRY_DELAY;
+            return;
+        }
+        LOG(WARN, "Unable to send stored event: %d, discarding it", error);
+        self->dropFront();
+        return;
+    }
+    self->sendAttempts_ = 0;
+    self->markDirty();
+    const int r = self->queue_.popFront();
+    if (r < 0) {
+        LOG(ERROR, "Unable to remove stored event: %d", r);
+    }
+}
+
+void PublishStore::directSendComplete(int error, const void* data, void* callbackData, void* reserved) {
+    std::unique_ptr<DirectSend> ds(static_cast<DirectSend*>(callbackData));
+    if (ds->pending) {
+        // Called before spark_send_event() returned, publish() decides what to do with the event
+        ds->error = error;
+        ds->done = true;
+        ds.release();
+        return;
+    }
+    if (canStoreOnError(error)) {
+        // The event was sent but not acknowledged, or the connection went away while it was queued
+        LOG_DEBUG(TRACE, "Unable to send event: %d, storing it", error);
+        error = instance()->store(ds->entry.get(), ds->entrySize);
+        data = nullptr;
+    }
+    if (ds->callback) {
+        ds->callback(error, data, ds->callbackData, reserved);
+    }
+}
+
+} // namespace system
+
+} // namespace particle
+
+#endif // HAL_PLATFORM_FILESYSTEM
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "hal_platform.h"
+
+#if HAL_PLATFORM_FILESYSTEM
+
+#include "system_cloud.h"
+#include "system_tick_hal.h"
+#include "ring_file_queue.h"
+
+namespace particle {
+namespace system {
+
+/**
+ * Store-and-forward of events published with PUBLISH_EVENT_FLAG_STORE.
+ *
+ * Events that can't be sent because the device is offline or the event budget is exhausted
+ * are kept in a persistent queue in flash, and sent in order once the device is connected,
+ * one at a time so that the protocol's rate limit applies. An event is removed from the
+ * queue once it has been acknowledged by the cloud, or once it has failed to be sent
+ * MAX_SEND_ATTEMPTS times or with an error that sending it again wouldn't fix.
+ */
+class PublishStore {
+public:
+    /**
+     * Size of the queue in flash.
+     */
+    static const size_t CAPACITY = 64 * 1024;
+
+    /**
+     * Sent events are removed from flash in batches no later than this many milliseconds
+     * after they were sent. Added events are written to flash before they're reported
+     * as stored.
+     */
+    static const system_tick_t SYNC_DELAY = 2000;
+
+    /**
+     * Delay before a queued event that couldn't be sent is sent again.
+     */
+    static const system_tick_t RETRY_DELAY = 5000;
+
+    /**
+     * Number of times a queued event is sent before it's discarded. Failures caused by the
+     * connection going away or by the rate limit don't count.
+     */
+    static const unsigned MAX_SEND_ATTEMPTS = 5;
+
+    static PublishStore* instance();
+
+    /**
+     * Sends an event, or stores it if it can't be sent now. Events stored earlier are sent first.
+     * The completion handler is invoked once the event is sent or stored.
+     */
+    bool publish(const char* name, const char* data, int ttl, uint32_t flags, const spark_send_event_data* d);
+
+    /**
+     * Sends the next stored event if the device is connected, and writes pending changes to flash.
+     */
+    void process(system_tick_t now);
+
+    /**
+     * Writes pending changes to flash.
+     */
+    int sync();
+
+    size_t size() const {
+        return queue_.size();
+    }
+
+    uint32_t bytesWritten() const {
+        return queue_.bytesWritten();
+    }
+
+    uint32_t wraps() const {
+        return queue_.wraps();
+    }
+
+    uint32_t dropped() const {
+        return dropped_;
+    }
+
+private:
+    fs::SegmentedFileStorage storage_;
+    fs::RingFileQueue queue_;
+    system_tick_t dirtySince_;
+    system_tick_t retryTime_;
+    uint32_t dropped_;
+    unsigned sendAttempts_;
+    int initResult_;
+    bool inited_;
+    bool sending_;
+
+    PublishStore();
+
+    int init();
+    int store(const char* entry, size_t size);
+    int sendNext();
+    void markDirty();
+    void dropFront();
+
+    static void sendComplete(int error, const void* data, void* callbackData, void* reserved);
+    static void directSendComplete(int error, const void* data, void* callbackData, void* reserved);
+};
+
+} // namespace system
+} // namespace particle
+
+#endif // HAL_PLATFORM_FILESYSTEM
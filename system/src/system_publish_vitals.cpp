@@ -5,6 +5,7 @@
 
 #include "logging.h"
 #include "system_cloud.h"
+#include "system_diag_delta.h"
 #include "system_threading.h"
 
 namespace
@@ -12,6 +13,25 @@ namespace
 
 using namespace particle::system;
 
+/**
+ * @brief Completion callback of a delta-encoded description message
+ *
+ * Following deltas are relative to the last snapshot that was acknowledged by the cloud.
+ */
+void descriptionDelivered(int error, const void* data, void* callback_data, void* reserved)
+{
+    const auto seq = (uint32_t)(uintptr_t)callback_data;
+    const auto delta = DiagnosticsDeltaEncoder::instance();
+    if (error)
+    {
+        delta->discard(seq);
+    }
+    else
+    {
+        delta->commit(seq);
+    }
+}
+
 /**
  * @brief Post description message via the CoAP protocol
  *
@@ -27,9 +47,23 @@ inline int postDescription()
 
     if (spark_cloud_flag_connected())
     {
+        const auto delta = DiagnosticsDeltaEncoder::instance();
+        const bool delta_enabled = delta->isEnabled();
+
+        completion_handler_data handler = {};
+        if (delta_enabled)
+        {
+            handler.size = sizeof(handler);
+            handler.handler_callback = descriptionDelivered;
+            // The snapshot is encoded while the message is being built
+            handler.handler_data = (void*)(uintptr_t)(delta->sequence() + 1);
+        }
+
         // Transmit CoAP message via communication layer
         error = spark_protocol_post_description(spark_protocol_instance(),
-                                                particle::protocol::DESCRIBE_METRICS, nullptr);
+                                                delta_enabled ? particle::protocol::DESCRIBE_METRICS_DELTA
+                                                              : particle::protocol::DESCRIBE_METRICS,
+                                                delta_enabled ? &handler : nullptr);
 
         // Convert `protocol` error to `system` error
         error = spark_protocol_to_system_error(error);
@@ -107,6 +141,20 @@ void VitalsPublisher<Timer>::period(system_tick_t period_s_)
     }
 }
 
+template <class Timer>
+unsigned VitalsPublisher<Timer>::keyframeInterval(void) const
+{
+    return DiagnosticsDeltaEncoder::instance()->keyframeInterval();
+}
+
+template <class Timer>
+void VitalsPublisher<Timer>::keyframeInterval(unsigned interval_)
+{
+    const auto delta = DiagnosticsDeltaEncoder::instance();
+    delta->keyframeInterval(interval_);
+    delta->reset();
+}
+
 template <class Timer>
 int VitalsPublisher<Timer>::publish(void)
 {
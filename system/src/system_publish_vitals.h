@@ -70,6 +70,23 @@ public:
      */
     void period(system_tick_t period_s);
 
+    /**
+     * @brief Fetch the keyframe interval
+     *
+     * @return The keyframe interval, or 0 if delta encoding is disabled
+     */
+    unsigned keyframeInterval(void) const;
+
+    /**
+     * @brief Enable or disable delta encoding
+     *
+     * When enabled, only the vitals that changed since the last message that was sent are
+     * published, and all of them are published every \p interval messages.
+     *
+     * @param[in] interval The keyframe interval, or 0 to disable delta encoding
+     */
+    void keyframeInterval(unsigned interval);
+
     /**
      * @brief Publish vitals information to the cloud (immediately)
      *
@@ -35,6 +35,8 @@
 #include "wlan_hal.h"
 #include "delay_hal.h"
 #include "timer_hal.h"
+#include "eeprom_hal.h"
+#include "system_diag_delta.h"
 #include "rgbled.h"
 #include "service_debug.h"
 #include "cellular_hal.h"
@@ -48,6 +50,7 @@
 #include "spark_wiring_interrupts.h"
 #include "spark_wiring_led.h"
 #include "system_commands.h"
+#include "system_publish_store.h"
 
 #if HAL_PLATFORM_BLE
 #include "ble_hal.h"
@@ -352,6 +355,8 @@ void handle_cloud_connection(bool force_events)
                     SPARK_CLOUD_HANDSHAKE_NOTIFY_DONE = 0;
                     cloud_failed_connection_attempts = 0;
                     CloudDiagnostics::instance()->status(CloudDiagnostics::CONNECTED);
+                    // The new session may not know the last delivered vitals snapshot
+                    particle::system::DiagnosticsDeltaEncoder::instance()->reset();
                     system_notify_event(cloud_status, cloud_status_connected);
                     if (system_mode() == SAFE_MODE) {
 /* FIXME: there should be macro that checks for NetworkManager availability */
@@ -374,7 +379,11 @@ void handle_cloud_connection(bool force_events)
                 }
             } else { // !SPARK_CLOUD_HANDSHAKE_NOTIFY_DONE
                 LED_SIGNAL_START(CLOUD_HANDSHAKE, NORMAL);
+                const system_tick_t start = HAL_Timer_Get_Milli_Seconds();
                 err = cloud_handshake();
+                if (!err) {
+                    CloudDiagnostics::instance()->handshakeTime(HAL_Timer_Get_Milli_Seconds() - start);
+                }
             }
             if (err)
             {
@@ -458,7 +467,11 @@ void Spark_Idle_Events(bool force_events/*=false*/)
 // FIXME: there should be a separate feature macro
 #if HAL_PLATFORM_FILESYSTEM
         particle::system::fetchAndExecuteCommand(millis());
+        particle::system::PublishStore::instance()->process(millis());
 #endif // HAL_PLATFORM_FILESYSTEM
+
+        // One bounded step of the background EEPROM page swap, if enabled
+        HAL_EEPROM_Compact_Step(nullptr);
     }
     else
     {
@@ -616,9 +629,26 @@ uint8_t main_thread_current(void* reserved)
 
 uint8_t application_thread_invoke(void (*callback)(void* data), void* data, void* reserved)
 {
-    // FIXME: We need a way to report an error back to caller, if asynchronous function call can't
-    // be scheduled for some reason
-    APPLICATION_THREAD_CONTEXT_ASYNC_RESULT(application_thread_invoke(callback, data, reserved), 0);
+#if PLATFORM_THREADING
+    if (ApplicationThread.isStarted() && !ApplicationThread.isCurrentThread()) {
+        return ApplicationThread.invoke_async([=]() { callback(data); }) ? 0 : 1;
+    }
+#endif
+    callback(data);
+    return 0;
+}
+
+uint8_t system_thread_invoke(void (*callback)(void* data), void* data, void* reserved)
+{
+#if PLATFORM_THREADING
+    if (!SystemThread.isStarted()) {
+        // The system runs on the application thread
+        return application_thread_invoke(callback, data, reserved);
+    }
+    if (!SystemThread.isCurrentThread()) {
+        return SystemThread.invoke_async([=]() { callback(data); }) ? 0 : 1;
+    }
+#endif
     callback(data);
     return 0;
 }
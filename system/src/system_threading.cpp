@@ -1,5 +1,6 @@
 #include "system_threading.h"
 #include "system_task.h"
+#include "spark_wiring_diagnostics.h"
 #include <time.h>
 #include <string.h>
 
@@ -22,6 +23,37 @@ ActiveObjectThreadQueue SystemThread(ActiveObjectConfiguration(system_thread_idl
 			50, /* queue size */
 			THREAD_STACK_SIZE /* stack size */));
 
+namespace {
+
+using namespace particle;
+
+class SystemThreadDiagnosticData: public AbstractIntegerDiagnosticData {
+public:
+    typedef IntType(*func_t)(const ActiveObjectStats&);
+
+    SystemThreadDiagnosticData(uint16_t id, const char* name, func_t f) :
+            AbstractIntegerDiagnosticData(id, name),
+            f_(f) {
+    }
+
+    virtual int get(IntType& val) override {
+        ActiveObjectStats stats = {};
+        SystemThread.stats(&stats);
+        val = f_(stats);
+        return 0; // OK
+    }
+
+private:
+    func_t f_;
+};
+
+SystemThreadDiagnosticData g_systemThreadQueuePeak(DIAG_ID_SYSTEM_THREAD_QUEUE_PEAK, DIAG_NAME_SYSTEM_THREAD_QUEUE_PEAK,
+        [](const ActiveObjectStats& s) -> SystemThreadDiagnosticData::IntType { return s.max_queued; });
+SystemThreadDiagnosticData g_systemThreadLatencyPeak(DIAG_ID_SYSTEM_THREAD_LATENCY_PEAK, DIAG_NAME_SYSTEM_THREAD_LATENCY_PEAK,
+        [](const ActiveObjectStats& s) -> SystemThreadDiagnosticData::IntType { return s.max_latency; });
+
+} // unnamed
+
 /**
  * Implementation to support gthread's concurrency primitives.
  */
@@ -43,6 +43,8 @@
 #include "system_network_internal.h"
 #include "bytes2hexbuf.h"
 #include "system_threading.h"
+#include "system_diag_delta.h"
+#include "system_ota_writer.h"
 #if HAL_PLATFORM_DCT
 #include "dct.h"
 #endif // HAL_PLATFORM_DCT
@@ -285,6 +287,13 @@ void set_flag(void* flag)
 	*p = true;
 }
 
+namespace {
+
+// Chunks are written while the next one is received
+particle::system::OtaChunkWriter g_otaWriter(HAL_FLASH_Update);
+
+} // namespace
+
 int Spark_Prepare_For_Firmware_Update(FileTransfer::Descriptor& file, uint32_t flags, void* reserved)
 {
     if (file.store==FileTransfer::Store::FIRMWARE)
@@ -313,6 +322,9 @@ int Spark_Prepare_For_Firmware_Update(FileTransfer::Descriptor& file, uint32_t f
             TimingFlashUpdateTimeout = 0;
             system_notify_event(firmware_update, firmware_update_begin, &file);
             HAL_FLASH_Begin(file.file_address, file.file_length, NULL);
+            if (file.store==FileTransfer::Store::FIRMWARE) {
+                g_otaWriter.begin(file.chunk_size);
+            }
         }
     }
     else {
@@ -385,10 +397,18 @@ int Spark_Finish_Firmware_Update(FileTransfer::Descriptor& file, uint32_t flags,
     hal_module_t mod;
 
     if ((flags & (UpdateFlag::VALIDATE_ONLY | UpdateFlag::SUCCESS)) == (UpdateFlag::VALIDATE_ONLY | UpdateFlag::SUCCESS)) {
+        // More chunks may follow if the validation fails, keep the writer running
+        if (g_otaWriter.flush()) {
+            return 1;
+        }
         res = HAL_FLASH_OTA_Validate(module ? (hal_module_t*)module : &mod, true, (module_validation_flags_t)(MODULE_VALIDATION_INTEGRITY | MODULE_VALIDATION_DEPENDENCIES_FULL), NULL);
         return res;
     }
 
+    if (g_otaWriter.end()) {
+        flags &= ~UpdateFlag::SUCCESS;
+    }
+
     if (flags & UpdateFlag::SUCCESS) {    // update successful
         if (file.store==FileTransfer::Store::FIRMWARE)
         {
@@ -420,7 +440,7 @@ int Spark_Save_Firmware_Chunk(FileTransfer::Descriptor& file, const uint8_t* chu
     system_notify_event(firmware_update, firmware_update_progress, &file);
     if (file.store==FileTransfer::Store::FIRMWARE)
     {
-        result = HAL_FLASH_Update(chunk, file.chunk_address, file.chunk_size, NULL);
+        result = g_otaWriter.write(chunk, file.chunk_address, file.chunk_size);
         LED_Toggle(LED_RGB);
     }
     return result;
@@ -515,6 +535,17 @@ public:
         return write(itoa(value, buf, 10));
     }
 
+    bool write_unsigned(unsigned value) {
+        char buf[12];
+        return write(utoa(value, buf, 10));
+    }
+
+    bool write_unsigned_value(const char* name, unsigned value) {
+        return write_attribute(name) &&
+               write_unsigned(value) &&
+               next();
+    }
+
     inline bool write(char c) {
     		return super::write(c);
     }
@@ -752,6 +783,14 @@ protected:
 	        }
 	        break;
 	    }
+	    case DIAG_TYPE_HISTOGRAM: {
+	        AbstractHistogramDiagnosticData::Summary val = {};
+	        const int ret = AbstractHistogramDiagnosticData::get(src, val);
+	        if ((ret == 0 && !fmt.formatSourceHistogram(src, val)) || (ret != 0 && !fmt.formatSourceError(src, ret))) {
+	            return SYSTEM_ERROR_TOO_LARGE;
+	        }
+	        break;
+	    }
 	    default:
 	        return SYSTEM_ERROR_NOT_SUPPORTED;
 	    }
@@ -827,6 +866,20 @@ public:
 	inline bool formatSourceInt(const diag_source* src, AbstractIntegerDiagnosticData::IntType val) {
 		return json.write_value(src->name, val);
 	}
+
+	bool formatSourceHistogram(const diag_source* src, const AbstractHistogramDiagnosticData::Summary& val) {
+	    return json.write_attribute(src->name) &&
+	            json.write('{') &&
+	            json.write_unsigned_value("n", val.count) &&
+	            json.write_unsigned_value("min", val.min) &&
+	            json.write_unsigned_value("max", val.max) &&
+	            json.write_unsigned_value("p50", val.p50) &&
+	            json.write_unsigned_value("p90", val.p90) &&
+	            json.write_attribute("p99") &&
+	            json.write_unsigned(val.p99) &&
+	            json.write('}') &&
+	            json.next();
+	}
 };
 
 
@@ -865,6 +918,55 @@ public:
 		return data.write(src->id) && data.write(val);
 	}
 
+	/**
+	 * Records of the binary format have a fixed size, so a histogram is written as an integer
+	 * holding the number of recorded values.
+	 */
+	bool formatSourceHistogram(const diag_source* src, const AbstractHistogramDiagnosticData::Summary& val) {
+		return data.write(src->id) && data.write(int32_t(val.count));
+	}
+
+};
+
+
+
+// Collects the values of the data sources for delta encoding
+class SnapshotDiagnosticsFormatter : public AbstractDiagnosticsFormatter<SnapshotDiagnosticsFormatter> {
+
+	using Entry = particle::system::DiagnosticsDeltaEncoder::Entry;
+
+	Vector<Entry> entries;
+
+public:
+	inline bool openDocument() {
+		return true;
+	}
+
+	inline bool closeDocument() {
+		return true;
+	}
+
+	bool formatSourceError(const diag_source* src, int error) {
+		return entries.append({ src->id, error, true });
+	}
+
+	inline bool isSourceOk(const diag_source* src) {
+	    return true;
+	}
+
+	inline bool formatSourceInt(const diag_source* src, AbstractIntegerDiagnosticData::IntType val) {
+		return entries.append({ src->id, val, false });
+	}
+
+	// Only the number of recorded values is tracked for a histogram
+	inline bool formatSourceHistogram(const diag_source* src, const AbstractHistogramDiagnosticData::Summary& val) {
+		return entries.append({ src->id, (int32_t)val.count, false });
+	}
+
+	int encode(appender_fn append, void* append_data) {
+		return particle::system::DiagnosticsDeltaEncoder::instance()->encode(entries.data(), entries.size(),
+				append, append_data);
+	}
 };
 
 
@@ -874,7 +976,15 @@ public:
 
 int system_format_diag_data(const uint16_t* id, size_t count, unsigned flags, appender_fn append, void* append_data,
         void* reserved) {
-	if (flags & 1) {
+	if (flags & DIAG_FORMAT_DELTA) {
+		SnapshotDiagnosticsFormatter fmt;
+		const int ret = fmt.format(id, count, flags);
+		if (ret != 0) {
+			return ret;
+		}
+		return fmt.encode(append, append_data);
+	}
+	else if (flags & DIAG_FORMAT_BINARY) {
 		AppendData data(append, append_data);
 		BinaryDiagnosticsFormatter fmt(data);
 	    return fmt.format(id, count, flags);
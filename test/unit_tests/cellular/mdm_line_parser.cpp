@@ -0,0 +1,402 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mdm_line_parser.h"
+#include "cellular_enums_hal.h"
+
+#undef WARN
+#undef INFO
+#include "catch2/catch.hpp"
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+const int LINE_BUFFER_SIZE = 1024 + 64; // Same as in MDMParser::waitFinalResp()
+
+// Line splitting algorithm used by MDMParser before MDMLineParser was introduced. Every offset
+// of the pipe is checked against every pattern on each call
+class LegacyLineParser {
+public:
+    int getLine(Pipe<char>* pipe, char* buf, int len) {
+        int unkn = 0;
+        int sz = pipe->size();
+        int fr = pipe->free();
+        if (len > sz)
+            len = sz;
+        while (len > 0)
+        {
+            static struct {
+                  const char* fmt;                              int type;
+            } lutF[] = {
+                { "\r\n+USORD: %d,%d,\"%c\"",                   TYPE_PLUS       },
+                { "\r\n\r\n+USORF: %d,\"" IPSTR "\",%d,%d,\"%c\"\r\n",  TYPE_PLUS },
+                { "\r\n+USORF: %d,\"" IPSTR "\",%d,%d,\"%c\"\r\n",  TYPE_PLUS     },
+                { "\r\n+USORF: %d,\"" IPSTR "\",%d,%d,\"%c\"",  TYPE_PLUS       },
+                { "\r\n+URDFILE: %s,%d,\"%c\"",                 TYPE_PLUS       },
+            };
+            static struct {
+                  const char* sta;          const char* end;    int type;
+            } lut[] = {
+                { "\r\n\r\r\nOK\r\n",       NULL,               TYPE_OK         },
+                { "\r\nOK\r\n",             NULL,               TYPE_OK         },
+                { "OK\r\n",                 NULL,               TYPE_OK         },
+                { "\r\nERROR\r\n",          NULL,               TYPE_ERROR      },
+                { "\r\n+CME ERROR:",        "\r\n",             TYPE_ERROR      },
+                { "\r\n+CMS ERROR:",        "\r\n",             TYPE_ERROR      },
+                { "\r\nRING\r\n",           NULL,               TYPE_RING       },
+                { "\r\nCONNECT\r\n",        NULL,               TYPE_CONNECT    },
+                { "\r\nNO CARRIER\r\n",     NULL,               TYPE_NOCARRIER  },
+                { "\r\nNO DIALTONE\r\n",    NULL,               TYPE_NODIALTONE },
+                { "\r\nBUSY\r\n",           NULL,               TYPE_BUSY       },
+                { "\r\nNO ANSWER\r\n",      NULL,               TYPE_NOANSWER   },
+                { "\r\r\n\r\r\n+USORF:",    NULL,               TYPE_USORF_1    },
+                { "\r\n+",                  "\r\n",             TYPE_PLUS       },
+                { "\r\n@",                  NULL,               TYPE_PROMPT     },
+                { "\r\n>",                  NULL,               TYPE_PROMPT     },
+                { "\n>",                    NULL,               TYPE_PROMPT     },
+                { "\r\nABORTED\r\n",        NULL,               TYPE_ABORTED    },
+                { "\r\n\r\n",               NULL,               TYPE_DBLNEWLINE },
+                { "\r\n",                   "\r\n",             TYPE_UNKNOWN    },
+            };
+            for (int i = 0; i < (int)(sizeof(lutF)/sizeof(*lutF)); i ++) {
+                pipe->set(unkn);
+                int ln = parseFormated(pipe, len, lutF[i].fmt);
+                if (ln == WAIT && fr)
+                    return WAIT;
+                if ((ln != NOT_FOUND) && (unkn > 0))
+                    return TYPE_UNKNOWN | pipe->get(buf, unkn);
+                if (ln > 0)
+                    return lutF[i].type  | pipe->get(buf, ln);
+            }
+            for (int i = 0; i < (int)(sizeof(lut)/sizeof(*lut)); i ++) {
+                pipe->set(unkn);
+                int ln = MDMLineParser::parseMatch(pipe, len, lut[i].sta, lut[i].end);
+                if (ln == WAIT && fr)
+                    return WAIT;
+                if ((ln > 0) && (lut[i].type == TYPE_DBLNEWLINE) && (unkn == 0))
+                    return TYPE_UNKNOWN | pipe->get(buf, 2);
+                if ((ln > 0) && (lut[i].type == TYPE_USORF_1) && (unkn == 0))
+                    return TYPE_UNKNOWN | pipe->get(buf, 4);
+                if ((ln != NOT_FOUND) && (unkn > 0))
+                    return TYPE_UNKNOWN | pipe->get(buf, unkn);
+                if (ln > 0)
+                    return lut[i].type | pipe->get(buf, ln);
+            }
+            unkn ++;
+            len--;
+        }
+        return WAIT;
+    }
+
+private:
+    static int parseFormated(Pipe<char>* pipe, int len, const char* fmt) {
+        int o = 0;
+        int num = 0;
+        while (*fmt) {
+            if (++o > len)                  return WAIT;
+            char ch = pipe->next();
+            if (*fmt == '%') {
+                fmt++;
+                if (*fmt == 'd') {
+                    fmt ++;
+                    num = 0;
+                    while (ch >= '0' && ch <= '9') {
+                        num = num * 10 + (ch - '0');
+                        if (++o > len)      return WAIT;
+                        ch = pipe->next();
+                    }
+                }
+                else if (*fmt == 'c') {
+                    fmt ++;
+                    while (num --) {
+                        if (++o > len)      return WAIT;
+                        ch = pipe->next();
+                    }
+                }
+                else if (*fmt == 's') {
+                    fmt ++;
+                    if (ch != '\"')         return NOT_FOUND;
+                    do {
+                        if (++o > len)      return WAIT;
+                        ch = pipe->next();
+                    } while (ch != '\"');
+                    if (++o > len)          return WAIT;
+                    ch = pipe->next();
+                }
+            }
+            if (*fmt++ != ch)               return NOT_FOUND;
+        }
+        return o;
+    }
+};
+
+struct Line {
+    int type;
+    std::string data;
+
+    bool operator==(const Line& line) const {
+        return type == line.type && data == line.data;
+    }
+};
+
+std::string payload(size_t size, unsigned seed) {
+    // Binary data with a fair share of the characters used for framing
+    const char chars[] = { '\r', '\n', '"', '+', 'O', 'K', ',', '\0', '\xff', '@', '>', '1' };
+    std::mt19937 gen(seed);
+    std::string s;
+    for (size_t i = 0; i < size; ++i) {
+        s += chars[gen() % sizeof(chars)];
+    }
+    return s;
+}
+
+std::string usord(int socket, const std::string& data) {
+    return "\r\n+USORD: " + std::to_string(socket) + "," + std::to_string(data.size()) + ",\"" + data + "\"\r\n\r\nOK\r\n";
+}
+
+std::string usorf(int socket, const std::string& data, bool r410 = false) {
+    return std::string(r410 ? "\r\r\n\r" : "") + "\r\n+USORF: " + std::to_string(socket) + ",\"52.4.20.66\",5684," +
+            std::to_string(data.size()) + ",\"" + data + "\"\r\n\r\nOK\r\n";
+}
+
+// Captured responses of SARA-U260, SARA-G350 and SARA-R410 modems. Socket payloads are replaced
+// with generated data
+std::vector<std::string> transcripts() {
+    std::vector<std::string> t;
+    // Power on and registration
+    t.push_back("AT\r\r\nOK\r\n"
+            "\r\nOK\r\n"
+            "\r\nSARA-U260\r\n\r\nOK\r\n"
+            "\r\n23.20\r\n\r\nOK\r\n"
+            "\r\n+CCID: 8934076500002587657\r\n\r\nOK\r\n"
+            "\r\n+CME ERROR: SIM busy\r\n"
+            "\r\n+CREG: 2,2\r\n"
+            "\r\n+CREG: 2,5,\"2B0D\",\"0A2B3C4D\",2\r\n"
+            "\r\n+CSQ: 17,3\r\n\r\nOK\r\n"
+            "\r\n+CGATT: 1\r\n\r\nOK\r\n"
+            "\r\n+UPSND: 0,8,1\r\n\r\nOK\r\n"
+            "\r\nERROR\r\n"
+            "\r\n+CMS ERROR: 500\r\n"
+            "\r\nRING\r\n"
+            "\r\nNO CARRIER\r\n"
+            "\r\nABORTED\r\n"
+            "\r\n+UUPSDD: 0\r\n");
+    // TCP socket
+    t.push_back("\r\n+USOCR: 0\r\n\r\nOK\r\n"
+            "\r\n@" "\r\n+USOWR: 0,5\r\n\r\nOK\r\n"
+            "\r\n+UUSORD: 0,32\r\n" +
+            usord(0, payload(32, 1)) +
+            "\r\n+UUSORD: 0,512\r\n" +
+            usord(0, payload(512, 2)) +
+            usord(0, "") +
+            "\r\n+UUSOCL: 0\r\n");
+    // UDP socket, including the framing quirks of SARA-G350 and SARA-R410
+    t.push_back("\r\n+USOCR: 1\r\n\r\nOK\r\n"
+            "\r\n+UUSORF: 1,64\r\n" +
+            usorf(1, payload(64, 3)) +
+            "\r\n\r\n" + usorf(1, payload(100, 4)) +
+            usorf(1, payload(16, 5), true) +
+            "\r\n\r\r\nOK\r\n"
+            "\r\n+CME ERROR: operation not allowed\r\n\r\n"
+            "\r\n@");
+    // Noise between lines and unterminated text
+    t.push_back(std::string("\0\xff\x13garbage", 10) + "\r\n+CEREG: 1,\"2B0D\",\"0A2B3C4D\",7\r\n" +
+            "\r\n+URDFILE: \"cert\",5,\"ab\"\"c\"\r\n\r\nOK\r\n" +
+            "OK\r\n\n>trailing text");
+    return t;
+}
+
+// Feeds the transcript into the pipe in chunks of random size and collects the lines that are
+// returned by the parser. The parser is polled a few times after each chunk, like the modem
+// thread does while the data is arriving
+template<typename ParserT>
+std::vector<Line> replay(ParserT* parser, const std::string& data, unsigned seed, size_t maxChunk = 64) {
+    std::mt19937 gen(seed);
+    Pipe<char> pipe(1024);
+    std::vector<char> buf(LINE_BUFFER_SIZE);
+    std::vector<Line> lines;
+    size_t offs = 0;
+    while (offs < data.size() || pipe.size() > 0) {
+        if (offs < data.size()) {
+            const size_t n = std::min<size_t>(std::min<size_t>(gen() % maxChunk + 1, data.size() - offs), pipe.free());
+            offs += pipe.put(data.data() + offs, n);
+        }
+        for (int i = 0; i < 4; ++i) {
+            const int ret = parser->getLine(&pipe, buf.data(), buf.size());
+            if (ret == WAIT || ret == NOT_FOUND) {
+                continue;
+            }
+            lines.push_back({ TYPE(ret), std::string(buf.data(), LENGTH(ret)) });
+        }
+        if (offs == data.size() && pipe.size() > 0) {
+            // Flush the unterminated text at the end of the transcript
+            const int ret = parser->getLine(&pipe, buf.data(), buf.size());
+            if (ret == WAIT) {
+                lines.push_back({ TYPE_TEXT, std::string(pipe.size(), '\0') });
+                pipe.get(&lines.back().data[0], pipe.size());
+            } else if (ret != NOT_FOUND) {
+                lines.push_back({ TYPE(ret), std::string(buf.data(), LENGTH(ret)) });
+            }
+        }
+    }
+    return lines;
+}
+
+} // namespace
+
+TEST_CASE("MDMLineParser") {
+    SECTION("splits the transcripts in the same lines as the previous algorithm") {
+        for (const auto& t: transcripts()) {
+            for (unsigned seed = 0; seed < 50; ++seed) {
+                LegacyLineParser legacy;
+                const auto expected = replay(&legacy, t, seed);
+                MDMLineParser parser;
+                const auto lines = replay(&parser, t, seed);
+                REQUIRE(lines.size() == expected.size());
+                for (size_t i = 0; i < lines.size(); ++i) {
+                    CHECK(lines[i] == expected[i]);
+                }
+            }
+        }
+    }
+
+    SECTION("classifies lines") {
+        MDMLineParser parser;
+        const auto lines = replay(&parser, transcripts()[1], 0);
+        REQUIRE(lines.size() == 17);
+        CHECK(lines[0] == Line{ TYPE_PLUS, "\r\n+USOCR: 0\r\n" });
+        CHECK(lines[1] == Line{ TYPE_OK, "\r\nOK\r\n" });
+        CHECK(lines[2] == Line{ TYPE_PROMPT, "\r\n@" });
+        CHECK(lines[5] == Line{ TYPE_PLUS, "\r\n+UUSORD: 0,32\r\n" });
+        CHECK(lines[6] == Line{ TYPE_PLUS, "\r\n+USORD: 0,32,\"" + payload(32, 1) + "\"" });
+        CHECK(lines[7] == Line{ TYPE_UNKNOWN, "\r\n" });
+        CHECK(lines[8] == Line{ TYPE_OK, "\r\nOK\r\n" });
+        CHECK(lines[16] == Line{ TYPE_PLUS, "\r\n+UUSOCL: 0\r\n" });
+    }
+
+    SECTION("does not scan the pipe again if no data has arrived") {
+        MDMLineParser parser;
+        Pipe<char> pipe(1024);
+        char buf[LINE_BUFFER_SIZE];
+        const std::string s = "\r\n+USORD: 0,512,\"" + payload(100, 1);
+        pipe.put(s.data(), s.size());
+        CHECK(parser.getLine(&pipe, buf, sizeof(buf)) == WAIT);
+        CHECK(parser.getLine(&pipe, buf, sizeof(buf)) == WAIT);
+        // The response is still incomplete
+        pipe.put("abc", 3);
+        CHECK(parser.getLine(&pipe, buf, sizeof(buf)) == WAIT);
+        const std::string rest = payload(409, 2) + "\"\r\n";
+        pipe.put(rest.data(), rest.size());
+        const int ret = parser.getLine(&pipe, buf, sizeof(buf));
+        CHECK(TYPE(ret) == TYPE_PLUS);
+        CHECK(LENGTH(ret) == (int)(s.size() + 3 + rest.size() - 2));
+    }
+
+    SECTION("copies the socket data to the payload buffer") {
+        MDMLineParser parser;
+        Pipe<char> pipe(1024);
+        char buf[LINE_BUFFER_SIZE];
+        char data[512];
+        int received = 0;
+        parser.setPayloadBuffer(data, sizeof(data), &received);
+        CHECK(received == -1);
+        const std::string p1 = payload(300, 1);
+        const std::string p2 = payload(20, 2);
+        const std::string s = "\r\n+UUSORD: 0,300\r\n" + usord(0, p1) + usorf(1, p2);
+        pipe.put(s.data(), s.size());
+        int ret = parser.getLine(&pipe, buf, sizeof(buf));
+        CHECK(std::string(buf, LENGTH(ret)) == "\r\n+UUSORD: 0,300\r\n");
+        CHECK(received == -1);
+        ret = parser.getLine(&pipe, buf, sizeof(buf));
+        CHECK(TYPE(ret) == TYPE_PLUS);
+        CHECK(std::string(buf, LENGTH(ret)) == "\r\n+USORD: 0,300,\"\"");
+        CHECK(received == 300);
+        CHECK(std::string(data, received) == p1);
+        // The buffer is used only once
+        ret = parser.getLine(&pipe, buf, sizeof(buf));
+        ret = parser.getLine(&pipe, buf, sizeof(buf));
+        CHECK(TYPE(ret) == TYPE_OK);
+        ret = parser.getLine(&pipe, buf, sizeof(buf));
+        CHECK(std::string(buf, LENGTH(ret)) == "\r\n+USORF: 1,\"52.4.20.66\",5684,20,\"" + p2 + "\"\r\n");
+        CHECK(received == 300);
+        // UDP
+        parser.setPayloadBuffer(data, sizeof(data), &received);
+        const std::string p3 = payload(64, 3);
+        const std::string s2 = usorf(1, p3);
+        pipe.put(s2.data(), s2.size());
+        do {
+            ret = parser.getLine(&pipe, buf, sizeof(buf));
+        } while (TYPE(ret) != TYPE_PLUS);
+        CHECK(std::string(buf, LENGTH(ret)) == "\r\n+USORF: 1,\"52.4.20.66\",5684,64,\"\"\r\n");
+        CHECK(received == 64);
+        CHECK(std::string(data, received) == p3);
+    }
+
+    SECTION("keeps the data in the line if it doesn't fit in the payload buffer") {
+        MDMLineParser parser;
+        Pipe<char> pipe(1024);
+        char buf[LINE_BUFFER_SIZE];
+        char data[16];
+        int received = 0;
+        parser.setPayloadBuffer(data, sizeof(data), &received);
+        const std::string p = payload(32, 1);
+        const std::string s = usord(0, p);
+        pipe.put(s.data(), s.size());
+        const int ret = parser.getLine(&pipe, buf, sizeof(buf));
+        CHECK(std::string(buf, LENGTH(ret)) == "\r\n+USORD: 0,32,\"" + p + "\"");
+        CHECK(received == -1);
+    }
+
+    SECTION("starts over when the pipe is read by someone else") {
+        MDMLineParser parser;
+        Pipe<char> pipe(1024);
+        char buf[LINE_BUFFER_SIZE];
+        pipe.put("xxxxxx", 6);
+        CHECK(parser.getLine(&pipe, buf, sizeof(buf)) == WAIT);
+        pipe.get(buf, 6);
+        pipe.put("\r\nOK\r\n", 6);
+        CHECK(parser.getLine(&pipe, buf, sizeof(buf)) == (TYPE_OK | 6));
+    }
+}
+
+TEST_CASE("MDMLineParser CPU time per KB", "[.][benchmark]") {
+    // Socket reads of various sizes, interleaved with URCs
+    std::string data;
+    for (unsigned i = 0; data.size() < 256 * 1024; ++i) {
+        const size_t size = (i % 4 == 0) ? 512 : 16 + (i * 37) % 200;
+        data += "\r\n+UUSORD: 0," + std::to_string(size) + "\r\n";
+        data += usord(0, payload(size, i));
+        if (i % 8 == 0) {
+            data += "\r\n+CEREG: 1,\"2B0D\",\"0A2B3C4D\",7\r\n";
+        }
+    }
+    const double kb = data.size() / 1024.0;
+    auto start = std::chrono::steady_clock::now();
+    LegacyLineParser legacy;
+    const auto expected = replay(&legacy, data, 0, 16);
+    const double legacyUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / kb;
+    start = std::chrono::steady_clock::now();
+    MDMLineParser parser;
+    const auto lines = replay(&parser, data, 0, 16);
+    const double parserUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / kb;
+    REQUIRE(lines.size() == expected.size());
+    WARN("Previous algorithm: " << legacyUs << " us per KB, MDMLineParser: " << parserUs << " us per KB");
+}
@@ -25,13 +25,20 @@
 #include <fakeit.hpp>
 
 #include "mock/mock_types.h"
+#include "system_diag_delta.h"
 #include "system_publish_vitals.h"
 
+#include <string>
+#include <vector>
+
 bool spark_cloud_flag_connected_called;
 int spark_cloud_flag_connected_result;
 
 bool spark_protocol_post_description_called;
+int spark_protocol_post_description_flags;
 int spark_protocol_post_description_result;
+completion_handler_data spark_protocol_post_description_handler;
+std::function<void()> spark_protocol_post_description_hook;
 
 ISRTaskQueue SystemISRTaskQueue;
 
@@ -51,9 +58,21 @@ extern "C"
         return nullptr;
     }
 
-    int spark_protocol_post_description(ProtocolFacade*, int, void*)
+    int spark_protocol_post_description(ProtocolFacade*, int desc_flags, void* reserved)
     {
         spark_protocol_post_description_called = true;
+        spark_protocol_post_description_flags = desc_flags;
+        spark_protocol_post_description_handler = reserved ?
+                *static_cast<const completion_handler_data*>(reserved) : completion_handler_data();
+        if (spark_protocol_post_description_hook)
+        {
+            spark_protocol_post_description_hook();
+        }
+        const auto& handler = spark_protocol_post_description_handler;
+        if (spark_protocol_post_description_result && handler.handler_callback)
+        {
+            handler.handler_callback(spark_protocol_post_description_result, nullptr, handler.handler_data, nullptr);
+        }
         return spark_protocol_post_description_result;
     }
 
@@ -378,3 +397,244 @@ TEST_CASE("Publishing vitals", "[VitalsPublisher::publish]")
         }
     }
 }
+
+namespace
+{
+
+using particle::system::DiagnosticsDeltaEncoder;
+
+bool appendToString(void* data, const uint8_t* buf, size_t size)
+{
+    static_cast<std::string*>(data)->append((const char*)buf, size);
+    return true;
+}
+
+std::string encodeSnapshot(DiagnosticsDeltaEncoder& encoder,
+                           const std::vector<DiagnosticsDeltaEncoder::Entry>& entries)
+{
+    std::string out;
+    REQUIRE(encoder.encode(entries.data(), entries.size(), appendToString, &out) == 0);
+    return out;
+}
+
+// Encodes the snapshot of a single source that doesn't change
+std::string encodeNext(DiagnosticsDeltaEncoder& encoder)
+{
+    return encodeSnapshot(encoder, { { 1, 1, false } });
+}
+
+std::string bytes(std::initializer_list<uint8_t> b)
+{
+    return std::string(b.begin(), b.end());
+}
+
+// Size of the same snapshot as produced by the binary formatter
+size_t binarySnapshotSize(size_t count)
+{
+    return 4 + count * 6;
+}
+
+// Simulates a day of vitals published every 15 minutes: a few counters that change on most
+// publishes, a few values that drift slowly and the rest is steady
+size_t totalDeltaBytes(DiagnosticsDeltaEncoder& encoder, size_t sources, size_t publishes)
+{
+    std::vector<DiagnosticsDeltaEncoder::Entry> entries;
+    for (size_t i = 0; i < sources; ++i)
+    {
+        entries.push_back({ (uint16_t)(i + 1), (int32_t)(1000 * i), false });
+    }
+    size_t total = 0;
+    for (size_t n = 0; n < publishes; ++n)
+    {
+        entries[0].value += 900;                    // Uptime
+        entries[1].value += 1 + n % 3;              // Message counter
+        if (n % 4 == 0)
+        {
+            entries[2].value += (n % 8) ? 2 : -2;   // Signal strength
+        }
+        total += encodeSnapshot(encoder, entries).size();
+        encoder.commit();
+    }
+    return total;
+}
+
+} // namespace
+
+TEST_CASE("Delta encoding", "[DiagnosticsDeltaEncoder]")
+{
+    DiagnosticsDeltaEncoder encoder;
+    encoder.keyframeInterval(3);
+
+    SECTION("The first snapshot is a keyframe with all sources")
+    {
+        const auto out = encodeSnapshot(encoder, { { 10, 5, false }, { 2, -1, false }, { 7, 300, true } });
+        // Type, seq, then the sources in ascending ID order
+        CHECK(out == bytes({ 0x00, 0x01, 0x04, 0x01, 0x0b, 0xd8, 0x04, 0x06, 0x0a }));
+    }
+
+    SECTION("A delta contains only the changed sources")
+    {
+        encodeSnapshot(encoder, { { 1, 100, false }, { 2, 200, false }, { 3, 300, false } });
+        encoder.commit();
+        const auto out = encodeSnapshot(encoder, { { 1, 100, false }, { 2, 199, false }, { 3, 300, false } });
+        // Type, seq, base seq, ID 2 with a difference of -1
+        CHECK(out == bytes({ 0x01, 0x02, 0x01, 0x04, 0x01 }));
+    }
+
+    SECTION("A new source is sent with its value")
+    {
+        encodeSnapshot(encoder, { { 1, 100, false } });
+        encoder.commit();
+        const auto out = encodeSnapshot(encoder, { { 1, 100, false }, { 5, 64, false } });
+        // IDs are relative to the previous source that was sent
+        CHECK(out == bytes({ 0x01, 0x02, 0x01, 0x0a, 0x80, 0x01 }));
+    }
+
+    SECTION("A removed source forces a keyframe")
+    {
+        encodeSnapshot(encoder, { { 1, 100, false }, { 2, 200, false } });
+        encoder.commit();
+        const auto out = encodeSnapshot(encoder, { { 1, 100, false } });
+        CHECK(out[0] == DiagnosticsDeltaEncoder::KEYFRAME);
+    }
+
+    SECTION("Keyframes are sent periodically")
+    {
+        std::vector<DiagnosticsDeltaEncoder::Entry> entries = { { 1, 100, false } };
+        std::string types;
+        for (int i = 0; i < 7; ++i)
+        {
+            types += encodeSnapshot(encoder, entries)[0];
+            encoder.commit();
+        }
+        CHECK(types == bytes({ 0, 1, 1, 0, 1, 1, 0 }));
+    }
+
+    SECTION("Deltas are relative to the last committed snapshot")
+    {
+        encodeSnapshot(encoder, { { 1, 100, false } });
+        encoder.commit();
+        encodeSnapshot(encoder, { { 1, 110, false } });
+        encoder.discard();
+        const auto out = encodeSnapshot(encoder, { { 1, 120, false } });
+        // Seq 3 relative to seq 1, a difference of 20
+        CHECK(out == bytes({ 0x01, 0x03, 0x01, 0x02, 0x28 }));
+    }
+
+    SECTION("A reset forces a keyframe")
+    {
+        encodeSnapshot(encoder, { { 1, 100, false } });
+        encoder.commit();
+        encoder.reset();
+        const auto out = encodeSnapshot(encoder, { { 1, 100, false } });
+        CHECK(out[0] == DiagnosticsDeltaEncoder::KEYFRAME);
+    }
+
+    SECTION("Large values are encoded as 5-byte varints")
+    {
+        const auto out = encodeSnapshot(encoder, { { 1, INT32_MIN, false } });
+        CHECK(out == bytes({ 0x00, 0x01, 0x02, 0xff, 0xff, 0xff, 0xff, 0x0f }));
+    }
+}
+
+TEST_CASE("Delta encoding size", "[DiagnosticsDeltaEncoder]")
+{
+    const size_t SOURCES = 20;
+    const size_t PUBLISHES = 96;
+    DiagnosticsDeltaEncoder encoder;
+    encoder.keyframeInterval(DiagnosticsDeltaEncoder::DEFAULT_KEYFRAME_INTERVAL);
+    const size_t delta = totalDeltaBytes(encoder, SOURCES, PUBLISHES);
+    const size_t full = binarySnapshotSize(SOURCES) * PUBLISHES;
+    CHECK(delta * 4 < full);
+}
+
+TEST_CASE("Delta encoding bytes per publish", "[.][benchmark]")
+{
+    const size_t SOURCES = 20;
+    const size_t PUBLISHES = 96;
+    for (unsigned interval : { 1u, 5u, 10u, 50u })
+    {
+        DiagnosticsDeltaEncoder encoder;
+        encoder.keyframeInterval(interval);
+        const size_t delta = totalDeltaBytes(encoder, SOURCES, PUBLISHES);
+        WARN("Keyframe interval " << interval << ": " << (double)delta / PUBLISHES
+             << " bytes per publish, binary format: " << binarySnapshotSize(SOURCES));
+    }
+}
+
+TEST_CASE("Delta publishing", "[VitalsPublisher::publish]")
+{
+    extern int spark_cloud_flag_connected_result;
+    extern bool spark_protocol_post_description_called;
+    extern int spark_protocol_post_description_flags;
+    extern int spark_protocol_post_description_result;
+
+    const auto encoder = DiagnosticsDeltaEncoder::instance();
+    spark_cloud_flag_connected_result = true;
+    spark_protocol_post_description_called = false;
+    spark_protocol_post_description_result = 0;
+
+    // The protocol layer encodes the snapshot while the message is being built
+    spark_protocol_post_description_hook = [encoder]() {
+        encodeNext(*encoder);
+    };
+
+    particle::system::VitalsPublisher<particle::mock_type::Timer> vp;
+
+    SECTION("Full snapshots are published by default")
+    {
+        CHECK(vp.keyframeInterval() == 0);
+        CHECK(vp.publish() == 0);
+        CHECK(spark_protocol_post_description_flags == particle::protocol::DESCRIBE_METRICS);
+    }
+
+    SECTION("Deltas are requested when enabled")
+    {
+        vp.keyframeInterval(5);
+        CHECK(vp.keyframeInterval() == 5);
+        CHECK(vp.publish() == 0);
+        CHECK(spark_protocol_post_description_flags == particle::protocol::DESCRIBE_METRICS_DELTA);
+    }
+
+    SECTION("An acknowledged snapshot becomes the base of the next delta")
+    {
+        vp.keyframeInterval(5);
+        CHECK(vp.publish() == 0);
+        const auto handler = spark_protocol_post_description_handler;
+        REQUIRE(handler.handler_callback);
+        handler.handler_callback(0, nullptr, handler.handler_data, nullptr);
+        CHECK(encodeNext(*encoder)[0] == DiagnosticsDeltaEncoder::DELTA);
+    }
+
+    SECTION("A snapshot that isn't acknowledged is discarded")
+    {
+        vp.keyframeInterval(5);
+        CHECK(vp.publish() == 0);
+        const auto handler = spark_protocol_post_description_handler;
+        REQUIRE(handler.handler_callback);
+        handler.handler_callback(SYSTEM_ERROR_TIMEOUT, nullptr, handler.handler_data, nullptr);
+        CHECK(encodeNext(*encoder)[0] == DiagnosticsDeltaEncoder::KEYFRAME);
+    }
+
+    SECTION("A snapshot that failed to be sent is discarded")
+    {
+        vp.keyframeInterval(5);
+        spark_protocol_post_description_result = SYSTEM_ERROR_IO;
+        CHECK(vp.publish() == SYSTEM_ERROR_IO);
+        CHECK(encodeNext(*encoder)[0] == DiagnosticsDeltaEncoder::KEYFRAME);
+    }
+
+    SECTION("An acknowledgement received after the next snapshot was built is ignored")
+    {
+        vp.keyframeInterval(5);
+        CHECK(vp.publish() == 0);
+        const auto first = spark_protocol_post_description_handler;
+        CHECK(vp.publish() == 0);
+        first.handler_callback(0, nullptr, first.handler_data, nullptr);
+        CHECK(encodeNext(*encoder)[0] == DiagnosticsDeltaEncoder::KEYFRAME);
+    }
+
+    encoder->discard();
+    spark_protocol_post_description_hook = nullptr;
+    vp.keyframeInterval(0);
+}
@@ -0,0 +1,546 @@
+/**
+ ******************************************************************************
+  Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#include "chunked_transfer.h"
+
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <random>
+#include <vector>
+
+using namespace particle::protocol;
+
+namespace {
+
+/**
+ * A channel that uses a single buffer for received and created messages, as the device channels do,
+ * and keeps a copy of each message sent.
+ */
+class TestChannel : public MessageChannel
+{
+public:
+	uint8_t buffer[PROTOCOL_BUFFER_SIZE];
+	uint8_t response_buffer[64];
+	std::vector<std::vector<uint8_t>> sent;
+
+	ProtocolError receive(Message& message) override { return NO_ERROR; }
+	ProtocolError send(Message& msg) override
+	{
+		sent.emplace_back(msg.buf(), msg.buf() + msg.length());
+		return NO_ERROR;
+	}
+	ProtocolError command(Command cmd, void* arg) override { return NO_ERROR; }
+	bool is_unreliable() override { return true; }
+	ProtocolError establish(uint32_t& flags, uint32_t app_state_crc) override { return NO_ERROR; }
+	ProtocolError create(Message& message, size_t minimum_size) override
+	{
+		message.set_buffer(buffer, sizeof(buffer));
+		return NO_ERROR;
+	}
+	ProtocolError response(Message& original, Message& response, size_t required) override
+	{
+		response.set_buffer(response_buffer, sizeof(response_buffer));
+		return NO_ERROR;
+	}
+	ProtocolError notify_established() override { return NO_ERROR; }
+	void notify_client_messages_processed() override { }
+};
+
+class TestCallbacks : public ChunkedTransfer::Callbacks
+{
+public:
+	std::vector<uint8_t> image;
+	unsigned saved = 0;
+	int finish_flags = -1;
+	system_tick_t now = 0;
+
+	int prepare_for_firmware_update(FileTransfer::Descriptor& data, uint32_t flags, void*) override
+	{
+		image.assign(data.file_length, 0);
+		return 0;
+	}
+	int save_firmware_chunk(FileTransfer::Descriptor& descriptor, const unsigned char* chunk, void*) override
+	{
+		const uint32_t offset = descriptor.chunk_address - descriptor.file_address;
+		REQUIRE(offset + descriptor.chunk_size <= image.size());
+		memcpy(image.data() + offset, chunk, descriptor.chunk_size);
+		++saved;
+		return 0;
+	}
+	int finish_firmware_update(FileTransfer::Descriptor& data, uint32_t flags, void*) override
+	{
+		if (!(flags & UpdateFlag::VALIDATE_ONLY))
+			finish_flags = flags;
+		return 0;
+	}
+	uint32_t calculate_crc(const unsigned char *buf, uint32_t buflen) override
+	{
+		return checksum(buf, buflen);
+	}
+	system_tick_t millis() override { return now; }
+
+	static uint32_t checksum(const uint8_t* buf, size_t len)
+	{
+		uint32_t h = 2166136261u;
+		for (size_t i = 0; i < len; i++)
+			h = (h ^ buf[i]) * 16777619u;
+		return h;
+	}
+};
+
+/**
+ * An acknowledgement of firmware chunks sent by the device in windowed mode.
+ */
+struct ChunksAcked
+{
+	chunk_index_t next_index;
+	std::vector<std::pair<chunk_index_t, chunk_index_t>> ranges; // first chunk and count
+};
+
+/**
+ * Plays the server side of a fast OTA transfer, dropping chunks at random.
+ */
+class TestServer
+{
+public:
+	ChunkedTransfer& transfer;
+	TestChannel& channel;
+	std::vector<uint8_t> file;
+	uint16_t chunk_size;
+	unsigned loss_percent;
+	std::minstd_rand rng;
+
+	unsigned chunks_sent = 0;
+	unsigned chunks_lost = 0;
+	unsigned flights = 0;
+
+	std::vector<uint8_t> ready_payload;
+	std::vector<ChunksAcked> acks;
+
+	TestServer(ChunkedTransfer& transfer, TestChannel& channel, size_t file_length, uint16_t chunk_size, unsigned loss_percent) :
+			transfer(transfer),
+			channel(channel),
+			file(file_length),
+			chunk_size(chunk_size),
+			loss_percent(loss_percent),
+			rng(1234)
+	{
+		for (size_t i = 0; i < file.size(); i++)
+			file[i] = uint8_t(rng());
+	}
+
+	unsigned chunk_count() const
+	{
+		return (file.size() + chunk_size - 1) / chunk_size;
+	}
+
+	ProtocolError begin()
+	{
+		uint8_t* b = channel.buffer;
+		const uint8_t header[] = { 0x41, 0x02, 0x00, 0x01, 0x10, 0xb1, 'u', 0xff };
+		memcpy(b, header, sizeof(header));
+		b[8] = 1; // fast OTA
+		b[9] = chunk_size >> 8;
+		b[10] = chunk_size & 0xff;
+		const uint32_t length = file.size();
+		b[11] = length >> 24;
+		b[12] = length >> 16;
+		b[13] = length >> 8;
+		b[14] = length;
+		b[15] = FileTransfer::Store::FIRMWARE;
+		memset(b + 16, 0, 4);
+		Message msg(channel.buffer, sizeof(channel.buffer), 20);
+		channel.sent.clear();
+		const ProtocolError error = transfer.handle_update_begin(0x10, msg, channel);
+		for (const auto& m : channel.sent)
+		{
+			if (m.size() > 6 && m[1] == 0x44 && m[5] == 0xff) // UpdateReady
+				ready_payload.assign(m.begin() + 6, m.end());
+		}
+		return error;
+	}
+
+	ProtocolError send_chunk(chunk_index_t idx)
+	{
+		++chunks_sent;
+		if (rng() % 100 < loss_percent)
+		{
+			++chunks_lost;
+			return NO_ERROR;
+		}
+		return deliver_chunk(idx);
+	}
+
+	/**
+	 * Sends a chunk without loss and records the acknowledgements sent by the device.
+	 */
+	ProtocolError deliver_chunk(chunk_index_t idx)
+	{
+		const size_t offset = size_t(idx) * chunk_size;
+		const size_t size = std::min(file.size() - offset, size_t(chunk_size));
+		const uint32_t crc = TestCallbacks::checksum(file.data() + offset, size);
+		uint8_t* b = channel.buffer;
+		const uint8_t header[] = { 0x51, 0x02, 0x00, 0x02, 0x10, 0xb1, 'c', 0x04 };
+		memcpy(b, header, sizeof(header));
+		b[8] = crc >> 24;
+		b[9] = crc >> 16;
+		b[10] = crc >> 8;
+		b[11] = crc;
+		b[12] = 0x02;
+		b[13] = idx >> 8;
+		b[14] = idx & 0xff;
+		b[15] = 0xff;
+		memcpy(b + 16, file.data() + offset, size);
+		Message msg(channel.buffer, sizeof(channel.buffer), 16 + size);
+		channel.sent.clear();
+		const ProtocolError error = transfer.handle_chunk(0x10, msg, channel);
+		for (const auto& m : channel.sent)
+		{
+			if (m.size() >= 9 && m[0] == 0x50 && m[1] == 0x02 && m[4] == 0xb1 && m[5] == 'a')
+			{
+				ChunksAcked ack;
+				ack.next_index = m[7] << 8 | m[8];
+				for (size_t i = 9; i + 3 < m.size(); i += 4)
+					ack.ranges.emplace_back(m[i] << 8 | m[i + 1], m[i + 2] << 8 | m[i + 3]);
+				acks.push_back(ack);
+			}
+		}
+		return error;
+	}
+
+	/**
+	 * Sends UpdateDone and returns the chunks the device requests again.
+	 */
+	std::vector<chunk_index_t> done()
+	{
+		++flights;
+		channel.sent.clear();
+		const uint8_t msg_data[] = { 0x41, 0x03, 0x00, 0x03, 0x10, 0xb1, 'u' };
+		memcpy(channel.buffer, msg_data, sizeof(msg_data));
+		Message msg(channel.buffer, sizeof(channel.buffer), sizeof(msg_data));
+		REQUIRE(transfer.handle_update_done(0x10, msg, channel) == NO_ERROR);
+		std::vector<chunk_index_t> missing;
+		for (const auto& m : channel.sent)
+		{
+			if (m.size() >= 7 && m[4] == 0xb1 && m[5] == 'c')
+			{
+				for (size_t i = 7; i + 1 < m.size(); i += 2)
+					missing.push_back(chunk_index_t(m[i] << 8 | m[i + 1]));
+			}
+		}
+		return missing;
+	}
+
+	/**
+	 * Runs a complete transfer, resending the chunks requested by the device after each flight.
+	 */
+	void run()
+	{
+		REQUIRE(begin() == NO_ERROR);
+		for (chunk_index_t i = 0; i < chunk_count(); i++)
+			REQUIRE(send_chunk(i) == NO_ERROR);
+		for (std::vector<chunk_index_t> missing = done(); !missing.empty(); missing = done())
+		{
+			for (chunk_index_t idx : missing)
+				REQUIRE(send_chunk(idx) == NO_ERROR);
+			REQUIRE(flights < 1000);
+		}
+	}
+
+	/**
+	 * Runs a transfer within the receive window advertised by the device, resending the gaps
+	 * reported in its acknowledgements. When the window is exhausted or all chunks were sent,
+	 * falls back to UpdateDone and resends the chunks the device requests.
+	 */
+	void run_windowed()
+	{
+		REQUIRE(begin() == NO_ERROR);
+		REQUIRE(ready_payload.size() == 3);
+		REQUIRE(ready_payload[0] == 0x03);
+		const unsigned window = ready_payload[1] << 8 | ready_payload[2];
+		REQUIRE(window > 0);
+		std::vector<bool> queued(chunk_count());
+		std::deque<chunk_index_t> resend;
+		unsigned acked = 0;
+		unsigned next = 0;
+		const auto handle_acks = [&]() {
+			for (const ChunksAcked& ack : acks)
+			{
+				acked = std::max(acked, unsigned(ack.next_index));
+				unsigned idx = ack.next_index;
+				for (const auto& range : ack.ranges)
+				{
+					for (; idx < range.first; idx++)
+					{
+						if (!queued[idx])
+						{
+							queued[idx] = true;
+							resend.push_back(idx);
+						}
+					}
+					idx = range.first + range.second;
+				}
+			}
+			acks.clear();
+		};
+		for (;;)
+		{
+			if (!resend.empty())
+			{
+				const chunk_index_t idx = resend.front();
+				resend.pop_front();
+				queued[idx] = false;
+				REQUIRE(send_chunk(idx) == NO_ERROR);
+			}
+			else if (next < std::min(acked + window, chunk_count()))
+			{
+				REQUIRE(send_chunk(next++) == NO_ERROR);
+			}
+			else
+			{
+				const std::vector<chunk_index_t> missing = done();
+				if (missing.empty())
+					break;
+				// the device has received every chunk before the first one it requested. Chunks that
+				// were not sent yet are sent as the window moves on
+				acked = std::max(acked, unsigned(missing.front()));
+				for (chunk_index_t idx : missing)
+				{
+					if (idx >= next)
+						break;
+					REQUIRE(send_chunk(idx) == NO_ERROR);
+					handle_acks();
+				}
+				REQUIRE(flights < 1000);
+			}
+			handle_acks();
+		}
+	}
+};
+
+class TestChunkedTransfer : public ChunkedTransfer
+{
+public:
+	using ChunkedTransfer::next_chunk_missing;
+	using ChunkedTransfer::flag_chunk_received;
+};
+
+} // namespace
+
+SCENARIO("the next missing chunk is found across bitmap byte and word boundaries")
+{
+	GIVEN("a fast OTA transfer with all chunks missing")
+	{
+		TestChannel channel;
+		TestCallbacks callbacks;
+		TestChunkedTransfer transfer;
+		transfer.init(&callbacks);
+		transfer.reset();
+		TestServer server(transfer, channel, 100 * 16 - 5, 16, 0);
+		REQUIRE(server.begin() == NO_ERROR);
+		REQUIRE(server.chunk_count() == 100);
+
+		THEN("each chunk is reported missing")
+		{
+			for (chunk_index_t i = 0; i < 100; i++)
+				REQUIRE(transfer.next_chunk_missing(i) == i);
+			REQUIRE(transfer.next_chunk_missing(100) == NO_CHUNKS_MISSING);
+		}
+
+		WHEN("all but a few chunks are received")
+		{
+			const chunk_index_t missing[] = { 0, 7, 8, 31, 32, 33, 63, 64, 90, 99 };
+			for (chunk_index_t i = 0; i < 100; i++)
+			{
+				if (std::find(std::begin(missing), std::end(missing), i) == std::end(missing))
+					transfer.flag_chunk_received(i);
+			}
+
+			THEN("the missing chunks are found in order from any starting point")
+			{
+				for (chunk_index_t start = 0; start <= 100; start++)
+				{
+					const chunk_index_t* next = std::lower_bound(std::begin(missing), std::end(missing), start);
+					const chunk_index_t expected = next == std::end(missing) ? NO_CHUNKS_MISSING : *next;
+					INFO("start " << start);
+					REQUIRE(transfer.next_chunk_missing(start) == expected);
+				}
+			}
+
+			AND_WHEN("the last chunk is received")
+			{
+				transfer.flag_chunk_received(99);
+				THEN("the unused bits at the end of the bitmap are not reported missing")
+				{
+					REQUIRE(transfer.next_chunk_missing(91) == NO_CHUNKS_MISSING);
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("a fast OTA transfer with lost chunks completes once the missing chunks are resent")
+{
+	for (unsigned loss : { 0, 10, 40 })
+	{
+		TestChannel channel;
+		TestCallbacks callbacks;
+		ChunkedTransfer transfer;
+		transfer.init(&callbacks);
+		transfer.reset();
+		TestServer server(transfer, channel, 64 * 1024 + 100, 512, loss);
+		INFO("loss " << loss << "%");
+		server.run();
+
+		REQUIRE(callbacks.finish_flags == UpdateFlag::SUCCESS);
+		REQUIRE(callbacks.image == server.file);
+		REQUIRE(server.chunks_sent - server.chunks_lost == callbacks.saved);
+		REQUIRE_FALSE(transfer.is_updating());
+		if (loss == 0)
+			REQUIRE(server.flights == 1);
+	}
+}
+
+SCENARIO("the device advertises its receive window only if the server supports it")
+{
+	TestChannel channel;
+	TestCallbacks callbacks;
+	ChunkedTransfer transfer;
+	transfer.init(&callbacks);
+	transfer.reset();
+	TestServer server(transfer, channel, 64 * 16, 16, 0);
+
+	GIVEN("a server without receive window support")
+	{
+		REQUIRE(server.begin() == NO_ERROR);
+		THEN("UpdateReady only carries the fast OTA flag and no chunks are acknowledged")
+		{
+			REQUIRE(server.ready_payload == std::vector<uint8_t>{ 0x01 });
+			for (chunk_index_t i = 0; i < server.chunk_count(); i++)
+				REQUIRE(server.deliver_chunk(i) == NO_ERROR);
+			REQUIRE(server.acks.empty());
+		}
+	}
+
+	GIVEN("a server with receive window support")
+	{
+		transfer.set_window_supported(true);
+		REQUIRE(server.begin() == NO_ERROR);
+		THEN("UpdateReady carries the window size")
+		{
+			const chunk_index_t window = ChunkedTransfer::RECEIVE_WINDOW;
+			REQUIRE(server.ready_payload == std::vector<uint8_t>{ 0x03, uint8_t(window >> 8), uint8_t(window & 0xff) });
+		}
+
+		WHEN("chunks are received with gaps")
+		{
+			const chunk_index_t delivered[] = { 0, 1, 3, 4, 6, 7, 8, 9 };
+			static_assert(sizeof(delivered) / sizeof(delivered[0]) == ChunkedTransfer::ACK_INTERVAL, "");
+			for (chunk_index_t idx : delivered)
+			{
+				REQUIRE(server.acks.empty());
+				REQUIRE(server.deliver_chunk(idx) == NO_ERROR);
+			}
+			THEN("the device acknowledges the received ranges after each interval")
+			{
+				REQUIRE(server.acks.size() == 1);
+				const ChunksAcked& ack = server.acks.front();
+				REQUIRE(ack.next_index == 2);
+				const std::vector<std::pair<chunk_index_t, chunk_index_t>> ranges = { { 3, 2 }, { 6, 4 } };
+				REQUIRE(ack.ranges == ranges);
+			}
+		}
+
+		WHEN("all chunks are received")
+		{
+			for (chunk_index_t i = 0; i < server.chunk_count(); i++)
+				REQUIRE(server.deliver_chunk(i) == NO_ERROR);
+			THEN("the last acknowledgement covers the whole file")
+			{
+				REQUIRE(server.acks.size() == server.chunk_count() / ChunkedTransfer::ACK_INTERVAL);
+				REQUIRE(server.acks.back().next_index == server.chunk_count());
+				REQUIRE(server.acks.back().ranges.empty());
+			}
+		}
+	}
+}
+
+SCENARIO("a windowed fast OTA transfer with lost chunks completes")
+{
+	for (unsigned loss : { 0, 10, 40 })
+	{
+		TestChannel channel;
+		TestCallbacks callbacks;
+		ChunkedTransfer transfer;
+		transfer.init(&callbacks);
+		transfer.reset();
+		transfer.set_window_supported(true);
+		TestServer server(transfer, channel, 64 * 1024 + 100, 512, loss);
+		INFO("loss " << loss << "%");
+		server.run_windowed();
+
+		REQUIRE(callbacks.finish_flags == UpdateFlag::SUCCESS);
+		REQUIRE(callbacks.image == server.file);
+		REQUIRE_FALSE(transfer.is_updating());
+		if (loss == 0)
+		{
+			REQUIRE(server.flights == 1);
+			REQUIRE(server.chunks_sent == server.chunk_count());
+		}
+	}
+}
+
+SCENARIO("benchmark: fast OTA transfer of 512KB under packet loss", "[.][benchmark]")
+{
+	// The server side is not part of this tree: both server strategies are played by TestServer
+	// against the device code, and the link time is a model of an LTE-M link: 512 byte chunks
+	// at ~40 kbit/s, 500 ms round trip per UpdateDone flight.
+	const unsigned chunk_airtime_ms = 110;
+	const unsigned round_trip_ms = 500;
+	for (bool windowed : { false, true })
+	{
+		for (unsigned loss : { 0, 1, 5, 10, 20 })
+		{
+			TestChannel channel;
+			TestCallbacks callbacks;
+			ChunkedTransfer transfer;
+			transfer.init(&callbacks);
+			transfer.reset();
+			transfer.set_window_supported(windowed);
+			TestServer server(transfer, channel, 512 * 1024, 512, loss);
+
+			const auto start = std::chrono::steady_clock::now();
+			if (windowed)
+				server.run_windowed();
+			else
+				server.run();
+			const double elapsed_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+			REQUIRE(callbacks.finish_flags == UpdateFlag::SUCCESS);
+
+			const unsigned link_ms = server.chunks_sent * chunk_airtime_ms + server.flights * round_trip_ms;
+			WARN((windowed ? "windowed, " : "flights, ") << loss << "% loss: "
+					<< server.chunks_sent << " chunks sent, " << server.flights << " flights, "
+					<< link_ms / 1000 << " s on the link (modeled), "
+					<< elapsed_us << " us device processing");
+		}
+	}
+}
@@ -18,6 +18,8 @@
  */
 
 #include <climits>
+#include <chrono>
+#include <vector>
 
 #include "coap_channel.h"
 #include "forward_message_channel.h"
@@ -201,7 +203,7 @@ SCENARIO("a message can be added to a message store with the same id more than o
 
 }
 
-SCENARIO("multiple messages are stored in a list in the order they are added, most recent first")
+SCENARIO("multiple messages with distinct IDs are stored independently")
 {
 	const message_id_t id1 = 456;
 	const message_id_t id2 = 345;
@@ -221,9 +223,9 @@ SCENARIO("multiple messages are stored in a list in the order they are added, mo
 			REQUIRE(store.add(m1)==NO_ERROR);
 			REQUIRE(store.add(m2)==NO_ERROR);
 
-			THEN("the second message points to the first")
+			THEN("both messages are stored")
 			{
-				REQUIRE(m2->get_next()==m1);
+				REQUIRE(store.has_messages());
 				AND_THEN("both messages can be retrieved")
 				{
 					REQUIRE(store.from_id(id1)==m1);
@@ -1254,3 +1256,251 @@ SCENARIO("notify_client_messages_processed() is invoked when all client messages
 		}
 	}
 }
+
+/**
+ * A channel that counts the messages sent. Used instead of a mock where the number of
+ * messages makes recording each invocation impractical.
+ */
+class CountingChannel : public Channel
+{
+public:
+	unsigned sent = 0;
+	unsigned closed = 0;
+
+	ProtocolError receive(Message& msg) override { return NO_ERROR; }
+	ProtocolError send(Message& msg) override { ++sent; return NO_ERROR; }
+	ProtocolError command(Command cmd, void* arg) override
+	{
+		if (cmd==MessageChannel::CLOSE)
+			++closed;
+		return NO_ERROR;
+	}
+};
+
+/**
+ * Sends a confirmable message with the given ID to the store.
+ */
+ProtocolError send_confirmable(CoAPMessageStore& store, message_id_t id, system_tick_t time, size_t size=4)
+{
+	uint8_t buf[64] = { 0x40, 0, uint8_t(id >> 8), uint8_t(id & 0xFF) };
+	Message m(buf, sizeof(buf), size);
+	m.decode_id();
+	return store.send(m, time);
+}
+
+/**
+ * Delivers an acknowledgement for the given message ID to the store.
+ */
+ProtocolError receive_ack(CoAPMessageStore& store, Channel& channel, message_id_t id)
+{
+	uint8_t buf[4];
+	Message m(buf, sizeof(buf), Messages::empty_ack(buf, id >> 8, id & 0xFF));
+	return store.receive(m, channel, 0);
+}
+
+SCENARIO("many pending messages can be stored and acknowledged in any order", "[reliability]")
+{
+	GIVEN("a message store with many confirmable messages")
+	{
+		CountingChannel channel;
+		CoAPMessageStore store;
+		const unsigned count = 500;
+		for (unsigned i=0; i<count; i++)
+			REQUIRE(send_confirmable(store, 1000 + i*7, 0)==NO_ERROR);
+
+		THEN("each message can be retrieved by id")
+		{
+			REQUIRE(CoAPMessage::messages()==count);
+			REQUIRE(store.has_unacknowledged_requests());
+			for (unsigned i=0; i<count; i++)
+				REQUIRE(store.from_id(1000 + i*7)!=nullptr);
+			REQUIRE(store.from_id(1001)==nullptr);
+		}
+
+		WHEN("the messages are acknowledged in reverse order")
+		{
+			for (unsigned i=count; i>0; i--)
+				REQUIRE(receive_ack(store, channel, 1000 + (i-1)*7)==NO_ERROR);
+
+			THEN("the store is empty")
+			{
+				REQUIRE_FALSE(store.has_messages());
+				REQUIRE_FALSE(store.has_unacknowledged_requests());
+				REQUIRE(CoAPMessage::messages()==0);
+			}
+		}
+	}
+	REQUIRE(CoAPMessage::messages()==0);
+}
+
+SCENARIO("only confirmable messages count as unacknowledged requests", "[reliability]")
+{
+	GIVEN("a message store holding an acknowledgement")
+	{
+		CountingChannel channel;
+		CoAPMessageStore store;
+		uint8_t buf[4];
+		Message ack(buf, sizeof(buf), Messages::empty_ack(buf, 0x12, 0x34));
+		ack.decode_id();
+		REQUIRE(store.send(ack, 0)==NO_ERROR);
+		REQUIRE(store.has_messages());
+		REQUIRE_FALSE(store.has_unacknowledged_requests());
+
+		WHEN("a confirmable message is sent and then acknowledged")
+		{
+			REQUIRE(send_confirmable(store, 0x2345, 0)==NO_ERROR);
+			REQUIRE(store.has_unacknowledged_requests());
+			REQUIRE(receive_ack(store, channel, 0x2345)==NO_ERROR);
+
+			THEN("no unacknowledged requests remain")
+			{
+				REQUIRE_FALSE(store.has_unacknowledged_requests());
+				REQUIRE(store.has_messages());
+			}
+		}
+	}
+	REQUIRE(CoAPMessage::messages()==0);
+}
+
+SCENARIO("messages are retransmitted when their timeout is reached regardless of the order they were added", "[reliability]")
+{
+	GIVEN("a message store with a message with a later timeout added before one with an earlier timeout")
+	{
+		CountingChannel channel;
+		CoAPMessageStore store;
+		REQUIRE(send_confirmable(store, 1, 10000)==NO_ERROR);
+		REQUIRE(send_confirmable(store, 2, 0)==NO_ERROR);
+		const system_tick_t timeout1 = store.from_id(1)->get_timeout();
+		const system_tick_t timeout2 = store.from_id(2)->get_timeout();
+		REQUIRE(timeout2<timeout1);
+
+		WHEN("the store is processed before either timeout")
+		{
+			store.process(timeout2-1, channel);
+			THEN("nothing is sent")
+			{
+				REQUIRE(channel.sent==0);
+			}
+		}
+
+		WHEN("the store is processed at the earlier timeout")
+		{
+			store.process(timeout2, channel);
+			THEN("only the message with the earlier timeout is resent")
+			{
+				REQUIRE(channel.sent==1);
+				REQUIRE(store.from_id(1)->get_timeout()==timeout1);
+				REQUIRE(store.from_id(2)->get_timeout()>timeout2);
+			}
+			AND_WHEN("the store is processed at the later timeout")
+			{
+				store.process(timeout1, channel);
+				THEN("the other message is resent")
+				{
+					REQUIRE(channel.sent>=2);
+					REQUIRE(store.from_id(1)->get_timeout()>timeout1);
+				}
+			}
+		}
+
+		WHEN("the earlier message is acknowledged and the store is processed at its timeout")
+		{
+			REQUIRE(receive_ack(store, channel, 2)==NO_ERROR);
+			store.process(timeout2, channel);
+			THEN("nothing is sent")
+			{
+				REQUIRE(channel.sent==0);
+				REQUIRE(store.from_id(1)->get_timeout()==timeout1);
+			}
+		}
+
+		WHEN("both messages time out")
+		{
+			system_tick_t now = timeout1;
+			for (int i=0; i<CoAPMessage::MAX_RETRANSMIT+1; i++)
+			{
+				store.process(now, channel);
+				now += CoAPMessage::transmit_timeout(CoAPMessage::MAX_RETRANSMIT)*2;
+			}
+			THEN("both messages are removed and the channel is closed for each")
+			{
+				REQUIRE_FALSE(store.has_messages());
+				REQUIRE(channel.sent==2*CoAPMessage::MAX_RETRANSMIT);
+				REQUIRE(channel.closed==2);
+			}
+		}
+	}
+	REQUIRE(CoAPMessage::messages()==0);
+}
+
+SCENARIO("small and large CoAP messages can be allocated and released", "[reliability]")
+{
+	GIVEN("more small messages than there are pooled blocks, and a large message")
+	{
+		std::vector<CoAPMessage*> messages;
+		uint8_t buf[PROTOCOL_BUFFER_SIZE] = { 0x40, 0, 0x12, 0x34 };
+		Message small(buf, sizeof(buf), 5);
+		Message large(buf, sizeof(buf), sizeof(buf));
+		small.decode_id();
+		large.decode_id();
+
+		for (unsigned i=0; i<COAP_MESSAGE_POOL_SIZE*2; i++)
+			messages.push_back(CoAPMessage::create(small));
+		messages.push_back(CoAPMessage::create(large));
+		messages.push_back(new CoAPMessage(0x2345));
+
+		THEN("each message has distinct storage holding its data")
+		{
+			for (CoAPMessage* m : messages)
+				REQUIRE(m!=nullptr);
+			for (size_t i=0; i<messages.size()-1; i++)
+			{
+				REQUIRE(messages[i]->get_id()==0x1234);
+				REQUIRE(!memcmp(messages[i]->get_data(), buf, messages[i]->get_data_length()));
+				for (size_t j=i+1; j<messages.size(); j++)
+					REQUIRE(messages[i]!=messages[j]);
+			}
+			REQUIRE(messages.back()->get_id()==0x2345);
+			REQUIRE(messages[messages.size()-2]->get_data_length()==sizeof(buf));
+		}
+		for (CoAPMessage* m : messages)
+			delete m;
+	}
+	REQUIRE(CoAPMessage::messages()==0);
+}
+
+namespace {
+
+/**
+ * Measures the average time per acknowledgement when the given number of messages are pending.
+ */
+double ack_time_ns(unsigned pending, unsigned rounds)
+{
+	CountingChannel channel;
+	CoAPMessageStore store;
+	message_id_t id = 0;
+	for (unsigned i=0; i<pending; i++)
+		send_confirmable(store, id++, 0);
+	const auto start = std::chrono::steady_clock::now();
+	for (unsigned i=0; i<rounds; i++)
+	{
+		// acknowledge the oldest message and send a new one, keeping the number pending constant
+		receive_ack(store, channel, message_id_t(id - pending));
+		send_confirmable(store, id++, 0);
+		store.process(0, channel);
+	}
+	const auto elapsed = std::chrono::steady_clock::now() - start;
+	return std::chrono::duration<double, std::nano>(elapsed).count() / rounds;
+}
+
+} // namespace
+
+SCENARIO("benchmark: acknowledging a message with many messages pending", "[.][benchmark]")
+{
+	for (unsigned pending : { 1, 16, 128, 1024 })
+	{
+		const double ns = ack_time_ns(pending, 20000);
+		WARN(pending << " pending: " << ns << " ns per send/ack/process");
+	}
+	REQUIRE(CoAPMessage::messages()==0);
+}
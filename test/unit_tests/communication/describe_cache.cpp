@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "describe_cache.h"
+
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+
+using namespace particle::protocol;
+
+namespace {
+
+bool g_failRealloc = false;
+
+// Builds a part from a string, in chunks of a few bytes like the describe message
+struct PartBuilder
+{
+	std::string content;
+	int builds = 0;
+
+	void operator()(Appender& appender)
+	{
+		++builds;
+		for (size_t i = 0; i < content.size(); i += 7)
+		{
+			appender.append((const uint8_t*)content.data() + i, std::min<size_t>(7, content.size() - i));
+		}
+	}
+};
+
+std::string data(const DescribeCache& cache, DescribeCache::Part part)
+{
+	return std::string((const char*)cache.data(part), cache.size(part));
+}
+
+} // namespace
+
+extern "C" void* t_realloc(void* ptr, size_t size)
+{
+	if (g_failRealloc)
+	{
+		return nullptr;
+	}
+	return realloc(ptr, size);
+}
+
+extern "C" void t_free(void* ptr)
+{
+	free(ptr);
+}
+
+TEST_CASE("DescribeCache")
+{
+	DescribeCache cache;
+	PartBuilder app;
+	app.content = "\"f\":[\"func\"],\"v\":{\"var\":2}";
+	PartBuilder sys;
+	sys.content = std::string(1000, 's');
+	g_failRealloc = false;
+
+	auto buildApp = [&app](Appender& a) { app(a); };
+	auto buildSys = [&sys](Appender& a) { sys(a); };
+
+	SECTION("a part is built once while its generation is current")
+	{
+		REQUIRE(cache.update(DescribeCache::APPLICATION, buildApp));
+		REQUIRE(cache.update(DescribeCache::APPLICATION, buildApp));
+		CHECK(app.builds == 1);
+		CHECK(data(cache, DescribeCache::APPLICATION) == app.content);
+	}
+
+	SECTION("a part larger than the initial buffer is built in a single pass")
+	{
+		REQUIRE(cache.update(DescribeCache::SYSTEM, buildSys));
+		CHECK(sys.builds == 1);
+		CHECK(data(cache, DescribeCache::SYSTEM) == sys.content);
+	}
+
+	SECTION("a part is rebuilt after its generation changes")
+	{
+		REQUIRE(cache.update(DescribeCache::APPLICATION, buildApp));
+		REQUIRE(cache.update(DescribeCache::SYSTEM, buildSys));
+		const uint32_t gen = cache.generation(DescribeCache::APPLICATION);
+		app.content = "\"f\":[],\"v\":{}";
+		cache.invalidate(DESCRIBE_APPLICATION);
+		CHECK(cache.generation(DescribeCache::APPLICATION) != gen);
+		REQUIRE(cache.update(DescribeCache::APPLICATION, buildApp));
+		REQUIRE(cache.update(DescribeCache::SYSTEM, buildSys));
+		CHECK(app.builds == 2);
+		CHECK(sys.builds == 1);
+		CHECK(data(cache, DescribeCache::APPLICATION) == app.content);
+	}
+
+	SECTION("a checksum is computed again after its generation changes")
+	{
+		int computed = 0;
+		auto compute = [&computed]() { return (uint32_t)++computed; };
+		CHECK(cache.checksum(DescribeCache::SYSTEM, compute) == 1);
+		CHECK(cache.checksum(DescribeCache::SYSTEM, compute) == 1);
+		cache.invalidate(DESCRIBE_APPLICATION);
+		CHECK(cache.checksum(DescribeCache::SYSTEM, compute) == 1);
+		cache.invalidate(DESCRIBE_SYSTEM);
+		CHECK(cache.checksum(DescribeCache::SYSTEM, compute) == 2);
+	}
+
+	SECTION("a part that can't be allocated is not cached")
+	{
+		g_failRealloc = true;
+		CHECK_FALSE(cache.update(DescribeCache::SYSTEM, buildSys));
+		CHECK_FALSE(cache.update(DescribeCache::SYSTEM, buildSys));
+		CHECK(sys.builds == 2);
+		g_failRealloc = false;
+		REQUIRE(cache.update(DescribeCache::SYSTEM, buildSys));
+		CHECK(data(cache, DescribeCache::SYSTEM) == sys.content);
+	}
+
+	SECTION("a part that can't be grown is not cached")
+	{
+		REQUIRE(cache.update(DescribeCache::APPLICATION, buildApp));
+		app.content = std::string(500, 'a');
+		cache.invalidate(DESCRIBE_APPLICATION);
+		g_failRealloc = true;
+		CHECK_FALSE(cache.update(DescribeCache::APPLICATION, buildApp));
+		g_failRealloc = false;
+		REQUIRE(cache.update(DescribeCache::APPLICATION, buildApp));
+		CHECK(data(cache, DescribeCache::APPLICATION) == app.content);
+	}
+}
@@ -290,3 +290,112 @@ SCENARIO("confirmable messages")
 	}
 
 }
+
+SCENARIO("encoding a batch of events")
+{
+	WHEN("a batch header is written")
+	{
+		uint8_t buf[Messages::event_batch_header_size];
+		const size_t len = Messages::event_batch(buf, 0x1234, true);
+		THEN("the header is a confirmable POST to /b followed by a payload marker")
+		{
+			const uint8_t expected[] = { 0x40, 0x02, 0x12, 0x34, 0xb1, 'b', 0xff };
+			REQUIRE(len==sizeof(expected));
+			REQUIRE(memcmp(buf, expected, sizeof(expected))==0);
+		}
+	}
+
+	WHEN("an event with data is encoded")
+	{
+		uint8_t buf[32];
+		const size_t len = Messages::event_batch_record(buf, "temp", "21.5", 60, EventType::PRIVATE);
+		THEN("the record contains the type, TTL, name and data")
+		{
+			const uint8_t expected[] = { 'E', 0, 0, 60, 4, 't', 'e', 'm', 'p', 0, 4, '2', '1', '.', '5' };
+			REQUIRE(len==sizeof(expected));
+			REQUIRE(len==Messages::event_batch_record_size("temp", "21.5"));
+			REQUIRE(memcmp(buf, expected, sizeof(expected))==0);
+		}
+	}
+
+	WHEN("an event without data is encoded")
+	{
+		uint8_t buf[32];
+		const size_t len = Messages::event_batch_record(buf, "a", nullptr, 0x123456, EventType::PUBLIC);
+		THEN("the data length is 0xffff")
+		{
+			const uint8_t expected[] = { 'e', 0x12, 0x34, 0x56, 1, 'a', 0xff, 0xff };
+			REQUIRE(len==sizeof(expected));
+			REQUIRE(len==Messages::event_batch_record_size("a", nullptr));
+			REQUIRE(memcmp(buf, expected, sizeof(expected))==0);
+		}
+	}
+}
+
+SCENARIO("decoding the flags of a hello message")
+{
+	WHEN("a hello message is decoded")
+	{
+		uint8_t buf[32];
+		const uint8_t device_id[] = { 1, 2, 3 };
+		const size_t len = Messages::hello(buf, 0, 0x0a, 6, 1234, 5, true, device_id, sizeof(device_id));
+		THEN("the flags are returned")
+		{
+			REQUIRE(Messages::hello_flags(buf, len)==0x0a);
+		}
+	}
+
+	WHEN("a hello message has no payload")
+	{
+		uint8_t buf[] = { 0x40, 0x02, 0, 0, 0xb1, 'h' };
+		THEN("no flags are returned")
+		{
+			REQUIRE(Messages::hello_flags(buf, sizeof(buf))==0);
+		}
+	}
+
+	WHEN("a hello message has an option with a reserved length")
+	{
+		uint8_t buf[] = { 0x40, 0x02, 0, 0, 0xb1, 'h', 0x0f, 0xff, 0, 0, 0, 0, 0, 0, 0x0a };
+		THEN("no flags are returned")
+		{
+			REQUIRE(Messages::hello_flags(buf, sizeof(buf))==0);
+		}
+	}
+
+	WHEN("a hello message ends in the middle of an extended option length")
+	{
+		uint8_t buf[] = { 0x40, 0x02, 0, 0, 0xb1, 'h', 0x0e, 0x01 };
+		THEN("no flags are returned")
+		{
+			REQUIRE(Messages::hello_flags(buf, sizeof(buf))==0);
+		}
+	}
+}
+
+SCENARIO("encoding a describe response with a checksum")
+{
+	WHEN("the description has changed")
+	{
+		uint8_t buf[16];
+		const size_t len = Messages::description(buf, 0x1234, 0x56, 0x01020304, true);
+		THEN("the response is a 2.05 with an ETag followed by a payload marker")
+		{
+			const uint8_t expected[] = { 0x61, 0x45, 0x12, 0x34, 0x56, 0x44, 1, 2, 3, 4, 0xff };
+			REQUIRE(len==sizeof(expected));
+			REQUIRE(memcmp(buf, expected, sizeof(expected))==0);
+		}
+	}
+
+	WHEN("the description is unchanged")
+	{
+		uint8_t buf[16];
+		const size_t len = Messages::description(buf, 0x1234, 0x56, 0x01020304, false);
+		THEN("the response is a 2.03 with an ETag and no payload")
+		{
+			const uint8_t expected[] = { 0x61, 0x43, 0x12, 0x34, 0x56, 0x44, 1, 2, 3, 4 };
+			REQUIRE(len==sizeof(expected));
+			REQUIRE(memcmp(buf, expected, sizeof(expected))==0);
+		}
+	}
+}
@@ -71,11 +71,11 @@ void event_handler(const char* event, const char* data)
 {
 }
 
-SCENARIO("6 subscribe messages are registered")
+SCENARIO("more than MAX_SUBSCRIPTIONS subscribe messages are registered")
 {
 	MessageChannel* channel = nullptr;
 	AbstractProtocol p(*channel);	// channel is not used
-	for (int i=0; i<6; i++) {
+	for (int i=0; i<MAX_SUBSCRIPTIONS * 2; i++) {
 		INFO("adding event " << i);
 		char buf[2];
 		buf[1] = 0;
@@ -84,12 +84,9 @@ SCENARIO("6 subscribe messages are registered")
 		REQUIRE(added);
 	}
 
-	bool added = p.add_event_handler("abcd", event_handler);
-	REQUIRE(!added);
-
 	p.remove_event_handlers(nullptr);
 
-	added = p.add_event_handler("abcd", event_handler);
+	bool added = p.add_event_handler("abcd", event_handler);
 	REQUIRE(added);
 
 }
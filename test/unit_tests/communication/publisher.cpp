@@ -21,7 +21,80 @@
 
 #include <catch2/catch.hpp>
 
+#include <string>
+#include <cstdio>
+
 using namespace particle::protocol;
+using particle::CompletionHandler;
+
+namespace {
+
+class TestChannel : public MessageChannel
+{
+public:
+	uint8_t buffer[PROTOCOL_BUFFER_SIZE];
+	int sent;
+	size_t sent_bytes;
+	ProtocolError send_result;
+
+	TestChannel() :
+			sent(0),
+			sent_bytes(0),
+			send_result(NO_ERROR)
+	{
+	}
+
+	ProtocolError receive(Message& message) override { return NO_ERROR; }
+	ProtocolError send(Message& msg) override
+	{
+		if (send_result == NO_ERROR) {
+			++sent;
+			sent_bytes += msg.length();
+		}
+		return send_result;
+	}
+	ProtocolError command(Command cmd, void* arg) override { return NO_ERROR; }
+	bool is_unreliable() override { return true; }
+	ProtocolError establish(uint32_t& flags, uint32_t app_state_crc) override { return NO_ERROR; }
+	ProtocolError create(Message& message, size_t minimum_size) override
+	{
+		message.set_buffer(buffer, sizeof(buffer));
+		return NO_ERROR;
+	}
+	ProtocolError response(Message& original, Message& response, size_t required) override { return NO_ERROR; }
+	ProtocolError notify_established() override { return NO_ERROR; }
+	void notify_client_messages_processed() override { }
+};
+
+struct Completions
+{
+	int results = 0;
+	int errors = 0;
+	int last_error = 0;
+
+	static void callback(int error, const void* data, void* callback_data, void* reserved)
+	{
+		Completions* c = static_cast<Completions*>(callback_data);
+		if (error) {
+			++c->errors;
+			c->last_error = error;
+		} else {
+			++c->results;
+		}
+	}
+
+	CompletionHandler handler()
+	{
+		return CompletionHandler(callback, this);
+	}
+};
+
+ProtocolError publish(Publisher& publisher, TestChannel& channel, const char* name, system_tick_t time, Completions& c)
+{
+	return publisher.send_event(channel, name, "data", 60, EventType::PRIVATE, EventType::EMPTY_FLAGS, time, c.handler());
+}
+
+} // namespace
 
 SCENARIO("publisher")
 {
@@ -30,24 +103,33 @@ SCENARIO("publisher")
 		Protocol* protocol = nullptr;
 		Publisher publisher(protocol);
 
-		WHEN("4 application events are sent within 1 second")
+		WHEN("a burst of 4 application events is sent")
 		{
-			REQUIRE(publisher.is_rate_limited(false, 1000)==false);
-			REQUIRE(publisher.is_rate_limited(false, 1200)==false);
-			REQUIRE(publisher.is_rate_limited(false, 1400)==false);
-			REQUIRE(publisher.is_rate_limited(false, 1600)==false);
+			for (int i=0; i<4; i++) {
+				REQUIRE(publisher.is_rate_limited(false, 1000)==false);
+			}
 
-			const system_tick_t next_app_event = 5000;  // 1000ms + 4s
-			THEN("application events until 4 seconds have elapsed are rate limited")
+			THEN("application events are rate limited until the budget for one event is regained")
 			{
-				for (system_tick_t i=1600; i<next_app_event; i+=100) {
+				for (system_tick_t i=1000; i<1250; i+=50) {
 					REQUIRE(publisher.is_rate_limited(false, i)==true);
 				}
+				REQUIRE(publisher.is_rate_limited(false, 1250)==false);
+				REQUIRE(publisher.is_rate_limited(false, 1250)==true);
 			}
 
-			THEN("an application event after 4 seconds have elapsed is not rate limited")
+			THEN("the full burst is available again after 1 second has elapsed")
 			{
-				REQUIRE(publisher.is_rate_limited(false, next_app_event)==false);
+				const system_tick_t next_burst = 2000;  // 1000ms + 4 * 250ms
+				for (int i=0; i<4; i++) {
+					REQUIRE(publisher.is_rate_limited(false, next_burst)==false);
+				}
+				REQUIRE(publisher.is_rate_limited(false, next_burst)==true);
+			}
+
+			THEN("system events are not rate limited")
+			{
+				REQUIRE(publisher.is_rate_limited(true, 1600)==false);
 			}
 		}
 
@@ -58,25 +140,21 @@ SCENARIO("publisher")
 				REQUIRE(publisher.is_rate_limited(true, i)==false);
 			}
 
-			THEN("all system events until the next minute begins are rate limited")
+			THEN("system events are rate limited until the budget for one event is regained")
 			{
-				for (int i=1000; i<60*1000; i+=1000) {
-					INFO("The counter is " << i);
-					REQUIRE(publisher.is_rate_limited(true, i)==true);
-				}
+				REQUIRE(publisher.is_rate_limited(true, 255)==true);
+				REQUIRE(publisher.is_rate_limited(true, Publisher::DEFAULT_SYSTEM_PERIOD - 1)==true);
+				REQUIRE(publisher.is_rate_limited(true, Publisher::DEFAULT_SYSTEM_PERIOD)==false);
+				REQUIRE(publisher.is_rate_limited(true, Publisher::DEFAULT_SYSTEM_PERIOD)==true);
 
-				// it's only approximately 1 minute, the cutoff is 64k milliseconds
-				for (int i=60000; i<65536; i+=8) {
-					INFO("The counter is " << i);
-					REQUIRE(publisher.is_rate_limited(true, i)==true);
-				}
-
-				AND_THEN("system events in the next minute are not rate limited")
+				AND_THEN("the full budget is regained in about a minute")
 				{
-					for (int i=65536; i<65536+255; i++) {
+					const system_tick_t minute_later = Publisher::DEFAULT_SYSTEM_PERIOD * 256;
+					for (int i=0; i<255; i++) {
 						INFO("The counter is " << i);
-						REQUIRE(publisher.is_rate_limited(true, i)==false);
+						REQUIRE(publisher.is_rate_limited(true, minute_later)==false);
 					}
+					REQUIRE(publisher.is_rate_limited(true, minute_later)==true);
 				}
 			}
 
@@ -89,5 +167,382 @@ SCENARIO("publisher")
 				REQUIRE(publisher.is_rate_limited(false, 1000)==true);
 			}
 		}
+
+		WHEN("the budget is changed")
+		{
+			publisher.set_rate_limit(Publisher::APPLICATION_EVENT, 2, 100);
+
+			THEN("the new burst size and period are used")
+			{
+				REQUIRE(publisher.is_rate_limited(false, 0)==false);
+				REQUIRE(publisher.is_rate_limited(false, 0)==false);
+				REQUIRE(publisher.is_rate_limited(false, 0)==true);
+				REQUIRE(publisher.is_rate_limited(false, 100)==false);
+				REQUIRE(publisher.is_rate_limited(false, 100)==true);
+			}
+
+			THEN("a period of 0 disables rate limiting")
+			{
+				publisher.set_rate_limit(Publisher::APPLICATION_EVENT, 2, 0);
+				for (int i=0; i<1000; i++) {
+					REQUIRE(publisher.is_rate_limited(false, 0)==false);
+				}
+			}
+		}
+
+		WHEN("the millisecond counter overflows")
+		{
+			const system_tick_t start = system_tick_t(-100);
+			for (int i=0; i<4; i++) {
+				REQUIRE(publisher.is_rate_limited(false, start)==false);
+			}
+			REQUIRE(publisher.is_rate_limited(false, start)==true);
+
+			THEN("the budget is regained across the overflow")
+			{
+				REQUIRE(publisher.is_rate_limited(false, 149)==true);
+				REQUIRE(publisher.is_rate_limited(false, 150)==false);
+			}
+		}
+	}
+}
+
+SCENARIO("publisher queues rate limited events")
+{
+	GIVEN("a publisher with a backlog of 2 events")
+	{
+		Publisher publisher(nullptr);
+		publisher.set_backlog_size(2);
+		TestChannel channel;
+		Completions c;
+
+		WHEN("a burst of 6 application events is published")
+		{
+			for (int i=0; i<6; i++) {
+				REQUIRE(publish(publisher, channel, "event", 0, c)==NO_ERROR);
+			}
+
+			THEN("4 events are sent and 2 are queued")
+			{
+				REQUIRE(channel.sent==4);
+				REQUIRE(c.results==4);
+				REQUIRE(publisher.backlog_size()==2);
+				REQUIRE(publisher.has_pending_events());
+			}
+
+			THEN("the queued events are sent at the allowed rate")
+			{
+				REQUIRE(publisher.process(channel, 249)==NO_ERROR);
+				REQUIRE(channel.sent==4);
+				REQUIRE(publisher.process(channel, 250)==NO_ERROR);
+				REQUIRE(channel.sent==5);
+				REQUIRE(c.results==5);
+				REQUIRE(publisher.process(channel, 375)==NO_ERROR);
+				REQUIRE(channel.sent==5);
+				REQUIRE(publisher.process(channel, 500)==NO_ERROR);
+				REQUIRE(channel.sent==6);
+				REQUIRE(c.results==6);
+				REQUIRE_FALSE(publisher.has_pending_events());
+			}
+
+			THEN("an event that doesn't fit in the backlog fails")
+			{
+				REQUIRE(publish(publisher, channel, "event", 0, c)==BANDWIDTH_EXCEEDED);
+				REQUIRE(publisher.backlog_size()==2);
+			}
+
+			THEN("new application events are queued behind the backlog")
+			{
+				REQUIRE(publisher.process(channel, 250)==NO_ERROR);
+				REQUIRE(publisher.backlog_size()==1);
+				REQUIRE(publish(publisher, channel, "event", 5000, c)==NO_ERROR);
+				REQUIRE(channel.sent==5);
+				REQUIRE(publisher.backlog_size()==2);
+				REQUIRE(publisher.process(channel, 5000)==NO_ERROR);
+				REQUIRE(channel.sent==7);
+				REQUIRE(c.results==7);
+			}
+
+			THEN("system events are not queued behind application events")
+			{
+				REQUIRE(publish(publisher, channel, "particle/device/name", 0, c)==NO_ERROR);
+				REQUIRE(channel.sent==5);
+				REQUIRE(publisher.backlog_size()==2);
+			}
+
+			THEN("clearing the backlog fails the queued events")
+			{
+				publisher.clear_backlog(SYSTEM_ERROR_CANCELLED);
+				REQUIRE(c.errors==2);
+				REQUIRE(c.last_error==SYSTEM_ERROR_CANCELLED);
+				REQUIRE_FALSE(publisher.has_pending_events());
+			}
+
+			THEN("the queued events are not sent after the session is reset")
+			{
+				publisher.reset(SYSTEM_ERROR_ABORTED);
+				REQUIRE(c.errors==2);
+				REQUIRE(c.last_error==SYSTEM_ERROR_ABORTED);
+				REQUIRE(publisher.process(channel, 5000)==NO_ERROR);
+				REQUIRE(channel.sent==4);
+			}
+
+			THEN("shrinking the backlog fails the events that no longer fit")
+			{
+				publisher.set_backlog_size(1);
+				REQUIRE(c.errors==1);
+				REQUIRE(publisher.backlog_size()==1);
+			}
+
+			THEN("a queued event that can't be sent fails")
+			{
+				channel.send_result = IO_ERROR;
+				REQUIRE(publisher.process(channel, 250)==IO_ERROR);
+				REQUIRE(c.errors==1);
+				REQUIRE(publisher.backlog_size()==1);
+			}
+		}
+
+		WHEN("the backlog is disabled")
+		{
+			publisher.set_backlog_size(0);
+			for (int i=0; i<4; i++) {
+				REQUIRE(publish(publisher, channel, "event", 0, c)==NO_ERROR);
+			}
+
+			THEN("rate limited events fail immediately")
+			{
+				REQUIRE(publish(publisher, channel, "event", 0, c)==BANDWIDTH_EXCEEDED);
+				REQUIRE(channel.sent==4);
+			}
+		}
+	}
+}
+
+SCENARIO("publisher batches events")
+{
+	// IPv4 (20) + UDP (8) + DTLS record header (13) + explicit nonce (8) + CCM-8 tag (8)
+	const size_t DATAGRAM_OVERHEAD = 57;
+	const int EVENT_COUNT = 20;
+
+	GIVEN("a publisher with a batching window of 1 second")
+	{
+		Publisher publisher(nullptr);
+		publisher.set_rate_limit(Publisher::APPLICATION_EVENT, EVENT_COUNT, 0);
+		publisher.set_batching_window(1000);
+		TestChannel channel;
+		Completions c;
+
+		WHEN("the server doesn't support batching")
+		{
+			REQUIRE(publish(publisher, channel, "sensor/temp", 0, c)==NO_ERROR);
+
+			THEN("events are sent one by one")
+			{
+				REQUIRE_FALSE(publisher.is_batching());
+				REQUIRE(channel.sent==1);
+				REQUIRE(c.results==1);
+			}
+		}
+
+		WHEN("the server supports batching")
+		{
+			publisher.set_batching_supported(true);
+			REQUIRE(publish(publisher, channel, "sensor/temp", 0, c)==NO_ERROR);
+			REQUIRE(publish(publisher, channel, "sensor/hum", 100, c)==NO_ERROR);
+
+			THEN("events are held until the window elapses")
+			{
+				REQUIRE(channel.sent==0);
+				REQUIRE(c.results==0);
+				REQUIRE(publisher.has_pending_events());
+				REQUIRE(publisher.process(channel, 999)==NO_ERROR);
+				REQUIRE(channel.sent==0);
+				REQUIRE(publisher.process(channel, 1000)==NO_ERROR);
+				REQUIRE(channel.sent==1);
+				REQUIRE(c.results==2);
+				REQUIRE_FALSE(publisher.has_pending_events());
+			}
+
+			THEN("the message contains a record for each event")
+			{
+				REQUIRE(publisher.flush_batch(channel)==NO_ERROR);
+				REQUIRE(channel.sent==1);
+				const uint8_t* p = channel.buffer;
+				REQUIRE(Messages::decodeType(p, channel.sent_bytes)==CoAPMessageType::ERROR);
+				REQUIRE(p[5]=='b');
+				p += Messages::event_batch_header_size;
+				REQUIRE(p[4]==strlen("sensor/temp"));
+				REQUIRE(memcmp(p + 5, "sensor/temp", p[4])==0);
+				p += Messages::event_batch_record_size("sensor/temp", "data");
+				REQUIRE(p[4]==strlen("sensor/hum"));
+				REQUIRE(memcmp(p + 5, "sensor/hum", p[4])==0);
+			}
+
+			THEN("a batch is sent as soon as the next event doesn't fit")
+			{
+				std::string data(MAX_EVENT_DATA_LENGTH, 'x');
+				REQUIRE(publisher.send_event(channel, "big", data.c_str(), 60, EventType::PRIVATE,
+						EventType::EMPTY_FLAGS, 200, c.handler())==NO_ERROR);
+				REQUIRE(channel.sent==0);
+				REQUIRE(publisher.send_event(channel, "big", data.c_str(), 60, EventType::PRIVATE,
+						EventType::EMPTY_FLAGS, 300, c.handler())==NO_ERROR);
+				REQUIRE(channel.sent==1);
+				REQUIRE(c.results==3);
+				REQUIRE(publisher.flush_batch(channel)==NO_ERROR);
+				REQUIRE(channel.sent==2);
+				REQUIRE(c.results==4);
+			}
+
+			THEN("a batch that can't be sent fails all of its events")
+			{
+				channel.send_result = IO_ERROR;
+				REQUIRE(publisher.flush_batch(channel)==IO_ERROR);
+				REQUIRE(c.errors==2);
+			}
+
+			THEN("the batched events are not sent after the session is reset")
+			{
+				publisher.reset(SYSTEM_ERROR_ABORTED);
+				REQUIRE(c.errors==2);
+				REQUIRE(c.last_error==SYSTEM_ERROR_ABORTED);
+				REQUIRE_FALSE(publisher.has_pending_events());
+				REQUIRE(publisher.process(channel, 2000)==NO_ERROR);
+				REQUIRE(channel.sent==0);
+			}
+		}
+	}
+
+	GIVEN("a burst of small events")
+	{
+		size_t unbatched_bytes = 0;
+		size_t batched_bytes = 0;
+		for (int batching = 0; batching < 2; ++batching) {
+			Publisher publisher(nullptr);
+			publisher.set_rate_limit(Publisher::APPLICATION_EVENT, EVENT_COUNT, 0);
+			TestChannel channel;
+			Completions c;
+			if (batching) {
+				publisher.set_batching_window(1000);
+				publisher.set_batching_supported(true);
+			}
+			char data[32];
+			for (int i = 0; i < EVENT_COUNT; ++i) {
+				snprintf(data, sizeof(data), "{\"t\":%d.%d}", 20 + i % 5, i);
+				REQUIRE(publisher.send_event(channel, "sensor/temp", data, 60, EventType::PRIVATE,
+						EventType::EMPTY_FLAGS, i * 10, c.handler())==NO_ERROR);
+			}
+			REQUIRE(publisher.process(channel, 2000)==NO_ERROR);
+			REQUIRE(c.results==EVENT_COUNT);
+			const size_t bytes = channel.sent_bytes + channel.sent * DATAGRAM_OVERHEAD;
+			(batching ? batched_bytes : unbatched_bytes) = bytes;
+		}
+		WARN("bytes on wire per event: " << (double)unbatched_bytes / EVENT_COUNT << " unbatched, "
+				<< (double)batched_bytes / EVENT_COUNT << " batched");
+
+		THEN("batching reduces the number of bytes on the wire")
+		{
+			REQUIRE(batched_bytes < unbatched_bytes / 2);
+		}
+	}
+}
+
+namespace {
+
+struct DataWriter
+{
+	std::string data;
+	size_t size = 0; // Space offered by the last call
+	int calls = 0;
+
+	static int callback(char* buf, size_t size, void* writer_data)
+	{
+		DataWriter* w = static_cast<DataWriter*>(writer_data);
+		++w->calls;
+		w->size = size;
+		if (w->data.size() > size) {
+			return SYSTEM_ERROR_TOO_LARGE;
+		}
+		memcpy(buf, w->data.data(), w->data.size());
+		return w->data.size();
+	}
+};
+
+ProtocolError publish(Publisher& publisher, TestChannel& channel, DataWriter& writer, system_tick_t time, Completions& c)
+{
+	return publisher.send_event(channel, "event", DataWriter::callback, &writer, 60, EventType::PRIVATE,
+			EventType::EMPTY_FLAGS, time, c.handler());
+}
+
+} // namespace
+
+SCENARIO("publisher writes event data in place")
+{
+	GIVEN("a publisher and a data writer")
+	{
+		Publisher publisher(nullptr);
+		TestChannel channel;
+		Completions c;
+		DataWriter writer;
+		writer.data = "{\"a\":1}";
+		uint8_t expected[PROTOCOL_BUFFER_SIZE];
+		const size_t expected_size = Messages::event(expected, 0, "event", writer.data.c_str(), 60,
+				EventType::PRIVATE, true);
+
+		WHEN("the event can be sent right away")
+		{
+			REQUIRE(publish(publisher, channel, writer, 0, c)==NO_ERROR);
+
+			THEN("the data is written into the message buffer")
+			{
+				REQUIRE(channel.sent==1);
+				REQUIRE(c.results==1);
+				REQUIRE(writer.calls==1);
+				REQUIRE(writer.size==MAX_EVENT_DATA_LENGTH);
+				REQUIRE(channel.sent_bytes==expected_size);
+				REQUIRE(memcmp(channel.buffer, expected, expected_size)==0);
+			}
+		}
+
+		WHEN("the data doesn't fit")
+		{
+			writer.data = std::string(MAX_EVENT_DATA_LENGTH + 1, 'x');
+			REQUIRE(publish(publisher, channel, writer, 0, c)==INSUFFICIENT_STORAGE);
+
+			THEN("the event is not sent and the writer's error is reported")
+			{
+				REQUIRE(channel.sent==0);
+				REQUIRE(c.errors==1);
+				REQUIRE(c.last_error==SYSTEM_ERROR_TOO_LARGE);
+			}
+
+			THEN("the event budget is not charged")
+			{
+				writer.data = "{\"a\":1}";
+				for (int i=0; i<(int)Publisher::DEFAULT_APPLICATION_BURST; i++) {
+					REQUIRE(publish(publisher, channel, writer, 0, c)==NO_ERROR);
+				}
+				REQUIRE(channel.sent==(int)Publisher::DEFAULT_APPLICATION_BURST);
+				REQUIRE(publisher.backlog_size()==0);
+			}
+		}
+
+		WHEN("the event is rate limited")
+		{
+			publisher.set_rate_limit(Publisher::APPLICATION_EVENT, 1, 1000);
+			REQUIRE(publish(publisher, channel, writer, 0, c)==NO_ERROR);
+			REQUIRE(publish(publisher, channel, writer, 0, c)==NO_ERROR);
+
+			THEN("a copy of the data is queued and sent later")
+			{
+				REQUIRE(channel.sent==1);
+				REQUIRE(publisher.backlog_size()==1);
+				memset(channel.buffer, 0, sizeof(channel.buffer));
+				REQUIRE(publisher.process(channel, 1000)==NO_ERROR);
+				REQUIRE(channel.sent==2);
+				REQUIRE(c.results==2);
+				REQUIRE(memcmp(channel.buffer, expected, expected_size)==0);
+			}
+		}
 	}
 }
@@ -0,0 +1,228 @@
+/**
+ ******************************************************************************
+  Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#include "protocol.h"
+
+#include <catch2/catch.hpp>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace particle::protocol;
+
+namespace {
+
+class TestChannel : public MessageChannel
+{
+public:
+	ProtocolError receive(Message& message) override { return NO_ERROR; }
+	ProtocolError send(Message& msg) override { return NO_ERROR; }
+	ProtocolError command(Command cmd, void* arg) override { return NO_ERROR; }
+	bool is_unreliable() override { return false; }
+	ProtocolError establish(uint32_t& flags, uint32_t app_state_crc) override { return NO_ERROR; }
+	ProtocolError create(Message& message, size_t minimum_size) override { return NO_ERROR; }
+	ProtocolError response(Message& original, Message& response, size_t required) override { return NO_ERROR; }
+	ProtocolError notify_established() override { return NO_ERROR; }
+	void notify_client_messages_processed() override { }
+};
+
+std::vector<std::string> calls;
+
+void record_call(void* handler_data, const char* event_name, const char* data)
+{
+	calls.push_back(std::string((const char*) handler_data) + ":" + event_name);
+}
+
+struct Filter
+{
+	const char* filter;
+	const char* tag;
+};
+
+// the same filter is subscribed twice with different handler data
+const Filter FILTERS[] = { { "", "0" }, { "a", "1" }, { "abc", "2" }, { "abd", "3" }, { "ab", "4" },
+		{ "b", "5" }, { "abc", "6" }, { "abcdef", "7" }, { "ba", "8" }, { "c/d", "9" } };
+
+void subscribe_all(Subscriptions& subscriptions)
+{
+	for (const Filter& f : FILTERS)
+	{
+		REQUIRE(subscriptions.add_event_handler(f.filter, (EventHandler) record_call, (void*) f.tag,
+				SubscriptionScope::MY_DEVICES, nullptr) == NO_ERROR);
+	}
+}
+
+ProtocolError dispatch(Subscriptions& subscriptions, const char* event_name)
+{
+	TestChannel channel;
+	uint8_t buf[128];
+	const size_t len = Messages::event(buf, 1, event_name, "data", 60, EventType::PUBLIC, false);
+	Message msg(buf, sizeof(buf), len);
+	calls.clear();
+	return subscriptions.handle_event(msg, nullptr, channel);
+}
+
+/**
+ * The handlers expected to be called for the given event: those whose filter is a prefix of the name,
+ * in the order they were subscribed.
+ */
+std::vector<std::string> expected_calls(const char* event_name)
+{
+	std::vector<std::string> expected;
+	for (const Filter& f : FILTERS)
+	{
+		if (!strncmp(f.filter, event_name, strlen(f.filter)))
+			expected.push_back(std::string(f.tag) + ":" + event_name);
+	}
+	return expected;
+}
+
+uint32_t sum_crc(const unsigned char* buf, uint32_t len)
+{
+	uint32_t h = 2166136261u;
+	for (uint32_t i = 0; i < len; i++)
+		h = (h ^ buf[i]) * 16777619u;
+	return h;
+}
+
+} // namespace
+
+SCENARIO("more handlers than MAX_SUBSCRIPTIONS can be subscribed")
+{
+	Subscriptions subscriptions;
+	REQUIRE(sizeof(FILTERS) / sizeof(FILTERS[0]) > MAX_SUBSCRIPTIONS);
+	subscribe_all(subscriptions);
+
+	unsigned count = 0;
+	subscriptions.for_each([&count](FilteringEventHandler& handler) {
+		REQUIRE(handler.filter == std::string(FILTERS[count++].filter));
+		return NO_ERROR;
+	});
+	REQUIRE(count == sizeof(FILTERS) / sizeof(FILTERS[0]));
+
+	WHEN("an existing handler is added again")
+	{
+		REQUIRE(subscriptions.add_event_handler("abc", (EventHandler) record_call, (void*) FILTERS[2].tag,
+				SubscriptionScope::MY_DEVICES, nullptr) == NO_ERROR);
+		THEN("it is not duplicated")
+		{
+			count = 0;
+			subscriptions.for_each([&count](FilteringEventHandler&) { ++count; return NO_ERROR; });
+			REQUIRE(count == sizeof(FILTERS) / sizeof(FILTERS[0]));
+		}
+	}
+}
+
+SCENARIO("events are dispatched to each handler whose filter is a prefix of the event name")
+{
+	Subscriptions subscriptions;
+	subscribe_all(subscriptions);
+
+	for (const char* name : { "a", "ab", "abc", "abcd", "abcdefgh", "abd", "abe", "b", "ba", "bb", "c/d/e", "c", "x" })
+	{
+		INFO("event " << name);
+		REQUIRE(dispatch(subscriptions, name) == NO_ERROR);
+		REQUIRE(calls == expected_calls(name));
+	}
+}
+
+SCENARIO("handlers are called in the order they were subscribed regardless of the filter length")
+{
+	Subscriptions subscriptions;
+	for (const char* filter : { "abc", "a", "abcd", "" })
+	{
+		REQUIRE(subscriptions.add_event_handler(filter, (EventHandler) record_call, (void*) filter,
+				SubscriptionScope::MY_DEVICES, nullptr) == NO_ERROR);
+	}
+	REQUIRE(dispatch(subscriptions, "abcde") == NO_ERROR);
+	REQUIRE(calls == std::vector<std::string>{ "abc:abcde", "a:abcde", "abcd:abcde", ":abcde" });
+
+	WHEN("a handler is removed and subscribed again")
+	{
+		subscriptions.remove_event_handlers("a");
+		REQUIRE(subscriptions.add_event_handler("a", (EventHandler) record_call, (void*) "a",
+				SubscriptionScope::MY_DEVICES, nullptr) == NO_ERROR);
+		THEN("it is called last")
+		{
+			REQUIRE(dispatch(subscriptions, "abcde") == NO_ERROR);
+			REQUIRE(calls == std::vector<std::string>{ "abc:abcde", "abcd:abcde", ":abcde", "a:abcde" });
+		}
+	}
+}
+
+SCENARIO("removing handlers updates event dispatch")
+{
+	Subscriptions subscriptions;
+	subscribe_all(subscriptions);
+
+	subscriptions.remove_event_handlers("abc");
+	REQUIRE(dispatch(subscriptions, "abcdefg") == NO_ERROR);
+	REQUIRE(calls == std::vector<std::string>{ "0:abcdefg", "1:abcdefg", "4:abcdefg", "7:abcdefg" });
+
+	subscriptions.remove_event_handlers(nullptr);
+	REQUIRE(dispatch(subscriptions, "abcdefg") == NO_ERROR);
+	REQUIRE(calls.empty());
+
+	REQUIRE(subscriptions.add_event_handler("abc", (EventHandler) record_call, (void*) "x",
+			SubscriptionScope::MY_DEVICES, nullptr) == NO_ERROR);
+	REQUIRE(dispatch(subscriptions, "abcdefg") == NO_ERROR);
+	REQUIRE(calls == std::vector<std::string>{ "x:abcdefg" });
+}
+
+SCENARIO("the subscriptions checksum depends on the handlers and their order only")
+{
+	Subscriptions s1, s2;
+	subscribe_all(s1);
+	subscribe_all(s2);
+	// dispatching an event does not change the checksum
+	dispatch(s2, "abc");
+	REQUIRE(s1.compute_subscriptions_checksum(sum_crc) == s2.compute_subscriptions_checksum(sum_crc));
+
+	s2.remove_event_handlers("ba");
+	REQUIRE(s1.compute_subscriptions_checksum(sum_crc) != s2.compute_subscriptions_checksum(sum_crc));
+	s1.remove_event_handlers("ba");
+	REQUIRE(s1.compute_subscriptions_checksum(sum_crc) == s2.compute_subscriptions_checksum(sum_crc));
+}
+
+SCENARIO("benchmark: dispatching an event to many subscriptions", "[.][benchmark]")
+{
+	for (unsigned n : { 6, 32, 128, 512 })
+	{
+		Subscriptions subscriptions;
+		std::vector<std::string> filters;
+		for (unsigned i = 0; i < n; i++)
+			filters.push_back("device/sensor/" + std::to_string(i));
+		for (const std::string& filter : filters)
+		{
+			REQUIRE(subscriptions.add_event_handler(filter.c_str(), (EventHandler) record_call, (void*) "h",
+					SubscriptionScope::MY_DEVICES, nullptr) == NO_ERROR);
+		}
+		const std::string name = "device/sensor/" + std::to_string(n / 2) + "/temperature";
+		dispatch(subscriptions, name.c_str());
+		REQUIRE(calls.size() >= 1);
+
+		const unsigned rounds = 20000;
+		const auto start = std::chrono::steady_clock::now();
+		for (unsigned i = 0; i < rounds; i++)
+			dispatch(subscriptions, name.c_str());
+		const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+		WARN(n << " subscriptions: " << ns << " ns per event");
+	}
+}
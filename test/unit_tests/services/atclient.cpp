@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "atclient.h"
+#include "stream.h"
+#include "timer_hal.h"
+#include "system_error.h"
+
+#include <catch2/catch.hpp>
+
+#include <cstring>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace particle;
+using namespace particle::services::at;
+
+namespace {
+
+// Virtual time in microseconds. AtClientBase::setState() waits for 2 seconds after boot, so the
+// clock doesn't start from 0
+uint64_t g_timeUs = 3600ull * 1000000;
+
+// Simulates an NCP connected over a 115200 baud UART. The NCP buffers the commands it receives
+// and processes them one at a time. The host polls the stream once per millisecond when there's
+// no data to read
+class FakeNcp: public Stream {
+public:
+    static const unsigned BYTE_US = 87;
+    static const unsigned PROCESS_US = 5000;
+    static const unsigned POLL_US = 1000;
+
+    struct Command {
+        std::string command;
+        uint64_t sentUs;
+        uint64_t responseEndUs;
+    };
+
+    FakeNcp() :
+            busyUntilUs_(0) {
+        response("ATE0", "");
+    }
+
+    // Sets the information text and final result code sent in response to a command
+    void response(const std::string& cmd, const std::string& text, const std::string& result = "OK") {
+        responses_[cmd] = std::make_pair(text, result);
+    }
+
+    // Don't respond to a command
+    void drop(const std::string& cmd) {
+        dropped_.insert(cmd);
+    }
+
+    void urc(const std::string& line) {
+        output("\r\n" + line + "\r\n", std::max(g_timeUs, lastOutputUs()));
+    }
+
+    const std::vector<Command>& commands() const {
+        return commands_;
+    }
+
+    std::vector<std::string> commandNames() const {
+        std::vector<std::string> names;
+        for (const auto& c: commands_) {
+            names.push_back(c.command);
+        }
+        return names;
+    }
+
+    int read(char* data, size_t size) override {
+        size_t n = 0;
+        while (n < size && !out_.empty() && out_.front().first <= g_timeUs) {
+            data[n++] = out_.front().second;
+            out_.pop_front();
+        }
+        if (n == 0) {
+            g_timeUs += POLL_US;
+        }
+        return n;
+    }
+
+    int availForRead() override {
+        int n = 0;
+        for (const auto& b: out_) {
+            if (b.first > g_timeUs) {
+                break;
+            }
+            ++n;
+        }
+        if (n == 0) {
+            g_timeUs += POLL_US;
+        }
+        return n;
+    }
+
+    int write(const char* data, size_t size) override {
+        for (size_t i = 0; i < size; ++i) {
+            in_ += data[i];
+            if (in_.size() >= 2 && in_.compare(in_.size() - 2, 2, "\r\n") == 0) {
+                process(in_.substr(0, in_.size() - 2), g_timeUs + (i + 1) * BYTE_US);
+                in_.clear();
+            }
+        }
+        return size;
+    }
+
+    int peek(char* data, size_t size) override {
+        return SYSTEM_ERROR_NOT_SUPPORTED;
+    }
+
+    int skip(size_t size) override {
+        return SYSTEM_ERROR_NOT_SUPPORTED;
+    }
+
+    int flush() override {
+        return 0;
+    }
+
+    int availForWrite() override {
+        return 1024;
+    }
+
+    int waitEvent(unsigned flags, unsigned timeout) override {
+        return SYSTEM_ERROR_NOT_SUPPORTED;
+    }
+
+private:
+    std::map<std::string, std::pair<std::string, std::string>> responses_;
+    std::set<std::string> dropped_;
+    std::vector<Command> commands_;
+    std::deque<std::pair<uint64_t, char>> out_;
+    std::string in_;
+    uint64_t busyUntilUs_;
+
+    void process(const std::string& cmd, uint64_t receivedUs) {
+        const uint64_t startUs = std::max(receivedUs, busyUntilUs_) + PROCESS_US;
+        std::string resp;
+        if (!dropped_.count(cmd)) {
+            const auto it = responses_.find(cmd);
+            if (it != responses_.end()) {
+                if (!it->second.first.empty()) {
+                    resp = "\r\n" + it->second.first + "\r\n";
+                }
+                resp += "\r\n" + it->second.second + "\r\n";
+            } else {
+                resp = "\r\nOK\r\n";
+            }
+        }
+        busyUntilUs_ = output(resp, std::max(startUs, lastOutputUs()));
+        commands_.push_back({ cmd, g_timeUs, busyUntilUs_ });
+    }
+
+    uint64_t output(const std::string& data, uint64_t startUs) {
+        for (size_t i = 0; i < data.size(); ++i) {
+            out_.push_back(std::make_pair(startUs + (i + 1) * BYTE_US, data[i]));
+        }
+        return startUs + data.size() * BYTE_US;
+    }
+
+    uint64_t lastOutputUs() const {
+        return out_.empty() ? 0 : out_.back().first;
+    }
+};
+
+class TestAtClient: public AtClientBase {
+public:
+    explicit TestAtClient(Stream* stream) :
+            AtClientBase(stream) {
+    }
+
+    int init() override {
+        return 0;
+    }
+
+    int destroy() override {
+        return 0;
+    }
+};
+
+struct Result {
+    int error;
+    AtClientBase::ResultCode code;
+    std::string response;
+};
+
+void commandDone(int error, AtClientBase::ResultCode code, const char* response, void* data) {
+    const auto results = (std::vector<Result>*)data;
+    results->push_back({ error, code, response });
+}
+
+void urcReceived(const char* line, void* data) {
+    ((std::vector<std::string>*)data)->push_back(line);
+}
+
+// Sends a command and waits for the final result code using the synchronous API
+int sendAndWait(TestAtClient* client, const char* cmd) {
+    const int r = client->sendCommand("%s", cmd);
+    if (r < 0) {
+        return r;
+    }
+    while (client->getState() != AtClientBase::State::FINAL_RESULT_CODE) {
+        const int r = client->run();
+        if (r < 0) {
+            return r;
+        }
+    }
+    return 0;
+}
+
+// Typical NCP bring-up: identification, configuration and registration status queries
+const char* const BRINGUP_COMMANDS[] = {
+    "AT+CMEE=2", "AT+CGMI", "AT+CGMM", "AT+CGMR", "AT+CCID", "AT+CIMI", "AT+CGSN", "AT+UGPIOC?",
+    "AT+CPIN?", "AT+COPS=3,2", "AT+CREG=2", "AT+CGREG=2", "AT+CEREG=2", "AT+UPSV=0", "AT+CSQ",
+    "AT+CREG?", "AT+CGREG?", "AT+CEREG?", "AT+COPS?", "AT+CGDCONT?", "AT+UBANDSEL?", "AT+URAT?",
+    "AT+UMNOPROF?", "AT+CFUN?"
+};
+
+void setBringupResponses(FakeNcp* ncp) {
+    ncp->response("AT+CGMI", "u-blox");
+    ncp->response("AT+CGMM", "SARA-U201");
+    ncp->response("AT+CGMR", "23.60");
+    ncp->response("AT+CCID", "+CCID: 8934076500002587657");
+    ncp->response("AT+CIMI", "310410123456789");
+    ncp->response("AT+CGSN", "352753090041680");
+    ncp->response("AT+CPIN?", "+CPIN: READY");
+    ncp->response("AT+CSQ", "+CSQ: 17,3");
+    ncp->response("AT+CREG?", "+CREG: 2,5,\"2B0D\",\"0A2B3C4D\",2");
+    ncp->response("AT+COPS?", "+COPS: 0,2,\"310410\",2");
+}
+
+} // namespace
+
+TEST_CASE("AtClientBase command queue") {
+    FakeNcp ncp;
+    TestAtClient client(&ncp);
+    std::vector<Result> results;
+
+    SECTION("completes queued commands in order") {
+        ncp.response("AT+CGMI", "u-blox");
+        ncp.response("AT+CGMM", "SARA-U201");
+        ncp.response("AT+CPIN?", "", "+CME ERROR: SIM not inserted");
+        REQUIRE(client.queueCommand(commandDone, &results, 0, AtClientBase::Order::PIPELINED, "AT+CGMI") == 0);
+        REQUIRE(client.queueCommand(commandDone, &results, 0, AtClientBase::Order::PIPELINED, "AT+CGMM") == 0);
+        REQUIRE(client.queueCommand(commandDone, &results, 0, AtClientBase::Order::PIPELINED, "AT+CPIN?") == 0);
+        REQUIRE(client.queueCommand(commandDone, &results, 0, AtClientBase::Order::PIPELINED, "AT+CFUN=1") == 0);
+        CHECK(client.getQueuedCommandCount() == 4);
+        REQUIRE(client.flushQueue(10000) == 0);
+        CHECK(client.getQueuedCommandCount() == 0);
+        REQUIRE(results.size() == 4);
+        CHECK(results[0].error == 0);
+        CHECK(results[0].code == AtClientBase::ResultCode::OK);
+        CHECK(results[0].response == "u-blox\r\n");
+        CHECK(results[1].response == "SARA-U201\r\n");
+        CHECK(results[2].error == 0);
+        CHECK(results[2].code == AtClientBase::ResultCode::CME_ERROR);
+        CHECK(results[3].code == AtClientBase::ResultCode::OK);
+        CHECK(results[3].response == "");
+        CHECK(ncp.commandNames() == std::vector<std::string>({ "ATE0", "AT+CGMI", "AT+CGMM", "AT+CPIN?", "AT+CFUN=1" }));
+    }
+
+    SECTION("sends pipelined commands without waiting for responses") {
+        const auto seq = AtClientBase::Order::SEQUENTIAL;
+        const auto pip = AtClientBase::Order::PIPELINED;
+        REQUIRE(client.queueCommand(commandDone, &results, 0, seq, "AT+A") == 0);
+        REQUIRE(client.queueCommand(commandDone, &results, 0, pip, "AT+B") == 0);
+        REQUIRE(client.queueCommand(commandDone, &results, 0, pip, "AT+C") == 0);
+        REQUIRE(client.queueCommand(commandDone, &results, 0, seq, "AT+D") == 0);
+        REQUIRE(client.flushQueue(10000) == 0);
+        REQUIRE(results.size() == 4);
+        const auto& cmds = ncp.commands();
+        REQUIRE(cmds.size() == 5);
+        CHECK(cmds[2].sentUs >= cmds[1].responseEndUs); // B after A
+        CHECK(cmds[3].sentUs < cmds[2].responseEndUs); // C right after B
+        CHECK(cmds[4].sentUs >= cmds[3].responseEndUs); // D after C
+    }
+
+    SECTION("limits the number of pipelined commands") {
+        for (size_t i = 0; i < ATCLIENT_QUEUE_SIZE; ++i) {
+            REQUIRE(client.queueCommand(commandDone, &results, 0, AtClientBase::Order::PIPELINED, "AT+Q%u", (unsigned)i) == 0);
+        }
+        CHECK(client.queueCommand(commandDone, &results, 0, AtClientBase::Order::PIPELINED, "AT") == SYSTEM_ERROR_LIMIT_EXCEEDED);
+        REQUIRE(client.flushQueue(10000) == 0);
+        REQUIRE(results.size() == ATCLIENT_QUEUE_SIZE);
+        const auto& cmds = ncp.commands();
+        for (size_t i = 1 + ATCLIENT_PIPELINE_DEPTH; i < cmds.size(); ++i) {
+            CHECK(cmds[i].sentUs >= cmds[i - ATCLIENT_PIPELINE_DEPTH].responseEndUs);
+        }
+    }
+
+    SECTION("passes URCs to their handlers") {
+        std::vector<std::string> urcs;
+        REQUIRE(client.addUrcHandler("+CREG", urcReceived, &urcs) == 0);
+        REQUIRE(client.addUrcHandler("+UUSORD", urcReceived, &urcs) == 0);
+        ncp.response("AT+CSQ", "+CSQ: 17,3");
+        REQUIRE(client.queueCommand(commandDone, &results, 0, AtClientBase::Order::PIPELINED, "AT+CSQ") == 0);
+        REQUIRE(client.processQueue() == 0);
+        ncp.urc("+CREG: 5");
+        ncp.urc("+UUSORD: 0,32");
+        ncp.urc("+UNKNOWN: 1");
+        REQUIRE(client.flushQueue(10000) == 0);
+        REQUIRE(results.size() == 1);
+        CHECK(results[0].response == "+CSQ: 17,3\r\n");
+        for (int i = 0; i < 100; ++i) {
+            client.processQueue();
+        }
+        CHECK(urcs == std::vector<std::string>({ "+CREG: 5", "+UUSORD: 0,32" }));
+        client.removeUrcHandler("+CREG");
+        ncp.urc("+CREG: 1");
+        for (int i = 0; i < 100; ++i) {
+            client.processQueue();
+        }
+        CHECK(urcs.size() == 2);
+    }
+
+    SECTION("fails a command that times out and recovers") {
+        ncp.drop("AT+X");
+        REQUIRE(client.queueCommand(commandDone, &results, 100, AtClientBase::Order::SEQUENTIAL, "AT+X") == 0);
+        REQUIRE(client.queueCommand(commandDone, &results, 0, AtClientBase::Order::SEQUENTIAL, "AT+Y") == 0);
+        REQUIRE(client.flushQueue(10000) == 0);
+        REQUIRE(results.size() == 2);
+        CHECK(results[0].error == SYSTEM_ERROR_TIMEOUT);
+        CHECK(results[1].error == 0);
+        CHECK(ncp.commandNames() == std::vector<std::string>({ "ATE0", "AT+X", "ATE0", "AT+Y" }));
+    }
+
+    SECTION("aborts pipelined commands sent after a command that timed out") {
+        ncp.drop("AT+X");
+        ncp.drop("AT+Y");
+        REQUIRE(client.queueCommand(commandDone, &results, 100, AtClientBase::Order::PIPELINED, "AT+X") == 0);
+        REQUIRE(client.queueCommand(commandDone, &results, 100, AtClientBase::Order::PIPELINED, "AT+Y") == 0);
+        REQUIRE(client.flushQueue(10000) == 0);
+        REQUIRE(results.size() == 2);
+        CHECK(results[0].error == SYSTEM_ERROR_TIMEOUT);
+        CHECK(results[1].error == SYSTEM_ERROR_ABORTED);
+    }
+
+    SECTION("cancels queued commands") {
+        REQUIRE(client.queueCommand(commandDone, &results, 0, AtClientBase::Order::SEQUENTIAL, "AT+A") == 0);
+        REQUIRE(client.queueCommand(commandDone, &results, 0, AtClientBase::Order::SEQUENTIAL, "AT+B") == 0);
+        CHECK(client.sendCommand("AT") == SYSTEM_ERROR_BUSY);
+        client.cancelQueue();
+        REQUIRE(results.size() == 2);
+        CHECK(results[0].error == SYSTEM_ERROR_CANCELLED);
+        CHECK(results[1].error == SYSTEM_ERROR_CANCELLED);
+        CHECK(client.getQueuedCommandCount() == 0);
+    }
+
+    SECTION("passes URCs to their handlers when a command is sent synchronously") {
+        std::vector<std::string> urcs;
+        REQUIRE(client.addUrcHandler("+CREG", urcReceived, &urcs) == 0);
+        ncp.response("AT+CGMR", "23.60");
+        REQUIRE(client.waitReady(10000) == 0);
+        // The URC arrives before the response
+        ncp.urc("+CREG: 5");
+        REQUIRE(client.sendCommand("AT+CGMR") > 0);
+        REQUIRE(client.waitInformationText() == 0);
+        CHECK(strcmp(client.getInformationText(), "23.60") == 0);
+        REQUIRE(client.waitFinalResultCode() == 0);
+        CHECK(urcs == std::vector<std::string>({ "+CREG: 5" }));
+    }
+}
+
+TEST_CASE("AtClientBase NCP bring-up latency", "[.][benchmark]") {
+    const size_t count = sizeof(BRINGUP_COMMANDS) / sizeof(BRINGUP_COMMANDS[0]);
+    double syncMs = 0;
+    double seqMs = 0;
+    double pipMs = 0;
+    {
+        FakeNcp ncp;
+        setBringupResponses(&ncp);
+        TestAtClient client(&ncp);
+        REQUIRE(client.waitReady(10000) == 0);
+        const auto start = g_timeUs;
+        for (size_t i = 0; i < count; ++i) {
+            REQUIRE(sendAndWait(&client, BRINGUP_COMMANDS[i]) == 0);
+        }
+        syncMs = (g_timeUs - start) / 1000.0;
+    }
+    for (auto order: { AtClientBase::Order::SEQUENTIAL, AtClientBase::Order::PIPELINED }) {
+        FakeNcp ncp;
+        setBringupResponses(&ncp);
+        TestAtClient client(&ncp);
+        REQUIRE(client.waitReady(10000) == 0);
+        std::vector<Result> results;
+        const auto start = g_timeUs;
+        for (size_t i = 0; i < count; i += ATCLIENT_QUEUE_SIZE) {
+            for (size_t j = i; j < std::min(count, i + ATCLIENT_QUEUE_SIZE); ++j) {
+                REQUIRE(client.queueCommand(commandDone, &results, 0, order, "%s", BRINGUP_COMMANDS[j]) == 0);
+            }
+            REQUIRE(client.flushQueue(10000) == 0);
+        }
+        REQUIRE(results.size() == count);
+        const double ms = (g_timeUs - start) / 1000.0;
+        if (order == AtClientBase::Order::SEQUENTIAL) {
+            seqMs = ms;
+        } else {
+            pipMs = ms;
+        }
+    }
+    WARN(count << " commands, sendCommand(): " << syncMs << " ms, sequential queue: " << seqMs <<
+            " ms, pipelined queue: " << pipMs << " ms");
+}
+
+// Each call takes some time, so that the client's busy loops terminate
+extern "C" system_tick_t HAL_Timer_Get_Milli_Seconds() {
+    g_timeUs += 10;
+    return g_timeUs / 1000;
+}
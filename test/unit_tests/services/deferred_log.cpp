@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "deferred_log.h"
+#include "system_error.h"
+
+#include <catch2/catch.hpp>
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace particle;
+
+namespace {
+
+bool write(DeferredLogBuffer* log, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    const bool ok = log->write(30 /* INFO */, "app", 1234, fmt, args);
+    va_end(args);
+    return ok;
+}
+
+std::string read(DeferredLogBuffer* log, size_t size = 160) {
+    std::vector<char> buf(size);
+    int level = 0;
+    const char* category = nullptr;
+    uint32_t time = 0;
+    if (!log->read(buf.data(), buf.size(), &level, &category, &time)) {
+        return "<none>";
+    }
+    return buf.data();
+}
+
+std::string format(const char* fmt, ...) {
+    char buf[160];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    return buf;
+}
+
+void vformat(const char* fmt, ...) {
+    char buf[160];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+}
+
+} // namespace
+
+TEST_CASE("DeferredLogBuffer") {
+    alignas(4) uint8_t mem[1024];
+    DeferredLogBuffer log;
+    REQUIRE(log.init(mem, sizeof(mem)) == 0);
+
+    SECTION("the size must be a power of two") {
+        DeferredLogBuffer b;
+        CHECK(b.init(mem, 768) == SYSTEM_ERROR_INVALID_ARGUMENT);
+        CHECK(b.init(mem, 256) == SYSTEM_ERROR_INVALID_ARGUMENT);
+        CHECK(b.init(mem + 1, 512) == SYSTEM_ERROR_INVALID_ARGUMENT);
+        CHECK_FALSE(b.isInitialized());
+    }
+
+    SECTION("the message attributes are retained") {
+        REQUIRE(write(&log, "abc"));
+        char buf[16] = {};
+        int level = 0;
+        const char* category = nullptr;
+        uint32_t time = 0;
+        REQUIRE(log.read(buf, sizeof(buf), &level, &category, &time));
+        CHECK(std::string(buf) == "abc");
+        CHECK(level == 30);
+        CHECK(std::string(category) == "app");
+        CHECK(time == 1234);
+        CHECK(log.isEmpty());
+        CHECK_FALSE(log.read(buf, sizeof(buf), &level, &category, &time));
+    }
+
+    SECTION("messages are formatted like printf() does") {
+        const char* s = "str";
+        void* p = &log;
+        long long ll = -1234567890123LL;
+        CHECK(write(&log, "%d %i %u %x %X %o %c", -1, 2, 3u, 0xab, 0xcd, 8, 'z'));
+        CHECK(read(&log) == format("%d %i %u %x %X %o %c", -1, 2, 3u, 0xab, 0xcd, 8, 'z'));
+        CHECK(write(&log, "%ld %lu %lld %llu %zu %jd %td", -5L, 6UL, ll, 7ULL, (size_t)8, (intmax_t)-9, (ptrdiff_t)10));
+        CHECK(read(&log) == format("%ld %lu %lld %llu %zu %jd %td", -5L, 6UL, ll, 7ULL, (size_t)8, (intmax_t)-9, (ptrdiff_t)10));
+        CHECK(write(&log, "%hhd %hu %f %.3e %g %Lf", 1, 2, 3.5, 1e10, 0.25, (long double)1.5));
+        CHECK(read(&log) == format("%hhd %hu %f %.3e %g %f", 1, 2, 3.5, 1e10, 0.25, 1.5));
+        CHECK(write(&log, "[%-8s] [%8.2s] [%p] 100%%", s, s, p));
+        CHECK(read(&log) == format("[%-8s] [%8.2s] [%p] 100%%", s, s, p));
+        CHECK(write(&log, "[%*d] [%-*d] [%.*f] [%.*s]", 5, 1, -5, 2, 2, 3.14159, 3, "abcdef"));
+        CHECK(read(&log) == format("[%*d] [%-*d] [%.*f] [%.*s]", 5, 1, -5, 2, 2, 3.14159, 3, "abcdef"));
+        CHECK(write(&log, "[%.*d] %s", -1, 7, (const char*)nullptr));
+        CHECK(read(&log) == "[7] (null)");
+    }
+
+    SECTION("string arguments are copied") {
+        char s[] = "before";
+        REQUIRE(write(&log, "%s", s));
+        strcpy(s, "after");
+        CHECK(read(&log) == "before");
+    }
+
+    SECTION("string arguments limited by the precision don't need to be terminated") {
+        const char s[3] = { 'a', 'b', 'c' };
+        REQUIRE(write(&log, "%.3s", s));
+        CHECK(read(&log) == "abc");
+    }
+
+    SECTION("long strings and messages are truncated") {
+        const std::string s(100, 'x');
+        REQUIRE(write(&log, "%s", s.c_str()));
+        CHECK(read(&log) == std::string(DeferredLogBuffer::MAX_STRING_ARG_LENGTH, 'x') + "~");
+        REQUIRE(write(&log, "%d%s%s%s%s", 1, s.c_str(), s.c_str(), s.c_str(), s.c_str()));
+        const std::string r = read(&log);
+        CHECK(r.back() == '~');
+        CHECK(r.find('1') == 0);
+        REQUIRE(write(&log, "0123456789 %d", 1234));
+        CHECK(read(&log, 8) == "012345~");
+    }
+
+    SECTION("messages wrap around the end of the buffer") {
+        for (int i = 0; i < 1000; ++i) {
+            REQUIRE(write(&log, "message %d %s", i, "text"));
+            REQUIRE(write(&log, "%d", i + 1));
+            CHECK(read(&log) == format("message %d %s", i, "text"));
+            CHECK(read(&log) == format("%d", i + 1));
+        }
+        CHECK(log.dropped() == 0);
+    }
+
+    SECTION("messages that don't fit are dropped and counted") {
+        int n = 0;
+        while (write(&log, "message %d", n)) {
+            ++n;
+        }
+        CHECK(n > 10);
+        CHECK_FALSE(write(&log, "x"));
+        CHECK(log.dropped() == 2);
+        for (int i = 0; i < n; ++i) {
+            CHECK(read(&log) == format("message %d", i));
+        }
+        CHECK(log.isEmpty());
+        CHECK(write(&log, "x"));
+        CHECK(read(&log) == "x");
+    }
+
+    SECTION("several threads write messages concurrently") {
+        const int threadCount = 4;
+        const int count = 5000;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadCount; ++t) {
+            threads.emplace_back([&log, t]() {
+                for (int i = 0; i < count; ++i) {
+                    while (!write(&log, "%d:%d", t, i)) {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+        int next[threadCount] = {};
+        int received = 0;
+        bool ok = true;
+        while (received < threadCount * count) {
+            const std::string s = read(&log);
+            if (s == "<none>") {
+                std::this_thread::yield();
+                continue;
+            }
+            int t = -1, i = -1;
+            ok = ok && sscanf(s.c_str(), "%d:%d", &t, &i) == 2 && t >= 0 && t < threadCount && next[t] == i;
+            if (t >= 0 && t < threadCount) {
+                next[t] = i + 1;
+            }
+            ++received;
+        }
+        for (auto& t: threads) {
+            t.join();
+        }
+        CHECK(ok);
+        CHECK(log.isEmpty());
+    }
+}
+
+TEST_CASE("DeferredLogBuffer per-call cost", "[.][benchmark]") {
+    std::vector<uint32_t> mem(16 * 1024 / sizeof(uint32_t));
+    DeferredLogBuffer log;
+    REQUIRE(log.init(mem.data(), mem.size() * sizeof(uint32_t)) == 0);
+    const int count = 1000000;
+    const char* const fmt = "Connection %s failed: %d (attempt %u of %u, %.2f s)";
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i) {
+        vformat(fmt, "cloud", -170, i, 10u, 1.25);
+    }
+    const double formatNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+    char buf[160];
+    int level = 0;
+    const char* category = nullptr;
+    uint32_t time = 0;
+    double captureNs = 0;
+    for (int i = 0; i < count; i += 100) {
+        start = std::chrono::steady_clock::now();
+        for (int j = 0; j < 100; ++j) {
+            write(&log, fmt, "cloud", -170, i + j, 10u, 1.25);
+        }
+        captureNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        while (log.read(buf, sizeof(buf), &level, &category, &time)) {
+        }
+    }
+    captureNs /= count;
+    CHECK(log.dropped() == 0);
+    WARN("vsnprintf(): " << formatNs << " ns per message, deferred capture: " << captureNs << " ns per message");
+}
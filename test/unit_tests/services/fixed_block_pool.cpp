@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fixed_block_pool.h"
+
+#include <catch2/catch.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace particle::services;
+
+TEST_CASE("FixedBlockPool") {
+    SECTION("all blocks can be allocated and are distinct") {
+        FixedBlockPool<31, 32> pool;
+        CHECK(pool.available() == 32);
+        std::set<void*> blocks;
+        for (int i = 0; i < 32; ++i) {
+            void* p = pool.alloc();
+            REQUIRE(p != nullptr);
+            CHECK(pool.owns(p));
+            CHECK((uintptr_t)p % alignof(std::max_align_t) == 0);
+            memset(p, i, 31);
+            blocks.insert(p);
+        }
+        CHECK(blocks.size() == 32);
+        CHECK(pool.available() == 0);
+        CHECK(pool.alloc() == nullptr);
+        int x = 0;
+        CHECK_FALSE(pool.owns(&x));
+        for (void* p: blocks) {
+            pool.free(p);
+        }
+        CHECK(pool.available() == 32);
+    }
+
+    SECTION("a freed block can be allocated again") {
+        FixedBlockPool<8, 3> pool;
+        void* p1 = pool.alloc();
+        void* p2 = pool.alloc();
+        void* p3 = pool.alloc();
+        REQUIRE((p1 && p2 && p3));
+        CHECK(pool.alloc() == nullptr);
+        pool.free(p2);
+        CHECK(pool.alloc() == p2);
+        pool.free(nullptr);
+        CHECK(pool.available() == 0);
+    }
+
+    SECTION("a producer and a consumer share the pool without losing blocks") {
+        // Models the SoftDevice handler copying events faster than the event thread handles them
+        FixedBlockPool<64, 30> pool;
+        const int EVENTS = 200000;
+        std::atomic<void*> queue[8] = {};
+        std::atomic<int> dropped(0);
+        std::atomic<bool> done(false);
+        std::thread consumer([&]() {
+            while (!done.load() || [&]() {
+                for (auto& q: queue) {
+                    if (q.load()) {
+                        return true;
+                    }
+                }
+                return false;
+            }()) {
+                for (auto& q: queue) {
+                    void* p = q.exchange(nullptr);
+                    if (p) {
+                        pool.free(p);
+                    }
+                }
+            }
+        });
+        for (int i = 0; i < EVENTS; ++i) {
+            void* p = pool.alloc();
+            if (!p) {
+                ++dropped;
+                continue;
+            }
+            void* expected = nullptr;
+            if (!queue[i % 8].compare_exchange_strong(expected, p)) {
+                // Queue slot is busy, drop the event
+                pool.free(p);
+                ++dropped;
+            }
+        }
+        done = true;
+        consumer.join();
+        CHECK(dropped.load() < EVENTS);
+        CHECK(pool.available() == 30);
+    }
+}
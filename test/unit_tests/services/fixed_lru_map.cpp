@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fixed_lru_map.h"
+
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace particle::services;
+
+namespace {
+
+// Same layout as a BLE device address
+struct Address {
+    uint8_t addr[6];
+    uint8_t type;
+};
+
+struct AddressHash {
+    size_t operator()(const Address& a) const {
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < sizeof(a.addr); ++i) {
+            h = (h ^ a.addr[i]) * 16777619u;
+        }
+        return (h ^ a.type) * 16777619u;
+    }
+};
+
+struct AddressEqual {
+    bool operator()(const Address& a1, const Address& a2) const {
+        return a1.type == a2.type && memcmp(a1.addr, a2.addr, sizeof(a1.addr)) == 0;
+    }
+};
+
+// Beacons of the same vendor share most of their address
+Address beacon(unsigned n) {
+    Address a = { { 0xc0, 0xde, 0x01, 0x00, (uint8_t)(n >> 8), (uint8_t)n }, 1 };
+    return a;
+}
+
+struct PendingResult {
+    unsigned beacon;
+    int data; // Stands for the copy of the advertising data
+};
+
+} // namespace
+
+TEST_CASE("FixedLruMap") {
+    FixedLruMap<int, int, 4> m;
+
+    SECTION("is empty after construction") {
+        CHECK(m.empty());
+        CHECK(m.size() == 0);
+        CHECK(m.capacity() == 4);
+        CHECK(m.peek(1) == nullptr);
+        CHECK_FALSE(m.removeOldest());
+    }
+
+    SECTION("entries can be added, replaced and removed") {
+        REQUIRE(m.put(1, 10) != nullptr);
+        REQUIRE(m.put(2, 20) != nullptr);
+        CHECK(*m.peek(1) == 10);
+        CHECK(*m.get(2) == 20);
+        *m.put(1, 11) += 1;
+        CHECK(*m.peek(1) == 12);
+        CHECK(m.size() == 2);
+        int v = 0;
+        CHECK(m.remove(1, &v));
+        CHECK(v == 12);
+        CHECK_FALSE(m.remove(1));
+        CHECK_FALSE(m.contains(1));
+        CHECK(m.size() == 1);
+        m.clear();
+        CHECK(m.empty());
+        CHECK_FALSE(m.contains(2));
+    }
+
+    SECTION("the least recently used entry is evicted when the map is full") {
+        for (int i = 1; i <= 4; ++i) {
+            m.put(i, i * 10);
+        }
+        CHECK(m.full());
+        m.get(1); // 2 is now the oldest entry
+        m.peek(2); // Doesn't change the order
+        m.put(5, 50);
+        CHECK(m.size() == 4);
+        CHECK_FALSE(m.contains(2));
+        CHECK(m.contains(1));
+        int k = 0, v = 0;
+        CHECK(m.removeOldest(&k, &v));
+        CHECK(k == 3);
+        CHECK(v == 30);
+        std::vector<int> keys;
+        m.forEach([&](const int& key, int& value) {
+            keys.push_back(key);
+        });
+        CHECK(keys == std::vector<int>({ 4, 1, 5 }));
+    }
+
+    SECTION("keys that collide are kept apart") {
+        struct ZeroHash {
+            size_t operator()(int) const {
+                return 0;
+            }
+        };
+        FixedLruMap<int, int, 8, ZeroHash> z;
+        for (int i = 0; i < 8; ++i) {
+            z.put(i, i);
+        }
+        z.remove(3);
+        z.put(8, 8);
+        for (int i = 0; i <= 8; ++i) {
+            CHECK(z.contains(i) == (i != 3));
+        }
+    }
+}
+
+TEST_CASE("FixedLruMap under an advertisement storm") {
+    std::mt19937 rng(1);
+
+    SECTION("each device is reported once while the devices fit in the cache") {
+        FixedLruMap<Address, bool, 128, AddressHash, AddressEqual> cache;
+        std::map<unsigned, int> reported;
+        std::uniform_int_distribution<unsigned> dist(0, 99);
+        for (int i = 0; i < 100000; ++i) {
+            const unsigned n = dist(rng);
+            if (!cache.contains(beacon(n))) {
+                cache.put(beacon(n), true);
+                ++reported[n];
+            }
+        }
+        CHECK(reported.size() == 100);
+        for (const auto& r: reported) {
+            CHECK(r.second == 1);
+        }
+    }
+
+    SECTION("memory stays bounded with more devices than the cache holds") {
+        FixedLruMap<Address, bool, 128, AddressHash, AddressEqual> cache;
+        const unsigned BEACONS = 300;
+        std::vector<unsigned> order(BEACONS);
+        for (unsigned n = 0; n < BEACONS; ++n) {
+            order[n] = n;
+        }
+        unsigned reports = 0;
+        for (int round = 0; round < 10; ++round) {
+            std::shuffle(order.begin(), order.end(), rng);
+            for (unsigned n: order) {
+                // A beacon is usually heard a few times in a row
+                for (int i = 0; i < 3; ++i) {
+                    if (!cache.contains(beacon(n))) {
+                        cache.put(beacon(n), true);
+                        ++reports;
+                    }
+                }
+                CHECK(cache.size() <= 128);
+            }
+        }
+        // The repeated advertisements of a beacon are still suppressed
+        CHECK(reports <= 10 * BEACONS);
+    }
+
+    SECTION("results whose scan response is lost are evicted oldest first") {
+        FixedLruMap<Address, PendingResult, 16, AddressHash, AddressEqual> pending;
+        std::uniform_int_distribution<unsigned> dist(0, 299);
+        std::bernoulli_distribution lost(0.2);
+        int allocated = 0;
+        int completed = 0;
+        for (int i = 0; i < 100000; ++i) {
+            const unsigned n = dist(rng);
+            if (pending.contains(beacon(n))) {
+                continue;
+            }
+            if (pending.full()) {
+                PendingResult evicted = {};
+                REQUIRE(pending.removeOldest(nullptr, &evicted));
+                allocated -= evicted.data;
+            }
+            pending.put(beacon(n), PendingResult{ n, 1 });
+            ++allocated;
+            if (!lost(rng)) {
+                // Scan response received
+                PendingResult r = {};
+                REQUIRE(pending.remove(beacon(n), &r));
+                REQUIRE(r.beacon == n);
+                allocated -= r.data;
+                ++completed;
+            }
+            REQUIRE(allocated == (int)pending.size());
+        }
+        CHECK(completed > 70000);
+        pending.forEach([&](const Address& a, PendingResult& r) {
+            allocated -= r.data;
+        });
+        pending.clear();
+        CHECK(allocated == 0);
+    }
+}
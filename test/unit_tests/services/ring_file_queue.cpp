@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ring_file_queue.h"
+#include "system_error.h"
+
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace particle::fs;
+
+namespace {
+
+/**
+ * Storage in RAM. Only data that has been synced survives a simulated reset.
+ */
+class TestStorage: public RingFileQueue::Storage {
+public:
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> synced;
+    unsigned writes = 0;
+    unsigned syncs = 0;
+
+    explicit TestStorage(size_t size) :
+            data(size),
+            synced(size) {
+    }
+
+    int read(size_t offset, void* d, size_t size) override {
+        REQUIRE(offset + size <= data.size());
+        memcpy(d, data.data() + offset, size);
+        return 0;
+    }
+
+    int write(size_t offset, const void* d, size_t size) override {
+        REQUIRE(offset + size <= data.size());
+        memcpy(data.data() + offset, d, size);
+        ++writes;
+        return 0;
+    }
+
+    int sync() override {
+        synced = data;
+        ++syncs;
+        return 0;
+    }
+
+    void reset() {
+        data = synced;
+    }
+};
+
+std::string entry(unsigned i, size_t size) {
+    std::string s = std::to_string(i) + ":";
+    s.resize(size, 'a' + i % 26);
+    return s;
+}
+
+std::string front(RingFileQueue& queue) {
+    char buf[1024];
+    const int r = queue.front(buf, sizeof(buf));
+    REQUIRE(r >= 0);
+    return std::string(buf, r);
+}
+
+} // namespace
+
+TEST_CASE("RingFileQueue") {
+    TestStorage storage(1024);
+    RingFileQueue queue(&storage, storage.data.size());
+    REQUIRE(queue.init(1234) == 0);
+
+    SECTION("a new queue is empty") {
+        CHECK(queue.isEmpty());
+        char buf[16];
+        CHECK(queue.front(buf, sizeof(buf)) == SYSTEM_ERROR_NOT_FOUND);
+        CHECK(queue.popFront() == SYSTEM_ERROR_NOT_FOUND);
+    }
+
+    SECTION("entries are retrieved in the order they were added") {
+        for (unsigned i = 0; i < 5; ++i) {
+            const std::string e = entry(i, 10 + i);
+            REQUIRE(queue.pushBack(e.data(), e.size()) == 0);
+        }
+        CHECK(queue.size() == 5);
+        for (unsigned i = 0; i < 5; ++i) {
+            CHECK(front(queue) == entry(i, 10 + i));
+            REQUIRE(queue.popFront() == 0);
+        }
+        CHECK(queue.isEmpty());
+    }
+
+    SECTION("small entries are written in batches") {
+        const std::string e = entry(0, 20);
+        for (unsigned i = 0; i < 4; ++i) {
+            REQUIRE(queue.pushBack(e.data(), e.size()) == 0);
+        }
+        const unsigned writes = storage.writes;
+        CHECK(queue.isDirty());
+        REQUIRE(queue.sync() == 0);
+        CHECK(!queue.isDirty());
+        CHECK(storage.writes == writes + 1);
+    }
+
+    SECTION("a buffer that is too small is rejected") {
+        const std::string e = entry(0, 20);
+        REQUIRE(queue.pushBack(e.data(), e.size()) == 0);
+        char buf[10];
+        CHECK(queue.front(buf, sizeof(buf)) == SYSTEM_ERROR_TOO_LARGE);
+        CHECK(queue.size() == 1);
+    }
+
+    SECTION("an entry larger than the storage is rejected") {
+        std::vector<uint8_t> e(queue.maxEntrySize() + 1);
+        CHECK(queue.pushBack(e.data(), e.size()) == SYSTEM_ERROR_TOO_LARGE);
+    }
+
+    SECTION("a full queue rejects new entries until entries are removed") {
+        const std::string e = entry(0, 100);
+        unsigned n = 0;
+        while (queue.pushBack(e.data(), e.size()) == 0) {
+            ++n;
+        }
+        CHECK(n == (1024 - RingFileQueue::DATA_OFFSET) / (100 + 12));
+        CHECK(queue.pushBack(e.data(), e.size()) == SYSTEM_ERROR_LIMIT_EXCEEDED);
+        REQUIRE(queue.popFront() == 0);
+        CHECK(queue.pushBack(e.data(), e.size()) == 0);
+        CHECK(queue.size() == n);
+    }
+
+    SECTION("the queue wraps around without moving entries") {
+        std::deque<std::string> expected;
+        for (unsigned i = 0; i < 200; ++i) {
+            const std::string e = entry(i, 30 + (i * 37) % 90);
+            REQUIRE(queue.pushBack(e.data(), e.size()) == 0);
+            expected.push_back(e);
+            while (expected.size() > 4) {
+                CHECK(front(queue) == expected.front());
+                REQUIRE(queue.popFront() == 0);
+                expected.pop_front();
+            }
+        }
+        CHECK(queue.wraps() > 10);
+        CHECK(queue.size() == expected.size());
+    }
+
+    SECTION("synced entries survive a reset") {
+        for (unsigned i = 0; i < 20; ++i) {
+            const std::string e = entry(i, 20 + i);
+            REQUIRE(queue.pushBack(e.data(), e.size()) == 0);
+        }
+        REQUIRE(queue.popFront() == 0);
+        REQUIRE(queue.popFront() == 0);
+        REQUIRE(queue.sync() == 0);
+        const std::string e = entry(100, 20);
+        REQUIRE(queue.pushBack(e.data(), e.size()) == 0); // Not synced
+        storage.reset();
+
+        RingFileQueue loaded(&storage, storage.data.size());
+        REQUIRE(loaded.init(5678) == 0);
+        REQUIRE(loaded.size() == 18);
+        for (unsigned i = 2; i < 20; ++i) {
+            CHECK(front(loaded) == entry(i, 20 + i));
+            REQUIRE(loaded.popFront() == 0);
+        }
+        CHECK(loaded.isEmpty());
+    }
+
+    SECTION("entries removed since the last sync are delivered again after a reset") {
+        for (unsigned i = 0; i < 3; ++i) {
+            const std::string e = entry(i, 20);
+            REQUIRE(queue.pushBack(e.data(), e.size()) == 0);
+        }
+        REQUIRE(queue.sync() == 0);
+        REQUIRE(queue.popFront() == 0);
+        storage.reset();
+
+        RingFileQueue loaded(&storage, storage.data.size());
+        REQUIRE(loaded.init(5678) == 0);
+        CHECK(loaded.size() == 3);
+        CHECK(front(loaded) == entry(0, 20));
+    }
+
+    SECTION("space of removed entries is reused only after the head is saved") {
+        const std::string e = entry(0, 100);
+        unsigned n = 0;
+        while (queue.pushBack(e.data(), e.size()) == 0) {
+            ++n;
+        }
+        REQUIRE(queue.sync() == 0);
+        for (unsigned i = 0; i < n; ++i) {
+            REQUIRE(queue.popFront() == 0);
+        }
+        for (unsigned i = 0; i < n; ++i) {
+            const std::string e2 = entry(i + 1, 100);
+            REQUIRE(queue.pushBack(e2.data(), e2.size()) == 0);
+            REQUIRE(queue.sync() == 0);
+            // Every reset sees a consistent queue
+            TestStorage copy = storage;
+            RingFileQueue loaded(&copy, copy.data.size());
+            REQUIRE(loaded.init(5678) == 0);
+            REQUIRE(loaded.size() == i + 1);
+            CHECK(front(loaded) == entry(1, 100));
+        }
+    }
+
+    SECTION("clear() discards all entries") {
+        for (unsigned i = 0; i < 3; ++i) {
+            const std::string e = entry(i, 20);
+            REQUIRE(queue.pushBack(e.data(), e.size()) == 0);
+        }
+        REQUIRE(queue.sync() == 0);
+        REQUIRE(queue.clear() == 0);
+        CHECK(queue.isEmpty());
+        storage.reset();
+        RingFileQueue loaded(&storage, storage.data.size());
+        REQUIRE(loaded.init(5678) == 0);
+        CHECK(loaded.isEmpty());
+    }
+
+    SECTION("a corrupted entry ends the queue when it is loaded") {
+        for (unsigned i = 0; i < 3; ++i) {
+            const std::string e = entry(i, 20);
+            REQUIRE(queue.pushBack(e.data(), e.size()) == 0);
+        }
+        REQUIRE(queue.sync() == 0);
+        // Second entry's payload
+        storage.synced[RingFileQueue::DATA_OFFSET + (12 + 20) + 12 + 5] ^= 1;
+        storage.reset();
+        RingFileQueue loaded(&storage, storage.data.size());
+        REQUIRE(loaded.init(5678) == 0);
+        CHECK(loaded.size() == 1);
+    }
+
+    SECTION("a queue survives random resets") {
+        std::minstd_rand rng(42);
+        std::deque<std::string> removed; // Entries removed since the last sync
+        std::deque<std::string> current;
+        std::string lastSynced; // Last entry added before the last sync
+        unsigned next = 0;
+        std::unique_ptr<RingFileQueue> q(new RingFileQueue(&storage, storage.data.size()));
+        REQUIRE(q->init(1) == 0);
+        for (unsigned step = 0; step < 3000; ++step) {
+            switch (rng() % 6) {
+            case 0:
+            case 1:
+            case 2: {
+                const std::string e = entry(next++, 1 + rng() % 150);
+                if (q->pushBack(e.data(), e.size()) == 0) {
+                    current.push_back(e);
+                }
+                break;
+            }
+            case 3:
+                if (!current.empty()) {
+                    REQUIRE(front(*q) == current.front());
+                    REQUIRE(q->popFront() == 0);
+                    removed.push_back(current.front());
+                    current.pop_front();
+                }
+                break;
+            case 4:
+                REQUIRE(q->sync() == 0);
+                removed.clear();
+                lastSynced = current.empty() ? std::string() : current.back();
+                break;
+            case 5: {
+                storage.reset();
+                q.reset(new RingFileQueue(&storage, storage.data.size()));
+                REQUIRE(q->init(step) == 0);
+                std::deque<std::string> loaded;
+                while (!q->isEmpty()) {
+                    loaded.push_back(front(*q));
+                    REQUIRE(q->popFront() == 0);
+                }
+                storage.reset();
+                q.reset(new RingFileQueue(&storage, storage.data.size()));
+                REQUIRE(q->init(step) == 0);
+                REQUIRE(q->size() == loaded.size());
+                // The loaded entries are a contiguous run of the removed and current entries, starting
+                // no later than the first current entry and including every entry synced explicitly
+                std::deque<std::string> all = removed;
+                all.insert(all.end(), current.begin(), current.end());
+                size_t start = 0;
+                if (!loaded.empty()) {
+                    while (start < all.size() && all[start] != loaded.front()) {
+                        ++start;
+                    }
+                    REQUIRE(start <= removed.size());
+                    for (size_t i = 0; i < loaded.size(); ++i) {
+                        REQUIRE(start + i < all.size());
+                        REQUIRE(loaded[i] == all[start + i]);
+                    }
+                }
+                if (!lastSynced.empty() && std::find(current.begin(), current.end(), lastSynced) != current.end()) {
+                    REQUIRE(std::find(loaded.begin(), loaded.end(), lastSynced) != loaded.end());
+                }
+                current = loaded;
+                removed.clear();
+                break;
+            }
+            }
+        }
+        CHECK(q->wraps() > 0);
+    }
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "spsc_ring_buffer.h"
+
+#include <catch2/catch.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+using namespace particle::services;
+
+namespace {
+
+// Producer and consumer each run until `count` bytes went through the buffer, using chunks of
+// up to `chunk` bytes. Returns true if the consumer received the bytes in order.
+bool transfer(SpscRingBuffer<uint8_t>& rb, size_t count, size_t chunk) {
+    std::thread producer([&]() {
+        std::vector<uint8_t> buf(chunk);
+        size_t sent = 0;
+        while (sent < count) {
+            const size_t n = std::min(chunk, count - sent);
+            for (size_t i = 0; i < n; ++i) {
+                buf[i] = (uint8_t)(sent + i);
+            }
+            size_t written = 0;
+            while (written < n) {
+                const size_t w = rb.put(buf.data() + written, n - written);
+                if (!w) {
+                    std::this_thread::yield();
+                }
+                written += w;
+            }
+            sent += n;
+        }
+    });
+    bool ok = true;
+    size_t received = 0;
+    while (received < count) {
+        size_t avail = 0;
+        const uint8_t* p = rb.consume(&avail);
+        if (!p) {
+            std::this_thread::yield();
+            continue;
+        }
+        avail = std::min(avail, chunk);
+        for (size_t i = 0; i < avail; ++i) {
+            ok = ok && (p[i] == (uint8_t)(received + i));
+        }
+        rb.consumeCommit(avail);
+        received += avail;
+    }
+    producer.join();
+    return ok;
+}
+
+} // namespace
+
+TEST_CASE("SpscRingBuffer") {
+    uint8_t buf[16] = {};
+    SpscRingBuffer<uint8_t> rb;
+    REQUIRE(rb.init(buf, sizeof(buf)) == 0);
+
+    SECTION("the size must be a power of two") {
+        uint8_t b[12];
+        SpscRingBuffer<uint8_t> r;
+        CHECK(r.init(b, sizeof(b)) == SYSTEM_ERROR_INVALID_ARGUMENT);
+        CHECK(r.init(b, 0) == SYSTEM_ERROR_INVALID_ARGUMENT);
+        CHECK(r.init(b, 8) == 0);
+        CHECK(r.size() == 8);
+    }
+
+    SECTION("a new buffer is empty") {
+        CHECK(rb.empty());
+        CHECK_FALSE(rb.full());
+        CHECK(rb.data() == 0);
+        CHECK(rb.space() == 16);
+        uint8_t v;
+        CHECK_FALSE(rb.get(&v));
+        size_t n = 1;
+        CHECK(rb.consume(&n) == nullptr);
+        CHECK(n == 0);
+    }
+
+    SECTION("the whole buffer can be filled") {
+        for (int i = 0; i < 16; ++i) {
+            REQUIRE(rb.put((uint8_t)i));
+        }
+        CHECK(rb.full());
+        CHECK_FALSE(rb.put(0xff));
+        size_t n = 1;
+        CHECK(rb.acquire(&n) == nullptr);
+        for (int i = 0; i < 16; ++i) {
+            uint8_t v = 0;
+            REQUIRE(rb.get(&v));
+            CHECK(v == i);
+        }
+        CHECK(rb.empty());
+    }
+
+    SECTION("bulk operations copy as much as fits across the end of the buffer") {
+        uint8_t in[32];
+        for (int i = 0; i < 32; ++i) {
+            in[i] = i;
+        }
+        REQUIRE(rb.put(in, 10) == 10);
+        uint8_t out[32] = {};
+        REQUIRE(rb.get(out, 10) == 10);
+        // The next write wraps
+        CHECK(rb.put(in, 32) == 16);
+        CHECK(rb.peek(out, 4, 14) == 2);
+        CHECK(out[0] == 14);
+        CHECK(out[1] == 15);
+        CHECK(rb.peekAt(7) == 7);
+        CHECK(rb.get(out, 32) == 16);
+        CHECK(std::equal(in, in + 16, out));
+    }
+
+    SECTION("acquire returns contiguous regions up to the end of the buffer") {
+        uint8_t in[12] = {};
+        REQUIRE(rb.put(in, 12) == 12);
+        REQUIRE(rb.skip(10) == 10);
+        size_t n = 0;
+        uint8_t* p = rb.acquire(&n);
+        CHECK(p == buf + 12);
+        CHECK(n == 4);
+        memset(p, 0xaa, n);
+        rb.acquireCommit(n);
+        p = rb.acquire(&n);
+        CHECK(p == buf);
+        CHECK(n == 10);
+        rb.acquireCommit(3);
+        CHECK(rb.data() == 9);
+
+        const uint8_t* c = rb.consume(&n);
+        CHECK(c == buf + 10);
+        CHECK(n == 6);
+        rb.consumeCommit(6);
+        c = rb.consume(&n);
+        CHECK(c == buf);
+        CHECK(n == 3);
+    }
+
+    SECTION("reset discards the data") {
+        rb.put(1);
+        rb.reset();
+        CHECK(rb.empty());
+        CHECK(rb.space() == 16);
+    }
+
+    SECTION("a producer and a consumer thread transfer data in order") {
+        for (size_t chunk: { 1, 3, 16 }) {
+            CHECK(transfer(rb, 200000, chunk));
+        }
+    }
+}
+
+TEST_CASE("SpscRingBuffer throughput", "[.][benchmark]") {
+    std::vector<uint8_t> buf(1024);
+    SpscRingBuffer<uint8_t> rb(buf.data(), buf.size());
+    const size_t count = 16 * 1024 * 1024;
+    for (size_t chunk: { 1, 16, 256 }) {
+        const auto start = std::chrono::steady_clock::now();
+        REQUIRE(transfer(rb, count, chunk));
+        const double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        WARN(chunk << " byte chunks: " << count / s / (1024 * 1024) << " MB/s");
+    }
+}
@@ -0,0 +1,347 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "timer_wheel.h"
+
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace particle::services;
+
+namespace {
+
+struct TestTimer {
+    TimerWheel* wheel;
+    TimerWheel::Timer timer;
+    std::vector<uint32_t> fired;
+    std::function<void(TestTimer*)> onExpired;
+
+    explicit TestTimer(TimerWheel* wheel) :
+            wheel(wheel),
+            timer(expired, this) {
+    }
+
+    static void expired(void* data) {
+        const auto t = (TestTimer*)data;
+        t->fired.push_back(t->wheel->time());
+        if (t->onExpired) {
+            t->onExpired(t);
+        }
+    }
+};
+
+// Timers kept in a list sorted by the expiration time, like the active timer list of the RTOS
+class SortedListTimers {
+public:
+    struct Timer {
+        uint32_t expiry;
+        uint32_t period;
+        bool active;
+        std::list<Timer*>::iterator pos;
+    };
+
+    void start(Timer* t, uint32_t delay, uint32_t period) {
+        stop(t);
+        t->expiry = now_ + delay;
+        t->period = period;
+        insert(t);
+    }
+
+    void stop(Timer* t) {
+        if (t->active) {
+            list_.erase(t->pos);
+            t->active = false;
+        }
+    }
+
+    size_t advance(uint32_t now) {
+        now_ = now;
+        size_t n = 0;
+        while (!list_.empty() && (int32_t)(list_.front()->expiry - now) <= 0) {
+            const auto t = list_.front();
+            list_.pop_front();
+            t->active = false;
+            if (t->period) {
+                t->expiry += t->period;
+                insert(t);
+            }
+            ++n;
+        }
+        return n;
+    }
+
+private:
+    std::list<Timer*> list_;
+    uint32_t now_ = 0;
+
+    void insert(Timer* t) {
+        auto it = list_.begin();
+        while (it != list_.end() && (int32_t)((*it)->expiry - t->expiry) <= 0) {
+            ++it;
+        }
+        t->pos = list_.insert(it, t);
+        t->active = true;
+    }
+};
+
+void noop(void* data) {
+}
+
+} // namespace
+
+TEST_CASE("TimerWheel") {
+    SECTION("expires timers on their expiration tick") {
+        for (uint32_t start: { 0u, 1000u, 0xffffff00u }) {
+            TimerWheel wheel(start);
+            const uint32_t delays[] = { 1, 2, 63, 64, 65, 100, 4095, 4096, 4097, 262143, 262144, 300000,
+                    (1u << 24) - 1, 1u << 24, (1u << 24) + 5, 40000000 };
+            std::vector<std::unique_ptr<TestTimer>> timers;
+            std::map<uint32_t, std::vector<TestTimer*>> expiries;
+            for (auto delay: delays) {
+                timers.emplace_back(new TestTimer(&wheel));
+                wheel.start(&timers.back()->timer, delay);
+                expiries[delay].push_back(timers.back().get());
+            }
+            CHECK(wheel.activeCount() == timers.size());
+            size_t fired = 0;
+            for (const auto& e: expiries) {
+                CHECK(wheel.advance(start + e.first - 1) == 0);
+                CHECK(wheel.advance(start + e.first) == e.second.size());
+                for (auto t: e.second) {
+                    REQUIRE(t->fired.size() == 1);
+                    CHECK(t->fired[0] == start + e.first);
+                    CHECK_FALSE(t->timer.isActive());
+                }
+                fired += e.second.size();
+                CHECK(wheel.activeCount() == timers.size() - fired);
+            }
+        }
+    }
+
+    SECTION("expires timers when the wheel is advanced in steps of random size") {
+        std::mt19937 rand(1);
+        TimerWheel wheel(0xfff00000u);
+        std::vector<std::unique_ptr<TestTimer>> timers;
+        std::vector<uint32_t> expiry;
+        for (unsigned i = 0; i < 500; ++i) {
+            timers.emplace_back(new TestTimer(&wheel));
+            const uint32_t delay = std::uniform_int_distribution<uint32_t>(1, 300000)(rand);
+            wheel.start(&timers.back()->timer, delay);
+            expiry.push_back(wheel.time() + delay);
+        }
+        uint32_t now = wheel.time();
+        size_t fired = 0;
+        while (fired < timers.size()) {
+            const uint32_t prev = now;
+            now += std::uniform_int_distribution<uint32_t>(1, 2000)(rand);
+            fired += wheel.advance(now);
+            for (size_t i = 0; i < timers.size(); ++i) {
+                const bool due = (int32_t)(expiry[i] - now) <= 0;
+                REQUIRE(timers[i]->fired.size() == (due ? 1 : 0));
+                if (due && (int32_t)(expiry[i] - prev) > 0) {
+                    CHECK(timers[i]->fired[0] == now);
+                }
+            }
+        }
+        CHECK(wheel.activeCount() == 0);
+        const auto stats = wheel.stats();
+        CHECK(stats.expired == timers.size());
+        CHECK(stats.maxLateness < 2000);
+        CHECK(stats.overruns == 0);
+    }
+
+    SECTION("keeps the phase of periodic timers and counts the skipped periods") {
+        TimerWheel wheel(0);
+        TestTimer t(&wheel);
+        wheel.start(&t.timer, 10, 10);
+        for (uint32_t now = 1; now <= 100; ++now) {
+            wheel.advance(now);
+        }
+        CHECK(t.fired == std::vector<uint32_t>({ 10, 20, 30, 40, 50, 60, 70, 80, 90, 100 }));
+        CHECK(wheel.advance(135) == 1);
+        CHECK(wheel.stats().overruns == 2);
+        CHECK(wheel.stats().maxLateness == 25);
+        CHECK(wheel.advance(139) == 0);
+        CHECK(wheel.advance(140) == 1);
+        CHECK(t.timer.isActive());
+        wheel.stop(&t.timer);
+        CHECK_FALSE(t.timer.isActive());
+        CHECK(wheel.advance(1000) == 0);
+        wheel.resetStats();
+        CHECK(wheel.stats().expired == 0);
+    }
+
+    SECTION("stops and restarts timers in constant time") {
+        TimerWheel wheel(0);
+        TestTimer t1(&wheel), t2(&wheel), t3(&wheel);
+        wheel.start(&t1.timer, 5);
+        wheel.start(&t2.timer, 5);
+        wheel.start(&t3.timer, 5);
+        wheel.stop(&t2.timer);
+        wheel.stop(&t2.timer);
+        wheel.start(&t3.timer, 7);
+        CHECK(wheel.activeCount() == 2);
+        CHECK(wheel.advance(5) == 1);
+        CHECK(t1.fired.size() == 1);
+        CHECK(t2.fired.empty());
+        CHECK(t3.fired.empty());
+        CHECK(wheel.advance(7) == 1);
+        CHECK(t3.fired == std::vector<uint32_t>({ 7 }));
+    }
+
+    SECTION("starts timers at an absolute time") {
+        TimerWheel wheel(0);
+        TestTimer t1(&wheel), t2(&wheel);
+        wheel.advance(5000);
+        wheel.startAt(&t1.timer, 5000 + 3600000, 1000);
+        wheel.startAt(&t2.timer, 4000);
+        CHECK(wheel.nextTimeout() == 1);
+        CHECK(wheel.advance(5001) == 1);
+        CHECK(t2.fired == std::vector<uint32_t>({ 5001 }));
+        CHECK(wheel.advance(5000 + 3599999) == 0);
+        CHECK(wheel.advance(5000 + 3600000) == 1);
+        CHECK(wheel.advance(5000 + 3601000) == 1);
+        CHECK(t1.fired == std::vector<uint32_t>({ 5000 + 3600000, 5000 + 3601000 }));
+    }
+
+    SECTION("allows callbacks to restart their timer and to stop other timers") {
+        TimerWheel wheel(0);
+        TestTimer t1(&wheel), t2(&wheel);
+        t1.onExpired = [&t2](TestTimer* t) {
+            CHECK(t->wheel->isExpiring(&t->timer));
+            CHECK_FALSE(t->wheel->isExpiring(&t2.timer));
+            t->wheel->start(&t->timer, 0);
+            t->wheel->stop(&t2.timer);
+        };
+        wheel.start(&t1.timer, 3);
+        wheel.start(&t2.timer, 5);
+        CHECK(wheel.advance(10) == 1);
+        CHECK(wheel.advance(11) == 1);
+        CHECK(t1.fired == std::vector<uint32_t>({ 10, 11 }));
+        CHECK(t2.fired.empty());
+        CHECK_FALSE(wheel.isExpiring(&t1.timer));
+        CHECK(t1.timer.isActive());
+    }
+
+    SECTION("reports when the wheel needs to be advanced next") {
+        TimerWheel wheel(100);
+        CHECK(wheel.nextTimeout() == TimerWheel::NO_TIMERS);
+        TestTimer t1(&wheel), t2(&wheel);
+        wheel.start(&t1.timer, 10);
+        CHECK(wheel.nextTimeout() == 10);
+        wheel.start(&t2.timer, 5);
+        CHECK(wheel.nextTimeout() == 5);
+        wheel.stop(&t2.timer);
+        wheel.stop(&t1.timer);
+        // Sleep until the reported timeout, the way a tickless driver would
+        const uint32_t delay = 1000000;
+        wheel.start(&t1.timer, delay);
+        uint32_t now = wheel.time();
+        size_t advances = 0;
+        while (t1.fired.empty()) {
+            const uint32_t ticks = wheel.nextTimeout();
+            REQUIRE(ticks > 0);
+            REQUIRE(ticks != TimerWheel::NO_TIMERS);
+            now += ticks;
+            wheel.advance(now);
+            ++advances;
+        }
+        CHECK(t1.fired[0] == 100 + delay);
+        CHECK(advances <= 4); // One per level
+        CHECK(wheel.stats().maxLateness == 0);
+        CHECK(wheel.nextTimeout() == TimerWheel::NO_TIMERS);
+        // Many timers with random delays expire exactly on time
+        std::mt19937 rand(2);
+        std::vector<std::unique_ptr<TestTimer>> timers;
+        for (unsigned i = 0; i < 200; ++i) {
+            timers.emplace_back(new TestTimer(&wheel));
+            wheel.start(&timers.back()->timer, std::uniform_int_distribution<uint32_t>(1, 20000000)(rand));
+        }
+        wheel.resetStats();
+        while (wheel.nextTimeout() != TimerWheel::NO_TIMERS) {
+            now += wheel.nextTimeout();
+            wheel.advance(now);
+        }
+        CHECK(wheel.stats().expired == timers.size());
+        CHECK(wheel.stats().maxLateness == 0);
+    }
+}
+
+TEST_CASE("TimerWheel with 1000 timers", "[.][benchmark]") {
+    const size_t count = 1000;
+    const uint32_t duration = 60000; // 60 s of 1 ms ticks
+    const size_t restartsPerTick = 10;
+    std::mt19937 rand(1);
+    std::vector<uint32_t> periods;
+    std::vector<size_t> restarts;
+    for (size_t i = 0; i < count; ++i) {
+        periods.push_back(std::uniform_int_distribution<uint32_t>(10, 10000)(rand));
+    }
+    for (size_t i = 0; i < duration * restartsPerTick; ++i) {
+        restarts.push_back(std::uniform_int_distribution<size_t>(0, count - 1)(rand));
+    }
+    size_t wheelExpired = 0;
+    double wheelSec = 0;
+    {
+        TimerWheel wheel(0);
+        std::vector<std::unique_ptr<TimerWheel::Timer>> timers;
+        for (size_t i = 0; i < count; ++i) {
+            timers.emplace_back(new TimerWheel::Timer(noop, nullptr));
+            wheel.start(timers.back().get(), periods[i], periods[i]);
+        }
+        const auto start = std::chrono::steady_clock::now();
+        size_t r = 0;
+        for (uint32_t now = 1; now <= duration; ++now) {
+            for (size_t i = 0; i < restartsPerTick; ++i, ++r) {
+                wheel.start(timers[restarts[r]].get(), periods[restarts[r]], periods[restarts[r]]);
+            }
+            wheelExpired += wheel.advance(now);
+        }
+        wheelSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    size_t listExpired = 0;
+    double listSec = 0;
+    {
+        SortedListTimers list;
+        std::vector<SortedListTimers::Timer> timers(count);
+        for (size_t i = 0; i < count; ++i) {
+            timers[i].active = false;
+            list.start(&timers[i], periods[i], periods[i]);
+        }
+        const auto start = std::chrono::steady_clock::now();
+        size_t r = 0;
+        for (uint32_t now = 1; now <= duration; ++now) {
+            for (size_t i = 0; i < restartsPerTick; ++i, ++r) {
+                list.start(&timers[restarts[r]], periods[restarts[r]], periods[restarts[r]]);
+            }
+            listExpired += list.advance(now);
+        }
+        listSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    CHECK(wheelExpired == listExpired);
+    WARN(count << " timers, " << restartsPerTick << " restarts per tick: sorted list " <<
+            listSec * 1e6 / duration << " us per tick, timer wheel " << wheelSec * 1e6 / duration <<
+            " us per tick");
+}
@@ -0,0 +1,436 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tlv_file.h"
+#include "system_error.h"
+
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace particle::services::settings;
+
+namespace {
+
+/**
+ * Files in RAM. Like littlefs built with LFS_NO_MALLOC, only one file can be open at a time.
+ * The contents of a file are persisted when it's synced or closed.
+ */
+struct RamFilesystem {
+    std::map<std::string, std::vector<uint8_t>> files;
+    std::set<std::string> dirs;
+    std::string failOpenPath; // Opening this file fails
+    int openFiles = 0;
+    int maxOpenFiles = 0;
+    size_t bytesRead = 0;
+    size_t bytesWritten = 0;
+
+    RamFilesystem() {
+        dirs.insert("/");
+    }
+
+    bool hasParentDir(const std::string& path) const {
+        const size_t n = path.rfind('/');
+        return n == std::string::npos || dirs.count(n ? path.substr(0, n) : "/");
+    }
+};
+
+RamFilesystem g_fs;
+filesystem_t g_filesystem;
+
+const char* const PATH = "/sys/test.dat";
+
+std::string value(unsigned i, size_t size) {
+    std::string s = std::to_string(i) + ":";
+    s.resize(size, 'a' + i % 26);
+    return s;
+}
+
+std::string get(TlvFile& file, uint16_t key, int index = 0) {
+    char buf[256] = {};
+    const ssize_t n = file.get(key, (uint8_t*)buf, sizeof(buf), index);
+    if (n < 0) {
+        return std::string();
+    }
+    return std::string(buf, n);
+}
+
+ssize_t find(TlvFile& file, uint16_t key, int index = 0) {
+    uint8_t c = 0;
+    return file.get(key, &c, sizeof(c), index);
+}
+
+int set(TlvFile& file, uint16_t key, const std::string& value) {
+    return file.set(key, (const uint8_t*)value.data(), value.size());
+}
+
+uint32_t footerMagick() {
+    const auto& data = g_fs.files.at(PATH);
+    uint32_t magick = 0;
+    memcpy(&magick, data.data() + data.size() - sizeof(magick), sizeof(magick));
+    return magick;
+}
+
+} // namespace
+
+int filesystem_mount(filesystem_t* fs) {
+    return 0;
+}
+
+filesystem_t* filesystem_get_instance(void* reserved) {
+    return &g_filesystem;
+}
+
+int lfs_file_open(lfs_t* lfs, lfs_file_t* file, const char* path, int flags) {
+    if (g_fs.openFiles > 0) {
+        // All files would share the same file buffer
+        return LFS_ERR_NOMEM;
+    }
+    if (g_fs.failOpenPath == path) {
+        return LFS_ERR_IO;
+    }
+    if (!g_fs.hasParentDir(path)) {
+        return LFS_ERR_NOENT;
+    }
+    auto it = g_fs.files.find(path);
+    if (it == g_fs.files.end()) {
+        if (!(flags & LFS_O_CREAT)) {
+            return LFS_ERR_NOENT;
+        }
+        it = g_fs.files.insert(std::make_pair(std::string(path), std::vector<uint8_t>())).first;
+    }
+    file->path = path;
+    file->data = it->second;
+    file->pos = 0;
+    file->flags = flags;
+    if (flags & LFS_O_TRUNC) {
+        file->data.clear();
+    }
+    g_fs.maxOpenFiles = std::max(g_fs.maxOpenFiles, ++g_fs.openFiles);
+    return 0;
+}
+
+int lfs_file_sync(lfs_t* lfs, lfs_file_t* file) {
+    if (file->flags & LFS_O_WRONLY) {
+        g_fs.files[file->path] = file->data;
+    }
+    return 0;
+}
+
+int lfs_file_close(lfs_t* lfs, lfs_file_t* file) {
+    const int ret = lfs_file_sync(lfs, file);
+    --g_fs.openFiles;
+    return ret;
+}
+
+lfs_ssize_t lfs_file_read(lfs_t* lfs, lfs_file_t* file, void* buffer, lfs_size_t size) {
+    if (file->pos >= file->data.size()) {
+        return 0;
+    }
+    size = std::min<lfs_size_t>(size, file->data.size() - file->pos);
+    memcpy(buffer, file->data.data() + file->pos, size);
+    file->pos += size;
+    g_fs.bytesRead += size;
+    return size;
+}
+
+lfs_ssize_t lfs_file_write(lfs_t* lfs, lfs_file_t* file, const void* buffer, lfs_size_t size) {
+    if (!(file->flags & LFS_O_WRONLY)) {
+        return LFS_ERR_INVAL;
+    }
+    if (file->flags & LFS_O_APPEND) {
+        file->pos = file->data.size();
+    }
+    if (file->data.size() < file->pos + size) {
+        file->data.resize(file->pos + size);
+    }
+    memcpy(file->data.data() + file->pos, buffer, size);
+    file->pos += size;
+    g_fs.bytesWritten += size;
+    return size;
+}
+
+lfs_soff_t lfs_file_seek(lfs_t* lfs, lfs_file_t* file, lfs_soff_t off, int whence) {
+    lfs_soff_t pos = off;
+    if (whence == LFS_SEEK_CUR) {
+        pos += file->pos;
+    } else if (whence == LFS_SEEK_END) {
+        pos += file->data.size();
+    }
+    if (pos < 0) {
+        return LFS_ERR_INVAL;
+    }
+    file->pos = pos;
+    return pos;
+}
+
+int lfs_file_truncate(lfs_t* lfs, lfs_file_t* file, lfs_off_t size) {
+    file->data.resize(size);
+    return 0;
+}
+
+lfs_soff_t lfs_file_size(lfs_t* lfs, lfs_file_t* file) {
+    return file->data.size();
+}
+
+int lfs_remove(lfs_t* lfs, const char* path) {
+    if (!g_fs.files.erase(path) && !g_fs.dirs.erase(path)) {
+        return LFS_ERR_NOENT;
+    }
+    return 0;
+}
+
+int lfs_rename(lfs_t* lfs, const char* oldpath, const char* newpath) {
+    auto it = g_fs.files.find(oldpath);
+    if (it == g_fs.files.end()) {
+        return LFS_ERR_NOENT;
+    }
+    std::vector<uint8_t> data = std::move(it->second);
+    g_fs.files.erase(it);
+    g_fs.files[newpath] = std::move(data);
+    return 0;
+}
+
+int lfs_stat(lfs_t* lfs, const char* path, struct lfs_info* info) {
+    memset(info, 0, sizeof(*info));
+    if (g_fs.dirs.count(path)) {
+        info->type = LFS_TYPE_DIR;
+        return 0;
+    }
+    auto it = g_fs.files.find(path);
+    if (it == g_fs.files.end()) {
+        return LFS_ERR_NOENT;
+    }
+    info->type = LFS_TYPE_REG;
+    info->size = it->second.size();
+    return 0;
+}
+
+int lfs_mkdir(lfs_t* lfs, const char* path) {
+    if (!g_fs.hasParentDir(path)) {
+        return LFS_ERR_NOENT;
+    }
+    if (!g_fs.dirs.insert(path).second) {
+        return LFS_ERR_EXIST;
+    }
+    return 0;
+}
+
+TEST_CASE("TlvFile") {
+    g_fs = RamFilesystem();
+    TlvFile file(PATH);
+    REQUIRE(file.init() == 0);
+
+    SECTION("entries survive a reopen") {
+        REQUIRE(set(file, 1, "one") == 0);
+        REQUIRE(set(file, 2, "two") == 0);
+        REQUIRE(file.add(2, (const uint8_t*)"three", 5) == 0);
+        REQUIRE(file.deInit() == 0);
+        TlvFile file2(PATH);
+        REQUIRE(file2.init() == 0);
+        CHECK(get(file2, 1) == "one");
+        CHECK(get(file2, 2, 0) == "two");
+        CHECK(get(file2, 2, 1) == "three");
+        CHECK(find(file2, 3) == SYSTEM_ERROR_NOT_FOUND);
+    }
+
+    SECTION("an update rewrites the file in place") {
+        REQUIRE(set(file, 1, "one") == 0);
+        REQUIRE(set(file, 2, "two") == 0);
+        const ssize_t size = file.size();
+        REQUIRE(set(file, 1, "uno") == 0);
+        CHECK(file.size() == size);
+        CHECK(get(file, 1) == "uno");
+        CHECK(get(file, 2) == "two");
+        CHECK(find(file, 1, 1) == SYSTEM_ERROR_NOT_FOUND);
+        CHECK(footerMagick() == TLV_FILE_MAGICK);
+        CHECK(file.fileVersion() == 0);
+    }
+
+    SECTION("deleting all entries with a key reports that none are left") {
+        REQUIRE(set(file, 1, "one") == 0);
+        REQUIRE(file.add(1, (const uint8_t*)"two", 3) == 0);
+        REQUIRE(set(file, 2, value(2, 600)) == 0);
+        REQUIRE(file.del(1, 0) == 0);
+        CHECK(get(file, 1) == "two");
+        CHECK(file.del(1) == SYSTEM_ERROR_NOT_FOUND);
+        CHECK(find(file, 1) == SYSTEM_ERROR_NOT_FOUND);
+        CHECK(file.size() == (ssize_t)(8 + 600 + 16));
+        CHECK(file.get(2, nullptr, 0) == SYSTEM_ERROR_NOT_FOUND);
+        char buf[600] = {};
+        CHECK(file.get(2, (uint8_t*)buf, sizeof(buf)) == (ssize_t)sizeof(buf));
+        CHECK(std::string(buf, sizeof(buf)) == value(2, 600));
+        CHECK(g_fs.maxOpenFiles == 1);
+    }
+
+    SECTION("a file with tombstones is rewritten without them") {
+        REQUIRE(file.deInit() == 0);
+        {
+            TlvFile indexed(PATH, TlvFile::INDEXED);
+            REQUIRE(indexed.init() == 0);
+            REQUIRE(set(indexed, 1, "one") == 0);
+            REQUIRE(set(indexed, 2, "two") == 0);
+            REQUIRE(set(indexed, 1, "uno") == 0);
+            // Firmware that doesn't know about tombstones discards the file
+            CHECK(footerMagick() == TLV_FILE_TOMBSTONES_MAGICK);
+            CHECK(indexed.fileVersion() == TLV_FILE_VERSION);
+            REQUIRE(indexed.deInit() == 0);
+        }
+        TlvFile file2(PATH);
+        REQUIRE(file2.init() == 0);
+        CHECK(footerMagick() == TLV_FILE_MAGICK);
+        CHECK(file2.fileVersion() == 0);
+        CHECK(file2.size() == (ssize_t)(2 * (8 + 3) + 16));
+        CHECK(get(file2, 1) == "uno");
+        CHECK(get(file2, 2) == "two");
+        CHECK(find(file2, 1, 1) == SYSTEM_ERROR_NOT_FOUND);
+    }
+}
+
+TEST_CASE("TlvFile with INDEXED") {
+    g_fs = RamFilesystem();
+    TlvFile file(PATH, TlvFile::INDEXED);
+    REQUIRE(file.init() == 0);
+
+    SECTION("entries survive a reopen") {
+        REQUIRE(set(file, 1, "one") == 0);
+        REQUIRE(set(file, 2, "two") == 0);
+        REQUIRE(file.add(2, (const uint8_t*)"three", 5) == 0);
+        REQUIRE(file.deInit() == 0);
+        TlvFile file2(PATH, TlvFile::INDEXED);
+        REQUIRE(file2.init() == 0);
+        CHECK(get(file2, 1) == "one");
+        CHECK(get(file2, 2, 0) == "two");
+        CHECK(get(file2, 2, 1) == "three");
+        CHECK(find(file2, 3) == SYSTEM_ERROR_NOT_FOUND);
+    }
+
+    SECTION("an update appends a tombstone and the new entry") {
+        REQUIRE(set(file, 1, "one") == 0);
+        const ssize_t size = file.size();
+        REQUIRE(set(file, 1, "uno") == 0);
+        // Tombstone (header + offset) and the new entry (header + data)
+        CHECK(file.size() == size + 8 + 4 + 8 + 3);
+        CHECK(get(file, 1) == "uno");
+        CHECK(find(file, 1, 1) == SYSTEM_ERROR_NOT_FOUND);
+    }
+
+    SECTION("deleted entries stay deleted after a reopen") {
+        REQUIRE(set(file, 1, "one") == 0);
+        REQUIRE(file.add(1, (const uint8_t*)"two", 3) == 0);
+        REQUIRE(set(file, 2, "keep") == 0);
+        REQUIRE(file.del(1, 0) == 0);
+        CHECK(get(file, 1) == "two");
+        REQUIRE(file.del(1) == SYSTEM_ERROR_NOT_FOUND);
+        CHECK(find(file, 1) == SYSTEM_ERROR_NOT_FOUND);
+        REQUIRE(file.deInit() == 0);
+        TlvFile file2(PATH, TlvFile::INDEXED);
+        REQUIRE(file2.init() == 0);
+        CHECK(find(file2, 1) == SYSTEM_ERROR_NOT_FOUND);
+        CHECK(get(file2, 2) == "keep");
+    }
+
+    SECTION("the file is compacted once deleted entries outweigh live ones") {
+        for (unsigned i = 0; i < 10; ++i) {
+            REQUIRE(set(file, i, value(i, 200)) == 0);
+        }
+        ssize_t maxSize = 0;
+        for (unsigned i = 0; i < 100; ++i) {
+            REQUIRE(set(file, i % 3, value(i, 200)) == 0);
+            maxSize = std::max(maxSize, file.size());
+        }
+        // Without compaction, each update would add 220 bytes
+        CHECK(maxSize < 10 * 208 * 2 + 1024);
+        CHECK(g_fs.maxOpenFiles == 1);
+        CHECK(g_fs.files.size() == 1);
+        for (unsigned i = 0; i < 3; ++i) {
+            CHECK(get(file, i) == value(99 - (99 - i) % 3, 200));
+        }
+        for (unsigned i = 3; i < 10; ++i) {
+            CHECK(get(file, i) == value(i, 200));
+        }
+
+        SECTION("the compacted file can be reopened") {
+            const ssize_t size = file.size();
+            CHECK(footerMagick() == TLV_FILE_MAGICK);
+            REQUIRE(file.deInit() == 0);
+            TlvFile file2(PATH, TlvFile::INDEXED);
+            REQUIRE(file2.init() == 0);
+            CHECK(file2.size() == size);
+            for (unsigned i = 0; i < 3; ++i) {
+                CHECK(get(file2, i) == value(99 - (99 - i) % 3, 200));
+            }
+            for (unsigned i = 3; i < 10; ++i) {
+                CHECK(get(file2, i) == value(i, 200));
+            }
+            REQUIRE(set(file2, 20, "new") == 0);
+            CHECK(get(file2, 20) == "new");
+        }
+    }
+
+    SECTION("the file is left intact if compaction fails") {
+        g_fs.failOpenPath = std::string(PATH) + ".tmp";
+        for (unsigned i = 0; i < 20; ++i) {
+            REQUIRE(set(file, 1, value(i, 200)) == 0);
+        }
+        CHECK(get(file, 1) == value(19, 200));
+        g_fs.failOpenPath.clear();
+        REQUIRE(set(file, 2, "two") == 0);
+        CHECK(file.size() < 1024);
+        CHECK(get(file, 1) == value(19, 200));
+        CHECK(get(file, 2) == "two");
+    }
+}
+
+TEST_CASE("TlvFile get/set cost", "[.][benchmark]") {
+    for (unsigned keys: { 10, 100, 1000 }) {
+        for (unsigned flags: { 0u, (unsigned)TlvFile::INDEXED }) {
+            g_fs = RamFilesystem();
+            TlvFile file(PATH, flags);
+            REQUIRE(file.init() == 0);
+            for (unsigned i = 0; i < keys; ++i) {
+                REQUIRE(file.add(i, (const uint8_t*)value(i, 16).data(), 16) == 0);
+            }
+            const unsigned ops = 1000;
+            g_fs.bytesRead = 0;
+            g_fs.bytesWritten = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (unsigned i = 0; i < ops; ++i) {
+                REQUIRE(find(file, (i * 7919) % keys) == 1);
+            }
+            const double getUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / ops;
+            const size_t getRead = g_fs.bytesRead / ops;
+            g_fs.bytesRead = 0;
+            g_fs.bytesWritten = 0;
+            start = std::chrono::steady_clock::now();
+            for (unsigned i = 0; i < ops; ++i) {
+                const unsigned key = (i * 7919) % keys;
+                REQUIRE(set(file, key, value(key + i, 16)) == 0);
+            }
+            const double setUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / ops;
+            WARN(keys << " keys, " << (flags ? "indexed" : "scanned") << ": get " << getUs << " us, " << getRead <<
+                    " B read; set " << setUs << " us, " << g_fs.bytesRead / ops << " B read, " << g_fs.bytesWritten / ops <<
+                    " B written");
+        }
+    }
+}
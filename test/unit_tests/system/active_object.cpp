@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
+
+#include "active_object.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace {
+
+void idle() {
+}
+
+ActiveObjectThreadQueue& activeObject() {
+    static ActiveObjectThreadQueue* obj = []() {
+        const auto obj = new ActiveObjectThreadQueue(ActiveObjectConfiguration(idle, 10 /* take_wait */,
+                0x7fffffff /* put_wait */, 50 /* queue_size */));
+        obj->start();
+        return obj;
+    }();
+    return *obj;
+}
+
+ActiveObjectStats stats() {
+    ActiveObjectStats s = {};
+    activeObject().stats(&s);
+    return s;
+}
+
+// Waits until all the tasks posted so far have run
+void flush() {
+    activeObject().invoke_sync([]() {});
+}
+
+} // namespace
+
+TEST_CASE("ActiveObjectBase") {
+    auto& obj = activeObject();
+    flush();
+    const auto before = stats();
+
+    SECTION("asynchronous calls are run on the thread of the active object in order") {
+        std::atomic<int> n(0);
+        std::atomic<bool> ok(true);
+        for (int i = 0; i < 100; ++i) {
+            obj.invoke_async([&n, &ok, &obj, i]() {
+                ok = ok && obj.isCurrentThread() && n == i;
+                ++n;
+            });
+        }
+        flush();
+        CHECK(n == 100);
+        CHECK(ok);
+        const auto s = stats();
+        // The tasks that were posted while all slots were in use were allocated on the heap
+        CHECK((s.inline_tasks - before.inline_tasks) + (s.heap_tasks - before.heap_tasks) == 101);
+        CHECK(s.inline_tasks - before.inline_tasks >= ActiveObjectBase::TASK_SLOT_COUNT);
+        CHECK(s.queued == 0);
+        CHECK(s.max_queued >= 1);
+    }
+
+    SECTION("synchronous calls return the result of the callable") {
+        const int a = 2, b = 3;
+        CHECK(obj.invoke_sync([=]() { return a * b; }) == 6);
+        CHECK(obj.invoke_sync([&obj]() { return obj.isCurrentThread(); }));
+        const char* s = "abc";
+        CHECK(obj.invoke_sync([=]() { return s + 1; }) == s + 1);
+        CHECK(stats().heap_tasks == before.heap_tasks);
+    }
+
+    SECTION("callables that don't fit in a task slot are allocated on the heap") {
+        std::array<char, InlineTask::STORAGE_SIZE + 1> data = {};
+        data[0] = 1;
+        std::atomic<int> n(0);
+        obj.invoke_async([data, &n]() { n += data[0]; });
+        CHECK(obj.invoke_sync([data]() { return (int)data[0]; }) == 1);
+        flush();
+        CHECK(n == 1);
+        CHECK(stats().heap_tasks - before.heap_tasks == 2);
+    }
+
+    SECTION("tasks are allocated on the heap when all task slots are in use") {
+        std::atomic<bool> blocked(true);
+        obj.invoke_async([&blocked]() {
+            while (blocked) {
+                std::this_thread::yield();
+            }
+        });
+        std::atomic<int> n(0);
+        for (unsigned i = 0; i < ActiveObjectBase::TASK_SLOT_COUNT + 4; ++i) {
+            obj.invoke_async([&n]() { ++n; });
+        }
+        CHECK(stats().queued >= ActiveObjectBase::TASK_SLOT_COUNT + 4);
+        blocked = false;
+        flush();
+        CHECK(n == (int)ActiveObjectBase::TASK_SLOT_COUNT + 4);
+        const auto s = stats();
+        // Including the call made by flush()
+        CHECK(s.heap_tasks - before.heap_tasks == 6);
+        CHECK(s.max_queued >= ActiveObjectBase::TASK_SLOT_COUNT + 4);
+        CHECK(s.max_latency > 0);
+    }
+
+    SECTION("several threads can make synchronous calls concurrently") {
+        std::atomic<bool> ok(true);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&obj, &ok, t]() {
+                for (int i = 0; i < 1000; ++i) {
+                    ok = ok && obj.invoke_sync([=]() { return t * 10000 + i; }) == t * 10000 + i;
+                }
+            });
+        }
+        for (auto& t: threads) {
+            t.join();
+        }
+        CHECK(ok);
+    }
+}
+
+TEST_CASE("ActiveObjectBase cross-thread call throughput", "[.][benchmark]") {
+    auto& obj = activeObject();
+    const int count = 20000;
+    const int a = 1, b = 2, c = 3;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i) {
+        // What SYSTEM_THREAD_CONTEXT_SYNC() used to do
+        auto future = obj.invoke_future(std::function<int()>([=]() { return a + b + c + i; }));
+        future->get();
+        delete future;
+    }
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    WARN("Synchronous, heap allocated promise: " << count / s << " calls/s");
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i) {
+        obj.invoke_sync([=]() { return a + b + c + i; });
+    }
+    s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    WARN("Synchronous, task slot: " << count / s << " calls/s");
+
+    std::atomic<int> n(0);
+    std::array<char, InlineTask::STORAGE_SIZE + 1> data = {};
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i) {
+        // Too large for a task slot
+        obj.invoke_async([data, &n]() { n += data[0] + 1; });
+    }
+    flush();
+    s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    WARN("Asynchronous, heap allocated task: " << count / s << " calls/s");
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i) {
+        obj.invoke_async([&n]() { ++n; });
+    }
+    flush();
+    s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    WARN("Asynchronous, task slot: " << count / s << " calls/s");
+    CHECK(n == count * 2);
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Implementation of the concurrency HAL on top of the standard library, sufficient to run active
+// objects on the host
+
+#include "concurrent_hal.h"
+#include "interrupts_hal.h"
+#include "timer_hal.h"
+#include "rng_hal.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Thread {
+    std::thread thread;
+};
+
+struct Queue {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<std::vector<char>> items;
+    size_t itemSize;
+    size_t capacity;
+};
+
+struct Semaphore {
+    std::mutex mutex;
+    std::condition_variable cond;
+    unsigned count;
+    unsigned maxCount;
+};
+
+// Thrown by os_thread_exit() to unwind the thread function
+struct ThreadExit {
+};
+
+thread_local Thread* g_currentThread = nullptr;
+
+std::unique_lock<std::mutex> waitFor(std::mutex& mutex, std::condition_variable& cond, system_tick_t timeout,
+        const std::function<bool()>& pred, bool* ok) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (timeout == CONCURRENT_WAIT_FOREVER) {
+        cond.wait(lock, pred);
+        *ok = true;
+    } else {
+        *ok = cond.wait_for(lock, std::chrono::milliseconds(timeout), pred);
+    }
+    return lock;
+}
+
+} // namespace
+
+os_result_t os_thread_create(os_thread_t* result, const char* name, os_thread_prio_t priority, os_thread_fn_t fun,
+        void* thread_param, size_t stack_size) {
+    const auto t = new Thread();
+    *result = t;
+    t->thread = std::thread([t, fun, thread_param]() {
+        g_currentThread = t;
+        try {
+            fun(thread_param);
+        } catch (const ThreadExit&) {
+        }
+    });
+    t->thread.detach();
+    return 0;
+}
+
+os_result_t os_thread_exit(os_thread_t thread) {
+    throw ThreadExit();
+}
+
+os_thread_t os_thread_current(void* reserved) {
+    return g_currentThread;
+}
+
+bool os_thread_is_current(os_thread_t thread) {
+    return thread && thread == g_currentThread;
+}
+
+os_result_t os_thread_yield(void) {
+    std::this_thread::yield();
+    return 0;
+}
+
+int os_queue_create(os_queue_t* queue, size_t item_size, size_t item_count, void* reserved) {
+    const auto q = new Queue();
+    q->itemSize = item_size;
+    q->capacity = item_count;
+    *queue = q;
+    return 0;
+}
+
+int os_queue_destroy(os_queue_t queue, void* reserved) {
+    delete static_cast<Queue*>(queue);
+    return 0;
+}
+
+int os_queue_put(os_queue_t queue, const void* item, system_tick_t delay, void* reserved) {
+    const auto q = static_cast<Queue*>(queue);
+    bool ok = false;
+    auto lock = waitFor(q->mutex, q->cond, delay, [q]() { return q->items.size() < q->capacity; }, &ok);
+    if (!ok) {
+        return 1;
+    }
+    q->items.emplace_back((const char*)item, (const char*)item + q->itemSize);
+    q->cond.notify_all();
+    return 0;
+}
+
+int os_queue_take(os_queue_t queue, void* item, system_tick_t delay, void* reserved) {
+    const auto q = static_cast<Queue*>(queue);
+    bool ok = false;
+    auto lock = waitFor(q->mutex, q->cond, delay, [q]() { return !q->items.empty(); }, &ok);
+    if (!ok) {
+        return 1;
+    }
+    memcpy(item, q->items.front().data(), q->itemSize);
+    q->items.pop_front();
+    q->cond.notify_all();
+    return 0;
+}
+
+int os_semaphore_create(os_semaphore_t* semaphore, unsigned max_count, unsigned initial_count) {
+    const auto s = new Semaphore();
+    s->count = initial_count;
+    s->maxCount = max_count;
+    *semaphore = s;
+    return 0;
+}
+
+int os_semaphore_destroy(os_semaphore_t semaphore) {
+    delete static_cast<Semaphore*>(semaphore);
+    return 0;
+}
+
+int os_semaphore_take(os_semaphore_t semaphore, system_tick_t timeout, bool reserved) {
+    const auto s = static_cast<Semaphore*>(semaphore);
+    bool ok = false;
+    auto lock = waitFor(s->mutex, s->cond, timeout, [s]() { return s->count > 0; }, &ok);
+    if (!ok) {
+        return 1;
+    }
+    --s->count;
+    return 0;
+}
+
+int os_semaphore_give(os_semaphore_t semaphore, bool reserved) {
+    const auto s = static_cast<Semaphore*>(semaphore);
+    std::lock_guard<std::mutex> lock(s->mutex);
+    if (s->count < s->maxCount) {
+        ++s->count;
+    }
+    s->cond.notify_all();
+    return 0;
+}
+
+system_tick_t HAL_Timer_Get_Milli_Seconds(void) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+system_tick_t HAL_Timer_Get_Micro_Seconds(void) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint32_t HAL_RNG_GetRandomNumber(void) {
+    return 0;
+}
+
+int HAL_disable_irq() {
+    return 0;
+}
+
+void HAL_enable_irq(int mask) {
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "system_ota_writer.h"
+
+#include <catch2/catch.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace particle::system;
+
+namespace {
+
+// Flash in RAM, written slowly
+struct Flash {
+    std::vector<uint8_t> data = std::vector<uint8_t>(4096);
+    std::atomic<int> writes{0};
+    std::atomic<bool> block{false};
+    uint32_t failAddress = 0xffffffff;
+};
+
+Flash* g_flash = nullptr;
+
+int writeFlash(const uint8_t* data, uint32_t address, uint32_t size, void* reserved) {
+    while (g_flash->block) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (address == g_flash->failAddress) {
+        return -1;
+    }
+    memcpy(g_flash->data.data() + address, data, size);
+    ++g_flash->writes;
+    return 0;
+}
+
+std::vector<uint8_t> chunk(unsigned i, size_t size) {
+    return std::vector<uint8_t>(size, uint8_t(i + 1));
+}
+
+} // namespace
+
+TEST_CASE("OtaChunkWriter") {
+    Flash flash;
+    g_flash = &flash;
+    OtaChunkWriter writer(writeFlash);
+    REQUIRE(writer.begin(64) == 0);
+    REQUIRE(writer.isPipelined());
+
+    SECTION("chunks are written in the background and flushed") {
+        flash.block = true;
+        for (unsigned i = 0; i < OtaChunkWriter::BUFFER_COUNT; ++i) {
+            REQUIRE(writer.write(chunk(i, 64).data(), i * 64, 64) == 0);
+        }
+        CHECK(flash.writes == 0);
+        flash.block = false;
+        CHECK(writer.flush() == 0);
+        CHECK(flash.writes == (int)OtaChunkWriter::BUFFER_COUNT);
+        for (unsigned i = 0; i < OtaChunkWriter::BUFFER_COUNT; ++i) {
+            CHECK(flash.data[i * 64] == i + 1);
+            CHECK(flash.data[i * 64 + 63] == i + 1);
+        }
+        CHECK(writer.end() == 0);
+        CHECK_FALSE(writer.isPipelined());
+    }
+
+    SECTION("a write waits for a free buffer") {
+        for (unsigned i = 0; i < 32; ++i) {
+            REQUIRE(writer.write(chunk(i, 64).data(), i * 64, 64) == 0);
+        }
+        CHECK(writer.end() == 0);
+        CHECK(flash.writes == 32);
+        for (unsigned i = 0; i < 32; ++i) {
+            CHECK(flash.data[i * 64 + 10] == i + 1);
+        }
+    }
+
+    SECTION("a chunk larger than the buffers is written synchronously") {
+        REQUIRE(writer.write(chunk(1, 64).data(), 0, 64) == 0);
+        REQUIRE(writer.write(chunk(2, 100).data(), 64, 100) == 0);
+        CHECK(flash.writes == 2);
+        CHECK(flash.data[0] == 2);
+        CHECK(flash.data[163] == 3);
+        CHECK(writer.end() == 0);
+    }
+
+    SECTION("a failed write is reported until the next transfer") {
+        flash.failAddress = 128;
+        for (unsigned i = 0; i < 4; ++i) {
+            REQUIRE(writer.write(chunk(i, 64).data(), i * 64, 64) == 0);
+        }
+        CHECK(writer.flush() == -1);
+        CHECK(writer.write(chunk(5, 64).data(), 5 * 64, 64) == -1);
+        CHECK(writer.end() == -1);
+        CHECK(flash.data[3 * 64] == 0);
+        flash.failAddress = 0xffffffff;
+        REQUIRE(writer.begin(64) == 0);
+        REQUIRE(writer.write(chunk(5, 64).data(), 5 * 64, 64) == 0);
+        CHECK(writer.end() == 0);
+        CHECK(flash.data[5 * 64] == 6);
+    }
+
+    SECTION("a transfer can be restarted before it has ended") {
+        REQUIRE(writer.write(chunk(1, 64).data(), 0, 64) == 0);
+        REQUIRE(writer.begin(32) == 0);
+        CHECK(flash.writes == 1);
+        REQUIRE(writer.write(chunk(2, 32).data(), 64, 32) == 0);
+        CHECK(writer.end() == 0);
+        CHECK(flash.writes == 2);
+    }
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "loopback_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace test {
+
+namespace {
+
+const size_t PATTERN_CHUNK_SIZE = 16384;
+
+// The pattern starting at any offset within a period is a contiguous part of this buffer
+const std::vector<uint8_t>& patternBuffer() {
+    static const std::vector<uint8_t> buf = []() {
+        std::vector<uint8_t> b(PATTERN_CHUNK_SIZE + LoopbackServer::PATTERN_PERIOD);
+        for (size_t i = 0; i < b.size(); ++i) {
+            b[i] = LoopbackServer::pattern(i);
+        }
+        return b;
+    }();
+    return buf;
+}
+
+} // namespace
+
+const size_t LoopbackServer::PATTERN_PERIOD;
+
+LoopbackServer::LoopbackServer(std::function<void(int)> fn) {
+    listener_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listener_, (sockaddr*)&addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(listener_, (sockaddr*)&addr, &len);
+    port_ = ntohs(addr.sin_port);
+    listen(listener_, 1);
+    thread_ = std::thread([this, fn]() {
+        const int s = accept(listener_, nullptr, nullptr);
+        fn(s);
+        close(s);
+    });
+}
+
+LoopbackServer::~LoopbackServer() {
+    thread_.join();
+    close(listener_);
+}
+
+void LoopbackServer::sendPattern(int sock, size_t count) {
+    const auto& buf = patternBuffer();
+    size_t sent = 0;
+    while (sent < count) {
+        const size_t n = std::min(PATTERN_CHUNK_SIZE, count - sent);
+        const ssize_t r = send(sock, buf.data() + sent % PATTERN_PERIOD, n, MSG_NOSIGNAL);
+        if (r <= 0) {
+            break;
+        }
+        sent += r;
+    }
+}
+
+bool LoopbackServer::checkPattern(const uint8_t* data, size_t size, size_t offset) {
+    const auto& buf = patternBuffer();
+    while (size > 0) {
+        const size_t n = std::min(PATTERN_CHUNK_SIZE, size);
+        if (memcmp(data, buf.data() + offset % PATTERN_PERIOD, n) != 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+std::vector<uint8_t> LoopbackServer::receiveAll(int sock) {
+    std::vector<uint8_t> data;
+    uint8_t buf[1024];
+    ssize_t r = 0;
+    while ((r = recv(sock, buf, sizeof(buf), 0)) > 0) {
+        data.insert(data.end(), buf, buf + r);
+    }
+    return data;
+}
+
+} // namespace test
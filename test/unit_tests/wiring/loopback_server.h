@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace test {
+
+// Accepts a single TCP connection on the loopback interface and runs a function with the accepted
+// socket in a separate thread. The host socket API is kept out of this header, since its
+// definitions conflict with the compat socket HAL
+class LoopbackServer {
+public:
+    explicit LoopbackServer(std::function<void(int)> fn);
+    ~LoopbackServer();
+
+    uint16_t port() const {
+        return port_;
+    }
+
+    // Sends `count` bytes generated by `pattern()`
+    static void sendPattern(int sock, size_t count);
+    // Receives data until the peer closes the connection
+    static std::vector<uint8_t> receiveAll(int sock);
+
+    // The pattern repeats with a prime period, so that misplaced chunks of data are detected
+    static const size_t PATTERN_PERIOD = 251;
+
+    static uint8_t pattern(size_t offset) {
+        return (uint8_t)(offset % PATTERN_PERIOD);
+    }
+
+    // Checks that `data` matches the pattern at the given offset
+    static bool checkPattern(const uint8_t* data, size_t size, size_t offset);
+
+private:
+    std::thread thread_;
+    int listener_;
+    uint16_t port_;
+};
+
+} // namespace test
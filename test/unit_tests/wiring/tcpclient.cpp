@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Catch must be included first, since spark_macros.h defines `stringify`
+#include "catch2/catch.hpp"
+
+#include "spark_wiring_tcpclient.h"
+#include "system_error.h"
+#include "loopback_server.h"
+
+#include <chrono>
+#include <cstring>
+#include <string>
+
+// service_debug.h replaces Catch's WARN() with a logging macro
+#undef WARN
+#define WARN(msg) INTERNAL_CATCH_MSG("WARN", Catch::ResultWas::Warning, Catch::ResultDisposition::ContinueOnFailure, msg)
+
+#include "spark_wiring_network.h"
+
+// The client is tested against the gcc socket HAL, which only needs the network to be ready
+namespace spark {
+
+NetworkClass Network(NETWORK_INTERFACE_ALL);
+
+NetworkClass& NetworkClass::from(network_interface_t nif) {
+    return Network;
+}
+
+bool NetworkClass::ready() {
+    return true;
+}
+
+void NetworkClass::connect(unsigned flags) {
+}
+
+void NetworkClass::disconnect() {
+}
+
+bool NetworkClass::connecting() {
+    return false;
+}
+
+void NetworkClass::on() {
+}
+
+void NetworkClass::off() {
+}
+
+void NetworkClass::listen(bool begin) {
+}
+
+void NetworkClass::setListenTimeout(uint16_t timeout) {
+}
+
+uint16_t NetworkClass::getListenTimeout() {
+    return 0;
+}
+
+bool NetworkClass::listening() {
+    return false;
+}
+
+IPAddress NetworkClass::resolve(const char* name) {
+    return IPAddress();
+}
+
+} // namespace spark
+
+extern "C" {
+
+void core_log(const char* msg, ...) {
+}
+
+uint32_t HAL_NET_SetNetWatchDog(uint32_t timeOutInMS) {
+    return 0;
+}
+
+int inet_gethostbyname(const char* hostname, uint16_t hostnameLen, HAL_IPAddress* out_ip_addr,
+        network_interface_t nif, void* reserved) {
+    return -1;
+}
+
+} // extern "C"
+
+namespace {
+
+using test::LoopbackServer;
+
+uint8_t pattern(size_t offset) {
+    return LoopbackServer::pattern(offset);
+}
+
+void sendPattern(int s, size_t count) {
+    LoopbackServer::sendPattern(s, count);
+}
+
+bool connect(TCPClient& client, const LoopbackServer& server) {
+    return client.connect(IPAddress(127, 0, 0, 1), server.port());
+}
+
+// Reads `count` bytes in chunks of up to `chunk` bytes using the given read function. Returns
+// false if the data doesn't match the pattern
+bool readPattern(size_t count, size_t chunk, const std::function<int(uint8_t*, size_t)>& read) {
+    std::vector<uint8_t> buf(chunk);
+    size_t received = 0;
+    bool ok = true;
+    while (received < count) {
+        const int n = read(buf.data(), std::min(chunk, count - received));
+        if (n < 0) {
+            std::this_thread::yield();
+            continue;
+        }
+        ok = ok && LoopbackServer::checkPattern(buf.data(), n, received);
+        received += n;
+    }
+    return ok;
+}
+
+} // namespace
+
+TEST_CASE("TCPClient") {
+    SECTION("the receive buffer can be resized") {
+        TCPClient client;
+        CHECK(client.bufferSize() == TCPCLIENT_BUF_MAX_SIZE);
+        CHECK(client.setBufferSize(4096) == 0);
+        CHECK(client.bufferSize() == 4096);
+        uint8_t buf[1000];
+        CHECK(client.setBufferSize(sizeof(buf), buf) == 0);
+        CHECK(client.bufferSize() == sizeof(buf));
+        CHECK(client.setBufferSize(0) == 0);
+        CHECK(client.bufferSize() == TCPCLIENT_BUF_MAX_SIZE);
+    }
+
+    SECTION("data in the receive buffer is kept when it is resized") {
+        LoopbackServer server([](int s) {
+            sendPattern(s, 100);
+        });
+        TCPClient client;
+        REQUIRE(connect(client, server));
+        uint8_t buf[100] = {};
+        REQUIRE(client.read(buf, 10, 1000) == 10);
+        while (client.available() < 90) {
+            std::this_thread::yield();
+        }
+        CHECK(client.setBufferSize(50) == SYSTEM_ERROR_INVALID_STATE);
+        CHECK(client.setBufferSize(2048) == 0);
+        CHECK(client.available() == 90);
+        CHECK(client.read(buf + 10, 90) == 90);
+        for (size_t i = 0; i < sizeof(buf); ++i) {
+            REQUIRE(buf[i] == pattern(i));
+        }
+        client.stop();
+    }
+
+    SECTION("a timed read waits for all of the requested data") {
+        LoopbackServer server([](int s) {
+            sendPattern(s, 10000);
+        });
+        TCPClient client;
+        REQUIRE(connect(client, server));
+        std::vector<uint8_t> buf(10000);
+        size_t n = 0;
+        while (n < buf.size()) {
+            const int r = client.read(buf.data() + n, buf.size() - n, 1000);
+            REQUIRE(r > 0);
+            n += r;
+        }
+        for (size_t i = 0; i < buf.size(); ++i) {
+            REQUIRE(buf[i] == pattern(i));
+        }
+        client.stop();
+    }
+
+    SECTION("large reads bypass the receive buffer") {
+        LoopbackServer server([](int s) {
+            sendPattern(s, 100000);
+        });
+        TCPClient client;
+        REQUIRE(connect(client, server));
+        CHECK(readPattern(100000, 1000, [&](uint8_t* buf, size_t size) {
+            return client.read(buf, size);
+        }));
+        client.stop();
+    }
+
+    SECTION("readv scatters buffered and received data in order") {
+        LoopbackServer server([](int s) {
+            sendPattern(s, 3000);
+        });
+        TCPClient client;
+        REQUIRE(connect(client, server));
+        std::vector<uint8_t> data;
+        while (client.available() == 0) {
+            std::this_thread::yield();
+        }
+        // Leave a part of the buffered data unread so that readv starts with it
+        uint8_t b;
+        REQUIRE(client.read(&b, 1) == 1);
+        data.push_back(b);
+        while (data.size() < 3000) {
+            uint8_t b1[10], b2[300], b3[1000];
+            const TCPClient::IoVec iov[] = { { b1, sizeof(b1) }, { b2, sizeof(b2) }, { b3, sizeof(b3) } };
+            const int n = client.readv(iov, 3);
+            if (n < 0) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::vector<uint8_t> all(b1, b1 + sizeof(b1));
+            all.insert(all.end(), b2, b2 + sizeof(b2));
+            all.insert(all.end(), b3, b3 + sizeof(b3));
+            data.insert(data.end(), all.begin(), all.begin() + n);
+        }
+        REQUIRE(data.size() == 3000);
+        for (size_t i = 0; i < data.size(); ++i) {
+            REQUIRE(data[i] == pattern(i));
+        }
+        client.stop();
+    }
+
+    SECTION("writev gathers the buffers in order") {
+        std::vector<uint8_t> received;
+        {
+            LoopbackServer server([&](int s) {
+                received = LoopbackServer::receiveAll(s);
+            });
+            TCPClient client;
+            REQUIRE(connect(client, server));
+            const char h[] = "header:";
+            const char b[] = "body";
+            const char e[] = "";
+            const TCPClient::IoVec iov[] = { { (void*)h, strlen(h) }, { (void*)e, 0 }, { (void*)b, strlen(b) } };
+            CHECK(client.writev(iov, 3) == 11);
+            CHECK(client.getWriteError() == 0);
+            client.stop();
+        }
+        CHECK(std::string(received.begin(), received.end()) == "header:body");
+    }
+}
+
+TEST_CASE("TCPClient throughput", "[.][benchmark]") {
+    const size_t count = 64 * 1024 * 1024;
+    struct Mode {
+        const char* name;
+        size_t bufferSize;
+        size_t chunk;
+        bool timed;
+    };
+    const Mode modes[] = {
+        { "128 byte buffer, 128 byte reads", 0, 128, false },
+        { "4 KB buffer, 512 byte reads", 4096, 512, false },
+        { "zero-copy 16 KB reads", 0, 16384, false },
+        { "timed 64 KB reads", 0, 65536, true }
+    };
+    for (const auto& mode: modes) {
+        LoopbackServer server([&](int s) {
+            sendPattern(s, count);
+        });
+        TCPClient client;
+        REQUIRE(connect(client, server));
+        REQUIRE(client.setBufferSize(mode.bufferSize) == 0);
+        const auto start = std::chrono::steady_clock::now();
+        REQUIRE(readPattern(count, mode.chunk, [&](uint8_t* buf, size_t size) {
+            return mode.timed ? client.read(buf, size, 1000) : client.read(buf, size);
+        }));
+        const double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        WARN(mode.name << ": " << count / s / (1024 * 1024) << " MB/s");
+        client.stop();
+    }
+}
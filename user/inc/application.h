@@ -61,6 +61,7 @@
 #include "spark_wiring_client.h"
 #include "spark_wiring_startup.h"
 #include "spark_wiring_timer.h"
+#include "spark_wiring_wheel_timer.h"
 #include "spark_wiring_tcpclient.h"
 #include "spark_wiring_tcpserver.h"
 #include "spark_wiring_udp.h"
@@ -0,0 +1,118 @@
+/**
+ ******************************************************************************
+  Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#include "append_list.h"
+#undef WARN
+#undef INFO
+
+#include "catch.hpp"
+
+#include <string>
+
+namespace {
+
+struct Entry {
+    int value;
+    char key[9];
+};
+
+typedef indexed_append_list<Entry, sizeof(Entry::key), &Entry::key> EntryList;
+
+Entry make_entry(const std::string& key, int value) {
+    Entry e = {};
+    e.value = value;
+    strncpy(e.key, key.c_str(), sizeof(e.key) - 1);
+    return e;
+}
+
+} // namespace
+
+SCENARIO("append_list removes an element and preserves the order of the rest", "[append_list]") {
+    append_list<Entry> list;
+    for (int i = 0; i < 4; i++) {
+        REQUIRE(list.add(make_entry(std::to_string(i), i)) != nullptr);
+    }
+    list.removeAt(1);
+    REQUIRE(list.size() == 3);
+    CHECK(list[0].value == 0);
+    CHECK(list[1].value == 2);
+    CHECK(list[2].value == 3);
+}
+
+SCENARIO("indexed_append_list finds nothing when empty", "[append_list]") {
+    EntryList list;
+    REQUIRE(list.find("a") == nullptr);
+}
+
+SCENARIO("indexed_append_list finds each added element by key", "[append_list]") {
+    EntryList list;
+    for (int i = 0; i < 200; i++) {
+        REQUIRE(list.add(make_entry("key" + std::to_string(i), i)) != nullptr);
+        // elements added earlier remain reachable as the index grows
+        for (int j = 0; j <= i; j += 17) {
+            Entry* e = list.find(("key" + std::to_string(j)).c_str());
+            REQUIRE(e != nullptr);
+            REQUIRE(e->value == j);
+        }
+    }
+    for (int i = 0; i < 200; i++) {
+        Entry* e = list.find(("key" + std::to_string(i)).c_str());
+        REQUIRE(e == &list[i]);
+    }
+    REQUIRE(list.find("key200") == nullptr);
+    REQUIRE(list.find("") == nullptr);
+}
+
+SCENARIO("indexed_append_list finds every element of a full list", "[append_list]") {
+    const unsigned max_size = EntryList::max_size; // Avoid binding a reference to the static member
+    EntryList list;
+    for (unsigned i = 0; i < max_size; i++) {
+        REQUIRE(list.add(make_entry("key" + std::to_string(i), i)) != nullptr);
+    }
+    REQUIRE(list.add(make_entry("key" + std::to_string(max_size), 0)) == nullptr);
+    REQUIRE(list.size() == max_size);
+    for (unsigned i = 0; i < max_size; i++) {
+        Entry* e = list.find(("key" + std::to_string(i)).c_str());
+        REQUIRE(e == &list[i]);
+    }
+}
+
+SCENARIO("indexed_append_list compares keys up to the key length", "[append_list]") {
+    EntryList list;
+    list.add(make_entry("abcdefgh", 1));
+    // only the first 8 characters are significant, as with strncmp
+    REQUIRE(list.find("abcdefgh") == &list[0]);
+    REQUIRE(list.find("abcdefghij") == &list[0]);
+    REQUIRE(list.find("abcdefg") == nullptr);
+}
+
+SCENARIO("indexed_append_list updates the index when an element is removed", "[append_list]") {
+    EntryList list;
+    for (int i = 0; i < 10; i++) {
+        list.add(make_entry("k" + std::to_string(i), i));
+    }
+    list.removeAt(9);
+    REQUIRE(list.size() == 9);
+    REQUIRE(list.find("k9") == nullptr);
+    for (int i = 0; i < 9; i++) {
+        Entry* e = list.find(("k" + std::to_string(i)).c_str());
+        REQUIRE(e != nullptr);
+        REQUIRE(e->value == i);
+    }
+}
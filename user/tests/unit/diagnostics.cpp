@@ -624,4 +624,85 @@ TEST_CASE("Wiring API") {
         testPersistentEnumDiagnosticData<PersistentEnumDiagnosticData, NoConcurrency>(diag);
         // testPersistentEnumDiagnosticData<PersistentEnumDiagnosticData, AtomicConcurrency>(diag);
     }
+
+    SECTION("HistogramDiagnosticData") {
+        typedef HistogramDiagnosticData<> Histogram;
+        Histogram d(1);
+        diag.start();
+
+        SECTION("an empty histogram has a zero summary") {
+            AbstractHistogramDiagnosticData::Summary s = {};
+            CHECK(AbstractHistogramDiagnosticData::get(1, s) == 0);
+            CHECK(s.count == 0);
+            CHECK(s.min == 0);
+            CHECK(s.max == 0);
+            CHECK(s.p50 == 0);
+            CHECK(s.p99 == 0);
+        }
+
+        SECTION("can be accessed as a data source") {
+            size_t size = 0;
+            CHECK(AbstractDiagnosticData::get(1, nullptr /* data */, size) == 0);
+            CHECK(size == sizeof(AbstractHistogramDiagnosticData::Summary));
+            int32_t val = 0;
+            size = sizeof(val);
+            CHECK(AbstractDiagnosticData::get(1, &val, size) == SYSTEM_ERROR_TOO_LARGE);
+        }
+
+        SECTION("buckets cover all values without gaps") {
+            for (size_t i = 1; i < Histogram::BUCKET_COUNT; ++i) {
+                const uint32_t first = Histogram::bucketUpperBound(i - 1) + 1;
+                CHECK(Histogram::bucketIndex(first) == i);
+                CHECK(Histogram::bucketIndex(Histogram::bucketUpperBound(i)) == i);
+                // Buckets above the linear range are at most 25% wide
+                const uint32_t width = Histogram::bucketUpperBound(i) - first + 1;
+                if (i >= 8) {
+                    CHECK(width <= first / 4);
+                }
+            }
+            CHECK(Histogram::bucketIndex(0xffffffff) == Histogram::BUCKET_COUNT - 1);
+        }
+
+        SECTION("record()") {
+            for (uint32_t i = 1; i <= 1000; ++i) {
+                d.record(i);
+            }
+            AbstractHistogramDiagnosticData::Summary s = {};
+            CHECK(AbstractHistogramDiagnosticData::get(1, s) == 0);
+            CHECK(s.count == 1000);
+            CHECK(s.min == 1);
+            CHECK(s.max == 1000);
+            CHECK(s.p50 >= 500);
+            CHECK(s.p50 <= 625);
+            CHECK(s.p90 >= 900);
+            CHECK(s.p90 <= 1000);
+            CHECK(s.p99 >= 990);
+            CHECK(s.p99 <= 1000);
+        }
+
+        SECTION("percentiles are clamped to the largest recorded value") {
+            d.record(1000);
+            CHECK(d.percentile(0) == 1000);
+            CHECK(d.percentile(100) == 1000);
+            d.record(5000);
+            CHECK(d.percentile(50) == 1023);
+            CHECK(d.percentile(100) == 5000);
+        }
+
+        SECTION("values beyond the last bucket are counted") {
+            d.record(5);
+            d.record(100000000);
+            CHECK(d.count() == 2);
+            CHECK(d.percentile(99) == 100000000);
+        }
+
+        SECTION("reset()") {
+            d.record(10);
+            d.reset();
+            CHECK(d.count() == 0);
+            CHECK(d.summary().max == 0);
+            d.record(20);
+            CHECK(d.summary().min == 20);
+        }
+    }
 }
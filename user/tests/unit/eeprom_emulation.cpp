@@ -4,6 +4,8 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <chrono>
+#include <cstdlib>
 #include "eeprom_emulation.h"
 #include "flash_storage.h"
 
@@ -34,10 +36,11 @@ auto PAGE_INACTIVE = TestEEPROM::PageHeader::INACTIVE;
 
 // Test helper class to pre-write EEPROM records and validate written
 // records
-class EEPROMTester
+template <typename EEPROM>
+class BasicEEPROMTester
 {
 public:
-    EEPROMTester(TestEEPROM &eeprom)
+    BasicEEPROMTester(EEPROM &eeprom)
         : eeprom(eeprom)
     {
     }
@@ -105,9 +108,11 @@ public:
     }
 private:
 
-    TestEEPROM &eeprom;
+    EEPROM &eeprom;
 };
 
+using EEPROMTester = BasicEEPROMTester<TestEEPROM>;
+
 TEST_CASE("Get byte", "[eeprom]")
 {
     TestEEPROM eeprom;
@@ -1338,3 +1343,382 @@ TEST_CASE("Page swap with data in multiple batches", "[eeprom]")
         REQUIRE(dataRead == data);
     }
 }
+
+using ShadowEEPROM = EEPROMEmulation<TestStore, PageBase1, PageSize1, PageBase2, PageSize2, true>;
+
+TEST_CASE("RAM shadow", "[eeprom]")
+{
+    TestEEPROM eeprom;
+    ShadowEEPROM shadowed;
+    eeprom.init();
+    shadowed.init();
+
+    auto requireSameContents = [&]()
+    {
+        for(uint16_t index = 0; index < TestEEPROM::capacity(); index++)
+        {
+            uint8_t expected, actual;
+            eeprom.get(index, expected);
+            shadowed.get(index, actual);
+            CAPTURE(index);
+            REQUIRE(actual == expected);
+        }
+        REQUIRE(shadowed.getPageBegin(shadowed.getActivePage()) == eeprom.getPageBegin(eeprom.getActivePage()));
+        REQUIRE(std::memcmp(shadowed.store.dataAt(TestBase), eeprom.store.dataAt(TestBase), TestPageCount * TestPageSize) == 0);
+    };
+
+    SECTION("Writes and page swaps produce the same records")
+    {
+        std::srand(1);
+        for(int i = 0; i < 2000; i++)
+        {
+            uint8_t values[16];
+            const uint16_t length = std::rand() % sizeof(values) + 1;
+            const uint16_t index = std::rand() % (TestEEPROM::capacity() - length + 1);
+            for(auto &value: values)
+            {
+                value = std::rand() % 4 ? std::rand() : 0xFF;
+            }
+            eeprom.put(index, values, length);
+            shadowed.put(index, values, length);
+        }
+        requireSameContents();
+    }
+
+    SECTION("The shadow is loaded from the active page")
+    {
+        BasicEEPROMTester<ShadowEEPROM> tester(shadowed);
+        tester.populate(PageBase1, PAGE_ACTIVE, {
+            Record(1, 0x11),
+            Record(2, 0x22),
+            Record(1, 0x33)
+        });
+        shadowed.init();
+
+        uint8_t values[3];
+        shadowed.get(0, values, sizeof(values));
+        REQUIRE(values[0] == 0xFF);
+        REQUIRE(values[1] == 0x33);
+        REQUIRE(values[2] == 0x22);
+    }
+
+    SECTION("Records beyond the capacity are read from flash and copied during page swaps")
+    {
+        BasicEEPROMTester<ShadowEEPROM> tester(shadowed);
+        tester.populate(PageBase1, PAGE_ACTIVE, {
+            Record(1, 0x11),
+            Record(5000, 0x22)
+        });
+        shadowed.init();
+
+        uint8_t value;
+        shadowed.get(5000, value);
+        REQUIRE(value == 0x22);
+
+        shadowed.swapPagesAndWrite(1, nullptr, 0);
+
+        tester.requireContents(PageBase2, PAGE_ACTIVE, {
+            Record(1, 0x11),
+            Record(5000, 0x22)
+        });
+        shadowed.get(5000, value);
+        REQUIRE(value == 0x22);
+    }
+}
+
+TEST_CASE("RAM shadow performance", "[.][benchmark]")
+{
+    // A settings struct read in a loop while the page is half full of records
+    const uint16_t settingsIndex = 100;
+    uint8_t settings[200];
+    const int iterations = 2000;
+
+    auto run = [&](auto &eeprom, double &getUs, double &putUs)
+    {
+        eeprom.init();
+        for(uint16_t i = 0; i < TestEEPROM::capacity(); i++)
+        {
+            eeprom.put(i, (uint8_t)i);
+        }
+        auto start = std::chrono::steady_clock::now();
+        int sum = 0;
+        for(int i = 0; i < iterations; i++)
+        {
+            eeprom.get(settingsIndex, settings, sizeof(settings));
+            sum += settings[i % sizeof(settings)];
+        }
+        getUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+        REQUIRE(sum != 0);
+        start = std::chrono::steady_clock::now();
+        for(int i = 0; i < iterations; i++)
+        {
+            eeprom.put(settingsIndex + i % sizeof(settings), (uint8_t)(i * 7));
+        }
+        putUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+    };
+
+    TestEEPROM eeprom;
+    ShadowEEPROM shadowed;
+    double getUs, putUs, shadowGetUs, shadowPutUs;
+    run(eeprom, getUs, putUs);
+    run(shadowed, shadowGetUs, shadowPutUs);
+    REQUIRE(std::memcmp(shadowed.store.dataAt(TestBase), eeprom.store.dataAt(TestBase), TestPageCount * TestPageSize) == 0);
+    WARN("get " << sizeof(settings) << " bytes: " << getUs << " us, with RAM shadow " << shadowGetUs << " us; " <<
+            "put 1 byte: " << putUs << " us, with RAM shadow " << shadowPutUs << " us");
+}
+
+// A put, or a step of the background page swap when length is 0
+struct EEPROMOperation
+{
+    uint16_t index;
+    uint16_t length;
+    uint8_t data[4];
+};
+
+std::vector<EEPROMOperation> makeOperations(size_t count, uint16_t indexCount, bool compact)
+{
+    std::vector<EEPROMOperation> operations;
+    for(size_t i = 0; i < count; i++)
+    {
+        EEPROMOperation put = {};
+        put.length = std::rand() % sizeof(put.data) + 1;
+        put.index = std::rand() % (indexCount - put.length + 1);
+        for(auto &data: put.data)
+        {
+            data = std::rand();
+        }
+        operations.push_back(put);
+        if(compact)
+        {
+            operations.push_back(EEPROMOperation());
+        }
+    }
+    return operations;
+}
+
+template <typename EEPROM>
+void applyOperation(EEPROM &eeprom, const EEPROMOperation &operation, std::vector<uint8_t> &values)
+{
+    if(operation.length)
+    {
+        eeprom.put(operation.index, operation.data, operation.length);
+        std::memcpy(values.data() + operation.index, operation.data, operation.length);
+    }
+    else
+    {
+        eeprom.compactStep();
+    }
+}
+
+template <typename EEPROM>
+std::vector<uint8_t> readAll(EEPROM &eeprom)
+{
+    std::vector<uint8_t> values(EEPROM::capacity());
+    eeprom.get(0, values.data(), values.size());
+    return values;
+}
+
+// Fill the active page with puts until there's room for no more than
+// `records` records
+template <typename EEPROM>
+void fillActivePage(EEPROM &eeprom, uint16_t indexCount, size_t records)
+{
+    for(unsigned i = 0; ; i++)
+    {
+        uintptr_t emptyAddress;
+        eeprom.findEmpty(eeprom.getActivePage(), emptyAddress);
+        if(emptyAddress + records * sizeof(Record) >= eeprom.getPageEnd(eeprom.getActivePage()))
+        {
+            break;
+        }
+        eeprom.put(i % indexCount, (uint8_t)(i % 255));
+    }
+}
+
+// Discards whole writes instead of single bytes after a reset, like the word
+// programming of records done on the device, and verifies the written data
+// like the device implementations do. Partially written records are covered
+// by the tests above
+class WholeWriteStorage : public TestStore
+{
+public:
+    int write(unsigned offset, const void* data, unsigned size)
+    {
+        if(getWriteCount() < (int)size)
+        {
+            setWriteCount(0);
+            return -1;
+        }
+        int result = TestStore::write(offset, data, size);
+        if(result == 0 && std::memcmp(dataAt(offset), data, size) != 0)
+        {
+            result = -1;
+        }
+        return result;
+    }
+};
+
+using ResetEEPROM = EEPROMEmulation<WholeWriteStorage, PageBase1, PageSize1, PageBase2, PageSize2>;
+using ResetShadowEEPROM = EEPROMEmulation<WholeWriteStorage, PageBase1, PageSize1, PageBase2, PageSize2, true>;
+
+// Simulates a reset after each flash write or erase done by the operations and checks that
+// the values after a restart are the ones before or after the interrupted operation
+template <typename EEPROM>
+void requireRecoveryAfterEveryWrite(EEPROM &eeprom, const std::vector<EEPROMOperation> &operations)
+{
+    const auto snapshot = eeprom.store;
+    const auto initialValues = readAll(eeprom);
+
+    // Count the writes
+    std::vector<uint8_t> values = initialValues;
+    eeprom.store.setWriteCount(INT_MAX);
+    for(const auto &operation: operations)
+    {
+        applyOperation(eeprom, operation, values);
+    }
+    const int writeCount = INT_MAX - eeprom.store.getWriteCount();
+    REQUIRE(readAll(eeprom) == values);
+    REQUIRE(eeprom.getActivePage() == EEPROM::LogicalPage::Page2);
+
+    for(int count = 0; count < writeCount; count++)
+    {
+        eeprom.store = snapshot;
+        eeprom.init();
+        values = initialValues;
+
+        std::vector<uint8_t> previousValues;
+        eeprom.store.discardWritesAfter(count, [&] {
+            for(const auto &operation: operations)
+            {
+                previousValues = values;
+                applyOperation(eeprom, operation, values);
+                if(eeprom.store.getWriteCount() == 0)
+                {
+                    break;
+                }
+            }
+        });
+
+        // Restart
+        eeprom.init();
+        const auto valuesRead = readAll(eeprom);
+        CAPTURE(count);
+        REQUIRE((valuesRead == values || valuesRead == previousValues));
+
+        // Keep going after the restart
+        values = valuesRead;
+        for(const auto &operation: makeOperations(4, 64, true))
+        {
+            applyOperation(eeprom, operation, values);
+        }
+        eeprom.finishCompaction();
+        REQUIRE(readAll(eeprom) == values);
+    }
+}
+
+TEST_CASE("Background page swap", "[eeprom]")
+{
+    std::srand(2);
+    const uint16_t indexCount = 300;
+
+    SECTION("Puts never erase or swap pages synchronously")
+    {
+        TestEEPROM eeprom;
+        eeprom.init();
+        std::vector<uint8_t> values = readAll(eeprom);
+        int swaps = 0;
+        auto page = eeprom.getActivePage();
+
+        for(const auto &operation: makeOperations(5000, indexCount, true))
+        {
+            eeprom.store.resetEraseCount();
+            applyOperation(eeprom, operation, values);
+            if(operation.length)
+            {
+                REQUIRE(eeprom.store.getEraseCount() == 0);
+                REQUIRE(eeprom.getActivePage() == page);
+            }
+            else if(eeprom.getActivePage() != page)
+            {
+                page = eeprom.getActivePage();
+                swaps++;
+            }
+        }
+
+        REQUIRE(swaps > 2);
+        REQUIRE(readAll(eeprom) == values);
+    }
+
+    SECTION("Puts complete a background page swap in progress")
+    {
+        TestEEPROM eeprom;
+        eeprom.init();
+        fillActivePage(eeprom, indexCount, TestEEPROM::CompactionThreshold - 1);
+        std::vector<uint8_t> values = readAll(eeprom);
+
+        // Start the page swap and copy a few batches
+        eeprom.compactStep();
+        eeprom.compactStep();
+        eeprom.compactStep();
+        REQUIRE(eeprom.getActivePage() == Page1);
+
+        for(const auto &operation: makeOperations(TestEEPROM::CompactionThreshold, indexCount, false))
+        {
+            applyOperation(eeprom, operation, values);
+        }
+
+        REQUIRE(eeprom.getActivePage() == Page2);
+        REQUIRE(readAll(eeprom) == values);
+    }
+
+    SECTION("Compaction recovers from a reset at any point")
+    {
+        ResetEEPROM eeprom;
+        eeprom.init();
+        fillActivePage(eeprom, indexCount, TestEEPROM::CompactionThreshold + 40);
+
+        requireRecoveryAfterEveryWrite(eeprom, makeOperations(40, indexCount, true));
+    }
+
+    SECTION("Compaction with a RAM shadow recovers from a reset at any point")
+    {
+        ResetShadowEEPROM eeprom;
+        eeprom.init();
+        fillActivePage(eeprom, indexCount, TestEEPROM::CompactionThreshold + 40);
+
+        requireRecoveryAfterEveryWrite(eeprom, makeOperations(40, indexCount, true));
+    }
+}
+
+TEST_CASE("Background page swap latency", "[.][benchmark]")
+{
+    // Rough STM32F2 timings, see the comment in eeprom_emulation.h
+    const double EraseMs = 200;
+    const double RecordWriteMs = 0.01;
+
+    for(bool compact: { false, true })
+    {
+        std::srand(3);
+        TestEEPROM eeprom;
+        eeprom.init();
+        std::vector<uint8_t> values = readAll(eeprom);
+        double maxPutMs = 0;
+        double maxStepMs = 0;
+
+        for(const auto &operation: makeOperations(20000, 300, compact))
+        {
+            eeprom.store.setWriteCount(INT_MAX);
+            eeprom.store.resetEraseCount();
+            applyOperation(eeprom, operation, values);
+            const int erases = eeprom.store.getEraseCount();
+            const int bytes = INT_MAX - eeprom.store.getWriteCount() - erases;
+            const double ms = erases * EraseMs + bytes / sizeof(Record) * RecordWriteMs;
+            double &maxMs = operation.length ? maxPutMs : maxStepMs;
+            maxMs = std::max(maxMs, ms);
+        }
+
+        REQUIRE(readAll(eeprom) == values);
+        WARN((compact ? "Background page swap" : "Synchronous page swap") << ": worst put " << maxPutMs <<
+                " ms, worst step " << maxStepMs << " ms (simulated)");
+    }
+}
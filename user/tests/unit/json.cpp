@@ -6,6 +6,8 @@
 
 #include <boost/variant.hpp>
 
+#include <array>
+#include <chrono>
 #include <deque>
 #include <string>
 #include <cstdlib>
@@ -870,3 +872,439 @@ TEST_CASE("JSONBufferWriter") {
         CHECK(buf.isPaddingValid());
     }
 }
+
+TEST_CASE("JSONAppenderWriter") {
+    SECTION("exact buffer size") {
+        test::Buffer buf(25);
+        BufferAppender appender((uint8_t*)(char*)buf, buf.size());
+        JSONAppenderWriter w(appender);
+        CHECK(w.appender() == &appender);
+        w.beginArray().nullValue().value(true).value(2).value(3.14).value("abcd").endArray();
+        CHECK(appender.size() == 25);
+        CHECK(appender.overflowed() == 0);
+        check(buf).equals("[null,true,2,3.14,\"abcd\"]");
+        CHECK(buf.isPaddingValid());
+    }
+
+    SECTION("too small buffer") {
+        test::Buffer buf(10);
+        BufferAppender appender((uint8_t*)(char*)buf, buf.size());
+        JSONAppenderWriter w(appender);
+        w.beginArray().nullValue().value(true).value(2).value(3.14).value("abcd").endArray();
+        CHECK(appender.overflowed() > 0);
+        CHECK(buf.isPaddingValid());
+    }
+}
+
+namespace {
+
+// Records the parser events as a string, e.g. `{ a: [ 1 "x" ] }`
+class EventRecorder: public JSONStreamParser {
+public:
+    explicit EventRecorder(size_t bufSize = 64) :
+            JSONStreamParser((char*)buf_.data(), bufSize),
+            stopAt_(-1),
+            count_(0) {
+    }
+
+    EventRecorder& stopAt(int event) {
+        stopAt_ = event;
+        return *this;
+    }
+
+    const std::string& events() const {
+        return events_;
+    }
+
+    bool truncated() const {
+        return isTruncated();
+    }
+
+protected:
+    virtual bool beginObject() override {
+        return event("{");
+    }
+
+    virtual bool endObject() override {
+        return event("}");
+    }
+
+    virtual bool beginArray() override {
+        return event("[");
+    }
+
+    virtual bool endArray() override {
+        return event("]");
+    }
+
+    virtual bool name(const char *name, size_t size) override {
+        CHECK(strlen(name) == size);
+        return event(std::string(name, size) + ":");
+    }
+
+    virtual bool value(JSONType type, const char *data, size_t size) override {
+        CHECK(strlen(data) == size);
+        switch (type) {
+        case JSON_TYPE_STRING:
+            return event("\"" + std::string(data, size) + "\"");
+        case JSON_TYPE_NUMBER:
+        case JSON_TYPE_BOOL:
+        case JSON_TYPE_NULL:
+            return event(std::string(data, size));
+        default:
+            FAIL("Unexpected value type");
+            return false;
+        }
+    }
+
+private:
+    std::array<char, 256> buf_;
+    std::string events_;
+    int stopAt_, count_;
+
+    bool event(const std::string& e) {
+        if (!events_.empty()) {
+            events_ += ' ';
+        }
+        events_ += e;
+        return ++count_ != stopAt_;
+    }
+};
+
+// Records the depth and index of the parsed elements
+class PositionRecorder: public JSONStreamParser {
+public:
+    PositionRecorder() :
+            JSONStreamParser(buf_, sizeof(buf_)) {
+    }
+
+    std::string positions;
+
+protected:
+    virtual bool beginObject() override {
+        return record();
+    }
+
+    virtual bool beginArray() override {
+        return record();
+    }
+
+    virtual bool value(JSONType type, const char *data, size_t size) override {
+        return record();
+    }
+
+private:
+    char buf_[16];
+
+    bool record() {
+        positions += std::to_string(depth()) + (inArray() ? "[" : ".") + std::to_string(index()) + " ";
+        return true;
+    }
+};
+
+class InputStream: public Stream {
+public:
+    explicit InputStream(const std::string& data) :
+            data_(data),
+            pos_(0) {
+        setTimeout(0);
+    }
+
+    virtual int available() override {
+        return data_.size() - pos_;
+    }
+
+    virtual int read() override {
+        return (pos_ < data_.size()) ? (uint8_t)data_[pos_++] : -1;
+    }
+
+    virtual int peek() override {
+        return (pos_ < data_.size()) ? (uint8_t)data_[pos_] : -1;
+    }
+
+    virtual void flush() override {
+    }
+
+    virtual size_t write(uint8_t) override {
+        return 0;
+    }
+
+private:
+    std::string data_;
+    size_t pos_;
+};
+
+std::string streamEvents(const std::string& json, size_t chunkSize = 0) {
+    EventRecorder r;
+    if (!chunkSize) {
+        chunkSize = json.size();
+    }
+    for (size_t i = 0; i < json.size(); i += chunkSize) {
+        if (!r.parse(json.data() + i, std::min(chunkSize, json.size() - i))) {
+            return "error";
+        }
+    }
+    if (!r.finish()) {
+        return "incomplete";
+    }
+    return r.events();
+}
+
+bool streamValid(const std::string& json) {
+    const std::string e = streamEvents(json);
+    return e != "error" && e != "incomplete";
+}
+
+struct PathValue {
+    JSONType type;
+    std::string data;
+};
+
+PathValue findPath(const char* path, const std::string& json) {
+    char buf[32];
+    JSONPathReader r(path, buf, sizeof(buf));
+    r.parse(json.data(), json.size());
+    r.finish();
+    return PathValue{ r.type(), std::string(r.data(), r.size()) };
+}
+
+// Generates a document resembling a webhook response or a configuration file
+std::string makeDocument(size_t sensorCount) {
+    std::string s = "{\"device\":\"e00fce68f1b2c4a5d6e7f809\",\"version\":17,\"enabled\":true,\"sensors\":[";
+    for (size_t i = 0; i < sensorCount; ++i) {
+        if (i) {
+            s += ',';
+        }
+        s += "{\"name\":\"sensor" + std::to_string(i) + "\",\"type\":\"temperature\",\"interval\":" +
+                std::to_string(i * 10) + ",\"limits\":[-40.5,85.25],\"label\":\"Room \\\"" +
+                std::to_string(i) + "\\\"\"}";
+    }
+    s += "],\"checksum\":null}";
+    return s;
+}
+
+// Finds the interval of the last sensor using the jsmn-based parser
+int findWithJSONValue(const std::string& json, size_t sensorCount) {
+    const JSONValue root = JSONValue::parseCopy(json.data(), json.size());
+    JSONObjectIterator it(root);
+    while (it.next()) {
+        if (it.name() == "sensors") {
+            JSONArrayIterator sensors(it.value());
+            for (size_t i = 0; sensors.next(); ++i) {
+                if (i == sensorCount - 1) {
+                    JSONObjectIterator sensor(sensors.value());
+                    while (sensor.next()) {
+                        if (sensor.name() == "interval") {
+                            return sensor.value().toInt();
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return -1;
+}
+
+int findWithPathReader(const std::string& json, size_t sensorCount) {
+    char buf[32];
+    const std::string path = "sensors[" + std::to_string(sensorCount - 1) + "].interval";
+    JSONPathReader r(path.c_str(), buf, sizeof(buf));
+    r.parse(json.data(), json.size());
+    return r.isFound() ? atoi(r.data()) : -1;
+}
+
+} // namespace
+
+TEST_CASE("Streaming JSON parser") {
+    SECTION("primitive root values") {
+        CHECK(streamEvents("null") == "null");
+        CHECK(streamEvents("true") == "true");
+        CHECK(streamEvents(" false ") == "false");
+        CHECK(streamEvents("-12.5e+3") == "-12.5e+3");
+        CHECK(streamEvents("0") == "0");
+        CHECK(streamEvents("\"abc\"") == "\"abc\"");
+    }
+
+    SECTION("nested containers") {
+        const std::string json = " { \"a\" : [ 1 , \"x\" , { } , [ ] ] , \"b\" : { \"c\" : null , \"d\" : false } } ";
+        const std::string events = "{ a: [ 1 \"x\" { } [ ] ] b: { c: null d: false } }";
+        CHECK(streamEvents(json) == events);
+        // The result doesn't depend on how the input is split into chunks
+        for (size_t chunk = 1; chunk < 8; ++chunk) {
+            CHECK(streamEvents(json, chunk) == events);
+        }
+    }
+
+    SECTION("escaped characters") {
+        CHECK(streamEvents("\"\\\"\\/\\\\\\b\\f\\n\\r\\t\"") == "\"\"/\\\b\f\n\r\t\"");
+        CHECK(streamEvents("\"\\u0041\\u007e\"") == "\"A~\"");
+        CHECK(streamEvents("\"\\u2014\"") == "\"\\u2014\""); // Same as JSONValue
+        CHECK(streamEvents("{\"\\u0061\\n\":1}") == "{ a\n: 1 }");
+    }
+
+    SECTION("element positions") {
+        PositionRecorder r;
+        REQUIRE(r.parse("{\"a\":1,\"b\":[2,{\"c\":3},4]}", 25));
+        REQUIRE(r.isDone());
+        CHECK(r.positions == "0.0 1.0 1.1 2[0 2[1 3.0 2[2 ");
+    }
+
+    SECTION("a primitive root value is complete at the end of the input") {
+        EventRecorder r;
+        REQUIRE(r.parse("123", 3));
+        CHECK_FALSE(r.isDone());
+        CHECK(r.events() == "");
+        REQUIRE(r.finish());
+        CHECK(r.events() == "123");
+    }
+
+    SECTION("data after the document is ignored") {
+        EventRecorder r;
+        REQUIRE(r.parse("[1] [2]", 7));
+        CHECK(r.isDone());
+        CHECK(r.events() == "[ 1 ]");
+    }
+
+    SECTION("a handler can stop parsing") {
+        EventRecorder r;
+        r.stopAt(3);
+        REQUIRE(r.parse("[1,2,3,4]", 9));
+        CHECK(r.isDone());
+        CHECK(r.events() == "[ 1 2");
+    }
+
+    SECTION("long values are truncated") {
+        EventRecorder r(8);
+        REQUIRE(r.parse("\"0123456789\"", 12));
+        CHECK(r.truncated());
+        CHECK(r.events() == "\"0123456\"");
+        EventRecorder r2(8);
+        REQUIRE(r2.parse("[1234567890]", 12));
+        CHECK(r2.events() == "[ 1234567 ]");
+    }
+
+    SECTION("nesting depth is limited") {
+        CHECK(streamValid(std::string(JSONStreamParser::MAX_DEPTH, '[') + std::string(JSONStreamParser::MAX_DEPTH, ']')));
+        CHECK_FALSE(streamValid(std::string(JSONStreamParser::MAX_DEPTH + 1, '[') +
+                std::string(JSONStreamParser::MAX_DEPTH + 1, ']')));
+    }
+
+    SECTION("parsing errors") {
+        CHECK(streamEvents("") == "incomplete");
+        CHECK(streamEvents("[") == "incomplete");
+        CHECK(streamEvents("[1,") == "incomplete");
+        CHECK(streamEvents("{\"1\":") == "incomplete");
+        CHECK(streamEvents("\"abc") == "incomplete");
+        CHECK(streamEvents("]") == "error");
+        CHECK(streamEvents("}") == "error");
+        CHECK(streamEvents("[1}") == "error");
+        CHECK(streamEvents("{\"a\":1]") == "error");
+        CHECK(streamEvents("[1,]") == "error");
+        CHECK(streamEvents("[1 2]") == "error");
+        CHECK(streamEvents("{null") == "error");
+        CHECK(streamEvents("{1") == "error");
+        CHECK(streamEvents("{\"1\" 1}") == "error");
+        CHECK(streamEvents("[tru]") == "error");
+        CHECK(streamEvents("[nul]") == "error");
+        CHECK(streamEvents("[01]") == "error");
+        CHECK(streamEvents("[1.]") == "error");
+        CHECK(streamEvents("[-]") == "error");
+        CHECK(streamEvents("[1e]") == "error");
+        CHECK(streamEvents("\"a\nb\"") == "error"); // Unescaped control character
+        CHECK(streamEvents("\"\\x\"") == "error"); // Unknown escaped character
+        CHECK(streamEvents("\"\\U0001\"") == "error"); // Uppercase 'U'
+        CHECK(streamEvents("\"\\u000x\"") == "error"); // Invalid hex value
+        CHECK(streamEvents("\"\\u01\"") == "error");
+    }
+
+    SECTION("parsing from a stream") {
+        EventRecorder r;
+        InputStream s("{\"a\":[1,2]}");
+        CHECK(r.parse(s));
+        CHECK(r.events() == "{ a: [ 1 2 ] }");
+        EventRecorder r2;
+        InputStream s2("{\"a\":[1,2]");
+        CHECK_FALSE(r2.parse(s2));
+    }
+}
+
+TEST_CASE("Finding JSON values by path") {
+    const std::string json = "{\"a\":1,\"b\":{\"c\":[10,{\"d\":\"x\\ty\"},[true,null]],\"e\":-2.5},\"c\":3}";
+
+    SECTION("primitive values") {
+        auto v = findPath("a", json);
+        CHECK(v.type == JSON_TYPE_NUMBER);
+        CHECK(v.data == "1");
+        v = findPath("b.c[0]", json);
+        CHECK(v.type == JSON_TYPE_NUMBER);
+        CHECK(v.data == "10");
+        v = findPath("b.c[1].d", json);
+        CHECK(v.type == JSON_TYPE_STRING);
+        CHECK(v.data == "x\ty");
+        v = findPath("b.c[2][1]", json);
+        CHECK(v.type == JSON_TYPE_NULL);
+        v = findPath("b.e", json);
+        CHECK(v.data == "-2.5");
+        v = findPath("c", json);
+        CHECK(v.data == "3");
+    }
+
+    SECTION("containers") {
+        CHECK(findPath("", json).type == JSON_TYPE_OBJECT);
+        CHECK(findPath("b", json).type == JSON_TYPE_OBJECT);
+        CHECK(findPath("b.c", json).type == JSON_TYPE_ARRAY);
+        CHECK(findPath("b.c[2]", json).type == JSON_TYPE_ARRAY);
+    }
+
+    SECTION("missing values") {
+        CHECK(findPath("d", json).type == JSON_TYPE_INVALID);
+        CHECK(findPath("b.d", json).type == JSON_TYPE_INVALID);
+        CHECK(findPath("b.c[3]", json).type == JSON_TYPE_INVALID);
+        CHECK(findPath("b.c.d", json).type == JSON_TYPE_INVALID);
+        CHECK(findPath("a[0]", json).type == JSON_TYPE_INVALID);
+        CHECK(findPath("[0]", json).type == JSON_TYPE_INVALID);
+    }
+
+    SECTION("parsing stops once the value is found") {
+        char buf[16];
+        JSONPathReader r("a", buf, sizeof(buf));
+        const std::string data = "{\"a\":true,this is not parsed";
+        CHECK(r.parse(data.data(), data.size()));
+        CHECK(r.isDone());
+        CHECK(r.type() == JSON_TYPE_BOOL);
+        CHECK(strcmp(r.data(), "true") == 0);
+    }
+
+    SECTION("the result matches JSONValue") {
+        for (size_t n: { 1, 5, 50 }) {
+            const std::string doc = makeDocument(n);
+            CHECK(findWithPathReader(doc, n) == findWithJSONValue(doc, n));
+        }
+    }
+}
+
+TEST_CASE("Streaming JSON parser performance", "[.][benchmark]") {
+    for (size_t n: { 4, 64 }) {
+        const std::string doc = makeDocument(n);
+        const int iterations = 20000;
+        auto start = std::chrono::steady_clock::now();
+        int r = 0;
+        for (int i = 0; i < iterations; ++i) {
+            r += findWithJSONValue(doc, n);
+        }
+        const double jsmnUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            r -= findWithPathReader(doc, n);
+        }
+        const double streamUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+        REQUIRE(r == 0);
+        // The jsmn path allocates a copy of the document and a token array
+        jsmn_parser p;
+        p.size = sizeof(p);
+        jsmn_init(&p, nullptr);
+        const int tokens = jsmn_parse(&p, doc.data(), doc.size(), nullptr, 0, nullptr);
+        CATCH_WARN(doc.size() << " bytes: JSONValue " << jsmnUs << " us, " << doc.size() + 1 + tokens * sizeof(jsmntok_t) <<
+                " bytes of heap; JSONPathReader " << streamUs << " us, " << sizeof(JSONPathReader) + 32 << " bytes");
+    }
+}
@@ -0,0 +1,71 @@
+/**
+ ******************************************************************************
+  Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#include "shared_event_data.h"
+
+#include "catch.hpp"
+
+#include <string>
+
+SCENARIO("SharedEventData copies the event name and data", "[shared_event_data]") {
+    char name[] = "temperature";
+    char data[] = "21.5";
+    SharedEventData event = SharedEventData::create(name, data);
+    REQUIRE(event);
+    // the copy is independent of the receive buffer
+    memset(name, 'x', sizeof(name) - 1);
+    memset(data, 'x', sizeof(data) - 1);
+    REQUIRE(std::string(event.name()) == "temperature");
+    REQUIRE(std::string(event.data()) == "21.5");
+}
+
+SCENARIO("SharedEventData stores missing data as an empty string", "[shared_event_data]") {
+    SharedEventData event = SharedEventData::create("name", nullptr);
+    REQUIRE(std::string(event.data()) == "");
+    REQUIRE(event.matches("name", nullptr));
+    REQUIRE(event.matches("name", ""));
+    REQUIRE_FALSE(event.matches("name", "a"));
+}
+
+SCENARIO("SharedEventData matches only an identical event", "[shared_event_data]") {
+    SharedEventData event = SharedEventData::create("abc", "123");
+    REQUIRE(event.matches("abc", "123"));
+    REQUIRE_FALSE(event.matches("ab", "123"));
+    REQUIRE_FALSE(event.matches("abc", "1234"));
+    REQUIRE_FALSE(event.matches("abd", "123"));
+    REQUIRE_FALSE(event.matches("abc", "124"));
+    REQUIRE_FALSE(SharedEventData().matches("", nullptr));
+}
+
+SCENARIO("SharedEventData copies share the event", "[shared_event_data]") {
+    SharedEventData event = SharedEventData::create("abc", "123");
+    REQUIRE(event.useCount() == 1);
+    {
+        SharedEventData copy = event;
+        REQUIRE(copy.name() == event.name());
+        REQUIRE(event.useCount() == 2);
+        SharedEventData moved = std::move(copy);
+        REQUIRE_FALSE(copy);
+        REQUIRE(event.useCount() == 2);
+    }
+    REQUIRE(event.useCount() == 1);
+    event = SharedEventData();
+    REQUIRE_FALSE(event);
+    REQUIRE(std::string(event.name()) == "");
+}
@@ -77,3 +77,103 @@ TEST_CASE("Can format a string using printf like syntax") {
 TEST_CASE("Can convert a string to lowercase") {
     REQUIRE(String("In LOWERCAse").toLowerCase()==String("in lowercase"));
 }
+
+namespace {
+
+// Exposes the capacity of the buffer, which changes each time the string is reallocated
+class StringWithCapacity : public String {
+public:
+    using String::String;
+    using String::operator=;
+
+    unsigned int bufferCapacity() const {
+        return capacity;
+    }
+};
+
+class PartialPrintable : public Printable {
+public:
+    size_t printTo(Print& p) const override {
+        // The data written to the string is not null-terminated
+        return p.write((const uint8_t*)"abcdef", 3) + p.write((const uint8_t*)"xyz", 2);
+    }
+};
+
+} // namespace
+
+TEST_CASE("Appending to a string reallocates it a logarithmic number of times") {
+    StringWithCapacity s;
+    unsigned int allocations = 0;
+    unsigned int capacity = s.bufferCapacity();
+    for (int i = 0; i < 300; ++i) {
+        s += 'a';
+        if (s.bufferCapacity() != capacity) {
+            capacity = s.bufferCapacity();
+            ++allocations;
+        }
+    }
+    REQUIRE(s.length() == 300);
+    REQUIRE(allocations <= 10);
+    REQUIRE(s.bufferCapacity() < 600);
+}
+
+TEST_CASE("reserve() allocates the exact size") {
+    StringWithCapacity s;
+    REQUIRE(s.reserve(100));
+    REQUIRE(s.bufferCapacity() == 100);
+    s = "abc";
+    REQUIRE(s.bufferCapacity() == 100);
+    // No reallocation until the reserved capacity is exceeded
+    for (int i = 0; i < 97; ++i) {
+        s += 'x';
+    }
+    REQUIRE(s.bufferCapacity() == 100);
+}
+
+TEST_CASE("Moving a string doesn't allocate") {
+    SECTION("move construction takes over the buffer") {
+        String a("some fairly long string value");
+        const char* p = a.c_str();
+        String b(std::move(a));
+        REQUIRE(b.c_str() == p);
+        REQUIRE(b == "some fairly long string value");
+        REQUIRE(a.length() == 0);
+    }
+    SECTION("move assignment reuses a large enough buffer") {
+        StringWithCapacity a;
+        a.reserve(64);
+        const char* p = a.c_str();
+        String b("value");
+        a = std::move(b);
+        REQUIRE(a.c_str() == p);
+        REQUIRE(a == "value");
+        REQUIRE(a.bufferCapacity() == 64);
+        REQUIRE(b.length() == 0);
+        REQUIRE(strlen(b.c_str()) == 0);
+    }
+    SECTION("move assignment takes over the buffer of a longer string") {
+        String a("abc");
+        String b("a string that doesn't fit in the buffer of a");
+        const char* p = b.c_str();
+        a = std::move(b);
+        REQUIRE(a.c_str() == p);
+        REQUIRE(a == "a string that doesn't fit in the buffer of a");
+    }
+    SECTION("moving an invalid string invalidates the destination") {
+        String a("abc");
+        String b((const char*)nullptr);
+        REQUIRE(b.c_str() == nullptr);
+        a = std::move(b);
+        REQUIRE(a.c_str() == nullptr);
+    }
+}
+
+TEST_CASE("A string can be appended to itself") {
+    String s("0123456789abcdef");
+    s += s;
+    REQUIRE(s == "0123456789abcdef0123456789abcdef");
+}
+
+TEST_CASE("Only the given number of characters is appended") {
+    REQUIRE(String(PartialPrintable()) == "abcxy");
+}
@@ -50,6 +50,12 @@
 typedef std::function<user_function_int_str_t> user_std_function_int_str_t;
 typedef std::function<void (const char*, const char*)> wiring_event_handler_t;
 
+namespace spark {
+class JSONWriter;
+} // namespace spark
+
+typedef std::function<void (spark::JSONWriter&)> wiring_event_data_writer_t;
+
 #ifndef __XSTRING
 #define	__STRING(x)	#x		/* stringify without expanding x */
 #define	__XSTRING(x)	__STRING(x)	/* expand x, then stringify */
@@ -63,6 +69,7 @@ const PublishFlag PUBLIC(PUBLISH_EVENT_FLAG_PUBLIC);
 const PublishFlag PRIVATE(PUBLISH_EVENT_FLAG_PRIVATE);
 const PublishFlag NO_ACK(PUBLISH_EVENT_FLAG_NO_ACK);
 const PublishFlag WITH_ACK(PUBLISH_EVENT_FLAG_WITH_ACK);
+const PublishFlag STORE_AND_FORWARD(PUBLISH_EVENT_FLAG_STORE);
 
 // Test if the paramater a regular C "string" literal
 template <typename T>
@@ -230,6 +237,21 @@ public:
         return publish_event(eventName, eventData, ttl, flags1 | flags2);
     }
 
+    /**
+     * Publishes an event whose data is written by `writer` directly into the message buffer of the
+     * protocol, so that the data is serialized once and isn't copied. The event is not sent if
+     * the data doesn't fit into a message.
+     */
+    inline particle::Future<bool> publishJSON(const char *eventName, const wiring_event_data_writer_t& writer, PublishFlags flags1, PublishFlags flags2 = PublishFlags())
+    {
+        return publishJSON(eventName, writer, DEFAULT_CLOUD_EVENT_TTL, flags1, flags2);
+    }
+
+    inline particle::Future<bool> publishJSON(const char *eventName, const wiring_event_data_writer_t& writer, int ttl, PublishFlags flags1, PublishFlags flags2 = PublishFlags())
+    {
+        return publish_json_event(eventName, writer, ttl, flags1 | flags2);
+    }
+
     // Deprecated methods
     particle::Future<bool> publish(const char* name) PARTICLE_DEPRECATED_API_DEFAULT_PUBLISH_SCOPE;
     particle::Future<bool> publish(const char* name, const char* data) PARTICLE_DEPRECATED_API_DEFAULT_PUBLISH_SCOPE;
@@ -260,6 +282,22 @@ public:
     int publishVitals(system_tick_t period_s = particle::NOW);
     inline int publishVitals(std::chrono::seconds s) { return publishVitals(s.count()); }
 
+    /**
+     * @brief Enable or disable delta encoding of vitals
+     *
+     * When enabled, a vitals message only contains the vitals that changed since the last
+     * message acknowledged by the cloud, and all vitals are sent every \p interval messages.
+     * The cloud backend must support the delta-encoded format.
+     *
+     * @param[in] interval The keyframe interval, or 0 to send all vitals in every message (default)
+     *
+     * @returns \p system_error_t result code
+     * @retval \p system_error_t::SYSTEM_ERROR_NONE
+     */
+    inline int vitalsKeyframeInterval(unsigned interval) {
+        return spark_set_vitals_keyframe_interval(interval, nullptr);
+    }
+
     inline bool subscribe(const char *eventName, EventHandler handler, Spark_Subscription_Scope_TypeDef scope)
     {
         return spark_subscribe(eventName, handler, NULL, scope, NULL, NULL);
@@ -367,6 +405,39 @@ public:
     inline static void keepAlive(std::chrono::seconds s) { keepAlive(s.count()); }
 #endif
 
+    // Sets the budget for application events: up to `burst` events can be published back to back,
+    // after which one more event is allowed every `period` milliseconds. A period of 0 disables
+    // rate limiting
+    inline static void publishRateLimit(uint16_t burst, system_tick_t period)
+    {
+        particle::protocol::connection_properties_t conn_prop = {0};
+        conn_prop.size = sizeof(conn_prop);
+        conn_prop.publish_burst = burst;
+        spark_set_connection_property(particle::protocol::Connection::PUBLISH_RATE_LIMIT,
+                                               period, &conn_prop, nullptr);
+    }
+
+    inline static void publishRateLimit(uint16_t burst, std::chrono::milliseconds ms) { publishRateLimit(burst, ms.count()); }
+
+    // Sets the maximum number of events that are held in RAM when the event budget is exhausted.
+    // Queued events are sent as soon as the budget allows. A size of 0 makes rate limited events
+    // fail immediately
+    inline static void publishBacklog(size_t size)
+    {
+        spark_set_connection_property(particle::protocol::Connection::PUBLISH_BACKLOG,
+                                               size, nullptr, nullptr);
+    }
+
+    // Packs events published within `window` milliseconds into a single message, if the cloud
+    // supports it. Takes effect on the next handshake with the cloud. A window of 0 disables batching
+    inline static void publishBatching(system_tick_t window)
+    {
+        spark_set_connection_property(particle::protocol::Connection::PUBLISH_BATCHING,
+                                               window, nullptr, nullptr);
+    }
+
+    inline static void publishBatching(std::chrono::milliseconds ms) { publishBatching(ms.count()); }
+
 private:
 
     static bool register_function(cloud_function_t fn, void* data, const char* funcKey);
@@ -376,6 +447,7 @@ private:
     static void call_wiring_event_handler(const void* param, const char *event_name, const char *data);
 
     static particle::Future<bool> publish_event(const char *eventName, const char *eventData, int ttl, PublishFlags flags);
+    static particle::Future<bool> publish_json_event(const char *eventName, const wiring_event_data_writer_t& writer, int ttl, PublishFlags flags);
 
     static ProtocolFacade* sp()
     {
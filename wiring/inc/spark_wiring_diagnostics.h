@@ -423,6 +423,140 @@ private:
     }
 };
 
+// Base abstract class for a data source containing a histogram
+class AbstractHistogramDiagnosticData: public AbstractDiagnosticData {
+public:
+    typedef diag_histogram_summary Summary;
+
+    static int get(DiagnosticDataId id, Summary& summary);
+    static int get(const diag_source* src, Summary& summary);
+
+protected:
+    explicit AbstractHistogramDiagnosticData(DiagnosticDataId id, const char* name = nullptr);
+
+    virtual int get(Summary& summary) = 0;
+
+private:
+    virtual int get(void* data, size_t& size) override; // AbstractDiagnosticData
+};
+
+// Histogram of unsigned values, such as durations. Values below 8 are counted in a bucket each,
+// larger values in 4 buckets per power of two, so that a percentile is within 25% of the exact
+// value. Values beyond the last bucket are counted in the last bucket. Recording a value is
+// lock-free and can be done from an ISR
+template<size_t BucketCountV = 56>
+class HistogramDiagnosticData: public AbstractHistogramDiagnosticData {
+public:
+    static const size_t BUCKET_COUNT = BucketCountV;
+
+    explicit HistogramDiagnosticData(DiagnosticDataId id, const char* name = nullptr) :
+            AbstractHistogramDiagnosticData(id, name) {
+        reset();
+    }
+
+    void record(uint32_t val) {
+        buckets_[bucketIndex(val)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        uint32_t v = min_.load(std::memory_order_relaxed);
+        while (val < v && !min_.compare_exchange_weak(v, val, std::memory_order_relaxed)) {
+        }
+        v = max_.load(std::memory_order_relaxed);
+        while (val > v && !max_.compare_exchange_weak(v, val, std::memory_order_relaxed)) {
+        }
+    }
+
+    // Values recorded concurrently with this call may be partially kept
+    void reset() {
+        for (auto& b: buckets_) {
+            b.store(0, std::memory_order_relaxed);
+        }
+        count_.store(0, std::memory_order_relaxed);
+        min_.store(0xffffffff, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    uint32_t count() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    // Returns the upper bound of the bucket containing the given percentile, clamped to the
+    // range of the recorded values, or 0 if no values have been recorded
+    uint32_t percentile(unsigned p) const {
+        uint32_t total = 0;
+        for (const auto& b: buckets_) {
+            total += b.load(std::memory_order_relaxed);
+        }
+        if (!total) {
+            return 0;
+        }
+        uint32_t rank = ((uint64_t)total * p + 99) / 100;
+        if (!rank) {
+            rank = 1;
+        }
+        size_t i = 0;
+        for (uint32_t n = 0; i < BucketCountV - 1; ++i) {
+            n += buckets_[i].load(std::memory_order_relaxed);
+            if (n >= rank) {
+                break;
+            }
+        }
+        const uint32_t min = min_.load(std::memory_order_relaxed);
+        const uint32_t max = max_.load(std::memory_order_relaxed);
+        uint32_t val = (i < BucketCountV - 1) ? bucketUpperBound(i) : max;
+        if (val > max) {
+            val = max;
+        }
+        if (val < min) {
+            val = min;
+        }
+        return val;
+    }
+
+    Summary summary() const {
+        Summary s = {};
+        s.count = count_.load(std::memory_order_relaxed);
+        if (s.count) {
+            s.min = min_.load(std::memory_order_relaxed);
+            s.max = max_.load(std::memory_order_relaxed);
+            s.p50 = percentile(50);
+            s.p90 = percentile(90);
+            s.p99 = percentile(99);
+        }
+        return s;
+    }
+
+    static size_t bucketIndex(uint32_t val) {
+        if (val < 8) {
+            return val;
+        }
+        const unsigned msb = 31 - __builtin_clz(val);
+        const size_t i = (msb - 1) * 4 + ((val >> (msb - 2)) & 3);
+        return (i < BucketCountV) ? i : BucketCountV - 1;
+    }
+
+    // Largest value counted in a bucket
+    static uint32_t bucketUpperBound(size_t index) {
+        if (index < 8) {
+            return index;
+        }
+        const unsigned shift = index / 4 - 1;
+        return ((4 + (index & 3) + 1) << shift) - 1;
+    }
+
+private:
+    static_assert(BucketCountV >= 8 && BucketCountV <= 124, "Invalid number of histogram buckets");
+
+    std::atomic<uint32_t> buckets_[BucketCountV];
+    std::atomic<uint32_t> count_;
+    std::atomic<uint32_t> min_;
+    std::atomic<uint32_t> max_;
+
+    virtual int get(Summary& summary) override { // AbstractHistogramDiagnosticData
+        summary = this->summary();
+        return SYSTEM_ERROR_NONE;
+    }
+};
+
 template<typename ValueT>
 class RetainedDiagnosticDataStorage {
 public:
@@ -552,4 +686,38 @@ inline int AbstractIntegerDiagnosticData::get(void* data, size_t& size) {
     return ret;
 }
 
+inline AbstractHistogramDiagnosticData::AbstractHistogramDiagnosticData(DiagnosticDataId id, const char* name) :
+        AbstractDiagnosticData(id, name, DIAG_TYPE_HISTOGRAM) {
+}
+
+inline int AbstractHistogramDiagnosticData::get(DiagnosticDataId id, Summary& summary) {
+    const diag_source* src = nullptr;
+    const int ret = diag_get_source(id, &src, nullptr);
+    if (ret != SYSTEM_ERROR_NONE) {
+        return ret;
+    }
+    return get(src, summary);
+}
+
+inline int AbstractHistogramDiagnosticData::get(const diag_source* src, Summary& summary) {
+    SPARK_ASSERT(src->type == DIAG_TYPE_HISTOGRAM);
+    size_t size = sizeof(Summary);
+    return AbstractDiagnosticData::get(src, &summary, size);
+}
+
+inline int AbstractHistogramDiagnosticData::get(void* data, size_t& size) {
+    if (!data) {
+        size = sizeof(Summary);
+        return SYSTEM_ERROR_NONE;
+    }
+    if (size < sizeof(Summary)) {
+        return SYSTEM_ERROR_TOO_LARGE;
+    }
+    const int ret = get(*(Summary*)data);
+    if (ret == SYSTEM_ERROR_NONE) {
+        size = sizeof(Summary);
+    }
+    return ret;
+}
+
 } // namespace particle
@@ -19,8 +19,10 @@
 #define SPARK_WIRING_JSON_H
 
 #include "spark_wiring_print.h"
+#include "spark_wiring_stream.h"
 #include "spark_wiring_string.h"
 
+#include "appender.h"
 #include "jsmn.h"
 
 #include <cstring>
@@ -212,6 +214,21 @@ private:
     Print &strm_;
 };
 
+// Writes to an appender, e.g. a BufferAppender over a message buffer. Whether the output fit is
+// for the appender to track
+class JSONAppenderWriter: public JSONWriter {
+public:
+    explicit JSONAppenderWriter(Appender &appender);
+
+    Appender* appender() const;
+
+protected:
+    virtual void write(const char *data, size_t size) override;
+
+private:
+    Appender &app_;
+};
+
 class JSONBufferWriter: public JSONWriter {
 public:
     JSONBufferWriter(char *buf, size_t size);
@@ -230,6 +247,124 @@ private:
     size_t bufSize_, n_;
 };
 
+// Streaming JSON parser. The document is fed in chunks of any size and reported to the handler
+// methods as it is parsed, without tokenizing the whole document or copying it. The memory used
+// is fixed: a buffer for the longest name or primitive value, and a stack of MAX_DEPTH containers.
+// Names and values longer than the buffer are truncated
+class JSONStreamParser {
+public:
+    static const unsigned MAX_DEPTH = 32;
+
+    JSONStreamParser(char *buf, size_t size);
+    virtual ~JSONStreamParser() = default;
+
+    // Returns false if the data is not valid JSON. Parsing stops when the document is complete
+    // or a handler method returns false, and any remaining data is ignored
+    bool parse(const char *data, size_t size);
+    // Reads the document from a stream until it's complete or the stream times out
+    bool parse(Stream &stream);
+    // Signals the end of the input. Returns false if the document is incomplete
+    bool finish();
+
+    bool isDone() const;
+    bool isError() const;
+
+    void reset();
+
+protected:
+    // Handler methods. Returning false stops parsing
+    virtual bool beginObject();
+    virtual bool endObject();
+    virtual bool beginArray();
+    virtual bool endArray();
+    virtual bool name(const char *name, size_t size);
+    virtual bool value(JSONType type, const char *data, size_t size); // Data is null-terminated
+
+    // Nesting level of the reported element. The root value is at level 0
+    unsigned depth() const;
+    // Index of the reported element in its parent container
+    unsigned index() const;
+    // Returns true if the reported element is an array element
+    bool inArray() const;
+    // Returns true if the reported name or value was truncated
+    bool isTruncated() const;
+
+private:
+    enum State {
+        VALUE, // Expecting a value
+        FIRST_VALUE, // Expecting a value or the end of an array
+        FIRST_NAME, // Expecting a name or the end of an object
+        NAME, // Expecting a name
+        COLON, // Expecting a name separator
+        NEXT, // Expecting a value separator or the end of a container
+        STRING,
+        STRING_ESCAPE,
+        STRING_UNICODE,
+        PRIMITIVE,
+        DONE,
+        ERROR
+    };
+
+    char *buf_;
+    size_t bufSize_, n_;
+    uint32_t objects_; // Bit N is set if the container at level N is an object
+    uint16_t count_[MAX_DEPTH]; // Number of elements in the containers
+    uint8_t depth_; // Number of open containers
+    uint8_t state_;
+    char hex_[4]; // Hex digits of an escaped sequence
+    uint8_t hexCount_;
+    bool name_; // Set if the current string is a name
+    bool truncated_;
+
+    bool parseChar(char c);
+    bool beginString(bool name);
+    bool beginContainer(bool object);
+    bool endContainer(bool object);
+    bool endString();
+    bool endPrimitive();
+    bool endValue();
+    void append(char c);
+    bool stop();
+    bool error();
+};
+
+// Finds the value at the given path without storing the document. The path consists of names
+// separated by dots and array indices in brackets, e.g. "sensors[1].name". Parsing stops once
+// the value is found
+class JSONPathReader: public JSONStreamParser {
+public:
+    JSONPathReader(const char *path, char *buf, size_t size);
+
+    bool isFound() const;
+    JSONType type() const; // JSON_TYPE_INVALID if the value was not found
+    // Returns the data of a primitive value. Strings are unescaped
+    const char* data() const;
+    size_t size() const;
+
+    using JSONStreamParser::isTruncated;
+
+protected:
+    virtual bool beginObject() override;
+    virtual bool beginArray() override;
+    virtual bool name(const char *name, size_t size) override;
+    virtual bool value(JSONType type, const char *data, size_t size) override;
+    virtual bool endObject() override;
+    virtual bool endArray() override;
+
+private:
+    const char *path_;
+    const char *data_;
+    size_t size_;
+    unsigned levels_; // Number of path components
+    unsigned matched_; // Number of path components matched by the current element
+    JSONType type_;
+
+    bool element(JSONType type, const char *data, size_t size);
+    bool matchIndex(unsigned level, unsigned index) const;
+    bool matchName(unsigned level, const char *name, size_t size) const;
+    const char* component(unsigned level, size_t *size) const;
+};
+
 bool operator==(const char *str1, const JSONString &str2);
 bool operator!=(const char *str1, const JSONString &str2);
 bool operator==(const String &str1, const JSONString &str2);
@@ -405,6 +540,19 @@ inline void spark::JSONStreamWriter::write(const char *data, size_t size) {
     strm_.write((const uint8_t*)data, size);
 }
 
+// spark::JSONAppenderWriter
+inline spark::JSONAppenderWriter::JSONAppenderWriter(Appender &appender) :
+        app_(appender) {
+}
+
+inline Appender* spark::JSONAppenderWriter::appender() const {
+    return &app_;
+}
+
+inline void spark::JSONAppenderWriter::write(const char *data, size_t size) {
+    app_.append((const uint8_t*)data, size);
+}
+
 // spark::JSONBufferWriter
 inline spark::JSONBufferWriter::JSONBufferWriter(char *buf, size_t size) :
         buf_(buf),
@@ -424,6 +572,72 @@ inline size_t spark::JSONBufferWriter::dataSize() const {
     return n_;
 }
 
+// spark::JSONStreamParser
+inline bool spark::JSONStreamParser::isDone() const {
+    return state_ == DONE;
+}
+
+inline bool spark::JSONStreamParser::isError() const {
+    return state_ == ERROR;
+}
+
+inline bool spark::JSONStreamParser::beginObject() {
+    return true;
+}
+
+inline bool spark::JSONStreamParser::endObject() {
+    return true;
+}
+
+inline bool spark::JSONStreamParser::beginArray() {
+    return true;
+}
+
+inline bool spark::JSONStreamParser::endArray() {
+    return true;
+}
+
+inline bool spark::JSONStreamParser::name(const char *name, size_t size) {
+    return true;
+}
+
+inline bool spark::JSONStreamParser::value(JSONType type, const char *data, size_t size) {
+    return true;
+}
+
+inline unsigned spark::JSONStreamParser::depth() const {
+    return depth_;
+}
+
+inline unsigned spark::JSONStreamParser::index() const {
+    return depth_ ? count_[depth_ - 1] - 1 : 0;
+}
+
+inline bool spark::JSONStreamParser::inArray() const {
+    return depth_ && !(objects_ & (1u << (depth_ - 1)));
+}
+
+inline bool spark::JSONStreamParser::isTruncated() const {
+    return truncated_;
+}
+
+// spark::JSONPathReader
+inline bool spark::JSONPathReader::isFound() const {
+    return type_ != JSON_TYPE_INVALID;
+}
+
+inline spark::JSONType spark::JSONPathReader::type() const {
+    return type_;
+}
+
+inline const char* spark::JSONPathReader::data() const {
+    return data_;
+}
+
+inline size_t spark::JSONPathReader::size() const {
+    return size_;
+}
+
 // spark::
 inline bool spark::operator==(const char *str1, const JSONString &str2) {
     return str2 == str1;
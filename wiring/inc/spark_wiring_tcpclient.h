@@ -64,6 +64,36 @@ public:
 
     virtual IPAddress remoteIP();
 
+    /**
+     * A buffer for scatter/gather I/O. Has the same layout as `struct iovec`.
+     */
+    struct IoVec {
+        void* data;
+        size_t size;
+    };
+
+    /**
+     * Sets the size of the receive buffer. The buffer is allocated on the heap unless `buffer` is
+     * provided, in which case it must remain valid for as long as the client is used. A size of 0
+     * restores the default buffer. Data already in the buffer is kept.
+     */
+    int setBufferSize(size_t size, uint8_t* buffer = nullptr);
+    size_t bufferSize() const;
+
+    /**
+     * Reads up to `size` bytes, waiting at most `timeout` milliseconds for them to arrive. Returns
+     * the number of bytes read, or -1 if no data was read.
+     */
+    int read(uint8_t* buffer, size_t size, system_tick_t timeout);
+
+    /**
+     * Reads the available data into several buffers without waiting. Returns the number of bytes
+     * read, or -1 if no data was read.
+     */
+    int readv(const IoVec* iov, size_t count);
+    size_t writev(const IoVec* iov, size_t count);
+    size_t writev(const IoVec* iov, size_t count, system_tick_t timeout);
+
     friend class TCPServer;
 
     using Print::write;
@@ -74,9 +104,12 @@ protected:
 private:
     struct Data {
         sock_handle_t sock;
-        uint8_t buffer[TCPCLIENT_BUF_MAX_SIZE];
-        uint16_t offset;
-        uint16_t total;
+        uint8_t* buffer;
+        size_t size;
+        size_t offset;
+        size_t total;
+        std::unique_ptr<uint8_t[]> allocatedBuffer;
+        uint8_t defaultBuffer[TCPCLIENT_BUF_MAX_SIZE];
         IPAddress remoteIP;
 
         explicit Data(sock_handle_t sock);
@@ -86,6 +119,10 @@ private:
     std::shared_ptr<Data> d_;
 
     inline int bufferCount();
+    // Receives data into `buffer`, bypassing the internal buffer. Returns the number of bytes
+    // received, 0 if no data arrived within `timeout`, or a negative value on error
+    int receive(uint8_t* buffer, size_t size, system_tick_t timeout);
+    size_t readBuffered(uint8_t* buffer, size_t size);
 };
 
 #endif
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+
+#if PLATFORM_ID!=3
+
+#include "timer_wheel.h"
+
+namespace particle {
+
+/**
+ * The thread on which the callback of a WheelTimer is invoked.
+ */
+enum class TimerWorker {
+    TIMER_TASK, ///< The RTOS timer task. The callback needs to be short and must not block.
+    SYSTEM_THREAD, ///< The system thread, or the application thread if the system thread is disabled.
+    APPLICATION_THREAD ///< The application thread, between iterations of `loop()`.
+};
+
+/**
+ * A software timer served by a shared timer wheel.
+ *
+ * Unlike `Timer`, which creates an RTOS timer per instance, all wheel timers share one RTOS timer
+ * that is rearmed for the next expiration. Starting, stopping and resetting a timer takes constant
+ * time, never blocks and can be done from an ISR. Callbacks are plain functions and can be invoked
+ * on a worker thread, so that a slow callback doesn't delay the other timers.
+ */
+class WheelTimer {
+public:
+    typedef void (*Callback)(void* data);
+
+    struct Stats {
+        uint32_t expired; ///< Number of expirations.
+        /**
+         * Number of expirations that were skipped, either because the timers were processed late
+         * or because the previous callback of a timer was still waiting for its worker.
+         */
+        uint32_t overruns;
+        /**
+         * Maximum and average time in milliseconds between the expiration time of a timer and
+         * the time it was processed by the RTOS timer task.
+         */
+        uint32_t maxLateness;
+        uint32_t avgLateness;
+        /**
+         * Maximum time in milliseconds between the processing of an expired timer and the
+         * invocation of its callback on a worker thread.
+         */
+        uint32_t maxDispatchLatency;
+        /**
+         * Number of expirations whose callback was dropped because it couldn't be posted to the
+         * worker thread.
+         */
+        uint32_t drops;
+    };
+
+    WheelTimer(unsigned period, Callback callback, void* data = nullptr, bool oneShot = false,
+            TimerWorker worker = TimerWorker::TIMER_TASK);
+    virtual ~WheelTimer();
+
+    bool start();
+    bool stop();
+    bool reset();
+    bool changePeriod(unsigned period);
+    bool changePeriod(std::chrono::milliseconds ms) { return changePeriod(ms.count()); }
+
+    // Same as the above methods, provided for compatibility with Timer
+    bool startFromISR() { return start(); }
+    bool stopFromISR() { return stop(); }
+    bool resetFromISR() { return reset(); }
+    bool changePeriodFromISR(unsigned period) { return changePeriod(period); }
+    bool changePeriodFromISR(std::chrono::milliseconds ms) { return changePeriod(ms.count()); }
+
+    bool isValid() const;
+    bool isActive() const;
+
+    /**
+     * Stops the timer and waits until its callback is no longer running. Must not be called
+     * from the timer's callback.
+     */
+    void dispose();
+
+    /**
+     * Invokes the callback. Subclasses can override this method instead of providing a callback.
+     */
+    virtual void timeout();
+
+    static Stats stats();
+
+private:
+    struct Dispatch;
+
+    services::TimerWheel::Timer entry_;
+    Callback callback_;
+    void* data_;
+    unsigned period_;
+    bool oneShot_;
+    TimerWorker worker_;
+    Dispatch* volatile pending_; // Expiration waiting for the worker
+    volatile bool running_;
+
+    static void expired(void* data);
+    static void dispatched(void* data);
+};
+
+} // namespace particle
+
+#endif // PLATFORM_ID!=3
@@ -2,6 +2,7 @@
 
 #include <functional>
 #include "system_cloud.h"
+#include "spark_wiring_json.h"
 
 namespace {
 
@@ -16,6 +17,17 @@ void publishCompletionCallback(int error, const void* data, void* callbackData,
     }
 }
 
+int writeEventData(char* buf, size_t size, void* data) {
+    const auto fn = (const wiring_event_data_writer_t*)data;
+    BufferAppender appender((uint8_t*)buf, size);
+    spark::JSONAppenderWriter writer(appender);
+    (*fn)(writer);
+    if (appender.overflowed()) {
+        return Error::TOO_LARGE;
+    }
+    return appender.size();
+}
+
 } // namespace
 
 int CloudClass::call_raw_user_function(void* data, const char* param, void* reserved)
@@ -48,7 +60,8 @@ bool CloudClass::register_function(cloud_function_t fn, void* data, const char*
 }
 
 Future<bool> CloudClass::publish_event(const char *eventName, const char *eventData, int ttl, PublishFlags flags) {
-    if (!connected()) {
+    // Stored events are sent once the device is connected
+    if (!connected() && !(flags.value() & PUBLISH_EVENT_FLAG_STORE)) {
         return Future<bool>(Error::INVALID_STATE);
     }
     spark_send_event_data d = { sizeof(spark_send_event_data) };
@@ -67,6 +80,26 @@ Future<bool> CloudClass::publish_event(const char *eventName, const char *eventD
     return p.future();
 }
 
+Future<bool> CloudClass::publish_json_event(const char *eventName, const wiring_event_data_writer_t& writer, int ttl, PublishFlags flags) {
+    if (!connected() && !(flags.value() & PUBLISH_EVENT_FLAG_STORE)) {
+        return Future<bool>(Error::INVALID_STATE);
+    }
+    spark_send_event_data d = { sizeof(spark_send_event_data) };
+    d.data_writer = writeEventData;
+    d.data_writer_data = (void*)&writer;
+
+    Promise<bool> p;
+    d.handler_callback = publishCompletionCallback;
+    d.handler_data = p.dataPtr();
+
+    if (!spark_send_event(eventName, nullptr, ttl, flags.value(), &d) && !p.isDone()) {
+        p.setError(Error::UNKNOWN);
+        p.fromDataPtr(d.handler_data); // Free wrapper object
+    }
+
+    return p.future();
+}
+
 int CloudClass::publishVitals(system_tick_t period_s_) {
     return spark_publish_vitals(period_s_, nullptr);
 }
@@ -62,6 +62,57 @@ bool hexToInt(const char *s, size_t size, uint32_t *val) {
     return true;
 }
 
+bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Characters that can appear in numbers and literal names
+bool isPrimitiveChar(char c) {
+    return (c >= 'a' && c <= 'z') || isDigit(c) || c == '-' || c == '+' || c == '.' || c == 'E';
+}
+
+// Checks the number syntax defined by RFC 7159
+bool isNumber(const char *s) {
+    if (*s == '-') {
+        ++s;
+    }
+    if (*s == '0') {
+        ++s;
+    } else if (isDigit(*s)) {
+        while (isDigit(*s)) {
+            ++s;
+        }
+    } else {
+        return false;
+    }
+    if (*s == '.') {
+        ++s;
+        if (!isDigit(*s)) {
+            return false;
+        }
+        while (isDigit(*s)) {
+            ++s;
+        }
+    }
+    if (*s == 'e' || *s == 'E') {
+        ++s;
+        if (*s == '+' || *s == '-') {
+            ++s;
+        }
+        if (!isDigit(*s)) {
+            return false;
+        }
+        while (isDigit(*s)) {
+            ++s;
+        }
+    }
+    return *s == '\0';
+}
+
 } // namespace
 
 // spark::detail::JSONData
@@ -403,6 +454,411 @@ bool spark::JSONArrayIterator::next() {
     return true;
 }
 
+// spark::JSONStreamParser
+spark::JSONStreamParser::JSONStreamParser(char *buf, size_t size) :
+        buf_(buf),
+        bufSize_(size) {
+    reset();
+}
+
+bool spark::JSONStreamParser::parse(const char *data, size_t size) {
+    const char* const end = data + size;
+    while (data != end && parseChar(*data)) {
+        ++data;
+    }
+    return state_ != ERROR;
+}
+
+bool spark::JSONStreamParser::parse(Stream &stream) {
+    char buf[64];
+    while (state_ != DONE && state_ != ERROR) {
+        int n = stream.available();
+        if (n <= 0) {
+            n = 1; // Wait for more data
+        }
+        n = stream.readBytes(buf, std::min((size_t)n, sizeof(buf)));
+        if (n <= 0) {
+            break; // Timeout
+        }
+        parse(buf, n);
+    }
+    return finish();
+}
+
+bool spark::JSONStreamParser::finish() {
+    if (state_ == PRIMITIVE && depth_ == 0) {
+        endPrimitive(); // A primitive root value ends with the input
+    }
+    return state_ == DONE;
+}
+
+void spark::JSONStreamParser::reset() {
+    n_ = 0;
+    objects_ = 0;
+    depth_ = 0;
+    state_ = (buf_ && bufSize_) ? VALUE : ERROR;
+    hexCount_ = 0;
+    name_ = false;
+    truncated_ = false;
+}
+
+bool spark::JSONStreamParser::parseChar(char c) {
+    switch (state_) {
+    case STRING:
+        if (c == '"') {
+            return endString();
+        }
+        if (c == '\\') {
+            state_ = STRING_ESCAPE;
+            return true;
+        }
+        if ((unsigned char)c < 0x20) {
+            return error(); // Control characters must be escaped
+        }
+        append(c);
+        return true;
+    case STRING_ESCAPE:
+        switch (c) {
+        case '"':
+        case '\\':
+        case '/':
+            append(c);
+            break;
+        case 'b': // Backspace
+            append(0x08);
+            break;
+        case 't': // Tab
+            append(0x09);
+            break;
+        case 'n': // Line feed
+            append(0x0a);
+            break;
+        case 'f': // Form feed
+            append(0x0c);
+            break;
+        case 'r': // Carriage return
+            append(0x0d);
+            break;
+        case 'u': // Arbitrary character, e.g. "\u001f"
+            hexCount_ = 0;
+            state_ = STRING_UNICODE;
+            return true;
+        default:
+            return error(); // Invalid escaped sequence
+        }
+        state_ = STRING;
+        return true;
+    case STRING_UNICODE: {
+        uint32_t u = 0;
+        if (!hexToInt(&c, 1, &u)) {
+            return error(); // Invalid escaped sequence
+        }
+        hex_[hexCount_++] = c;
+        if (hexCount_ < sizeof(hex_)) {
+            return true;
+        }
+        hexToInt(hex_, sizeof(hex_), &u);
+        if (u <= 0x7f) {
+            append(u);
+        } else {
+            // Same as JSONValue, only code points within the basic latin block are unescaped
+            append('\\');
+            append('u');
+            for (char h: hex_) {
+                append(h);
+            }
+        }
+        state_ = STRING;
+        return true;
+    }
+    case PRIMITIVE:
+        if (isPrimitiveChar(c)) {
+            append(c);
+            return true;
+        }
+        if (!endPrimitive()) {
+            return false;
+        }
+        return parseChar(c); // Process the character that ended the primitive value
+    case DONE:
+    case ERROR:
+        return false;
+    default:
+        break;
+    }
+    if (isSpace(c)) {
+        return true;
+    }
+    switch (state_) {
+    case FIRST_VALUE:
+        if (c == ']') {
+            return endContainer(false);
+        }
+        // Fall through
+    case VALUE:
+        if (inArray()) {
+            ++count_[depth_ - 1];
+        }
+        switch (c) {
+        case '{':
+            return beginContainer(true);
+        case '[':
+            return beginContainer(false);
+        case '"':
+            return beginString(false);
+        case '-':
+        case 't':
+        case 'f':
+        case 'n':
+            break;
+        default:
+            if (!isDigit(c)) {
+                return error();
+            }
+            break;
+        }
+        n_ = 0;
+        truncated_ = false;
+        append(c);
+        state_ = PRIMITIVE;
+        return true;
+    case FIRST_NAME:
+        if (c == '}') {
+            return endContainer(true);
+        }
+        // Fall through
+    case NAME:
+        if (c != '"') {
+            return error();
+        }
+        ++count_[depth_ - 1];
+        return beginString(true);
+    case COLON:
+        if (c != ':') {
+            return error();
+        }
+        state_ = VALUE;
+        return true;
+    case NEXT:
+        if (c == ',') {
+            state_ = inArray() ? VALUE : NAME;
+            return true;
+        } else if (c == '}') {
+            return endContainer(true);
+        } else if (c == ']') {
+            return endContainer(false);
+        }
+        return error();
+    default:
+        return error();
+    }
+}
+
+bool spark::JSONStreamParser::beginString(bool name) {
+    n_ = 0;
+    truncated_ = false;
+    name_ = name;
+    state_ = STRING;
+    return true;
+}
+
+bool spark::JSONStreamParser::beginContainer(bool object) {
+    if (depth_ == MAX_DEPTH) {
+        return error();
+    }
+    if (!(object ? beginObject() : beginArray())) {
+        return stop();
+    }
+    if (object) {
+        objects_ |= (1u << depth_);
+    } else {
+        objects_ &= ~(1u << depth_);
+    }
+    count_[depth_] = 0;
+    ++depth_;
+    state_ = object ? FIRST_NAME : FIRST_VALUE;
+    return true;
+}
+
+bool spark::JSONStreamParser::endContainer(bool object) {
+    if (!depth_ || !(objects_ & (1u << (depth_ - 1))) != !object) {
+        return error(); // Mismatched bracket
+    }
+    --depth_;
+    if (!(object ? endObject() : endArray())) {
+        return stop();
+    }
+    return endValue();
+}
+
+bool spark::JSONStreamParser::endString() {
+    buf_[n_] = '\0';
+    if (name_) {
+        if (!name(buf_, n_)) {
+            return stop();
+        }
+        state_ = COLON;
+        return true;
+    }
+    if (!value(JSON_TYPE_STRING, buf_, n_)) {
+        return stop();
+    }
+    return endValue();
+}
+
+bool spark::JSONStreamParser::endPrimitive() {
+    buf_[n_] = '\0';
+    JSONType type = JSON_TYPE_NUMBER;
+    if (strcmp(buf_, "true") == 0 || strcmp(buf_, "false") == 0) {
+        type = JSON_TYPE_BOOL;
+    } else if (strcmp(buf_, "null") == 0) {
+        type = JSON_TYPE_NULL;
+    } else if (!isNumber(buf_) && !(truncated_ && (*buf_ == '-' || isDigit(*buf_)))) {
+        return error(); // Only numbers are long enough to be truncated
+    }
+    if (!value(type, buf_, n_)) {
+        return stop();
+    }
+    return endValue();
+}
+
+bool spark::JSONStreamParser::endValue() {
+    if (!depth_) {
+        state_ = DONE;
+        return false;
+    }
+    state_ = NEXT;
+    return true;
+}
+
+void spark::JSONStreamParser::append(char c) {
+    if (n_ + 1 < bufSize_) { // Reserve space for the term. null
+        buf_[n_++] = c;
+    } else {
+        truncated_ = true;
+    }
+}
+
+bool spark::JSONStreamParser::stop() {
+    state_ = DONE;
+    return false;
+}
+
+bool spark::JSONStreamParser::error() {
+    state_ = ERROR;
+    return false;
+}
+
+// spark::JSONPathReader
+spark::JSONPathReader::JSONPathReader(const char *path, char *buf, size_t size) :
+        JSONStreamParser(buf, size),
+        path_(path),
+        data_(""),
+        size_(0),
+        levels_(0),
+        matched_(0),
+        type_(JSON_TYPE_INVALID) {
+    size_t n = 0;
+    while (component(levels_ + 1, &n)) {
+        ++levels_;
+    }
+}
+
+bool spark::JSONPathReader::beginObject() {
+    return element(JSON_TYPE_OBJECT, "", 0);
+}
+
+bool spark::JSONPathReader::beginArray() {
+    return element(JSON_TYPE_ARRAY, "", 0);
+}
+
+bool spark::JSONPathReader::name(const char *name, size_t size) {
+    // Object members are matched by name before their values are parsed
+    const unsigned level = depth();
+    if (matched_ + 1 >= level) {
+        matched_ = level - 1;
+        if (!isTruncated() && matchName(level, name, size)) {
+            matched_ = level;
+        }
+    }
+    return true;
+}
+
+bool spark::JSONPathReader::value(JSONType type, const char *data, size_t size) {
+    return element(type, data, size);
+}
+
+bool spark::JSONPathReader::endObject() {
+    matched_ = std::min(matched_, depth());
+    return true;
+}
+
+bool spark::JSONPathReader::endArray() {
+    matched_ = std::min(matched_, depth());
+    return true;
+}
+
+bool spark::JSONPathReader::element(JSONType type, const char *data, size_t size) {
+    const unsigned level = depth();
+    if (inArray() && matched_ + 1 >= level) {
+        matched_ = level - 1;
+        if (matchIndex(level, index())) {
+            matched_ = level;
+        }
+    }
+    if (matched_ == level && level == levels_) {
+        type_ = type;
+        data_ = data;
+        size_ = size;
+        return false; // Found
+    }
+    return true;
+}
+
+bool spark::JSONPathReader::matchIndex(unsigned level, unsigned index) const {
+    size_t n = 0;
+    const char* const s = component(level, &n);
+    if (!s || *s != '[') {
+        return false;
+    }
+    char *end = nullptr;
+    const unsigned long i = strtoul(s + 1, &end, 10);
+    return end == s + n - 1 && end != s + 1 && i == index;
+}
+
+bool spark::JSONPathReader::matchName(unsigned level, const char *name, size_t size) const {
+    size_t n = 0;
+    const char* const s = component(level, &n);
+    return s && *s != '[' && n == size && memcmp(s, name, n) == 0;
+}
+
+const char* spark::JSONPathReader::component(unsigned level, size_t *size) const {
+    const char *s = path_;
+    for (unsigned i = 1; *s; ++i) {
+        if (*s == '.' && !*++s) {
+            break; // Trailing separator
+        }
+        const char *end = s;
+        if (*s == '[') {
+            end = strchr(s, ']');
+            if (!end) {
+                return nullptr;
+            }
+            ++end;
+        } else {
+            while (*end && *end != '.' && *end != '[') {
+                ++end;
+            }
+        }
+        if (i == level) {
+            *size = end - s;
+            return s;
+        }
+        s = end;
+    }
+    return nullptr;
+}
+
 // spark::JSONWriter
 spark::JSONWriter& spark::JSONWriter::beginArray() {
     writeSeparator();
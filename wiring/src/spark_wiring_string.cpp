@@ -33,6 +33,9 @@
 #include <stdlib.h>
 #include "string_convert.h"
 
+// The smallest buffer allocated when a string grows, not counting the '\0'
+static const unsigned int MIN_GROW_CAPACITY = 15;
+
 //These are very crude implementations - will refine later
 //------------------------------------------------------------------------------------------
 
@@ -202,6 +205,23 @@ unsigned char String::reserve(unsigned int size)
 	return 0;
 }
 
+// Unlike reserve(), which allocates exactly the requested size, this grows the capacity by at least
+// half, so that building a string by repeated concatenation reallocates it only a logarithmic
+// number of times
+unsigned char String::grow(unsigned int size)
+{
+	if (buffer && capacity >= size) return 1;
+	unsigned int newCapacity = capacity + (capacity >> 1);
+	if (newCapacity < capacity || newCapacity < size) newCapacity = size;
+	if (newCapacity < MIN_GROW_CAPACITY) newCapacity = MIN_GROW_CAPACITY;
+	if (newCapacity > size && changeBuffer(newCapacity)) {
+		if (len == 0) buffer[0] = 0;
+		return 1;
+	}
+	// The larger buffer couldn't be allocated, try the exact size
+	return reserve(size);
+}
+
 unsigned char String::changeBuffer(unsigned int maxStrLen)
 {
 	char *newbuffer = (char *)realloc(buffer, maxStrLen + 1);
@@ -236,16 +256,16 @@ String & String::copy(const __FlashStringHelper *pstr, unsigned int length) {
 #ifdef __GXX_EXPERIMENTAL_CXX0X__
 void String::move(String &rhs)
 {
-	if (buffer) {
-		if (capacity >= rhs.len) {
-			strcpy(buffer, rhs.buffer);
-			len = rhs.len;
-			rhs.len = 0;
-			return;
-		} else {
-			free(buffer);
-		}
+	// Neither branch allocates: the value is either copied to the existing buffer, if it fits,
+	// or the buffer of rhs is taken over
+	if (buffer && rhs.buffer && capacity >= rhs.len) {
+		memcpy(buffer, rhs.buffer, rhs.len + 1);
+		len = rhs.len;
+		rhs.len = 0;
+		rhs.buffer[0] = 0;
+		return;
 	}
+	free(buffer);
 	buffer = rhs.buffer;
 	capacity = rhs.capacity;
 	len = rhs.len;
@@ -309,9 +329,17 @@ unsigned char String::concat(const char *cstr, unsigned int length)
 	unsigned int newlen = len + length;
 	if (!cstr) return 0;
 	if (length == 0) return 1;
-	if (!reserve(newlen)) return 0;
-	strcpy(buffer + len, cstr);
+	if (buffer && cstr >= buffer && cstr <= buffer + len) {
+		// Appending a part of this string, which may be moved by the reallocation
+		const unsigned int offset = cstr - buffer;
+		if (!grow(newlen)) return 0;
+		cstr = buffer + offset;
+	} else if (!grow(newlen)) {
+		return 0;
+	}
+	memcpy(buffer + len, cstr, length);
 	len = newlen;
+	buffer[len] = 0;
 	return 1;
 }
 
@@ -704,7 +732,7 @@ String& String::replace(const String& find, const String& replace)
 			size += diff;
 		}
 		if (size == len) return *this;;
-		if (size > capacity && !changeBuffer(size)) return *this; // XXX: tell user!
+		if (!grow(size)) return *this; // XXX: tell user!
 		int index = len - 1;
 		while (index >= 0 && (index = lastIndexOf(find, index)) >= 0) {
 			readFrom = buffer + index + find.len;
@@ -35,6 +35,10 @@
 #include "socket_hal.h"
 #include "inet_hal.h"
 #include "spark_macros.h"
+#include "timer_hal.h"
+#include "system_error.h"
+
+#include <algorithm>
 
 using namespace spark;
 
@@ -140,11 +144,54 @@ size_t TCPClient::write(const uint8_t *buffer, size_t size, system_tick_t timeou
     return ret;
 }
 
+size_t TCPClient::writev(const IoVec* iov, size_t count)
+{
+    return writev(iov, count, SPARK_WIRING_TCPCLIENT_DEFAULT_SEND_TIMEOUT);
+}
+
+size_t TCPClient::writev(const IoVec* iov, size_t count, system_tick_t timeout)
+{
+    // The compat socket HAL has no gather send, so the buffers are sent one by one
+    clearWriteError();
+    size_t n = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (!iov[i].size) {
+            continue;
+        }
+        int ret = status() ? socket_send_ex(d_->sock, iov[i].data, iov[i].size, 0, timeout, nullptr) : -1;
+        if (ret < 0) {
+            setWriteError(ret);
+            break;
+        }
+        n += ret;
+        if ((size_t)ret < iov[i].size) {
+            break;
+        }
+    }
+    return n;
+}
+
 int TCPClient::bufferCount()
 {
   return d_->total - d_->offset;
 }
 
+int TCPClient::receive(uint8_t* buffer, size_t size, system_tick_t timeout)
+{
+    if (!Network.from(nif).ready() || !isOpen(d_->sock)) {
+        return -1;
+    }
+    return socket_receive(d_->sock, buffer, size, timeout);
+}
+
+size_t TCPClient::readBuffered(uint8_t* buffer, size_t size)
+{
+    size = std::min(size, (size_t)bufferCount());
+    memcpy(buffer, d_->buffer + d_->offset, size);
+    d_->offset += size;
+    return size;
+}
+
 int TCPClient::available()
 {
     int avail = 0;
@@ -155,20 +202,17 @@ int TCPClient::available()
         flush_buffer();
     }
 
-    if(Network.from(nif).ready() && isOpen(d_->sock))
+    // Have room
+    if (d_->total < d_->size)
     {
-        // Have room
-        if ( d_->total < arraySize(d_->buffer))
+        int ret = receive(d_->buffer + d_->total, d_->size - d_->total, 0);
+        if (ret > 0)
         {
-            int ret = socket_receive(d_->sock, d_->buffer + d_->total , arraySize(d_->buffer)-d_->total, 0);
-            if (ret > 0)
-            {
-                DEBUG("recv(=%d)",ret);
-                if (d_->total == 0) d_->offset = 0;
-                d_->total += ret;
-            }
-        } // Have Space
-    } // WiFi.ready() && isOpen(d_->sock)
+            DEBUG("recv(=%d)",ret);
+            if (d_->total == 0) d_->offset = 0;
+            d_->total += ret;
+        }
+    } // Have Space
     avail = bufferCount();
     return avail;
 }
@@ -180,16 +224,61 @@ int TCPClient::read()
 
 int TCPClient::read(uint8_t *buffer, size_t size)
 {
+        if (!bufferCount() && size >= d_->size)
+        {
+          // Reads that are at least as large as the internal buffer bypass it
+          flush_buffer();
+          int ret = receive(buffer, size, 0);
+          return (ret > 0) ? ret : -1;
+        }
         int read = -1;
         if (bufferCount() || available())
         {
-          read = (size > (size_t) bufferCount()) ? bufferCount() : size;
-          memcpy(buffer, &d_->buffer[d_->offset], read);
-          d_->offset += read;
+          read = readBuffered(buffer, size);
         }
         return read;
 }
 
+int TCPClient::read(uint8_t* buffer, size_t size, system_tick_t timeout)
+{
+    size_t n = readBuffered(buffer, size);
+    const system_tick_t start = HAL_Timer_Get_Milli_Seconds();
+    while (n < size) {
+        const system_tick_t elapsed = HAL_Timer_Get_Milli_Seconds() - start;
+        const system_tick_t left = (elapsed < timeout) ? timeout - elapsed : 0;
+        int ret = receive(buffer + n, size - n, left);
+        if (ret < 0) {
+            break;
+        }
+        n += ret;
+        if (!left) {
+            break;
+        }
+    }
+    return n ? n : -1;
+}
+
+int TCPClient::readv(const IoVec* iov, size_t count)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const auto buf = (uint8_t*)iov[i].data;
+        const size_t size = iov[i].size;
+        const size_t buffered = readBuffered(buf, size);
+        n += buffered;
+        if (buffered < size) {
+            int ret = receive(buf + buffered, size - buffered, 0);
+            if (ret > 0) {
+                n += ret;
+            }
+            if (ret < (int)(size - buffered)) {
+                break;
+            }
+        }
+    }
+    return n ? n : -1;
+}
+
 int TCPClient::peek()
 {
   return  (bufferCount() || available()) ? d_->buffer[d_->offset] : -1;
@@ -249,8 +338,41 @@ IPAddress TCPClient::remoteIP()
     return d_->remoteIP;
 }
 
+int TCPClient::setBufferSize(size_t size, uint8_t* buffer)
+{
+    std::unique_ptr<uint8_t[]> allocated;
+    if (!size) {
+        buffer = d_->defaultBuffer;
+        size = sizeof(d_->defaultBuffer);
+    } else if (!buffer) {
+        allocated.reset(new(std::nothrow) uint8_t[size]);
+        if (!allocated) {
+            return SYSTEM_ERROR_NO_MEMORY;
+        }
+        buffer = allocated.get();
+    }
+    const size_t count = bufferCount();
+    if (count > size) {
+        return SYSTEM_ERROR_INVALID_STATE;
+    }
+    memmove(buffer, d_->buffer + d_->offset, count);
+    d_->buffer = buffer;
+    d_->size = size;
+    d_->offset = 0;
+    d_->total = count;
+    d_->allocatedBuffer = std::move(allocated);
+    return 0;
+}
+
+size_t TCPClient::bufferSize() const
+{
+    return d_->size;
+}
+
 TCPClient::Data::Data(sock_handle_t sock)
         : sock(sock),
+          buffer(defaultBuffer),
+          size(sizeof(defaultBuffer)),
           offset(0),
           total(0) {
 }
@@ -33,13 +33,32 @@
 #include <arpa/inet.h>
 #include "spark_wiring_constants.h"
 #include "spark_wiring_posix_common.h"
+#include "timer_hal.h"
+#include "system_error.h"
+#include <algorithm>
+#include <climits>
+#include <cstddef>
 
 using namespace spark;
 
+static_assert(sizeof(TCPClient::IoVec) == sizeof(struct iovec) &&
+        offsetof(TCPClient::IoVec, data) == offsetof(struct iovec, iov_base) &&
+        offsetof(TCPClient::IoVec, size) == offsetof(struct iovec, iov_len),
+        "TCPClient::IoVec must have the same layout as struct iovec");
+
 static bool inline isOpen(sock_handle_t sd) {
     return socket_handle_valid(sd);
 }
 
+static int setSendTimeout(sock_handle_t sd, system_tick_t timeout) {
+    struct timeval tv = {};
+    if (timeout != SOCKET_WAIT_FOREVER) {
+        tv.tv_sec = timeout / 1000;
+        tv.tv_usec = (timeout % 1000) * 1000;
+    }
+    return sock_setsockopt(sd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
 TCPClient::TCPClient()
         : TCPClient(-1) {
 }
@@ -132,12 +151,7 @@ size_t TCPClient::write(uint8_t b, system_tick_t timeout) {
 
 size_t TCPClient::write(const uint8_t *buffer, size_t size, system_tick_t timeout) {
     clearWriteError();
-    struct timeval tv = {};
-    if (timeout != SOCKET_WAIT_FOREVER) {
-        tv.tv_sec = timeout / 1000;
-        tv.tv_usec = (timeout % 1000) * 1000;
-    }
-    int ret = sock_setsockopt(d_->sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    int ret = setSendTimeout(d_->sock, timeout);
     if (ret < 0) {
         setWriteError(errno);
         return 0;
@@ -152,10 +166,67 @@ size_t TCPClient::write(const uint8_t *buffer, size_t size, system_tick_t timeou
     return ret;
 }
 
+size_t TCPClient::writev(const IoVec* iov, size_t count) {
+    return writev(iov, count, SOCKET_WAIT_FOREVER);
+}
+
+size_t TCPClient::writev(const IoVec* iov, size_t count, system_tick_t timeout) {
+    clearWriteError();
+    int ret = setSendTimeout(d_->sock, timeout);
+    if (ret < 0) {
+        setWriteError(errno);
+        return 0;
+    }
+
+    struct msghdr msg = {};
+    msg.msg_iov = (struct iovec*)iov;
+    msg.msg_iovlen = count;
+    ret = sock_sendmsg(d_->sock, &msg, 0);
+    if (ret < 0) {
+        setWriteError(errno);
+        return 0;
+    }
+
+    return ret;
+}
+
 int TCPClient::bufferCount() {
     return d_->total - d_->offset;
 }
 
+int TCPClient::receive(uint8_t* buffer, size_t size, system_tick_t timeout) {
+    if (!isOpen(d_->sock)) {
+        return -1;
+    }
+    if (timeout) {
+        struct pollfd pfd = {};
+        pfd.fd = d_->sock;
+        pfd.events = POLLIN;
+        const int ret = sock_poll(&pfd, 1, std::min<system_tick_t>(timeout, INT_MAX));
+        if (ret <= 0) {
+            return ret;
+        }
+    }
+    const int ret = sock_recv(d_->sock, buffer, size, MSG_DONTWAIT);
+    if (ret > 0) {
+        return ret;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        LOG(ERROR, "recv error = %d", errno);
+        sock_close(d_->sock);
+        d_->sock = -1;
+        return -1;
+    }
+    return 0;
+}
+
+size_t TCPClient::readBuffered(uint8_t* buffer, size_t size) {
+    size = std::min(size, (size_t)bufferCount());
+    memcpy(buffer, d_->buffer + d_->offset, size);
+    d_->offset += size;
+    return size;
+}
+
 int TCPClient::available()
 {
     int avail = 0;
@@ -165,24 +236,16 @@ int TCPClient::available()
         flush_buffer();
     }
 
-    if (isOpen(d_->sock)) {
-        // Have room
-        if (d_->total < arraySize(d_->buffer)) {
-            int ret = sock_recv(d_->sock, d_->buffer + d_->total, arraySize(d_->buffer) - d_->total, MSG_DONTWAIT);
-            if (ret > 0) {
-                if (d_->total == 0) {
-                    d_->offset = 0;
-                }
-                d_->total += ret;
-            } else {
-                if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                    LOG(ERROR, "recv error = %d", errno);
-                    sock_close(d_->sock);
-                    d_->sock = -1;
-                }
+    // Have room
+    if (isOpen(d_->sock) && d_->total < d_->size) {
+        int ret = receive(d_->buffer + d_->total, d_->size - d_->total, 0);
+        if (ret > 0) {
+            if (d_->total == 0) {
+                d_->offset = 0;
             }
-        } // Have Space
-    } // isOpen(d_->sock)
+            d_->total += ret;
+        }
+    }
     avail = bufferCount();
     return avail;
 }
@@ -192,15 +255,76 @@ int TCPClient::read() {
 }
 
 int TCPClient::read(uint8_t *buffer, size_t size) {
+    if (!bufferCount() && size >= d_->size) {
+        // Reads that are at least as large as the internal buffer bypass it
+        flush_buffer();
+        int ret = receive(buffer, size, 0);
+        return (ret > 0) ? ret : -1;
+    }
     int read = -1;
     if (bufferCount() || available()) {
-        read = (size > (size_t) bufferCount()) ? bufferCount() : size;
-        memcpy(buffer, &d_->buffer[d_->offset], read);
-        d_->offset += read;
+        read = readBuffered(buffer, size);
     }
     return read;
 }
 
+int TCPClient::read(uint8_t* buffer, size_t size, system_tick_t timeout) {
+    size_t n = readBuffered(buffer, size);
+    const system_tick_t start = HAL_Timer_Get_Milli_Seconds();
+    while (n < size) {
+        const system_tick_t elapsed = HAL_Timer_Get_Milli_Seconds() - start;
+        const system_tick_t left = (elapsed < timeout) ? timeout - elapsed : 0;
+        int ret = receive(buffer + n, size - n, left);
+        if (ret < 0) {
+            break;
+        }
+        n += ret;
+        if (!left) {
+            break;
+        }
+    }
+    return n ? n : -1;
+}
+
+int TCPClient::readv(const IoVec* iov, size_t count) {
+    size_t n = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const auto buf = (uint8_t*)iov[i].data;
+        const size_t size = iov[i].size;
+        const size_t buffered = readBuffered(buf, size);
+        n += buffered;
+        if (buffered == size) {
+            continue;
+        }
+        if (buffered) {
+            int ret = receive(buf + buffered, size - buffered, 0);
+            if (ret > 0) {
+                n += ret;
+            }
+            if (ret < (int)(size - buffered)) {
+                break;
+            }
+            continue;
+        }
+        // The internal buffer is empty, receive into the remaining buffers with a single call
+        if (isOpen(d_->sock)) {
+            struct msghdr msg = {};
+            msg.msg_iov = (struct iovec*)(iov + i);
+            msg.msg_iovlen = count - i;
+            int ret = sock_recvmsg(d_->sock, &msg, MSG_DONTWAIT);
+            if (ret > 0) {
+                n += ret;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOG(ERROR, "recv error = %d", errno);
+                sock_close(d_->sock);
+                d_->sock = -1;
+            }
+        }
+        break;
+    }
+    return n ? n : -1;
+}
+
 int TCPClient::peek() {
     return (bufferCount() || available()) ? d_->buffer[d_->offset] : -1;
 }
@@ -245,8 +369,35 @@ IPAddress TCPClient::remoteIP() {
     return d_->remoteIP;
 }
 
+int TCPClient::setBufferSize(size_t size, uint8_t* buffer) {
+    std::unique_ptr<uint8_t[]> allocated;
+    if (!size) {
+        buffer = d_->defaultBuffer;
+        size = sizeof(d_->defaultBuffer);
+    } else if (!buffer) {
+        allocated.reset(new(std::nothrow) uint8_t[size]);
+        CHECK_TRUE(allocated, SYSTEM_ERROR_NO_MEMORY);
+        buffer = allocated.get();
+    }
+    const size_t count = bufferCount();
+    CHECK_TRUE(count <= size, SYSTEM_ERROR_INVALID_STATE);
+    memmove(buffer, d_->buffer + d_->offset, count);
+    d_->buffer = buffer;
+    d_->size = size;
+    d_->offset = 0;
+    d_->total = count;
+    d_->allocatedBuffer = std::move(allocated);
+    return 0;
+}
+
+size_t TCPClient::bufferSize() const {
+    return d_->size;
+}
+
 TCPClient::Data::Data(sock_handle_t sock)
         : sock(sock),
+          buffer(defaultBuffer),
+          size(sizeof(defaultBuffer)),
           offset(0),
           total(0) {
 }
@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "spark_wiring_wheel_timer.h"
+
+#if PLATFORM_ID!=3
+
+#include "spark_wiring_interrupts.h"
+#include "concurrent_hal.h"
+#include "timer_hal.h"
+#include "system_task.h"
+#include "fixed_block_pool.h"
+
+namespace particle {
+
+namespace {
+
+using services::TimerWheel;
+
+// Advances the timer wheel from a single RTOS timer, which is rearmed for the next time the wheel
+// needs to be advanced and stays idle while no timers are active
+class WheelTimerDriver {
+public:
+    WheelTimerDriver() :
+            wheel_(HAL_Timer_Get_Milli_Seconds()),
+            timer_(nullptr),
+            wakeAt_(0),
+            armed_(false),
+            dispatchOverruns_(0),
+            dispatchDrops_(0),
+            maxDispatchLatency_(0) {
+        os_timer_create(&timer_, 1, tick, this, true /* one_shot */, nullptr);
+    }
+
+    static WheelTimerDriver* instance() {
+        static WheelTimerDriver driver;
+        return &driver;
+    }
+
+    bool isValid() const {
+        return timer_ != nullptr;
+    }
+
+    bool isExpiring(const TimerWheel::Timer* timer) const {
+        return wheel_.isExpiring(timer);
+    }
+
+    void start(TimerWheel::Timer* timer, unsigned period, bool oneShot) {
+        if (!period) {
+            period = 1;
+        }
+        const system_tick_t at = HAL_Timer_Get_Milli_Seconds() + period;
+        wheel_.startAt(timer, at, oneShot ? 0 : period);
+        bool earlier = false;
+        ATOMIC_BLOCK() {
+            if (!armed_ || (int32_t)(at - wakeAt_) < 0) {
+                armed_ = true;
+                wakeAt_ = at;
+                earlier = true;
+            }
+        }
+        if (earlier) {
+            rearm(at);
+        }
+    }
+
+    void stop(TimerWheel::Timer* timer) {
+        // The RTOS timer is left as is, it finds nothing to do if this was the next timer to expire
+        wheel_.stop(timer);
+    }
+
+    void dispatchOverrun() {
+        ATOMIC_BLOCK() {
+            ++dispatchOverruns_;
+        }
+    }
+
+    void dispatchDrop() {
+        ATOMIC_BLOCK() {
+            ++dispatchDrops_;
+        }
+    }
+
+    void dispatchLatency(system_tick_t latency) {
+        ATOMIC_BLOCK() {
+            if (latency > maxDispatchLatency_) {
+                maxDispatchLatency_ = latency;
+            }
+        }
+    }
+
+    WheelTimer::Stats stats() const {
+        const auto s = wheel_.stats();
+        WheelTimer::Stats stats = {};
+        stats.expired = s.expired;
+        stats.maxLateness = s.maxLateness;
+        stats.avgLateness = s.expired ? s.totalLateness / s.expired : 0;
+        ATOMIC_BLOCK() {
+            stats.overruns = s.overruns + dispatchOverruns_;
+            stats.maxDispatchLatency = maxDispatchLatency_;
+            stats.drops = dispatchDrops_;
+        }
+        return stats;
+    }
+
+private:
+    TimerWheel wheel_;
+    os_timer_t timer_;
+    volatile system_tick_t wakeAt_;
+    volatile bool armed_;
+    uint32_t dispatchOverruns_;
+    uint32_t dispatchDrops_;
+    system_tick_t maxDispatchLatency_;
+
+    void process() {
+        wheel_.advance(HAL_Timer_Get_Milli_Seconds());
+        system_tick_t at = 0;
+        bool active = false;
+        ATOMIC_BLOCK() {
+            // Checked in the same critical section as the wake-up time, so that a timer started
+            // by another thread is either seen here or rearms the RTOS timer itself
+            const uint32_t ticks = wheel_.nextTimeout();
+            active = (ticks != TimerWheel::NO_TIMERS);
+            armed_ = active;
+            at = wheel_.time() + ticks;
+            wakeAt_ = at;
+        }
+        if (active) {
+            rearm(at);
+        }
+    }
+
+    void rearm(system_tick_t at) {
+        for (;;) {
+            const int32_t dt = at - HAL_Timer_Get_Milli_Seconds();
+            // Changing the period starts the timer. This may be called from the timer task itself,
+            // so the call must not block
+            os_timer_change(timer_, OS_TIMER_CHANGE_PERIOD, HAL_IsISR(), (dt > 0) ? dt : 1, 0, nullptr);
+            // Another caller may have scheduled an earlier wake-up in the meantime
+            bool changed = false;
+            ATOMIC_BLOCK() {
+                changed = armed_ && wakeAt_ != at;
+                at = wakeAt_;
+            }
+            if (!changed) {
+                break;
+            }
+        }
+    }
+
+    static void tick(os_timer_t timer) {
+        void* id = nullptr;
+        os_timer_get_id(timer, &id);
+        static_cast<WheelTimerDriver*>(id)->process();
+    }
+};
+
+} // namespace
+
+// Expiration of a timer that is posted to a worker thread. The timer may be disposed of before
+// the worker gets to it, in which case the pointer to it is cleared
+struct WheelTimer::Dispatch {
+    WheelTimer* timer;
+    system_tick_t time;
+};
+
+namespace {
+
+const size_t DISPATCH_BLOCK_SIZE = sizeof(void*) * 2;
+
+// At most one expiration per timer is waiting for a worker at any time
+services::FixedBlockPool<DISPATCH_BLOCK_SIZE, 32> g_dispatchPool;
+
+} // namespace
+
+WheelTimer::WheelTimer(unsigned period, Callback callback, void* data, bool oneShot, TimerWorker worker) :
+        entry_(expired, this),
+        callback_(callback),
+        data_(data),
+        period_(period),
+        oneShot_(oneShot),
+        worker_(worker),
+        pending_(nullptr),
+        running_(false) {
+    WheelTimerDriver::instance();
+}
+
+WheelTimer::~WheelTimer() {
+    dispose();
+}
+
+bool WheelTimer::start() {
+    const auto driver = WheelTimerDriver::instance();
+    if (!driver->isValid()) {
+        return false;
+    }
+    driver->start(&entry_, period_, oneShot_);
+    return true;
+}
+
+bool WheelTimer::stop() {
+    WheelTimerDriver::instance()->stop(&entry_);
+    return true;
+}
+
+bool WheelTimer::reset() {
+    return start();
+}
+
+bool WheelTimer::changePeriod(unsigned period) {
+    period_ = period;
+    return start();
+}
+
+bool WheelTimer::isValid() const {
+    return WheelTimerDriver::instance()->isValid();
+}
+
+bool WheelTimer::isActive() const {
+    return entry_.isActive();
+}
+
+void WheelTimer::dispose() {
+    stop();
+    const auto driver = WheelTimerDriver::instance();
+    while (driver->isExpiring(&entry_)) {
+        os_thread_yield();
+    }
+    ATOMIC_BLOCK() {
+        if (pending_) {
+            pending_->timer = nullptr;
+            pending_ = nullptr;
+        }
+    }
+    while (running_) {
+        os_thread_yield();
+    }
+}
+
+void WheelTimer::timeout() {
+    if (callback_) {
+        callback_(data_);
+    }
+}
+
+WheelTimer::Stats WheelTimer::stats() {
+    return WheelTimerDriver::instance()->stats();
+}
+
+// Called in the RTOS timer task
+void WheelTimer::expired(void* data) {
+    static_assert(sizeof(Dispatch) <= DISPATCH_BLOCK_SIZE, "Invalid block size");
+    const auto t = static_cast<WheelTimer*>(data);
+    if (t->worker_ == TimerWorker::TIMER_TASK) {
+        t->timeout();
+        return;
+    }
+    Dispatch* d = nullptr;
+    if (!t->pending_) {
+        d = static_cast<Dispatch*>(g_dispatchPool.alloc());
+    }
+    if (!d) {
+        // The previous expiration hasn't been handled yet
+        WheelTimerDriver::instance()->dispatchOverrun();
+        return;
+    }
+    d->timer = t;
+    d->time = HAL_Timer_Get_Milli_Seconds();
+    t->pending_ = d;
+    uint8_t ret = 0;
+    if (t->worker_ == TimerWorker::SYSTEM_THREAD) {
+        ret = system_thread_invoke(dispatched, d, nullptr);
+    } else {
+        ret = application_thread_invoke(dispatched, d, nullptr);
+    }
+    if (ret != 0) {
+        // The worker's queue is full, the next expiration is dispatched as usual
+        ATOMIC_BLOCK() {
+            t->pending_ = nullptr;
+        }
+        g_dispatchPool.free(d);
+        WheelTimerDriver::instance()->dispatchDrop();
+    }
+}
+
+// Called on the worker thread
+void WheelTimer::dispatched(void* data) {
+    const auto d = static_cast<Dispatch*>(data);
+    WheelTimer* t = nullptr;
+    ATOMIC_BLOCK() {
+        t = d->timer;
+        if (t) {
+            t->pending_ = nullptr;
+            t->running_ = true;
+        }
+    }
+    const system_tick_t time = d->time;
+    g_dispatchPool.free(d);
+    if (t) {
+        WheelTimerDriver::instance()->dispatchLatency(HAL_Timer_Get_Milli_Seconds() - time);
+        t->timeout();
+        t->running_ = false;
+    }
+}
+
+} // namespace particle
+
+#endif // PLATFORM_ID!=3